@@ -1,6 +1,9 @@
 varying vec2 v_uv;
 
+uniform sampler2D u_texture;
+
 void main()
 {
-	gl_FragColor = ...;
+	// The framebuffer uploaded by the presenter, one texel per pixel
+	gl_FragColor = vec4(texture2D(u_texture, v_uv).rgb, 1.0);
 }
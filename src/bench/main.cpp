@@ -0,0 +1,800 @@
+/*
+	+ cg_bench: renders lee, anna and cleo offscreen (into an Image and a FloatImage, no window or GL context) while the camera
+	  orbits around them, for every requested resolution and render mode, and prints the throughput and timings as JSON.
+	+ Usage: cg_bench [--frames N] [--resolution WxH]... [--mode NAME]... [--immediate] [--scalar] [--no-hiz] [--visibility]
+	  Modes: pointcloud, wireframe, interpolated, interpolated_z, textured, textured_z (all of them by default).
+	+ With --filters it measures the ImageFilter kernels instead, in MPixel/s, on a generated image at 720p, 4K and 8K
+	  (or the given resolutions), running every kernel --frames times (5 by default).
+	+ With --png it decodes the PNG files of res/images, and the ones given with --png-file, from memory with PNGDecoder and with
+	  picopng (plus the copy into an image that LoadPNG used to do), --frames times each (20 by default).
+	+ With --png-encode it saves res/images/fruits.png scaled to 720p, 1080p and 4K (or the given resolutions) with PNGEncoder
+	  at every level, on one thread and on the pool, and reports MB/s of pixels and the size of the file (3 runs by default).
+	+ With --obj it parses the meshes from memory with OBJParser, on one thread and on the pool, and with the tokenizing parser
+	  Mesh::LoadOBJ used to have, checks that all of them give the same vertices, and reports MB/s (10 runs by default). It also
+	  times whole loads of the files with Mesh::LoadOBJ, parsing them and from their binary cache (see MeshCache).
+	+ All of them end with the counters of the pixel buffer pool; --no-pool returns every freed buffer to the heap instead.
+*/
+
+#include "framework/image.h"
+#include "framework/mesh.h"
+#include "framework/camera.h"
+#include "framework/entity.h"
+#include "framework/rasterizer.h"
+#include "framework/hizbuffer.h"
+#include "framework/vertexstage.h"
+#include "framework/threadpool.h"
+#include "framework/imagefilter.h"
+#include "framework/pngcodec.h"
+#include "framework/objparser.h"
+#include "framework/meshcache.h"
+#include "framework/mappedfile.h"
+#include "framework/deflate.h"
+#include "framework/utils.h"
+#include "extra/picopng.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+struct BenchMode
+{
+	const char* name;
+	eRenderMode mode;
+	bool use_texture;
+	bool use_zbuffer;
+};
+
+static const BenchMode MODES[] = {
+	{ "pointcloud", eRenderMode::POINTCLOUD, false, false },
+	{ "wireframe", eRenderMode::WIREFRAME, false, false },
+	{ "interpolated", eRenderMode::TRIANGLES_INTERPOLATED, false, false },
+	{ "interpolated_z", eRenderMode::TRIANGLES_INTERPOLATED, false, true },
+	{ "textured", eRenderMode::TRIANGLES_INTERPOLATED, true, false },
+	{ "textured_z", eRenderMode::TRIANGLES_INTERPOLATED, true, true },
+};
+static const int NUM_MODES = sizeof(MODES) / sizeof(MODES[0]);
+
+struct BenchOptions
+{
+	int frames = 0;	// 0 until given, then 120 frames or 5 filter runs
+	std::vector<int> widths, heights;
+	std::vector<int> modes;
+	bool tiled = true;
+	bool use_hiz = true;
+	bool visibility_buffer = false;
+	bool filters = false;
+	bool png = false;
+	std::vector<std::string> png_files;	// Besides the ones in res/images
+	bool png_encode = false;
+	bool obj = false;
+};
+
+// Time per stage of one frame, in milliseconds
+struct FrameTimes
+{
+	double total = 0.0;
+	double clear = 0.0;
+	double vertex = 0.0;
+	double assembly = 0.0;	// Clipping and triangle setup (and the pixels too, for lines, points and the immediate rasterizer)
+	double raster = 0.0;	// Flush of the queued triangles
+};
+
+static double Milliseconds(std::chrono::high_resolution_clock::time_point start, std::chrono::high_resolution_clock::time_point end)
+{
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Nearest-rank percentile of sorted values
+static double Percentile(const std::vector<double>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0.0;
+	int rank = (int)std::ceil(p * sorted.size()) - 1;
+	return sorted[std::max(0, std::min(rank, (int)sorted.size() - 1))];
+}
+
+static void PrintUsage()
+{
+	std::cerr << "Usage: cg_bench [--frames N] [--resolution WxH]... [--mode NAME]... [--immediate] [--scalar] [--no-hiz] [--visibility] [--filters] [--png] [--png-file PATH]... [--png-encode] [--obj] [--no-pool]" << std::endl;
+	std::cerr << "Modes:";
+	for (int i = 0; i < NUM_MODES; ++i)
+		std::cerr << " " << MODES[i].name;
+	std::cerr << std::endl;
+}
+
+static bool ParseOptions(int argc, char** argv, BenchOptions& options)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--frames" && has_value)
+		{
+			options.frames = atoi(argv[++i]);
+			if (options.frames <= 0) {
+				std::cerr << "Invalid frame count: " << argv[i] << std::endl;
+				return false;
+			}
+		}
+		else if (arg == "--resolution" && has_value)
+		{
+			int width = 0, height = 0;
+			if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+				std::cerr << "Invalid resolution: " << argv[i] << std::endl;
+				return false;
+			}
+			options.widths.push_back(width);
+			options.heights.push_back(height);
+		}
+		else if (arg == "--mode" && has_value)
+		{
+			int mode = -1;
+			for (int m = 0; m < NUM_MODES; ++m)
+				if (strcmp(argv[i + 1], MODES[m].name) == 0)
+					mode = m;
+			if (mode < 0) {
+				std::cerr << "Unknown mode: " << argv[i + 1] << std::endl;
+				return false;
+			}
+			options.modes.push_back(mode);
+			++i;
+		}
+		else if (arg == "--immediate")
+			options.tiled = false;
+		else if (arg == "--scalar")
+			Rasterizer::use_simd = VertexStage::use_simd = ImageFilter::use_simd = PNGDecoder::use_simd = PNGEncoder::use_simd = false;
+		else if (arg == "--no-hiz")
+			options.use_hiz = false;
+		else if (arg == "--visibility")
+			options.visibility_buffer = true;
+		else if (arg == "--filters")
+			options.filters = true;
+		else if (arg == "--png")
+			options.png = true;
+		else if (arg == "--png-file" && has_value)
+		{
+			options.png = true;
+			options.png_files.push_back(argv[++i]);
+		}
+		else if (arg == "--png-encode")
+			options.png_encode = true;
+		else if (arg == "--obj")
+			options.obj = true;
+		else if (arg == "--no-pool")
+			PixelPool::enabled = false;
+		else
+		{
+			std::cerr << "Unknown option: " << arg << std::endl;
+			return false;
+		}
+	}
+
+	if (!options.frames)
+		options.frames = options.filters ? 5 : options.png ? 20 : options.png_encode ? 3 : options.obj ? 10 : 120;
+	if (options.widths.empty() && options.filters)
+	{
+		const int widths[] = { 1280, 3840, 7680 };
+		const int heights[] = { 720, 2160, 4320 };
+		options.widths.assign(widths, widths + 3);
+		options.heights.assign(heights, heights + 3);
+	}
+	if (options.widths.empty() && options.png_encode)
+	{
+		const int widths[] = { 1280, 1920, 3840 };
+		const int heights[] = { 720, 1080, 2160 };
+		options.widths.assign(widths, widths + 3);
+		options.heights.assign(heights, heights + 3);
+	}
+	if (options.widths.empty())
+	{
+		const int widths[] = { 640, 1280, 1920 };
+		const int heights[] = { 360, 720, 1080 };
+		options.widths.assign(widths, widths + 3);
+		options.heights.assign(heights, heights + 3);
+	}
+	if (options.modes.empty())
+		for (int m = 0; m < NUM_MODES; ++m)
+			options.modes.push_back(m);
+	return true;
+}
+
+// Last member of the JSON object: how often image allocations were served by the pool, and the most memory it held
+static void PrintPoolStats()
+{
+	PixelPoolStats stats = PixelPool::Get()->GetStats();
+	std::cout << "  \"pixel_pool\": { \"enabled\": " << (PixelPool::enabled ? "true" : "false") << ", \"allocations\": " << stats.allocations
+		<< ", \"hit_rate\": " << stats.GetHitRate() << ", \"peak_mb\": " << stats.peak_bytes / (1024.0 * 1024.0) << " }" << std::endl;
+}
+
+// Throughput of every filter kernel on an Image (and the Gaussian blur on a FloatImage too)
+static void BenchmarkFilters(const BenchOptions& options)
+{
+	const char* names[] = { "gaussian", "gaussian_float", "box", "sharpen", "sobel", "convolve3x3", "convolve5x5" };
+	const int NUM_FILTERS = 7;
+	const float kernel3[9] = { 1.0f, 2.0f, 1.0f, 2.0f, 4.0f, 2.0f, 1.0f, 2.0f, 1.0f };
+	float kernel5[25];
+	for (int i = 0; i < 25; ++i)
+		kernel5[i] = 1.0f / 25.0f;
+
+	ImageFilter* filter = ImageFilter::Get();
+
+	std::cout << "{" << std::endl;
+	std::cout << "  \"threads\": " << ThreadPool::Get()->GetNumThreads() << "," << std::endl;
+	std::cout << "  \"simd\": " << (ImageFilter::use_simd ? "true" : "false") << "," << std::endl;
+	std::cout << "  \"tile\": \"" << ImageFilter::TILE_WIDTH << "x" << ImageFilter::TILE_HEIGHT << "\"," << std::endl;
+	std::cout << "  \"runs_per_filter\": " << options.frames << "," << std::endl;
+	std::cout << "  \"filters\": [" << std::endl;
+
+	size_t num_runs = options.widths.size() * NUM_FILTERS;
+	size_t run = 0;
+	for (size_t r = 0; r < options.widths.size(); ++r)
+	{
+		int width = options.widths[r];
+		int height = options.heights[r];
+
+		// Gradients with some noise, so no kernel works on flat data
+		Image source(width, height), destination(width, height);
+		FloatImage float_source(width, height), float_destination(width, height);
+		unsigned int seed = 1;
+		for (int y = 0; y < height; ++y)
+			for (int x = 0; x < width; ++x)
+			{
+				seed = seed * 1664525u + 1013904223u;
+				source.SetPixelUnsafe(x, y, Color((float)(x & 255), (float)(y & 255), (float)(seed >> 24)));
+				float_source.SetPixelUnsafe(x, y, (float)(seed >> 16) / 65536.0f);
+			}
+
+		for (int f = 0; f < NUM_FILTERS; ++f)
+		{
+			std::vector<double> times;
+
+			// Run -1 allocates the destination and the buffers of the filter, and is not measured
+			for (int i = -1; i < options.frames; ++i)
+			{
+				std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+				switch (f)
+				{
+				case 0: filter->GaussianBlur(source, destination, 2.0f); break;
+				case 1: filter->GaussianBlur(float_source, float_destination, 2.0f); break;
+				case 2: filter->BoxBlur(source, destination, 2); break;
+				case 3: filter->Sharpen(source, destination); break;
+				case 4: filter->Sobel(source, destination); break;
+				case 5: filter->Convolve(source, destination, kernel3, 3); break;
+				case 6: filter->Convolve(source, destination, kernel5, 5); break;
+				}
+				std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+				if (i >= 0)
+					times.push_back(Milliseconds(start, end));
+			}
+
+			std::sort(times.begin(), times.end());
+			double total = 0.0;
+			for (size_t i = 0; i < times.size(); ++i)
+				total += times[i];
+			double mean = total / times.size();
+
+			std::cout << "    { \"filter\": \"" << names[f] << "\", \"width\": " << width << ", \"height\": " << height
+				<< ", \"mpixels_per_second\": " << (double)width * height / (mean * 1000.0)
+				<< ", \"ms\": { \"mean\": " << mean << ", \"p50\": " << Percentile(times, 0.5) << ", \"min\": " << times.front() << " } }"
+				<< (++run < num_runs ? "," : "") << std::endl;
+		}
+	}
+
+	std::cout << "  ]," << std::endl;
+	PrintPoolStats();
+	std::cout << "}" << std::endl;
+}
+
+static bool ReadFile(const std::string& path, std::vector<unsigned char>& data)
+{
+	std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+	if (!file.good())
+		return false;
+	std::streamsize size = file.tellg();
+	if (size <= 0)
+		return false;
+	data.resize((size_t)size);
+	file.seekg(0, std::ios::beg);
+	return file.read((char*)&data[0], size).good();
+}
+
+// Decode time of every PNG file, read into memory first so only the decoders are measured
+static bool BenchmarkPNG(const BenchOptions& options)
+{
+	const char* images[] = { "black", "blue", "circle", "clear", "cyan", "eraser", "fruits", "green", "line", "load", "pencil",
+		"pink", "rectangle", "red", "save", "triangle", "white", "yellow" };
+	std::vector<std::string> paths;
+	for (size_t i = 0; i < sizeof(images) / sizeof(images[0]); ++i)
+		paths.push_back(absResPath(std::string("images/") + images[i] + ".png"));
+	paths.insert(paths.end(), options.png_files.begin(), options.png_files.end());
+
+	std::cout << "{" << std::endl;
+	std::cout << "  \"simd\": " << (PNGDecoder::use_simd ? "true" : "false") << "," << std::endl;
+	std::cout << "  \"runs_per_file\": " << options.frames << "," << std::endl;
+	std::cout << "  \"png\": [" << std::endl;
+
+	double total_decoder = 0.0, total_picopng = 0.0;
+	for (size_t f = 0; f < paths.size(); ++f)
+	{
+		std::vector<unsigned char> data;
+		if (!ReadFile(paths[f], data))
+		{
+			std::cerr << "--- Failed to load file: " << paths[f] << std::endl;
+			return false;
+		}
+
+		PNGDecoder decoder;
+		RGBAImage image, picopng_image;
+		std::vector<double> decoder_times, picopng_times;
+
+		// Run -1 allocates the images and the buffers, and is not measured
+		for (int i = -1; i < options.frames; ++i)
+		{
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			if (!decoder.Decode(&data[0], data.size(), image))
+				return false;
+			std::chrono::high_resolution_clock::time_point decoded = std::chrono::high_resolution_clock::now();
+
+			std::vector<unsigned char> pixels;
+			unsigned int width = 0, height = 0;
+			if (decodePNG(pixels, width, height, &data[0], data.size(), true) != 0)
+				return false;
+			picopng_image.Allocate(width, height);
+			size_t row_size = (size_t)width * sizeof(ColorRGBA);
+			for (unsigned int y = 0; y < height; ++y)
+				memcpy(picopng_image.GetRow(height - y - 1), &pixels[y * row_size], row_size);
+			std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+			if (i < 0)
+				continue;
+			decoder_times.push_back(Milliseconds(start, decoded));
+			picopng_times.push_back(Milliseconds(decoded, end));
+		}
+
+		std::sort(decoder_times.begin(), decoder_times.end());
+		std::sort(picopng_times.begin(), picopng_times.end());
+		double decoder_mean = 0.0, picopng_mean = 0.0;
+		for (int i = 0; i < options.frames; ++i)
+		{
+			decoder_mean += decoder_times[i] / options.frames;
+			picopng_mean += picopng_times[i] / options.frames;
+		}
+		total_decoder += decoder_mean;
+		total_picopng += picopng_mean;
+
+		std::string name = paths[f].substr(paths[f].find_last_of("/\\") + 1);
+		std::cout << "    { \"file\": \"" << name << "\", \"width\": " << image.width << ", \"height\": " << image.height
+			<< ", \"bytes\": " << data.size() << ", \"mpixels_per_second\": " << (double)image.width * image.height / (decoder_mean * 1000.0)
+			<< ", \"decoder_ms\": { \"mean\": " << decoder_mean << ", \"min\": " << decoder_times.front() << " }"
+			<< ", \"picopng_ms\": { \"mean\": " << picopng_mean << ", \"min\": " << picopng_times.front() << " }"
+			<< ", \"speedup\": " << picopng_mean / decoder_mean << " }" << (f + 1 < paths.size() ? "," : "") << std::endl;
+	}
+
+	std::cout << "  ]," << std::endl;
+	std::cout << "  \"total_ms\": { \"decoder\": " << total_decoder << ", \"picopng\": " << total_picopng
+		<< ", \"speedup\": " << total_picopng / total_decoder << " }," << std::endl;
+	PrintPoolStats();
+	std::cout << "}" << std::endl;
+	return true;
+}
+
+// Counts the bytes written to it and drops them, so only the encoder is measured
+class CountingBuffer : public std::streambuf
+{
+public:
+	size_t size = 0;
+
+protected:
+	std::streamsize xsputn(const char*, std::streamsize count) override { size += (size_t)count; return count; }
+	int overflow(int c) override { size++; return c == EOF ? 0 : c; }
+};
+
+// Encode speed and file size of every level, serial and parallel
+static bool BenchmarkPNGEncode(const BenchOptions& options)
+{
+	Image fruits;
+	std::streambuf* output = std::cout.rdbuf(std::cerr.rdbuf());
+	bool loaded = fruits.LoadPNG("images/fruits.png");
+	std::cout.rdbuf(output);
+	if (!loaded)
+		return false;
+
+	std::cout << "{" << std::endl;
+	std::cout << "  \"threads\": " << ThreadPool::Get()->GetNumThreads() << "," << std::endl;
+	std::cout << "  \"simd\": " << (PNGEncoder::use_simd ? "true" : "false") << "," << std::endl;
+	std::cout << "  \"runs_per_level\": " << options.frames << "," << std::endl;
+	std::cout << "  \"png_encode\": [" << std::endl;
+
+	size_t num_runs = options.widths.size() * (Deflater::MAX_LEVEL + 1) * 2;
+	size_t run = 0;
+	for (size_t r = 0; r < options.widths.size(); ++r)
+	{
+		Image image(options.widths[r], options.heights[r]);
+		fruits.ScaleTo(image);
+		double megabytes = (double)image.width * image.height * 3 / (1024.0 * 1024.0);
+
+		for (int level = 0; level <= Deflater::MAX_LEVEL; ++level)
+			for (int parallel = 0; parallel < 2; ++parallel)
+			{
+				PNGEncoder encoder;
+				encoder.level = level;
+				encoder.parallel = parallel != 0;
+				std::vector<double> times;
+				size_t size = 0;
+				for (int i = 0; i < options.frames; ++i)
+				{
+					CountingBuffer buffer;
+					std::ostream stream(&buffer);
+					std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+					if (!encoder.Encode(image, stream))
+						return false;
+					std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+					times.push_back(Milliseconds(start, end));
+					size = buffer.size;
+				}
+
+				std::sort(times.begin(), times.end());
+				double total = 0.0;
+				for (size_t i = 0; i < times.size(); ++i)
+					total += times[i];
+				double mean = total / times.size();
+
+				std::cout << "    { \"width\": " << image.width << ", \"height\": " << image.height << ", \"level\": " << level
+					<< ", \"parallel\": " << (parallel ? "true" : "false") << ", \"mb_per_second\": " << megabytes / (mean / 1000.0)
+					<< ", \"bytes\": " << size << ", \"ratio\": " << (double)size / (megabytes * 1024.0 * 1024.0)
+					<< ", \"ms\": { \"mean\": " << mean << ", \"min\": " << times.front() << " } }"
+					<< (++run < num_runs ? "," : "") << std::endl;
+			}
+	}
+
+	std::cout << "  ]," << std::endl;
+	PrintPoolStats();
+	std::cout << "}" << std::endl;
+	return true;
+}
+
+// The parser Mesh::LoadOBJ had before OBJParser, as the reference: every line is copied into a buffer and tokenized into
+// strings, and the numbers are read with std::stof
+static void ParseOBJTokenized(const char* data, std::vector<Vector3>& vertices, std::vector<Vector3>& normals, std::vector<Vector2>& uvs)
+{
+	const char* pos = data;
+	char line[255];
+	std::vector<Vector3> indexed_positions;
+	std::vector<Vector3> indexed_normals;
+	std::vector<Vector2> indexed_uvs;
+	vertices.clear();
+	normals.clear();
+	uvs.clear();
+
+	while (*pos != 0)
+	{
+		if (*pos == '\n') pos++;
+		if (*pos == '\r') pos++;
+
+		int i = 0;
+		while (i < 255 && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
+		memcpy(line, pos, i);
+		line[i] = 0;
+		pos = pos + i;
+		if (*line == '#' || *line == 0) continue;
+
+		std::vector<std::string> tokens = tokenize(line, " ");
+		if (tokens.empty()) continue;
+
+		if (tokens[0] == "v" && tokens.size() == 4)
+			indexed_positions.push_back(Vector3(std::stof(tokens[1]), std::stof(tokens[2]), std::stof(tokens[3])));
+		else if (tokens[0] == "vt" && (tokens.size() == 4 || tokens.size() == 3))
+			indexed_uvs.push_back(Vector2(std::stof(tokens[1]), std::stof(tokens[2])));
+		else if (tokens[0] == "vn" && tokens.size() == 4)
+			indexed_normals.push_back(Vector3(std::stof(tokens[1]), std::stof(tokens[2]), std::stof(tokens[3])));
+		else if (tokens[0] == "f" && tokens.size() >= 4)
+		{
+			Vector3 v1 = parseVector3(tokens[1].c_str(), '/');
+			for (size_t iPoly = 2; iPoly < tokens.size() - 1; iPoly++)
+			{
+				Vector3 v2 = parseVector3(tokens[iPoly].c_str(), '/');
+				Vector3 v3 = parseVector3(tokens[iPoly + 1].c_str(), '/');
+				vertices.push_back(indexed_positions[(unsigned int)(v1.x) - 1]);
+				vertices.push_back(indexed_positions[(unsigned int)(v2.x) - 1]);
+				vertices.push_back(indexed_positions[(unsigned int)(v3.x) - 1]);
+				if (indexed_uvs.size() > 0)
+				{
+					uvs.push_back(indexed_uvs[(unsigned int)(v1.y) - 1]);
+					uvs.push_back(indexed_uvs[(unsigned int)(v2.y) - 1]);
+					uvs.push_back(indexed_uvs[(unsigned int)(v3.y) - 1]);
+				}
+				if (indexed_normals.size() > 0)
+				{
+					normals.push_back(indexed_normals[(unsigned int)(v1.z) - 1]);
+					normals.push_back(indexed_normals[(unsigned int)(v2.z) - 1]);
+					normals.push_back(indexed_normals[(unsigned int)(v3.z) - 1]);
+				}
+			}
+		}
+	}
+}
+
+template <typename T>
+static bool SameBits(const std::vector<T>& a, const std::vector<T>& b)
+{
+	return a.size() == b.size() && (a.empty() || memcmp(&a[0], &b[0], a.size() * sizeof(T)) == 0);
+}
+
+// Parse time of every mesh, read into memory first so only the parsers are measured
+static bool BenchmarkOBJ(const BenchOptions& options)
+{
+	const char* meshes[] = { "meshes/lee.obj", "meshes/anna.obj", "meshes/cleo.obj" };
+	const int num_meshes = sizeof(meshes) / sizeof(meshes[0]);
+
+	std::cout << "{" << std::endl;
+	std::cout << "  \"threads\": " << ThreadPool::Get()->GetNumThreads() << "," << std::endl;
+	std::cout << "  \"runs_per_file\": " << options.frames << "," << std::endl;
+	std::cout << "  \"obj\": [" << std::endl;
+
+	const char* names[] = { "serial", "parallel", "tokenized" };
+	double totals[3] = { 0.0, 0.0, 0.0 };
+	for (int f = 0; f < num_meshes; ++f)
+	{
+		std::vector<unsigned char> data;
+		if (!ReadFile(absResPath(meshes[f]), data))
+		{
+			std::cerr << "--- Failed to load file: " << meshes[f] << std::endl;
+			return false;
+		}
+		size_t size = data.size();
+		data.push_back(0);	// The tokenized parser reads up to a 0
+		const char* text = (const char*)&data[0];
+
+		std::vector<Vector3> vertices[3], normals[3];
+		std::vector<Vector2> uvs[3];
+		std::vector<double> times[3];
+		OBJParser parser;
+
+		// Run -1 grows the arrays and is not measured
+		for (int i = -1; i < options.frames; ++i)
+			for (int k = 0; k < 3; ++k)
+			{
+				std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+				if (k < 2)
+				{
+					parser.parallel = k == 1;
+					if (!parser.Parse(text, size, vertices[k], normals[k], uvs[k]))
+						return false;
+				}
+				else
+					ParseOBJTokenized(text, vertices[k], normals[k], uvs[k]);
+				std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+				if (i >= 0)
+					times[k].push_back(Milliseconds(start, end));
+			}
+
+		// Whole loads, parsed and from the cache the first one writes. The loader logs to std::cout, which is kept for the JSON
+		Mesh meshes_loaded[2];
+		std::vector<double> load_times[2];
+		std::streambuf* output = std::cout.rdbuf(std::cerr.rdbuf());
+		bool loaded = meshes_loaded[0].LoadOBJ(meshes[f], true);
+		for (int i = 0; loaded && i < options.frames; ++i)
+			for (int k = 0; k < 2; ++k)
+			{
+				std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+				loaded &= meshes_loaded[k].LoadOBJ(meshes[f], k == 1);
+				std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+				load_times[k].push_back(Milliseconds(start, end));
+			}
+		std::cout.rdbuf(output);
+		MappedFile cache_file;
+		if (!loaded || !cache_file.Open(MeshCache::GetPath(absResPath(meshes[f]))))
+			return false;
+
+		bool identical = true;
+		for (int k = 0; k < 2; ++k)
+			identical &= SameBits(vertices[k], vertices[2]) && SameBits(normals[k], normals[2]) && SameBits(uvs[k], uvs[2]);
+		for (int k = 0; k < 2; ++k)
+			identical &= SameBits(meshes_loaded[k].GetVertices(), vertices[2]) && SameBits(meshes_loaded[k].GetNormals(), normals[2]) &&
+				SameBits(meshes_loaded[k].GetUVs(), uvs[2]);
+
+		double mean[3];
+		std::cout << "    { \"file\": \"" << meshes[f] << "\", \"bytes\": " << size << ", \"triangles\": " << parser.GetNumTriangles()
+			<< ", \"identical\": " << (identical ? "true" : "false");
+		for (int k = 0; k < 3; ++k)
+		{
+			std::sort(times[k].begin(), times[k].end());
+			mean[k] = 0.0;
+			for (size_t i = 0; i < times[k].size(); ++i)
+				mean[k] += times[k][i] / times[k].size();
+			totals[k] += mean[k];
+			std::cout << ", \"" << names[k] << "\": { \"mean_ms\": " << mean[k] << ", \"min_ms\": " << times[k].front()
+				<< ", \"mb_per_second\": " << size / (1024.0 * 1024.0) / (mean[k] / 1000.0) << " }";
+		}
+		for (int k = 0; k < 2; ++k)
+			std::sort(load_times[k].begin(), load_times[k].end());
+		std::cout << ", \"speedup\": " << mean[2] / mean[1] << ", \"load_ms\": { \"parsed\": " << Percentile(load_times[0], 0.5)
+			<< ", \"cached\": " << Percentile(load_times[1], 0.5) << " }, \"cache_bytes\": " << cache_file.GetSize() << " }"
+			<< (f + 1 < num_meshes ? "," : "") << std::endl;
+	}
+
+	std::cout << "  ]," << std::endl;
+	std::cout << "  \"total_ms\": { \"serial\": " << totals[0] << ", \"parallel\": " << totals[1] << ", \"tokenized\": " << totals[2]
+		<< ", \"speedup\": " << totals[2] / totals[1] << " }," << std::endl;
+	PrintPoolStats();
+	std::cout << "}" << std::endl;
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	BenchOptions options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	if (options.filters)
+	{
+		BenchmarkFilters(options);
+		return 0;
+	}
+	if (options.png)
+		return BenchmarkPNG(options) ? 0 : 1;
+	if (options.png_encode)
+		return BenchmarkPNGEncode(options) ? 0 : 1;
+	if (options.obj)
+		return BenchmarkOBJ(options) ? 0 : 1;
+
+	// The loaders log to std::cout, which is kept for the JSON
+	std::streambuf* output = std::cout.rdbuf(std::cerr.rdbuf());
+
+	const char* mesh_files[] = { "meshes/lee.obj", "meshes/anna.obj", "meshes/cleo.obj" };
+	Mesh meshes[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		if (!meshes[i].LoadOBJ(mesh_files[i]))
+		{
+			std::cout.rdbuf(output);
+			return 1;
+		}
+	}
+
+	std::cout.rdbuf(output);
+
+	// Generated checkerboard, so the textured modes do not depend on the texture files
+	Image texture(256, 256);
+	for (unsigned int y = 0; y < texture.height; ++y)
+		for (unsigned int x = 0; x < texture.width; ++x)
+			texture.SetPixel(x, y, ((x / 32 + y / 32) % 2) ? Color(230, 200, 160) : Color(60, 90, 140));
+
+	// The three heads side by side, standing still while the camera moves
+	Entity entities[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		entities[i].mesh = &meshes[i];
+		entities[i].texture = &texture;
+		entities[i].base_position = Vector3(0.6f * (i - 1), 0.0f, 0.0f);
+		entities[i].Update(0.0f);
+	}
+
+	Image framebuffer;
+	FloatImage zbuffer;
+	HiZBuffer hiz;
+	Rasterizer rasterizer;
+	rasterizer.tiled = options.tiled;
+	rasterizer.visibility_buffer = options.visibility_buffer;
+
+	Camera camera;
+	camera.center = Vector3(0.0f, 0.25f, 0.0f);
+
+	std::cout << "{" << std::endl;
+	std::cout << "  \"threads\": " << ThreadPool::Get()->GetNumThreads() << "," << std::endl;
+	std::cout << "  \"simd\": " << (Rasterizer::use_simd ? "true" : "false") << "," << std::endl;
+	std::cout << "  \"rasterizer\": \"" << (options.tiled ? "tiled" : "immediate") << "\"," << std::endl;
+	std::cout << "  \"hiz\": " << (options.use_hiz ? "true" : "false") << "," << std::endl;
+	std::cout << "  \"visibility_buffer\": " << (options.visibility_buffer ? "true" : "false") << "," << std::endl;
+	std::cout << "  \"frames\": " << options.frames << "," << std::endl;
+	std::cout << "  \"runs\": [" << std::endl;
+
+	size_t num_runs = options.widths.size() * options.modes.size();
+	size_t run = 0;
+	for (size_t r = 0; r < options.widths.size(); ++r)
+	{
+		int width = options.widths[r];
+		int height = options.heights[r];
+		framebuffer.Resize(width, height);
+		zbuffer.Resize(width, height);
+		camera.SetPerspective(45.0f, (float)width / (float)height, 0.1f, 100.0f);
+
+		for (size_t m = 0; m < options.modes.size(); ++m)
+		{
+			const BenchMode& mode = MODES[options.modes[m]];
+			for (int i = 0; i < 3; ++i)
+			{
+				entities[i].mode = mode.mode;
+				entities[i].use_texture = mode.use_texture;
+				entities[i].use_zbuffer = mode.use_zbuffer;
+			}
+
+			std::vector<FrameTimes> times;
+			double triangles = 0.0, rasterized = 0.0, fragments = 0.0;
+
+			// Frame -1 warms up the caches and the buffers, and is not measured
+			for (int f = -1; f < options.frames; ++f)
+			{
+				float angle = 2.0f * (float)PI * std::max(f, 0) / options.frames;
+				Vector3 eye = camera.center + Vector3(1.8f * sinf(angle), 0.4f * sinf(2.0f * angle), 1.8f * cosf(angle));
+				camera.LookAt(eye, camera.center, Vector3(0.0f, 1.0f, 0.0f));
+
+				FrameTimes t;
+				std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+				framebuffer.Fill(Color::BLACK);
+				zbuffer.Fill(10000.0f);
+				hiz.Reset(&zbuffer, 10000.0f);
+				VertexStage::Get()->ResetStats();
+				rasterizer.Begin(&framebuffer, options.use_hiz ? &hiz : nullptr);
+				std::chrono::high_resolution_clock::time_point cleared = std::chrono::high_resolution_clock::now();
+
+				for (int i = 0; i < 3; ++i)
+					entities[i].Render(&framebuffer, &camera, &zbuffer, &rasterizer);
+				std::chrono::high_resolution_clock::time_point assembled = std::chrono::high_resolution_clock::now();
+
+				rasterizer.Flush();
+				std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+				if (f < 0)
+					continue;
+
+				t.total = Milliseconds(start, end);
+				t.clear = Milliseconds(start, cleared);
+				t.vertex = VertexStage::Get()->stats.milliseconds;
+				t.assembly = Milliseconds(cleared, assembled) - t.vertex;
+				t.raster = Milliseconds(assembled, end);
+				times.push_back(t);
+
+				for (int i = 0; i < 3; ++i)
+					triangles += entities[i].clipper.stats.triangles;
+				rasterized += rasterizer.stats.triangles;
+				fragments += rasterizer.stats.fragments;
+			}
+
+			FrameTimes sum;
+			std::vector<double> sorted;
+			for (size_t i = 0; i < times.size(); ++i)
+			{
+				sum.total += times[i].total;
+				sum.clear += times[i].clear;
+				sum.vertex += times[i].vertex;
+				sum.assembly += times[i].assembly;
+				sum.raster += times[i].raster;
+				sorted.push_back(times[i].total);
+			}
+			std::sort(sorted.begin(), sorted.end());
+
+			double frames = (double)options.frames;
+			double seconds = sum.total / 1000.0;
+
+			std::cout << "    {" << std::endl;
+			std::cout << "      \"mode\": \"" << mode.name << "\"," << std::endl;
+			std::cout << "      \"width\": " << width << "," << std::endl;
+			std::cout << "      \"height\": " << height << "," << std::endl;
+			std::cout << "      \"triangles_per_frame\": " << triangles / frames << "," << std::endl;
+			std::cout << "      \"triangles_per_second\": " << triangles / seconds << "," << std::endl;
+			std::cout << "      \"rasterized_triangles_per_second\": " << rasterized / seconds << "," << std::endl;
+			std::cout << "      \"fragments_per_second\": " << fragments / seconds << "," << std::endl;
+			std::cout << "      \"frame_ms\": { \"mean\": " << sum.total / frames << ", \"p50\": " << Percentile(sorted, 0.5)
+				<< ", \"p99\": " << Percentile(sorted, 0.99) << ", \"min\": " << sorted.front() << ", \"max\": " << sorted.back() << " }," << std::endl;
+			std::cout << "      \"stage_ms\": { \"clear\": " << sum.clear / frames << ", \"vertex\": " << sum.vertex / frames
+				<< ", \"assembly\": " << sum.assembly / frames << ", \"raster\": " << sum.raster / frames << " }" << std::endl;
+			std::cout << "    }" << (++run < num_runs ? "," : "") << std::endl;
+		}
+	}
+
+	std::cout << "  ]," << std::endl;
+	PrintPoolStats();
+	std::cout << "}" << std::endl;
+	return 0;
+}
@@ -4,9 +4,22 @@
 #include "utils.h"
 #include "entity.h"
 #include "camera.h"
+#include "threadpool.h"
+#include "vertexstage.h"
+#include "blitter.h"
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 
+// Toolbar icons keep their alpha, premultiplied for the blitter
+static bool LoadIcon(const char* filename, RGBAImage& icon)
+{
+    if (!LoadPNG(filename, icon))
+        return false;
+    PremultiplyAlpha(icon);
+    return true;
+}
+
 Application::Application(const char* caption, int width, int height)
 {
     this->window = createWindow(caption, width, height);
@@ -27,6 +40,8 @@ Application::Application(const char* caption, int width, int height)
 
 Application::~Application()
 {
+    // main deletes the application before the window, while the GL context still exists
+    presenter.Release();
 }
 
 void Application::UpdateCameraProjection()
@@ -60,19 +75,26 @@ void Application::UpdateCameraFromOrbit()
 void Application::Init(void)
 {
     std::cout << "Initiating app..." << std::endl;
+    init_start = std::chrono::high_resolution_clock::now();
     framebuffer.Fill(Color::BLACK);
 
+    // Nothing is loaded here: the entities start with an empty mesh and no texture, and the files are swapped in as
+    // they arrive (see Update)
     shared_mesh = new Mesh();
-    shared_mesh->LoadOBJ("meshes/lee.obj");
+    assets.LoadOBJ("meshes/lee.obj", [this](Mesh& mesh) { std::swap(*shared_mesh, mesh); });
 
     zBuffer.Resize(window_width, window_height);
 
     Image* myTexture = new Image();
-    myTexture->LoadTGA("textures/lee_color_specular.tga", true);
+    assets.LoadTGA("textures/lee_color_specular.tga", true, [this, myTexture](Image& image) {
+        *myTexture = std::move(image);
+        for (Entity* e : entities)
+            if (e)
+                e->texture = myTexture;
+    });
 
     Entity* e0 = new Entity();
     e0->mesh = shared_mesh;
-    e0->texture = myTexture; 
     e0->base_position = Vector3(0.0f, 0.0f, 0.0f);
     e0->rotation_speed = 1.0f;
     e0->scale_base = 1.0f;
@@ -81,7 +103,6 @@ void Application::Init(void)
 
     Entity* e1 = new Entity();
     e1->mesh = shared_mesh;
-    e1->texture = myTexture;
     e1->base_position = Vector3(-1.6f, 0.0f, 0.0f);
     e1->rotation_speed = -1.6f;
     e1->scale_base = 1.25f;
@@ -90,7 +111,6 @@ void Application::Init(void)
 
     Entity* e2 = new Entity();
     e2->mesh = shared_mesh;
-    e2->texture = myTexture;
     e2->base_position = Vector3(1.6f, 0.0f, 0.0f);
     e2->rotation_speed = 2.2f;
     e2->scale_base = 0.85f;
@@ -120,20 +140,6 @@ void Application::Init(void)
 
     UpdateCameraFromOrbit();
 
-    // Cargar iconos
-    icons_loaded = true;
-    icons_loaded &= iconLine.LoadPNG("images/line.png", true);
-    icons_loaded &= iconRect.LoadPNG("images/rectangle.png", true);
-    icons_loaded &= iconTri.LoadPNG("images/triangle.png", true);
-    icons_loaded &= iconPencil.LoadPNG("images/pencil.png", true);
-    icons_loaded &= iconEraser.LoadPNG("images/eraser.png", true);
-    icons_loaded &= iconBlack.LoadPNG("images/black.png", true);
-    icons_loaded &= iconWhite.LoadPNG("images/white.png", true);
-    icons_loaded &= iconRed.LoadPNG("images/red.png", true);
-    icons_loaded &= iconGreen.LoadPNG("images/green.png", true);
-    icons_loaded &= iconBlue.LoadPNG("images/blue.png", true);
-    icons_loaded &= iconYellow.LoadPNG("images/yellow.png", true);
-
     // Crear botones (posición en toolbar)
     btnLine = Button(&iconLine, Vector2(8, 8), Button::BTN_LINE);
     btnRect = Button(&iconRect, Vector2(48, 8), Button::BTN_RECT);
@@ -147,24 +153,77 @@ void Application::Init(void)
     btnGreen = Button(&iconGreen, Vector2(360, 8), Button::BTN_COLOR_GREEN);
     btnBlue = Button(&iconBlue, Vector2(400, 8), Button::BTN_COLOR_BLUE);
     btnYellow = Button(&iconYellow, Vector2(440, 8), Button::BTN_COLOR_YELLOW);
+
+    // Cargar iconos: each button takes the size of its icon and joins the toolbar when the icon arrives
+    icons_loaded = false;
+    Button* buttons[] = { &btnLine, &btnRect, &btnTri, &btnPencil, &btnEraser, &btnBlack, &btnWhite, &btnRed, &btnGreen, &btnBlue, &btnYellow };
+    const char* icon_files[] = { "images/line.png", "images/rectangle.png", "images/triangle.png", "images/pencil.png", "images/eraser.png",
+        "images/black.png", "images/white.png", "images/red.png", "images/green.png", "images/blue.png", "images/yellow.png" };
+    for (size_t i = 0; i < sizeof(buttons) / sizeof(buttons[0]); ++i)
+    {
+        Button* b = buttons[i];
+        std::string filename = icon_files[i];
+        assets.Load<RGBAImage>(filename, [filename](RGBAImage& icon) { return LoadIcon(filename.c_str(), icon); }, [this, b](RGBAImage& icon) {
+            *b->image = std::move(icon);
+            *b = Button(b->image, b->position, b->type);
+            toolbar_rect.Add(PixelRect((int)b->position.x, (int)b->position.y, (int)b->position.x + b->width, (int)b->position.y + b->height));
+            icons_loaded = true;
+        });
+    }
 }
 
-// Render one frame
-void Application::Render(void)
+// Canvas plus the 3D entities, without the tool preview
+void Application::RenderScene(void)
 {
-    // 1) Base: lo persistente
-    framebuffer = canvas;
-	zBuffer.Fill(10000.0f);
+    // 1) Base: lo persistente. Only where the canvas changed or the last scene and preview were drawn
+    int width = (int)framebuffer.width, height = (int)framebuffer.height;
+    composited.Clear();
+    if (composite_all || canvas.width != framebuffer.width || canvas.height != framebuffer.height)
+    {
+        canvas.Resize(framebuffer.width, framebuffer.height);
+        composited.Add(PixelRect(0, 0, width, height));
+        zBuffer.Fill(10000.0f);
+        composite_all = false;
+    }
+    else
+    {
+        composited.Add(canvas_dirty);
+        composited.Add(scene_rect);
+        composited.Add(preview_rect);
+        if (icons_loaded)
+            composited.Add(toolbar_rect.Clip(width, height));
+
+        // Depth is only written by the scene, everywhere else it still has the clear value
+        zBuffer.FillArea(10000.0f, scene_rect.x0, scene_rect.y0, scene_rect.GetWidth(), scene_rect.GetHeight());
+    }
+    canvas_dirty.Clear();
+
+    for (size_t i = 0; i < composited.rects.size(); ++i)
+    {
+        const PixelRect& r = composited.rects[i];
+        framebuffer.CopyArea(canvas, r.x0, r.y0, r.GetWidth(), r.GetHeight());
+    }
+    pixels_copied = composited.GetArea();
+
+	zHierarchy.Reset(&zBuffer, 10000.0f);
+
+    VertexStage::Get()->ResetStats();
 
     if (camera)
     {
+        rasterizer.tiled = use_tiled_rasterizer;
+        rasterizer.Begin(&framebuffer, use_hiz ? &zHierarchy : nullptr);
+
         if (scene_mode == MODE_SINGLE)
         {
             if (!entities.empty() && entities[0])
-                entities[0]->Render(&framebuffer, camera, &zBuffer);
+                entities[0]->Render(&framebuffer, camera, &zBuffer, &rasterizer);
         }
         else
         {
+            // Runs of filled copies of the shared mesh go as instances, the rest one by one. A run is drawn before the next
+            // entity that is not part of it, so everything lands in entity order
+            instances.clear();
             for (size_t i = 0; i < entities.size(); ++i)
             {
                 if (entities[i])
@@ -172,20 +231,56 @@ void Application::Render(void)
                     Color c = Color::WHITE;
                     if (i < entity_colors.size())
                         c = entity_colors[i];
-                    entities[i]->Render(&framebuffer, camera, &zBuffer);
+
+                    Entity* e = entities[i];
+                    bool filled = e->mode == eRenderMode::TRIANGLES || e->mode == eRenderMode::TRIANGLES_INTERPOLATED;
+                    if (use_instancing && filled && e->mesh == shared_mesh)
+                    {
+                        instances.push_back(e->GetInstance());
+                        continue;
+                    }
+
+                    Entity::RenderInstances(shared_mesh, instances.data(), (int)instances.size(), &framebuffer, camera, &zBuffer, &rasterizer);
+                    instances.clear();
+                    e->Render(&framebuffer, camera, &zBuffer, &rasterizer);
                 }
             }
+            Entity::RenderInstances(shared_mesh, instances.data(), (int)instances.size(), &framebuffer, camera, &zBuffer, &rasterizer);
         }
+
+        rasterizer.Flush();
     }
 
+    // The clipper bounds of what was drawn, restored from the canvas next frame
+    scene_rect = PixelRect();
+    if (camera)
+    {
+        size_t rendered = (scene_mode == MODE_SINGLE) ? std::min<size_t>(1, entities.size()) : entities.size();
+        for (size_t i = 0; i < rendered; ++i)
+            if (entities[i])
+                scene_rect.Add(entities[i]->clipper.stats.bounds);
+    }
+}
+
+// Render one frame
+void Application::Render(void)
+{
+    RenderScene();
+
     // 2) Preview mientras arrastras (no se guarda)
+    preview_rect = PixelRect();
     if (is_drawing && (mouse_state & SDL_BUTTON_LMASK))
     {
         Vector2 end_pos = mouse_position;
 
+        // Bounds of every tool shape (the rect border is drawn inside them)
+        preview_rect = PixelRect((int)std::min(start_pos.x, end_pos.x), (int)std::min(start_pos.y, end_pos.y),
+            (int)std::max(start_pos.x, end_pos.x) + 1, (int)std::max(start_pos.y, end_pos.y) + 1);
+        preview_rect = preview_rect.Clip((int)framebuffer.width, (int)framebuffer.height);
+
         if (current_tool == TOOL_LINE)
         {
-            framebuffer.DrawLineDDA((int)start_pos.x, (int)start_pos.y,
+            framebuffer.DrawLine((int)start_pos.x, (int)start_pos.y,
                 (int)end_pos.x, (int)end_pos.y, current_color);
         }
         else if (current_tool == TOOL_RECT)
@@ -220,9 +315,161 @@ void Application::Render(void)
         }
     }
 
+    // 3) Toolbar, blended over the scene (its area is restored from the canvas every frame)
+    if (icons_loaded)
+    {
+        const Button* buttons[] = { &btnLine, &btnRect, &btnTri, &btnPencil, &btnEraser, &btnBlack, &btnWhite, &btnRed, &btnGreen, &btnBlue, &btnYellow };
+        for (const Button* b : buttons)
+            b->Render(framebuffer);
+    }
 
     // 4) Presentar
-    framebuffer.Render();
+    presenter.Present(framebuffer);
+
+    if (first_frame)
+    {
+        first_frame = false;
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - init_start;
+        std::cout << "First frame after " << elapsed.count() << " ms" << std::endl;
+    }
+}
+
+// Renders the current scene with the scalar and the vectorized kernels and prints the time per frame
+void Application::BenchmarkKernels(int frames)
+{
+    if (!Rasterizer::HasSimd()) {
+        std::cout << "Benchmark: SIMD not available on this target" << std::endl;
+        return;
+    }
+
+    bool previous = Rasterizer::use_simd;
+    double ms[2];
+    double vertex_ms[2];
+
+    for (int k = 0; k < 2; ++k)
+    {
+        Rasterizer::use_simd = VertexStage::use_simd = (k == 1);
+        RenderScene(); // warm up caches
+
+        double vertex_total = 0.0;
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < frames; ++i)
+        {
+            RenderScene();
+            vertex_total += VertexStage::Get()->stats.milliseconds;
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+        ms[k] = elapsed.count() / frames;
+        vertex_ms[k] = vertex_total / frames;
+    }
+
+    Rasterizer::use_simd = VertexStage::use_simd = previous;
+
+    std::cout << "Benchmark (" << frames << " frames, " << (use_tiled_rasterizer ? "tiled" : "single thread") << "): "
+        << "scalar " << ms[0] << " ms, simd " << ms[1] << " ms, speedup " << ms[0] / ms[1] << "x" << std::endl;
+    std::cout << "  vertex stage (" << VertexStage::Get()->stats.vertices << " vertices): scalar " << vertex_ms[0]
+        << " ms, simd " << vertex_ms[1] << " ms" << std::endl;
+
+    const RasterStats& stats = rasterizer.stats;
+    std::cout << "  " << stats.triangles << " triangles, " << stats.blocks_drawn << " blocks drawn, hierarchical Z "
+        << (use_hiz ? "rejected " : "off ") << stats.hiz_rejected_triangles << " triangle tiles and "
+        << stats.hiz_rejected_blocks << " blocks" << std::endl;
+    std::cout << "  " << stats.fragments << " fragments, " << stats.pixels_shaded << " pixels shaded, overdraw "
+        << stats.GetOverdraw() << "x" << (rasterizer.visibility_buffer ? " (saved by the visibility buffer)" : "") << std::endl;
+
+    ClipStats clip;
+    size_t rendered = (scene_mode == MODE_SINGLE) ? std::min<size_t>(1, entities.size()) : entities.size();
+    for (size_t i = 0; i < rendered; ++i)
+        if (entities[i])
+            clip.Add(entities[i]->clipper.stats);
+    std::cout << "  " << clip.triangles << " input triangles: " << clip.backface_culled << " back-facing, "
+        << clip.frustum_culled << " outside the frustum, " << clip.clipped << " clipped" << std::endl;
+    std::cout << "  compositing: " << pixels_copied << " of " << framebuffer.width * framebuffer.height
+        << " pixels copied from the canvas per frame (" << composited.rects.size() << " rectangles)" << std::endl;
+    PixelPoolStats pool = PixelPool::Get()->GetStats();
+    std::cout << "  pixel pool: " << pool.allocations << " image allocations, " << pool.GetHitRate() * 100.0
+        << "% recycled, peak " << pool.peak_bytes / (1024.0 * 1024.0) << " MB" << std::endl;
+}
+
+// Renders grids of copies of the shared mesh, one instanced call against one call per copy, and prints the cost per instance
+void Application::BenchmarkInstancing(int frames)
+{
+    if (!shared_mesh || entities.empty() || !entities[0]) return;
+
+    const int COLUMNS = 20;
+    const int counts[] = { 1, 10, 100, 400 };
+
+    // The whole 20 x 20 grid in view, from a camera of its own
+    Camera grid_camera;
+    grid_camera.center = Vector3(0.0f, 0.0f, 0.0f);
+    grid_camera.LookAt(Vector3(0.0f, 0.0f, 22.0f), grid_camera.center, Vector3(0.0f, 1.0f, 0.0f));
+    grid_camera.SetPerspective(45.0f, (float)window_width / (float)window_height, 0.1f, 1000.0f);
+
+    std::vector<MeshInstance> grid;
+
+    std::cout << "Instancing benchmark (" << shared_mesh->GetVertices().size() / 3 << " triangles per copy, " << frames
+        << " frames, " << (use_tiled_rasterizer ? "tiled" : "single thread") << ")" << std::endl;
+
+    for (int c = 0; c < 4; ++c)
+    {
+        int count = counts[c];
+        grid.clear();
+        for (int i = 0; i < count; ++i)
+        {
+            MeshInstance instance = entities[0]->GetInstance();
+            int row = i / COLUMNS, column = i % COLUMNS;
+
+            Matrix44 T, R, S;
+            T.MakeTranslationMatrix((column - (COLUMNS - 1) * 0.5f) * 0.8f, (row - (COLUMNS - 1) * 0.5f) * 0.8f, 0.0f);
+            R.MakeRotationMatrix(i * 0.7f, Vector3(0.0f, 1.0f, 0.0f));
+            S.MakeScaleMatrix(0.35f, 0.35f, 0.35f);
+            instance.model = T * R * S;
+            instance.stats = nullptr;
+            grid.push_back(instance);
+        }
+
+        double ms[2];
+        double vertex_ms[2];
+        for (int k = 0; k < 2; ++k)
+        {
+            double vertex_total = 0.0;
+            std::chrono::high_resolution_clock::time_point start;
+            for (int f = -1; f < frames; ++f) // frame -1 warms up caches
+            {
+                if (f == 0)
+                    start = std::chrono::high_resolution_clock::now();
+
+                framebuffer.Fill(Color::BLACK);
+                zBuffer.Fill(10000.0f);
+                zHierarchy.Reset(&zBuffer, 10000.0f);
+                VertexStage::Get()->ResetStats();
+
+                rasterizer.tiled = use_tiled_rasterizer;
+                rasterizer.Begin(&framebuffer, use_hiz ? &zHierarchy : nullptr);
+                if (k == 0)
+                {
+                    for (int i = 0; i < count; ++i)
+                        Entity::RenderInstances(shared_mesh, &grid[i], 1, &framebuffer, &grid_camera, &zBuffer, &rasterizer);
+                }
+                else
+                    Entity::RenderInstances(shared_mesh, grid.data(), count, &framebuffer, &grid_camera, &zBuffer, &rasterizer);
+                rasterizer.Flush();
+
+                if (f >= 0)
+                    vertex_total += VertexStage::Get()->stats.milliseconds;
+            }
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            ms[k] = elapsed.count() / frames;
+            vertex_ms[k] = vertex_total / frames;
+        }
+
+        std::cout << "  " << count << " instances: one call per copy " << ms[0] << " ms (" << ms[0] / count
+            << " ms per instance, vertex stage " << vertex_ms[0] << " ms), instanced " << ms[1] << " ms ("
+            << ms[1] / count << " ms per instance, vertex stage " << vertex_ms[1] << " ms)" << std::endl;
+    }
+
+    // The grids were drawn over the whole framebuffer
+    composite_all = true;
 }
 
 // Called after render
@@ -230,6 +477,8 @@ void Application::Update(float seconds_elapsed)
 {
     time += seconds_elapsed;
 
+    assets.Poll();
+
     if (scene_mode == MODE_MULTI)
     {
         for (size_t i = 0; i < entities.size(); ++i)
@@ -269,6 +518,14 @@ void Application::OnKeyPressed(SDL_KeyboardEvent event)
         std::cout << "Interpolation toggled" << std::endl;
         break;
 
+        // X: Toggle Back-Face Culling
+    case SDLK_x:
+        for (auto e : entities) {
+            if (e) e->clipper.cull_backfaces = !e->clipper.cull_backfaces;
+        }
+        std::cout << "Back-face culling toggled" << std::endl;
+        break;
+
         // W: Toggle Wireframe Mode
     case SDLK_w:
         for (auto e : entities) {
@@ -283,6 +540,14 @@ void Application::OnKeyPressed(SDL_KeyboardEvent event)
         std::cout << "Wireframe toggled" << std::endl;
         break;
 
+        // A: Toggle anti-aliased wireframe lines
+    case SDLK_a:
+        for (auto e : entities) {
+            if (e) e->antialias_lines = !e->antialias_lines;
+        }
+        std::cout << "Anti-aliased lines toggled" << std::endl;
+        break;
+
         // 1: Draw Single Entity
     case SDLK_1:
         scene_mode = MODE_SINGLE;
@@ -295,6 +560,72 @@ void Application::OnKeyPressed(SDL_KeyboardEvent event)
         std::cout << "Mode: Multi Entity" << std::endl;
         break;
 
+        // M: Toggle the tile-binned multithreaded rasterizer
+    case SDLK_m:
+        use_tiled_rasterizer = !use_tiled_rasterizer;
+        if (use_tiled_rasterizer)
+            std::cout << "Rasterizer: Tiled (" << ThreadPool::Get()->GetNumThreads() << " threads)" << std::endl;
+        else
+            std::cout << "Rasterizer: Single Thread" << std::endl;
+        break;
+
+        // K: Toggle the vectorized vertex and pixel kernels
+    case SDLK_k:
+        if (!Rasterizer::HasSimd()) {
+            std::cout << "Kernels: SIMD not available on this target" << std::endl;
+            break;
+        }
+        Rasterizer::use_simd = !Rasterizer::use_simd;
+        VertexStage::use_simd = Rasterizer::use_simd;
+        std::cout << "Vertex and pixel kernels: " << (Rasterizer::use_simd ? "SIMD" : "Scalar") << std::endl;
+        break;
+
+        // L: Cycle the texture filter (nearest, bilinear, trilinear)
+    case SDLK_l:
+        if (Rasterizer::texture_filter == eTextureFilter::NEAREST)
+            Rasterizer::texture_filter = eTextureFilter::BILINEAR;
+        else if (Rasterizer::texture_filter == eTextureFilter::BILINEAR)
+            Rasterizer::texture_filter = eTextureFilter::TRILINEAR;
+        else
+            Rasterizer::texture_filter = eTextureFilter::NEAREST;
+        std::cout << "Texture filter: " << (Rasterizer::texture_filter == eTextureFilter::NEAREST ? "Nearest" :
+            Rasterizer::texture_filter == eTextureFilter::BILINEAR ? "Bilinear (mipmapped)" : "Trilinear") << std::endl;
+        break;
+
+        // I: Toggle the visibility buffer (depth and triangle ids first, then shade each visible pixel once)
+    case SDLK_i:
+        rasterizer.visibility_buffer = !rasterizer.visibility_buffer;
+        std::cout << "Visibility buffer: " << (rasterizer.visibility_buffer ? "ON" : "OFF") << std::endl;
+        break;
+
+        // G: Toggle instanced drawing of the entities that share a mesh
+    case SDLK_g:
+        use_instancing = !use_instancing;
+        std::cout << "Instancing: " << (use_instancing ? "ON" : "OFF") << std::endl;
+        break;
+
+        // H: Toggle the hierarchical z-buffer rejection
+    case SDLK_h:
+        use_hiz = !use_hiz;
+        std::cout << "Hierarchical Z: " << (use_hiz ? "ON" : "OFF") << std::endl;
+        break;
+
+        // P: Toggle the streaming presentation (pixel-buffer ring and textured quad) against glDrawPixels
+    case SDLK_p:
+        presenter.use_streaming = !presenter.use_streaming;
+        std::cout << "Presentation: " << (presenter.use_streaming ? "Pixel buffer ring" : "glDrawPixels") << std::endl;
+        break;
+
+        // B: Benchmark the pixel kernels on the current scene
+    case SDLK_b:
+        BenchmarkKernels(50);
+        break;
+
+        // J: Benchmark instanced drawing against one draw per copy
+    case SDLK_j:
+        BenchmarkInstancing(10);
+        break;
+
         // N: Select Camera Near Plane
     case SDLK_n:
         current_property = PROP_NEAR;
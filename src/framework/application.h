@@ -8,9 +8,15 @@
 #include "framework.h"
 #include "image.h"
 #include "button.h"
+#include "rasterizer.h"
+#include "hizbuffer.h"
+#include "entity.h"
+#include "dirtyregion.h"
+#include "presenter.h"
+#include "assetloader.h"
 #include <vector>
+#include <chrono>
 
-class Entity;
 class Camera;
 class Mesh;
 
@@ -40,8 +46,38 @@ public:
     Image canvas;
 	FloatImage zBuffer;
 
+    // Dirty-rectangle compositing: framebuffer is kept between frames and only the areas that changed are copied back from
+    // the canvas. Whoever draws into the canvas adds the area to canvas_dirty
+    DirtyRegion canvas_dirty;
+    PixelRect scene_rect;               // Pixels the 3D layer touched in the last frame (also the only depths written)
+    PixelRect preview_rect;             // Same for the tool preview
+    PixelRect toolbar_rect;             // Buttons, blended over the scene every frame
+    bool composite_all = true;          // Copy everything, after a resize or after drawing something else into framebuffer
+    DirtyRegion composited;             // Areas copied in the last frame
+    unsigned int pixels_copied = 0;     // Pixels copied from the canvas in the last frame
+
+    // Streams framebuffer to the window through a ring of pixel buffers ('P' key)
+    Presenter presenter;
+
+    // Tile-binned multithreaded rasterization ('M' key)
+    Rasterizer rasterizer;
+    bool use_tiled_rasterizer = false;
+
+    // Per-tile and per-block farthest depth, to skip occluded triangles early ('H' key)
+    HiZBuffer zHierarchy;
+    bool use_hiz = true;
+
+    // The mesh, the texture and the icons load on worker threads, Update swaps each one in when it is ready
+    AssetLoader assets;
+    std::chrono::high_resolution_clock::time_point init_start;
+    bool first_frame = true;
+
     Mesh* shared_mesh = nullptr;
     std::vector<Entity*> entities;
+
+    // Consecutive entities that share the mesh are drawn in one instanced call ('G' key)
+    bool use_instancing = true;
+    std::vector<MeshInstance> instances;
     std::vector<Color> entity_colors;
     Camera* camera = nullptr;
 
@@ -66,9 +102,10 @@ public:
     void UpdateCameraFromOrbit();
     void UpdateCameraProjection();
 
-    Image iconLine, iconRect, iconTri;
-    Image iconPencil, iconEraser;
-    Image iconBlack, iconWhite, iconRed, iconGreen, iconBlue, iconYellow;
+    // With premultiplied alpha
+    RGBAImage iconLine, iconRect, iconTri;
+    RGBAImage iconPencil, iconEraser;
+    RGBAImage iconBlack, iconWhite, iconRed, iconGreen, iconBlue, iconYellow;
     bool icons_loaded = false;
 
     Button btnLine;
@@ -99,13 +136,20 @@ public:
 
     void Init(void);
     void Render(void);
+    void RenderScene(void);
     void Update(float dt);
 
+    void BenchmarkKernels(int frames);
+    void BenchmarkInstancing(int frames);
+
     void SetWindowSize(int width, int height) {
         glViewport(0, 0, width, height);
         this->window_width = width;
         this->window_height = height;
         this->framebuffer.Resize(width, height);
+        this->canvas.Resize(width, height);
+        this->zBuffer.Resize(width, height);
+        this->composite_all = true;
     }
 
     Vector2 GetWindowSize()
@@ -0,0 +1,88 @@
+#include "assetloader.h"
+#include "mesh.h"
+#include "image.h"
+
+#include <algorithm>
+#include <iostream>
+
+AssetLoader::AssetLoader(unsigned int num_threads) :
+	pool(std::max(num_threads ? num_threads : std::thread::hardware_concurrency(), 2u))
+{
+}
+
+std::shared_future<bool> AssetLoader::LoadOBJ(const char* filename, std::function<void(Mesh&)> ready)
+{
+	std::string path = filename;
+	return Load<Mesh>(path, [path](Mesh& mesh) { return mesh.LoadOBJ(path.c_str()); }, ready);
+}
+
+std::shared_future<bool> AssetLoader::LoadPNG(const char* filename, std::function<void(Image&)> ready)
+{
+	std::string path = filename;
+	return Load<Image>(path, [path](Image& image) { return image.LoadPNG(path.c_str()); }, ready);
+}
+
+std::shared_future<bool> AssetLoader::LoadPNG(const char* filename, std::function<void(RGBAImage&)> ready)
+{
+	std::string path = filename;
+	return Load<RGBAImage>(path, [path](RGBAImage& image) { return ::LoadPNG(path.c_str(), image); }, ready);
+}
+
+std::shared_future<bool> AssetLoader::LoadTGA(const char* filename, bool flip_y, std::function<void(Image&)> ready)
+{
+	std::string path = filename;
+	return Load<Image>(path, [path, flip_y](Image& image) { return image.LoadTGA(path.c_str(), flip_y); }, ready);
+}
+
+int AssetLoader::Poll()
+{
+	if (pending.empty())
+		return 0;
+
+	// In the order they were started
+	std::vector<sPending> ready;
+	for (size_t i = 0; i < pending.size();)
+	{
+		if (pending[i].result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			++i;
+			continue;
+		}
+		ready.push_back(pending[i]);
+		pending.erase(pending.begin() + i);
+	}
+
+	for (size_t i = 0; i < ready.size(); ++i)
+	{
+		const sPending& entry = ready[i];
+		load_milliseconds += *entry.milliseconds;
+		if (entry.result.get())
+		{
+			entry.deliver();
+			std::cout << "+++ Asset ready: " << entry.name << " (" << *entry.milliseconds << " ms)" << std::endl;
+		}
+		else
+		{
+			failed++;
+			std::cerr << "--- Asset failed: " << entry.name << " (" << *entry.milliseconds << " ms)" << std::endl;
+		}
+	}
+
+	if (!ready.empty() && pending.empty())
+	{
+		std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+		std::cout << "+++ Assets: " << started - failed << " of " << started << " loaded in " << elapsed.count() << " ms ("
+			<< load_milliseconds << " ms of loading, workers: " << pool.GetNumThreads() - 1 << ")" << std::endl;
+	}
+	return (int)pending.size();
+}
+
+void AssetLoader::Finish()
+{
+	while (!pending.empty())
+	{
+		for (size_t i = 0; i < pending.size(); ++i)
+			pending[i].result.wait();
+		Poll();
+	}
+}
@@ -0,0 +1,90 @@
+/*
+	+ This class loads meshes and images on worker threads, so the application shows its first frames while they load.
+	+ Every asset is loaded into an object of its own on a worker; Poll, called by the main thread once per frame, hands
+	  the ones that are ready to their callbacks, which move them into place, and logs how long each one took and the
+	  whole startup once nothing is left. The loaders never touch GL or anything the main thread uses.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include "threadpool.h"
+#include "pixelimage.h"
+
+class Mesh;
+class Image;
+
+class AssetLoader
+{
+public:
+	// num_threads as in ThreadPool, but never less than 2 so the loads always leave the calling thread free
+	AssetLoader(unsigned int num_threads = 0);
+
+	// The future of every Load is true once the asset is loaded, false when it failed. ready is called by Poll, only if
+	// it loaded, with the new asset to move from
+	template <typename Asset>
+	std::shared_future<bool> Load(const std::string& name, std::function<bool(Asset&)> load, std::function<void(Asset&)> ready);
+
+	std::shared_future<bool> LoadOBJ(const char* filename, std::function<void(Mesh&)> ready);
+	std::shared_future<bool> LoadPNG(const char* filename, std::function<void(Image&)> ready);
+	std::shared_future<bool> LoadPNG(const char* filename, std::function<void(RGBAImage&)> ready);
+	std::shared_future<bool> LoadTGA(const char* filename, bool flip_y, std::function<void(Image&)> ready);
+
+	// Delivers the assets that are ready, returns how many are still loading
+	int Poll();
+
+	// Waits for all of them and delivers them
+	void Finish();
+
+	bool IsLoading() const { return !pending.empty(); }
+
+private:
+	typedef std::chrono::high_resolution_clock Clock;
+
+	struct sPending
+	{
+		std::string name;
+		std::shared_future<bool> result;
+		std::shared_ptr<double> milliseconds;	// Written by the worker before the future is set
+		std::function<void()> deliver;
+	};
+
+	ThreadPool pool;
+	std::vector<sPending> pending;
+
+	// Since the first load after the last time nothing was pending
+	Clock::time_point start;
+	int started = 0;
+	int failed = 0;
+	double load_milliseconds = 0.0;
+};
+
+template <typename Asset>
+std::shared_future<bool> AssetLoader::Load(const std::string& name, std::function<bool(Asset&)> load, std::function<void(Asset&)> ready)
+{
+	if (pending.empty())
+	{
+		start = Clock::now();
+		started = failed = 0;
+		load_milliseconds = 0.0;
+	}
+	started++;
+
+	std::shared_ptr<Asset> asset = std::make_shared<Asset>();
+	std::shared_ptr<double> milliseconds = std::make_shared<double>(0.0);
+	sPending entry;
+	entry.name = name;
+	entry.milliseconds = milliseconds;
+	entry.deliver = [asset, ready] { ready(*asset); };
+	entry.result = pool.Submit([asset, load, milliseconds] {
+		Clock::time_point begin = Clock::now();
+		bool loaded = load(*asset);
+		*milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+		return loaded;
+	}).share();
+	pending.push_back(entry);
+	return entry.result;
+}
@@ -0,0 +1,345 @@
+#include "blitter.h"
+#include "simd.h"
+
+#include <algorithm>
+
+#ifdef CG_SIMD
+bool Blitter::use_simd = true;
+#else
+bool Blitter::use_simd = false;
+#endif
+
+// Rounded v / 255 for v in [0, 255 * 255], without dividing
+static inline int DivideBy255(int v)
+{
+	v += 128;
+	return (v + (v >> 8)) >> 8;
+}
+
+static inline void BlendPixel(const ColorRGBA& s, Color& d)
+{
+	// A zero pixel leaves the destination as it is, and an opaque one replaces it
+	if (!(s.r | s.g | s.b | s.a))
+		return;
+	if (s.a == 255)
+	{
+		d.r = s.r;
+		d.g = s.g;
+		d.b = s.b;
+		return;
+	}
+
+	// Premultiplied colours do not pass 255, the clamp only matters for the ones that are not (with alpha 0 their colour
+	// is added, as in the vector kernel)
+	int inverse = 255 - s.a;
+	d.r = (unsigned char)std::min(s.r + DivideBy255(d.r * inverse), 255);
+	d.g = (unsigned char)std::min(s.g + DivideBy255(d.g * inverse), 255);
+	d.b = (unsigned char)std::min(s.b + DivideBy255(d.b * inverse), 255);
+}
+
+#ifdef CG_SIMD
+
+// The kernels keep a pixel per 32-bit lane (RGBA for the sprites, RGB and a byte that is never stored for Image), and work
+// on the channels widened to 16 bits. The loads of RGB pixels read up to two pixels past the vector, so the vector loops
+// stop two pixels before the end of the row
+
+#if CG_SIMD_WIDTH == 8
+
+typedef __m256i vpixels;	// 8 pixels
+static const int ALL_LANES = -1;	// Byte mask of a comparison true in every lane
+
+static inline vpixels LoadRGB(const Color* p) { return _mm256_inserti128_si256(_mm256_castsi128_si256(simdLoadRGB4(p)), simdLoadRGB4(p + 4), 1); }
+static inline void StoreRGB(Color* p, vpixels v) { simdStoreRGB4(p, _mm256_castsi256_si128(v)); simdStoreRGB4(p + 4, _mm256_extracti128_si256(v, 1)); }
+static inline vpixels LoadRGBA(const ColorRGBA* p) { return _mm256_loadu_si256((const __m256i*)p); }
+
+static inline vpixels Splat32(int v) { return _mm256_set1_epi32(v); }
+static inline vpixels Splat16(short v) { return _mm256_set1_epi16(v); }
+static inline vpixels And(vpixels a, vpixels b) { return _mm256_and_si256(a, b); }
+static inline vpixels Or(vpixels a, vpixels b) { return _mm256_or_si256(a, b); }
+static inline vpixels AndNot(vpixels mask, vpixels a) { return _mm256_andnot_si256(mask, a); }
+static inline vpixels Equal32(vpixels a, vpixels b) { return _mm256_cmpeq_epi32(a, b); }
+static inline int MoveMask(vpixels mask) { return _mm256_movemask_epi8(mask); }
+
+static inline vpixels WidenLow(vpixels v) { return _mm256_unpacklo_epi8(v, _mm256_setzero_si256()); }
+static inline vpixels WidenHigh(vpixels v) { return _mm256_unpackhi_epi8(v, _mm256_setzero_si256()); }
+static inline vpixels Narrow(vpixels low, vpixels high) { return _mm256_packus_epi16(low, high); }
+static inline vpixels Add16(vpixels a, vpixels b) { return _mm256_add_epi16(a, b); }
+static inline vpixels Sub16(vpixels a, vpixels b) { return _mm256_sub_epi16(a, b); }
+static inline vpixels Mul16(vpixels a, vpixels b) { return _mm256_mullo_epi16(a, b); }
+static inline vpixels ShiftRight8(vpixels v) { return _mm256_srli_epi16(v, 8); }
+static inline vpixels BroadcastAlpha(vpixels v) { return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, 0xff), 0xff); }
+
+#else
+
+typedef __m128i vpixels;	// 4 pixels
+static const int ALL_LANES = 0xffff;
+
+static inline vpixels LoadRGB(const Color* p) { return simdLoadRGB4(p); }
+static inline void StoreRGB(Color* p, vpixels v) { simdStoreRGB4(p, v); }
+static inline vpixels LoadRGBA(const ColorRGBA* p) { return _mm_loadu_si128((const __m128i*)p); }
+
+static inline vpixels Splat32(int v) { return _mm_set1_epi32(v); }
+static inline vpixels Splat16(short v) { return _mm_set1_epi16(v); }
+static inline vpixels And(vpixels a, vpixels b) { return _mm_and_si128(a, b); }
+static inline vpixels Or(vpixels a, vpixels b) { return _mm_or_si128(a, b); }
+static inline vpixels AndNot(vpixels mask, vpixels a) { return _mm_andnot_si128(mask, a); }
+static inline vpixels Equal32(vpixels a, vpixels b) { return _mm_cmpeq_epi32(a, b); }
+static inline int MoveMask(vpixels mask) { return _mm_movemask_epi8(mask); }
+
+static inline vpixels WidenLow(vpixels v) { return _mm_unpacklo_epi8(v, _mm_setzero_si128()); }
+static inline vpixels WidenHigh(vpixels v) { return _mm_unpackhi_epi8(v, _mm_setzero_si128()); }
+static inline vpixels Narrow(vpixels low, vpixels high) { return _mm_packus_epi16(low, high); }
+static inline vpixels Add16(vpixels a, vpixels b) { return _mm_add_epi16(a, b); }
+static inline vpixels Sub16(vpixels a, vpixels b) { return _mm_sub_epi16(a, b); }
+static inline vpixels Mul16(vpixels a, vpixels b) { return _mm_mullo_epi16(a, b); }
+static inline vpixels ShiftRight8(vpixels v) { return _mm_srli_epi16(v, 8); }
+static inline vpixels BroadcastAlpha(vpixels v) { return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xff), 0xff); }
+
+#endif
+
+// BlendPixel on 16-bit channels: the products fit in 16 bits as unsigned values, and the pack clamps to 255
+static inline vpixels BlendChannels(vpixels source, vpixels destination)
+{
+	vpixels inverse = Sub16(Splat16(255), BroadcastAlpha(source));
+	vpixels t = Add16(Mul16(destination, inverse), Splat16(128));
+	return Add16(source, ShiftRight8(Add16(t, ShiftRight8(t))));
+}
+
+static inline vpixels BlendPixels(vpixels source, vpixels destination)
+{
+	return Narrow(BlendChannels(WidenLow(source), WidenLow(destination)), BlendChannels(WidenHigh(source), WidenHigh(destination)));
+}
+
+#endif
+
+static void BlendRow(const ColorRGBA* source, Color* destination, int count)
+{
+	int x = 0;
+#ifdef CG_SIMD
+	if (Blitter::use_simd)
+	{
+		const vpixels alpha_mask = Splat32((int)0xff000000);
+		const vpixels zero = Splat32(0);
+		for (; x + CG_SIMD_WIDTH + 2 <= count; x += CG_SIMD_WIDTH)
+		{
+			vpixels s = LoadRGBA(source + x);
+			vpixels alpha = And(s, alpha_mask);
+			if (MoveMask(Equal32(s, zero)) == ALL_LANES)
+				continue;
+			if (MoveMask(Equal32(alpha, alpha_mask)) == ALL_LANES)
+				StoreRGB(destination + x, s);
+			else
+				StoreRGB(destination + x, BlendPixels(s, LoadRGB(destination + x)));
+		}
+	}
+#endif
+	for (; x < count; ++x)
+		BlendPixel(source[x], destination[x]);
+}
+
+static void CopyRowColorKey(const Color* source, Color* destination, int count, const Color& key)
+{
+	int x = 0;
+#ifdef CG_SIMD
+	if (Blitter::use_simd)
+	{
+		// The unused byte is set in both, so it always compares equal
+		const vpixels unused = Splat32((int)0xff000000);
+		const vpixels keys = Splat32((int)(key.r | (key.g << 8) | (key.b << 16) | 0xff000000u));
+		for (; x + CG_SIMD_WIDTH + 2 <= count; x += CG_SIMD_WIDTH)
+		{
+			vpixels s = Or(LoadRGB(source + x), unused);
+			vpixels keyed = Equal32(s, keys);
+			int mask = MoveMask(keyed);
+			if (mask == ALL_LANES)
+				continue;
+			if (mask == 0)
+				StoreRGB(destination + x, s);
+			else
+				StoreRGB(destination + x, Or(And(keyed, LoadRGB(destination + x)), AndNot(keyed, s)));
+		}
+	}
+#endif
+	for (; x < count; ++x)
+		if (source[x].r != key.r || source[x].g != key.g || source[x].b != key.b)
+			destination[x] = source[x];
+}
+
+// The part of the area of a source_width x source_height image that lands inside destination when the top-left corner of
+// the area is drawn at x, y. x and y are moved to where the first pixel of the part goes. False when nothing is left
+static bool ClipArea(int source_width, int source_height, const PixelRect* area, const Image& destination, int& x, int& y, PixelRect& part)
+{
+	PixelRect full(0, 0, source_width, source_height);
+	part = area ? area->Clip(source_width, source_height) : full;
+	if (area)
+	{
+		x += part.x0 - area->x0;
+		y += part.y0 - area->y0;
+	}
+
+	if (x < 0)
+	{
+		part.x0 -= x;
+		x = 0;
+	}
+	if (y < 0)
+	{
+		part.y0 -= y;
+		y = 0;
+	}
+	part.x1 = std::min(part.x1, part.x0 + (int)destination.width - x);
+	part.y1 = std::min(part.y1, part.y0 + (int)destination.height - y);
+	return !part.IsEmpty();
+}
+
+void Blitter::Copy(const Image& source, Image& destination, int x, int y, const PixelRect* area)
+{
+	PixelRect part;
+	if (!ClipArea((int)source.width, (int)source.height, area, destination, x, y, part))
+		return;
+
+	for (int row = 0; row < part.GetHeight(); ++row)
+		memcpy(destination.GetRow(y + row) + x, source.GetRow(part.y0 + row) + part.x0, part.GetWidth() * sizeof(Color));
+}
+
+void Blitter::CopyColorKey(const Image& source, Image& destination, int x, int y, const Color& key, const PixelRect* area)
+{
+	PixelRect part;
+	if (!ClipArea((int)source.width, (int)source.height, area, destination, x, y, part))
+		return;
+
+	for (int row = 0; row < part.GetHeight(); ++row)
+		CopyRowColorKey(source.GetRow(part.y0 + row) + part.x0, destination.GetRow(y + row) + x, part.GetWidth(), key);
+}
+
+void Blitter::Blend(const RGBAImage& source, Image& destination, int x, int y, const PixelRect* area)
+{
+	PixelRect part;
+	if (!ClipArea((int)source.width, (int)source.height, area, destination, x, y, part))
+		return;
+
+	for (int row = 0; row < part.GetHeight(); ++row)
+		BlendRow(source.GetRow(part.y0 + row) + part.x0, destination.GetRow(y + row) + x, part.GetWidth());
+}
+
+// Source sample of the destination pixels [first, last) of a rect starting at start with size pixels, in 16.16 fixed point
+// from the pixel centres. The bilinear weight of the next pixel is 0 past the edges, so they repeat the edge pixel
+static void ComputeSamples(std::vector<int>& index, std::vector<int>& weight, int source_size, int start, int size, int first, int last,
+	eBlitFilter filter)
+{
+	index.resize(last - first);
+	weight.resize(last - first);
+
+	long long step = ((long long)source_size << 16) / size;
+	for (int i = first; i < last; ++i)
+	{
+		long long position = (i - start) * step + step / 2;
+		int k = i - first;
+		if (filter == eBlitFilter::NEAREST)
+		{
+			index[k] = std::min((int)(position >> 16), source_size - 1);
+			weight[k] = 0;
+			continue;
+		}
+
+		position -= 1 << 15;
+		if (position < 0)
+			position = 0;
+		index[k] = (int)(position >> 16);
+		weight[k] = (int)(position >> 8) & 255;
+		if (index[k] >= source_size - 1)
+		{
+			index[k] = source_size - 1;
+			weight[k] = 0;
+		}
+	}
+}
+
+template <typename Format, typename RowKernel>
+void Blitter::DrawScaled(const PixelImage<Format>& source, Image& destination, const PixelRect& rect, eBlitFilter filter, RowKernel kernel)
+{
+	typedef typename Format::Pixel Pixel;
+	const int channels = (int)sizeof(Pixel);
+
+	PixelRect part = rect.Clip((int)destination.width, (int)destination.height);
+	if (part.IsEmpty() || !source.width || !source.height)
+		return;
+
+	ComputeSamples(columns.index, columns.weight, (int)source.width, rect.x0, rect.GetWidth(), part.x0, part.x1, filter);
+	ComputeSamples(rows.index, rows.weight, (int)source.height, rect.y0, rect.GetHeight(), part.y0, part.y1, filter);
+
+	// Every destination row is sampled into scaled_row and drawn from there by the row kernel
+	int count = part.GetWidth();
+	scaled_row.resize(count * sizeof(Pixel));
+	Pixel* scaled = (Pixel*)scaled_row.data();
+
+	for (int y = part.y0; y < part.y1; ++y)
+	{
+		int source_y = rows.index[y - part.y0];
+		int weight_y = rows.weight[y - part.y0];
+		const Pixel* top = source.GetRow(source_y);
+
+		if (filter == eBlitFilter::NEAREST)
+		{
+			for (int x = 0; x < count; ++x)
+				scaled[x] = top[columns.index[x]];
+		}
+		else
+		{
+			const unsigned char* top_bytes = (const unsigned char*)top;
+			const unsigned char* bottom_bytes = (const unsigned char*)source.GetRow(std::min(source_y + 1, (int)source.height - 1));
+			unsigned char* out = scaled_row.data();
+			for (int x = 0; x < count; ++x)
+			{
+				int left = columns.index[x] * channels;
+				int right = std::min(columns.index[x] + 1, (int)source.width - 1) * channels;
+				int weight_x = columns.weight[x];
+				for (int c = 0; c < channels; ++c)
+				{
+					int upper = top_bytes[left + c] * (256 - weight_x) + top_bytes[right + c] * weight_x;
+					int lower = bottom_bytes[left + c] * (256 - weight_x) + bottom_bytes[right + c] * weight_x;
+					out[x * channels + c] = (unsigned char)((upper * (256 - weight_y) + lower * weight_y + (1 << 15)) >> 16);
+				}
+			}
+		}
+
+		kernel(scaled, destination.GetRow(y) + part.x0, count);
+	}
+}
+
+void Blitter::CopyScaled(const Image& source, Image& destination, const PixelRect& rect, eBlitFilter filter, const Color* key)
+{
+	if (key)
+	{
+		Color k = *key;
+		DrawScaled(source, destination, rect, filter, [k](const Color* s, Color* d, int count) { CopyRowColorKey(s, d, count, k); });
+	}
+	else
+		DrawScaled(source, destination, rect, filter, [](const Color* s, Color* d, int count) { memcpy(d, s, count * sizeof(Color)); });
+}
+
+void Blitter::BlendScaled(const RGBAImage& source, Image& destination, const PixelRect& rect, eBlitFilter filter)
+{
+	DrawScaled(source, destination, rect, filter, BlendRow);
+}
+
+Blitter* Blitter::Get()
+{
+	static Blitter blitter;
+	return &blitter;
+}
+
+void PremultiplyAlpha(RGBAImage& image)
+{
+	for (unsigned int y = 0; y < image.height; ++y)
+	{
+		ColorRGBA* row = image.GetRow(y);
+		for (unsigned int x = 0; x < image.width; ++x)
+		{
+			ColorRGBA& p = row[x];
+			p.r = (unsigned char)DivideBy255(p.r * p.a);
+			p.g = (unsigned char)DivideBy255(p.g * p.a);
+			p.b = (unsigned char)DivideBy255(p.b * p.a);
+		}
+	}
+}
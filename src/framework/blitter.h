@@ -0,0 +1,62 @@
+/*
+	+ This class draws images into an Image: opaque copies, copies that skip a key colour, and premultiplied-alpha sprites
+	  (RGBAImage), unscaled or scaled to a rectangle with the nearest or the bilinear filter.
+	+ The area drawn is clipped once against both images, then whole rows go through a row kernel: memcpy for opaque copies,
+	  and for the other two CG_SIMD_WIDTH pixels at a time, skipping the runs that are all zero (transparent). The scalar
+	  path uses the same formula and rounding, so both give the same bits for any input.
+	+ Alpha blending is out = src + dst * (255 - alpha) / 255 (rounded, clamped to 255), so the sprite colours must be
+	  premultiplied by their alpha: see PremultiplyAlpha.
+	+ The scaled blits share scratch rows, so they must not be called from several threads at once.
+*/
+
+#pragma once
+
+#include <vector>
+#include "image.h"
+#include "dirtyregion.h"
+
+enum class eBlitFilter {
+	NEAREST,
+	BILINEAR
+};
+
+class Blitter
+{
+public:
+	// Use the vectorized row kernels
+	static bool use_simd;
+
+	// Draws source (or the area of it when given) with its top-left corner at x, y of destination
+	void Copy(const Image& source, Image& destination, int x, int y, const PixelRect* area = nullptr);
+	void CopyColorKey(const Image& source, Image& destination, int x, int y, const Color& key, const PixelRect* area = nullptr);
+	// source must be premultiplied (see PremultiplyAlpha): a pixel with alpha 0 still adds its colour
+	void Blend(const RGBAImage& source, Image& destination, int x, int y, const PixelRect* area = nullptr);
+
+	// Draws the whole source stretched over rect of destination (the colour key is only exact with the nearest filter)
+	void CopyScaled(const Image& source, Image& destination, const PixelRect& rect, eBlitFilter filter = eBlitFilter::BILINEAR,
+		const Color* key = nullptr);
+	// As in Blend, source must be premultiplied
+	void BlendScaled(const RGBAImage& source, Image& destination, const PixelRect& rect, eBlitFilter filter = eBlitFilter::BILINEAR);
+
+	// Blitter used by Image::DrawImage and the toolbar
+	static Blitter* Get();
+
+private:
+	// Source sample of every destination column (or row) of a scaled blit: the first of the two pixels and the 8-bit
+	// weight of the second one
+	struct Samples
+	{
+		std::vector<int> index;
+		std::vector<int> weight;
+	};
+
+	Samples columns;
+	Samples rows;
+	std::vector<unsigned char> scaled_row;
+
+	template <typename Format, typename RowKernel>
+	void DrawScaled(const PixelImage<Format>& source, Image& destination, const PixelRect& rect, eBlitFilter filter, RowKernel kernel);
+};
+
+// Multiplies the colour of every pixel by its alpha (rounded), as Blitter::Blend expects
+void PremultiplyAlpha(RGBAImage& image);
@@ -21,7 +21,7 @@ public:
         BTN_COLOR_YELLOW
     };
 
-    Image* image = nullptr;
+    RGBAImage* image = nullptr;    // Premultiplied alpha
     Vector2 position;
     int width = 0;
     int height = 0;
@@ -29,7 +29,7 @@ public:
 
     Button() = default;
 
-    Button(Image* img, const Vector2& pos, Type t)
+    Button(RGBAImage* img, const Vector2& pos, Type t)
     {
         image = img;
         position = pos;
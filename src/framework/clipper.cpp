@@ -0,0 +1,153 @@
+#include "clipper.h"
+
+#include <algorithm>
+
+const float Clipper::GUARD_BAND = 4.0f;
+
+// Clip planes, the vertex is inside when the distance is >= 0
+enum
+{
+	PLANE_LEFT, PLANE_RIGHT, PLANE_BOTTOM, PLANE_TOP, PLANE_NEAR, PLANE_FAR, NUM_PLANES
+};
+
+static inline float PlaneDistance(int plane, const Vector4& p, float band)
+{
+	switch (plane)
+	{
+	case PLANE_LEFT:	return p.x + band * p.w;
+	case PLANE_RIGHT:	return band * p.w - p.x;
+	case PLANE_BOTTOM:	return p.y + band * p.w;
+	case PLANE_TOP:		return band * p.w - p.y;
+	case PLANE_NEAR:	return p.z + p.w;
+	default:			return p.w - p.z;
+	}
+}
+
+// One bit per plane the vertex is outside of, with the sides pushed out to band
+static inline int OutCode(const Vector4& p, float band)
+{
+	int code = 0;
+	for (int plane = 0; plane < NUM_PLANES; ++plane)
+		if (PlaneDistance(plane, p, band) < 0.0f)
+			code |= 1 << plane;
+	return code;
+}
+
+// One pass of Sutherland-Hodgman, returns the number of vertices left
+static int ClipPolygon(int plane, const ClipVertex* in, int count, ClipVertex* out)
+{
+	int result = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		const ClipVertex& a = in[i];
+		const ClipVertex& b = in[(i + 1) % count];
+		float da = PlaneDistance(plane, a.position, Clipper::GUARD_BAND);
+		float db = PlaneDistance(plane, b.position, Clipper::GUARD_BAND);
+
+		if (da >= 0.0f)
+			out[result++] = a;
+
+		// The edge crosses the plane
+		if ((da >= 0.0f) != (db >= 0.0f))
+		{
+			float t = da / (da - db);
+			ClipVertex& v = out[result++];
+			v.position.x = a.position.x + (b.position.x - a.position.x) * t;
+			v.position.y = a.position.y + (b.position.y - a.position.y) * t;
+			v.position.z = a.position.z + (b.position.z - a.position.z) * t;
+			v.position.w = a.position.w + (b.position.w - a.position.w) * t;
+			v.weights = a.weights + (b.weights - a.weights) * t;
+		}
+	}
+	return result;
+}
+
+int Clipper::ClipTriangle(const Vector4& c0, const Vector4& c1, const Vector4& c2, float width, float height,
+	Vector3* screen, float* inv_w, Vector3* weights)
+{
+	stats.triangles++;
+
+	// Nothing to draw if the three vertices are outside the same side of the screen
+	if (OutCode(c0, 1.0f) & OutCode(c1, 1.0f) & OutCode(c2, 1.0f))
+	{
+		stats.frustum_culled++;
+		return 0;
+	}
+
+	ClipVertex buffers[2][MAX_VERTICES];
+	ClipVertex* polygon = buffers[0];
+	int count = 3;
+	polygon[0].position = c0; polygon[0].weights = Vector3(1, 0, 0);
+	polygon[1].position = c1; polygon[1].weights = Vector3(0, 1, 0);
+	polygon[2].position = c2; polygon[2].weights = Vector3(0, 0, 1);
+
+	// Inside the guard band the triangle goes as it is, otherwise it is clipped against the planes it crosses
+	int crossed = OutCode(c0, GUARD_BAND) | OutCode(c1, GUARD_BAND) | OutCode(c2, GUARD_BAND);
+	if (crossed)
+	{
+		stats.clipped++;
+		for (int plane = 0; plane < NUM_PLANES && count >= 3; ++plane)
+		{
+			if (!(crossed & (1 << plane)))
+				continue;
+			ClipVertex* out = (polygon == buffers[0]) ? buffers[1] : buffers[0];
+			count = ClipPolygon(plane, polygon, count, out);
+			polygon = out;
+		}
+		if (count < 3)
+		{
+			stats.frustum_culled++;
+			return 0;
+		}
+	}
+
+	// Perspective divide and viewport mapping
+	for (int i = 0; i < count; ++i)
+	{
+		const Vector4& p = polygon[i].position;
+		inv_w[i] = 1.0f / p.w;
+		screen[i] = Vector3((p.x * inv_w[i] + 1.0f) * 0.5f * width, (p.y * inv_w[i] + 1.0f) * 0.5f * height, p.z * inv_w[i]);
+		weights[i] = polygon[i].weights;
+	}
+
+	// Clipping keeps the winding, so the signed area of the polygon tells the facing (counter-clockwise is front)
+	float area = 0.0f;
+	for (int i = 0; i < count; ++i)
+	{
+		const Vector3& a = screen[i];
+		const Vector3& b = screen[(i + 1) % count];
+		area += a.x * b.y - b.x * a.y;
+	}
+	if (cull_backfaces && area <= 0.0f)
+	{
+		stats.backface_culled++;
+		return 0;
+	}
+
+	// Pixel bounds of the pixel centers inside the polygon, plus one pixel for the rounding of lines and points
+	float min_x = screen[0].x, max_x = screen[0].x, min_y = screen[0].y, max_y = screen[0].y;
+	for (int i = 1; i < count; ++i)
+	{
+		min_x = std::min(min_x, screen[i].x);
+		max_x = std::max(max_x, screen[i].x);
+		min_y = std::min(min_y, screen[i].y);
+		max_y = std::max(max_y, screen[i].y);
+	}
+	PixelRect rect((int)clamp(floorf(min_x), -1.0f, width) - 1, (int)clamp(floorf(min_y), -1.0f, height) - 1,
+		(int)clamp(floorf(max_x), -1.0f, width) + 2, (int)clamp(floorf(max_y), -1.0f, height) + 2);
+	stats.bounds.Add(rect.Clip((int)width, (int)height));
+
+	return count;
+}
+
+Vector2 Clipper::Interpolate(const Vector3& w, const Vector2& a0, const Vector2& a1, const Vector2& a2)
+{
+	return a0 * w.x + a1 * w.y + a2 * w.z;
+}
+
+Color Clipper::Interpolate(const Vector3& w, const Color& a0, const Color& a1, const Color& a2)
+{
+	return Color(a0.r * w.x + a1.r * w.y + a2.r * w.z,
+		a0.g * w.x + a1.g * w.y + a2.g * w.z,
+		a0.b * w.x + a1.b * w.y + a2.b * w.z);
+}
@@ -0,0 +1,60 @@
+/*
+	+ Primitive assembly: triangles in clip space are tested against the view frustum and clipped with Sutherland-Hodgman before
+	  they are mapped to the screen. Only the near and far planes really need clipping; the sides use a guard band several times
+	  larger than the screen, because the rasterizer already limits the pixels to the framebuffer.
+	+ Clipped vertices keep their barycentric weights in the original triangle so any attribute can be rebuilt from them.
+*/
+
+#pragma once
+
+#include "framework.h"
+#include "dirtyregion.h"
+
+// Counters of the triangles that went through the clipper
+struct ClipStats
+{
+	unsigned int triangles = 0;			// Triangles received
+	unsigned int frustum_culled = 0;	// Completely outside the view frustum
+	unsigned int backface_culled = 0;	// Facing away from the camera
+	unsigned int clipped = 0;			// Crossed the near / far plane or the guard band and were clipped
+	PixelRect bounds;					// Screen pixels the visible polygons may touch
+
+	void Add(const ClipStats& s)
+	{
+		triangles += s.triangles;
+		frustum_culled += s.frustum_culled;
+		backface_culled += s.backface_culled;
+		clipped += s.clipped;
+		bounds.Add(s.bounds);
+	}
+};
+
+struct ClipVertex
+{
+	Vector4 position;	// Clip space
+	Vector3 weights;	// Barycentric weights of the corners of the original triangle
+};
+
+class Clipper
+{
+public:
+	// The x and y guard band in NDC units: vertices up to this many half-screens away are rasterized without clipping
+	static const float GUARD_BAND;
+
+	// Each of the 6 planes can add one vertex to the polygon
+	static const int MAX_VERTICES = 9;
+
+	bool cull_backfaces = true;
+
+	ClipStats stats;
+
+	// Clips a triangle given in clip space and writes the visible part as a convex polygon in screen space
+	// (pixels, and NDC depth in z) with counter-clockwise vertices when it faces the camera, plus the 1/w of each vertex.
+	// Returns the number of vertices written to screen / inv_w / weights (0 when the triangle is culled)
+	int ClipTriangle(const Vector4& c0, const Vector4& c1, const Vector4& c2, float width, float height,
+		Vector3* screen, float* inv_w, Vector3* weights);
+
+	// Attribute of a clipped vertex from its weights
+	static Vector2 Interpolate(const Vector3& w, const Vector2& a0, const Vector2& a1, const Vector2& a2);
+	static Color Interpolate(const Vector3& w, const Color& a0, const Color& a1, const Color& a2);
+};
@@ -0,0 +1,705 @@
+#include "deflate.h"
+
+#include <algorithm>
+#include <string.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Taken by reference by std::min and std::vector::resize
+const int Deflater::MAX_LEVEL;
+const size_t Deflater::WINDOW_SIZE;
+
+static const int MIN_MATCH = 3;
+static const int MAX_MATCH = 258;
+static const int HASH_BITS = 15;
+static const size_t BLOCK_SYMBOLS = 16384;	// Symbols per block, each block gets its own Huffman code
+static const size_t MAX_STORED = 65535;
+
+static const int NUM_LITERALS = 286;
+static const int NUM_FIXED_LITERALS = 288;
+static const int NUM_DISTANCES = 30;
+static const int NUM_CODE_LENGTHS = 19;
+
+// Base and extra bits of the length codes 257 to 285 and of the distance codes 0 to 29
+static const uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const uint8_t CODE_LENGTH_EXTRA[19] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7 };
+static const uint8_t CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// Search effort of every level, as in zlib (levels 1 to 3 match greedily)
+struct LevelParameters
+{
+	int max_chain;
+	int good_length;
+	int nice_length;
+	int lazy_length;
+	int max_insert;
+};
+static const LevelParameters LEVELS[10] = {
+	{ 0, 0, 0, 0, 0 },
+	{ 4, 0, 8, 0, 4 },
+	{ 8, 0, 16, 0, 5 },
+	{ 32, 0, 32, 0, 6 },
+	{ 16, 4, 16, 4, 0 },
+	{ 32, 8, 32, 16, 0 },
+	{ 128, 8, 128, 16, 0 },
+	{ 256, 8, 128, 32, 0 },
+	{ 1024, 32, 258, 128, 0 },
+	{ 4096, 32, 258, 258, 0 }
+};
+
+// Code of every match length and distance, built once (C++11 makes the initialization thread-safe)
+struct CodeTables
+{
+	uint8_t length_code[MAX_MATCH + 1];	// By length, minus 257
+	uint8_t distance_code[512];			// By distance - 1 up to 256, then by 256 + (distance - 1) / 128
+
+	CodeTables()
+	{
+		for (int code = 0; code < 29; ++code)
+			for (int length = LENGTH_BASE[code]; length < LENGTH_BASE[code] + (1 << LENGTH_EXTRA[code]) && length <= MAX_MATCH; ++length)
+				length_code[length] = (uint8_t)code;
+		length_code[MAX_MATCH] = 28;	// 258 has its own code, not 227 + 31
+		for (int code = 0; code < 30; ++code)
+			for (int d = DISTANCE_BASE[code] - 1; d < DISTANCE_BASE[code] - 1 + (1 << DISTANCE_EXTRA[code]); ++d)
+			{
+				if (d < 256)
+					distance_code[d] = (uint8_t)code;
+				else
+					distance_code[256 + (d >> 7)] = (uint8_t)code;
+			}
+	}
+
+	int GetDistanceCode(int distance) const
+	{
+		int d = distance - 1;
+		return d < 256 ? distance_code[d] : distance_code[256 + (d >> 7)];
+	}
+};
+
+static const CodeTables& GetCodeTables()
+{
+	static const CodeTables tables;
+	return tables;
+}
+
+// Huffman code lengths of count symbols with the given frequencies, none longer than max_bits. Too deep trees are built
+// again with flatter frequencies. At least two symbols get a code, as some decoders expect
+static void BuildLengths(const uint32_t* frequencies, int count, int max_bits, unsigned char* lengths)
+{
+	memset(lengths, 0, count);
+
+	int used[NUM_LITERALS];
+	int num_used = 0;
+	for (int i = 0; i < count; ++i)
+		if (frequencies[i])
+			used[num_used++] = i;
+	if (num_used < 2)
+	{
+		lengths[num_used && used[0] == 0 ? 1 : 0] = 1;
+		if (num_used)
+			lengths[used[0]] = 1;
+		else
+			lengths[1] = 1;
+		return;
+	}
+
+	// Two queues: the leaves sorted by weight, and the merged nodes, which come out sorted by themselves
+	uint32_t weights[2 * NUM_LITERALS];
+	int leaves[NUM_LITERALS];
+	int parent[2 * NUM_LITERALS];
+	for (int shift = 0;; ++shift)
+	{
+		memcpy(leaves, used, num_used * sizeof(int));
+		std::sort(leaves, leaves + num_used, [&](int a, int b) {
+			uint32_t wa = shift ? (frequencies[a] >> shift) | 1 : frequencies[a];
+			uint32_t wb = shift ? (frequencies[b] >> shift) | 1 : frequencies[b];
+			return wa < wb || (wa == wb && a < b);
+		});
+		for (int i = 0; i < num_used; ++i)
+			weights[i] = shift ? (frequencies[leaves[i]] >> shift) | 1 : frequencies[leaves[i]];
+
+		int next_leaf = 0, next_node = num_used, num_nodes = num_used;
+		for (int k = 0; k < num_used - 1; ++k)
+		{
+			int children[2];
+			for (int c = 0; c < 2; ++c)
+			{
+				if (next_leaf < num_used && (next_node == num_nodes || weights[next_leaf] <= weights[next_node]))
+					children[c] = next_leaf++;
+				else
+					children[c] = next_node++;
+			}
+			weights[num_nodes] = weights[children[0]] + weights[children[1]];
+			parent[children[0]] = parent[children[1]] = num_nodes;
+			num_nodes++;
+		}
+
+		// Depths from the root (the last node) down, parents are always created after their children
+		int depth[2 * NUM_LITERALS];
+		depth[num_nodes - 1] = 0;
+		int deepest = 0;
+		for (int node = num_nodes - 2; node >= 0; --node)
+		{
+			depth[node] = depth[parent[node]] + 1;
+			deepest = std::max(deepest, depth[node]);
+		}
+		if (deepest > max_bits)
+			continue;
+
+		for (int i = 0; i < num_used; ++i)
+			lengths[leaves[i]] = (unsigned char)depth[i];
+		return;
+	}
+}
+
+// Canonical codes of the lengths, bit-reversed since deflate writes them from the highest bit
+static void BuildCodes(const unsigned char* lengths, int count, uint16_t* codes)
+{
+	int counts[16] = { 0 };
+	for (int i = 0; i < count; ++i)
+		counts[lengths[i]]++;
+	counts[0] = 0;
+
+	int next[16];
+	int code = 0;
+	for (int length = 1; length < 16; ++length)
+	{
+		code = (code + counts[length - 1]) << 1;
+		next[length] = code;
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		int length = lengths[i];
+		if (!length)
+			continue;
+		int value = next[length]++, reversed = 0;
+		for (int b = 0; b < length; ++b)
+			reversed |= ((value >> b) & 1) << (length - 1 - b);
+		codes[i] = (uint16_t)reversed;
+	}
+}
+
+Deflater::Deflater(int level)
+{
+	this->level = std::max(0, std::min(level, MAX_LEVEL));
+	max_chain = LEVELS[this->level].max_chain;
+	good_length = LEVELS[this->level].good_length;
+	nice_length = LEVELS[this->level].nice_length;
+	lazy_length = LEVELS[this->level].lazy_length;
+	max_insert = LEVELS[this->level].max_insert;
+}
+
+inline void Deflater::PutBits(uint32_t value, int n)
+{
+	bits |= (uint64_t)value << count;
+	count += n;
+	if (count >= 32)
+	{
+		unsigned char* next = &(*out)[written];
+		next[0] = (unsigned char)bits;
+		next[1] = (unsigned char)(bits >> 8);
+		next[2] = (unsigned char)(bits >> 16);
+		next[3] = (unsigned char)(bits >> 24);
+		written += 4;
+		bits >>= 32;
+		count -= 32;
+	}
+}
+
+void Deflater::AlignToByte()
+{
+	for (; count > 0; count -= 8)
+	{
+		(*out)[written++] = (unsigned char)bits;
+		bits >>= 8;
+	}
+	bits = 0;
+	count = 0;
+}
+
+void Deflater::Reserve(size_t bytes)
+{
+	// The pending bits are flushed on top of it
+	bytes += 8;
+	if (out->size() < written + bytes)
+		out->resize(std::max(written + bytes, out->size() + out->size() / 2));
+}
+
+void Deflater::PutBytes(const unsigned char* bytes, size_t size)
+{
+	if (size)
+		memcpy(&(*out)[written], bytes, size);
+	written += size;
+}
+
+inline int Deflater::Insert(const unsigned char* base, int position)
+{
+	const unsigned char* p = base + position;
+	uint32_t hash = ((uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2]) * 2654435761u >> (32 - HASH_BITS);
+	int candidate = head[hash];
+	prev[position & (WINDOW_SIZE - 1)] = candidate;
+	head[hash] = position;
+	return candidate;
+}
+
+// Bytes equal at the start of a and b, up to max_length. Whole words are compared, the first differing byte of a word is
+// its lowest set bit (little endian)
+static inline int MatchLength(const unsigned char* a, const unsigned char* b, int max_length)
+{
+	int length = 0;
+	for (; length + 8 <= max_length; length += 8)
+	{
+		uint64_t x, y;
+		memcpy(&x, a + length, 8);
+		memcpy(&y, b + length, 8);
+		if (x != y)
+		{
+#if defined(_MSC_VER) && defined(_M_X64)
+			unsigned long bit;
+			_BitScanForward64(&bit, x ^ y);
+			return length + (int)(bit >> 3);
+#elif defined(__GNUC__)
+			return length + (__builtin_ctzll(x ^ y) >> 3);
+#else
+			break;
+#endif
+		}
+	}
+	while (length < max_length && a[length] == b[length])
+		length++;
+	return length;
+}
+
+inline int Deflater::FindMatch(const unsigned char* base, int position, int candidate, int max_length, int previous_length, int& distance)
+{
+	int shortest = std::max(MIN_MATCH - 1, previous_length);
+	if (shortest >= max_length)
+		return 0;
+
+	// The slot of the position itself was just overwritten, so the chain stops one byte short of the whole window
+	const unsigned char* current = base + position;
+	int oldest = std::max(position - (int)WINDOW_SIZE + 1, 0);
+	int best = shortest;
+	int nice = std::min(nice_length, max_length);
+	int chain = previous_length >= good_length && good_length ? max_chain >> 2 : max_chain;
+	uint16_t start, end;
+	memcpy(&start, current, 2);
+	memcpy(&end, current + best - 1, 2);
+	for (; candidate >= oldest; candidate = prev[candidate & (WINDOW_SIZE - 1)])
+	{
+		// The last byte of the best match and the one that would make it longer first, they reject most candidates
+		const unsigned char* match = base + candidate;
+		uint16_t match_start, match_end;
+		memcpy(&match_end, match + best - 1, 2);
+		memcpy(&match_start, match, 2);
+		if (match_end == end && match_start == start)
+		{
+			int length = MatchLength(match, current, max_length);
+			if (length > best)
+			{
+				best = length;
+				distance = position - candidate;
+				if (length >= nice)
+					break;
+				memcpy(&end, current + best - 1, 2);
+			}
+		}
+		if (--chain == 0)
+			break;
+	}
+	return best > shortest ? best : 0;
+}
+
+void Deflater::AddLiteral(unsigned char literal)
+{
+	Symbol symbol = { literal, 0, 0, 0 };
+	symbols.push_back(symbol);
+}
+
+void Deflater::AddMatch(int length, int distance)
+{
+	const CodeTables& tables = GetCodeTables();
+	int code = tables.length_code[length];
+	int distance_code = tables.GetDistanceCode(distance);
+	Symbol symbol = { (uint16_t)(257 + code), (uint16_t)distance_code, (uint16_t)(length - LENGTH_BASE[code]),
+		(uint16_t)(distance - DISTANCE_BASE[distance_code]) };
+	symbols.push_back(symbol);
+}
+
+void Deflater::Compress(const unsigned char* data, size_t size, size_t dictionary_size, bool last, std::vector<unsigned char>& out)
+{
+	this->out = &out;
+	written = out.size();
+	bits = 0;
+	count = 0;
+	out.reserve(out.size() + size + size / 16 + 64);
+
+	if (level == 0)
+		WriteStored(data, size, last);
+	else
+	{
+		// Positions are counted from the start of the dictionary
+		dictionary_size = std::min(dictionary_size, WINDOW_SIZE);
+		const unsigned char* base = data - dictionary_size;
+		int start = (int)dictionary_size, end = (int)(dictionary_size + size);
+
+		head.assign((size_t)1 << HASH_BITS, -1);
+		prev.resize(WINDOW_SIZE);
+		symbols.clear();
+
+		// Positions up to last_hashed have MIN_MATCH bytes, the ones after it can only be literals
+		int last_hashed = end - MIN_MATCH;
+		for (int p = 0; p < std::min(start, last_hashed + 1); ++p)
+			Insert(base, p);
+
+		// Bytes before emitted are in symbols, the ones from block_start go to the next block
+		int block_start = start, emitted = start;
+		int p = start;
+		if (!lazy_length)
+		{
+			while (p <= last_hashed)
+			{
+				int distance = 0;
+				int length = FindMatch(base, p, Insert(base, p), std::min(MAX_MATCH, end - p), 0, distance);
+				if (length)
+				{
+					AddMatch(length, distance);
+					if (length <= max_insert)
+						for (int q = p + 1, stop = std::min(p + length, last_hashed + 1); q < stop; ++q)
+							Insert(base, q);
+					p += length;
+				}
+				else
+					AddLiteral(base[p++]);
+				emitted = p;
+
+				if (symbols.size() >= BLOCK_SYMBOLS)
+				{
+					WriteBlock(base + block_start, emitted - block_start, false);
+					block_start = emitted;
+				}
+			}
+		}
+		else
+		{
+			// The match found at a position is kept until the next one shows it is not beaten by a longer one
+			bool has_previous = false;
+			int previous_length = 0, previous_distance = 0;
+			while (p <= last_hashed)
+			{
+				int candidate = Insert(base, p);
+				int distance = 0, length = 0;
+				if (!has_previous || previous_length < lazy_length)
+					length = FindMatch(base, p, candidate, std::min(MAX_MATCH, end - p), has_previous ? previous_length : 0, distance);
+
+				if (has_previous && previous_length && length <= previous_length)
+				{
+					AddMatch(previous_length, previous_distance);
+					int match_end = p - 1 + previous_length;
+					for (int q = p + 1, stop = std::min(match_end, last_hashed + 1); q < stop; ++q)
+						Insert(base, q);
+					p = match_end;
+					emitted = p;
+					has_previous = false;
+				}
+				else
+				{
+					if (has_previous)
+					{
+						AddLiteral(base[p - 1]);
+						emitted = p;
+					}
+					has_previous = true;
+					previous_length = length;
+					previous_distance = distance;
+					p++;
+				}
+
+				if (symbols.size() >= BLOCK_SYMBOLS)
+				{
+					WriteBlock(base + block_start, emitted - block_start, false);
+					block_start = emitted;
+				}
+			}
+			if (has_previous)
+			{
+				if (previous_length)
+				{
+					AddMatch(previous_length, previous_distance);
+					p += previous_length - 1;
+				}
+				else
+					AddLiteral(base[p - 1]);
+			}
+		}
+
+		// The last bytes, too few for a match
+		for (; p < end; ++p)
+			AddLiteral(base[p]);
+		WriteBlock(base + block_start, end - block_start, last);
+	}
+
+	// Byte aligned: after the last block, or with an empty stored block (a sync flush) when more pieces follow
+	Reserve(8);
+	if (!last)
+	{
+		PutBits(0, 3);
+		AlignToByte();
+		const unsigned char empty[4] = { 0, 0, 0xff, 0xff };
+		PutBytes(empty, 4);
+	}
+	AlignToByte();
+	out.resize(written);
+	symbols.clear();
+}
+
+void Deflater::WriteStored(const unsigned char* block, size_t size, bool last)
+{
+	do
+	{
+		size_t n = std::min(size, MAX_STORED);
+		Reserve(n + 5);
+		PutBits(last && n == size ? 1 : 0, 1);
+		PutBits(0, 2);
+		AlignToByte();
+		const unsigned char header[4] = { (unsigned char)n, (unsigned char)(n >> 8), (unsigned char)~n, (unsigned char)(~n >> 8) };
+		PutBytes(header, 4);
+		PutBytes(block, n);
+		block += n;
+		size -= n;
+	} while (size);
+}
+
+void Deflater::WriteBlock(const unsigned char* block, size_t size, bool last)
+{
+	uint32_t literal_frequencies[NUM_LITERALS] = { 0 };
+	uint32_t distance_frequencies[NUM_DISTANCES] = { 0 };
+	uint64_t extra_bits = 0;
+	for (size_t i = 0; i < symbols.size(); ++i)
+	{
+		const Symbol& symbol = symbols[i];
+		literal_frequencies[symbol.code]++;
+		if (symbol.code > 256)
+		{
+			distance_frequencies[symbol.distance_code]++;
+			extra_bits += LENGTH_EXTRA[symbol.code - 257] + DISTANCE_EXTRA[symbol.distance_code];
+		}
+	}
+	literal_frequencies[256] = 1;
+
+	// The fixed code has 288 literal codes (the last two are never used), all of them count for the canonical codes
+	unsigned char literal_lengths[NUM_FIXED_LITERALS], distance_lengths[NUM_DISTANCES];
+	BuildLengths(literal_frequencies, NUM_LITERALS, 15, literal_lengths);
+	BuildLengths(distance_frequencies, NUM_DISTANCES, 15, distance_lengths);
+
+	int num_literals = NUM_LITERALS, num_distances = NUM_DISTANCES;
+	while (num_literals > 257 && !literal_lengths[num_literals - 1])
+		num_literals--;
+	while (num_distances > 1 && !distance_lengths[num_distances - 1])
+		num_distances--;
+
+	// Both sets of lengths in a row, with runs of zeros (17 and 18) and repeats of the previous length (16)
+	unsigned char all_lengths[NUM_LITERALS + NUM_DISTANCES];
+	memcpy(all_lengths, literal_lengths, num_literals);
+	memcpy(all_lengths + num_literals, distance_lengths, num_distances);
+	int total = num_literals + num_distances;
+	uint8_t runs[NUM_LITERALS + NUM_DISTANCES], run_extra[NUM_LITERALS + NUM_DISTANCES];
+	int num_runs = 0;
+	uint32_t code_length_frequencies[NUM_CODE_LENGTHS] = { 0 };
+	for (int i = 0; i < total;)
+	{
+		int value = all_lengths[i], run = 1;
+		while (i + run < total && all_lengths[i + run] == value)
+			run++;
+		i += run;
+
+		if (!value)
+		{
+			for (; run >= 11; run -= std::min(run, 138))
+			{
+				runs[num_runs] = 18;
+				run_extra[num_runs++] = (uint8_t)(std::min(run, 138) - 11);
+			}
+			for (; run >= 3; run -= std::min(run, 10))
+			{
+				runs[num_runs] = 17;
+				run_extra[num_runs++] = (uint8_t)(std::min(run, 10) - 3);
+			}
+		}
+		else
+		{
+			runs[num_runs] = (uint8_t)value;
+			run_extra[num_runs++] = 0;
+			run--;
+			for (; run >= 3; run -= std::min(run, 6))
+			{
+				runs[num_runs] = 16;
+				run_extra[num_runs++] = (uint8_t)(std::min(run, 6) - 3);
+			}
+		}
+		for (; run > 0; --run)
+		{
+			runs[num_runs] = (uint8_t)value;
+			run_extra[num_runs++] = 0;
+		}
+	}
+	for (int i = 0; i < num_runs; ++i)
+		code_length_frequencies[runs[i]]++;
+
+	unsigned char code_length_lengths[NUM_CODE_LENGTHS];
+	BuildLengths(code_length_frequencies, NUM_CODE_LENGTHS, 7, code_length_lengths);
+	int num_code_lengths = NUM_CODE_LENGTHS;
+	while (num_code_lengths > 4 && !code_length_lengths[CODE_LENGTH_ORDER[num_code_lengths - 1]])
+		num_code_lengths--;
+
+	// Size of the block with each kind of code, in bits
+	uint64_t dynamic_bits = 3 + 14 + 3 * num_code_lengths + extra_bits;
+	for (int i = 0; i < NUM_CODE_LENGTHS; ++i)
+		dynamic_bits += code_length_frequencies[i] * (uint64_t)(code_length_lengths[i] + CODE_LENGTH_EXTRA[i]);
+	uint64_t fixed_bits = 3 + extra_bits;
+	for (int i = 0; i < NUM_LITERALS; ++i)
+	{
+		dynamic_bits += literal_frequencies[i] * (uint64_t)literal_lengths[i];
+		fixed_bits += literal_frequencies[i] * (uint64_t)(i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8);
+	}
+	for (int i = 0; i < NUM_DISTANCES; ++i)
+	{
+		dynamic_bits += distance_frequencies[i] * (uint64_t)distance_lengths[i];
+		fixed_bits += distance_frequencies[i] * 5;
+	}
+	uint64_t stored_bits = (size + 5 * (size / MAX_STORED + 1)) * 8 + 7;
+
+	if (stored_bits < std::min(dynamic_bits, fixed_bits))
+	{
+		WriteStored(block, size, last);
+		symbols.clear();
+		return;
+	}
+
+	bool fixed = fixed_bits <= dynamic_bits;
+	Reserve((size_t)((fixed ? fixed_bits : dynamic_bits) + 7) / 8);
+	if (fixed)
+	{
+		memset(literal_lengths, 8, 144);
+		memset(literal_lengths + 144, 9, 112);
+		memset(literal_lengths + 256, 7, 24);
+		memset(literal_lengths + 280, 8, NUM_FIXED_LITERALS - 280);
+		memset(distance_lengths, 5, NUM_DISTANCES);
+	}
+	uint16_t literal_codes[NUM_FIXED_LITERALS], distance_codes[NUM_DISTANCES];
+	BuildCodes(literal_lengths, fixed ? NUM_FIXED_LITERALS : NUM_LITERALS, literal_codes);
+	BuildCodes(distance_lengths, NUM_DISTANCES, distance_codes);
+
+	PutBits(last ? 1 : 0, 1);
+	PutBits(fixed ? 1 : 2, 2);
+	if (!fixed)
+	{
+		uint16_t code_length_codes[NUM_CODE_LENGTHS];
+		BuildCodes(code_length_lengths, NUM_CODE_LENGTHS, code_length_codes);
+		PutBits(num_literals - 257, 5);
+		PutBits(num_distances - 1, 5);
+		PutBits(num_code_lengths - 4, 4);
+		for (int i = 0; i < num_code_lengths; ++i)
+			PutBits(code_length_lengths[CODE_LENGTH_ORDER[i]], 3);
+		for (int i = 0; i < num_runs; ++i)
+		{
+			PutBits(code_length_codes[runs[i]], code_length_lengths[runs[i]]);
+			if (runs[i] >= 16)
+				PutBits(run_extra[i], CODE_LENGTH_EXTRA[runs[i]]);
+		}
+	}
+
+	for (size_t i = 0; i < symbols.size(); ++i)
+	{
+		const Symbol& symbol = symbols[i];
+		PutBits(literal_codes[symbol.code], literal_lengths[symbol.code]);
+		if (symbol.code > 256)
+		{
+			PutBits(symbol.extra, LENGTH_EXTRA[symbol.code - 257]);
+			PutBits(distance_codes[symbol.distance_code], distance_lengths[symbol.distance_code]);
+			PutBits(symbol.distance_extra, DISTANCE_EXTRA[symbol.distance_code]);
+		}
+	}
+	PutBits(literal_codes[256], literal_lengths[256]);
+	symbols.clear();
+}
+
+uint32_t Adler32(uint32_t adler, const unsigned char* data, size_t size)
+{
+	const uint32_t BASE = 65521;
+	const size_t NMAX = 5552;	// Most bytes before the sums may overflow 32 bits
+	uint32_t a = adler & 0xffff, b = adler >> 16;
+	while (size)
+	{
+		size_t n = std::min(size, NMAX);
+		size -= n;
+		for (; n; --n)
+		{
+			a += *data++;
+			b += a;
+		}
+		a %= BASE;
+		b %= BASE;
+	}
+	return b << 16 | a;
+}
+
+uint32_t Adler32Combine(uint32_t first, uint32_t second, size_t second_size)
+{
+	// From zlib: the sum of the second piece is offset by the first sum once per byte of the second piece
+	const uint32_t BASE = 65521;
+	uint32_t remainder = (uint32_t)(second_size % BASE);
+	uint32_t a = first & 0xffff;
+	uint32_t b = (remainder * a) % BASE;
+	a += (second & 0xffff) + BASE - 1;
+	b += (first >> 16) + (second >> 16) + BASE - remainder;
+	if (a >= BASE)
+		a -= BASE;
+	if (a >= BASE)
+		a -= BASE;
+	if (b >= BASE << 1)
+		b -= BASE << 1;
+	if (b >= BASE)
+		b -= BASE;
+	return b << 16 | a;
+}
+
+uint32_t Crc32(uint32_t crc, const unsigned char* data, size_t size)
+{
+	// Slicing by 8: entries[k][b] is the CRC of byte b followed by k zero bytes, so 8 bytes take 8 independent lookups
+	struct CrcTable
+	{
+		uint32_t entries[8][256];
+		CrcTable()
+		{
+			for (uint32_t i = 0; i < 256; ++i)
+			{
+				uint32_t c = i;
+				for (int k = 0; k < 8; ++k)
+					c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				entries[0][i] = c;
+			}
+			for (int k = 1; k < 8; ++k)
+				for (uint32_t i = 0; i < 256; ++i)
+					entries[k][i] = entries[0][entries[k - 1][i] & 0xff] ^ (entries[k - 1][i] >> 8);
+		}
+	};
+	static const CrcTable table;
+
+	crc = ~crc;
+	for (; size >= 8; size -= 8, data += 8)
+	{
+		uint32_t low = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+		crc = table.entries[7][low & 0xff] ^ table.entries[6][(low >> 8) & 0xff] ^ table.entries[5][(low >> 16) & 0xff] ^
+			table.entries[4][low >> 24] ^ table.entries[3][data[4]] ^ table.entries[2][data[5]] ^ table.entries[1][data[6]] ^
+			table.entries[0][data[7]];
+	}
+	for (; size; --size)
+		crc = table.entries[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
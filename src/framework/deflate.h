@@ -0,0 +1,81 @@
+/*
+	+ This class compresses bytes with deflate (RFC 1951), the format inside zlib streams and PNG files.
+	+ Matches are found with hash chains over the last 32 KB; the level sets how far the chains are followed and whether a
+	  match is deferred when the next byte starts a longer one (lazy matching, from level 4), as in zlib. Every block is
+	  written with the smallest of a dynamic Huffman code (limited to 15 bits), the fixed one, or no compression.
+	+ A stream can be compressed in independent pieces, one per thread (like pigz): every piece is primed with the end of
+	  the previous one as a dictionary, and all but the last end with an empty stored block so they are byte aligned and
+	  can be concatenated. The Adler-32 of the whole stream is combined from the ones of the pieces.
+*/
+
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+class Deflater
+{
+public:
+	static const int MAX_LEVEL = 9;
+	static const size_t WINDOW_SIZE = 32768;	// Farthest back a match can start, and so the most useful dictionary
+
+	// 0 only stores the bytes, 1 is the fastest and 9 the smallest
+	Deflater(int level = 6);
+
+	// Compresses size bytes at data and appends them to out. The dictionary_size bytes right before data are only searched
+	// for matches. last ends the stream, otherwise the output ends byte aligned so the next piece can follow
+	void Compress(const unsigned char* data, size_t size, size_t dictionary_size, bool last, std::vector<unsigned char>& out);
+
+private:
+	// Literal (0-255), end of block (256) or length code (257-285) with its distance code, plus their extra bits
+	struct Symbol
+	{
+		uint16_t code;
+		uint16_t distance_code;
+		uint16_t extra;
+		uint16_t distance_extra;
+	};
+
+	int level;
+	int max_chain;		// Candidates tried per position
+	int good_length;	// The chain is cut to a quarter when the deferred match is already this long
+	int nice_length;	// A match this long ends the search
+	int lazy_length;	// Shorter matches are deferred when the next position has a longer one, 0 for greedy matching
+	int max_insert;		// Greedy matching only hashes the positions inside matches up to this long
+
+	std::vector<int> head;	// Last position of every hash
+	std::vector<int> prev;	// Previous position with the same hash, by position modulo the window (older ones are never followed)
+	std::vector<Symbol> symbols;
+
+	// Output bits, the lowest ones first. They go to out from written on, in room made beforehand by Reserve, and out is cut
+	// to the bytes written at the end of Compress
+	std::vector<unsigned char>* out = nullptr;
+	size_t written = 0;
+	uint64_t bits = 0;
+	int count = 0;
+
+	inline void PutBits(uint32_t value, int n);
+	void AlignToByte();
+	void Reserve(size_t bytes);
+	void PutBytes(const unsigned char* bytes, size_t size);
+
+	// Longest match at position, up to max_length, that is longer than previous_length (0 if none), as far back as
+	// distance. The hash chain is followed from candidate
+	inline int FindMatch(const unsigned char* base, int position, int candidate, int max_length, int previous_length, int& distance);
+	// Adds position to the chain of its hash and returns the position that was at the head (-1 if none). It needs
+	// MIN_MATCH bytes at position
+	inline int Insert(const unsigned char* base, int position);
+	void AddLiteral(unsigned char literal);
+	void AddMatch(int length, int distance);
+
+	void WriteBlock(const unsigned char* block, size_t size, bool last);
+	void WriteStored(const unsigned char* block, size_t size, bool last);
+};
+
+// Checksums of zlib streams and PNG chunks, updated with the next size bytes
+uint32_t Adler32(uint32_t adler, const unsigned char* data, size_t size);
+uint32_t Crc32(uint32_t crc, const unsigned char* data, size_t size);
+
+// Adler-32 of two pieces one after the other, from the ones of each piece and the size of the second
+uint32_t Adler32Combine(uint32_t first, uint32_t second, size_t second_size);
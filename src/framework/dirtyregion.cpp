@@ -0,0 +1,72 @@
+#include "dirtyregion.h"
+
+#include <algorithm>
+
+void PixelRect::Add(const PixelRect& r)
+{
+	if (r.IsEmpty())
+		return;
+	if (IsEmpty())
+	{
+		*this = r;
+		return;
+	}
+	x0 = std::min(x0, r.x0);
+	y0 = std::min(y0, r.y0);
+	x1 = std::max(x1, r.x1);
+	y1 = std::max(y1, r.y1);
+}
+
+PixelRect PixelRect::Clip(int width, int height) const
+{
+	PixelRect r(std::max(x0, 0), std::max(y0, 0), std::min(x1, width), std::min(y1, height));
+	return r.IsEmpty() ? PixelRect() : r;
+}
+
+void DirtyRegion::Add(const PixelRect& rect)
+{
+	if (rect.IsEmpty())
+		return;
+
+	// Absorb every rectangle it overlaps; the merged one can now reach others, so start over until none is left
+	PixelRect merged = rect;
+	bool found = true;
+	while (found)
+	{
+		found = false;
+		for (size_t i = 0; i < rects.size(); ++i)
+		{
+			if (merged.Intersects(rects[i]))
+			{
+				merged.Add(rects[i]);
+				rects[i] = rects.back();
+				rects.pop_back();
+				found = true;
+				break;
+			}
+		}
+	}
+	rects.push_back(merged);
+
+	if (rects.size() > MAX_RECTS)
+	{
+		PixelRect bounds;
+		for (size_t i = 0; i < rects.size(); ++i)
+			bounds.Add(rects[i]);
+		rects.assign(1, bounds);
+	}
+}
+
+void DirtyRegion::Add(const DirtyRegion& region)
+{
+	for (size_t i = 0; i < region.rects.size(); ++i)
+		Add(region.rects[i]);
+}
+
+unsigned int DirtyRegion::GetArea() const
+{
+	unsigned int area = 0;
+	for (size_t i = 0; i < rects.size(); ++i)
+		area += rects[i].GetArea();
+	return area;
+}
@@ -0,0 +1,50 @@
+/*
+	+ Rectangles of pixels that changed and have to be composited again. The application keeps one per layer (canvas, 3D scene,
+	  tool preview) and only copies the union of them into the framebuffer, so the cost of a frame follows the changed area.
+	+ Overlapping rectangles are merged so no pixel is copied twice; past a few rectangles they collapse into their bounds.
+*/
+
+#pragma once
+
+#include <vector>
+
+// Pixels [x0, x1) x [y0, y1), empty when x0 >= x1 or y0 >= y1
+struct PixelRect
+{
+	int x0 = 0;
+	int y0 = 0;
+	int x1 = 0;
+	int y1 = 0;
+
+	PixelRect() {}
+	PixelRect(int x0, int y0, int x1, int y1) : x0(x0), y0(y0), x1(x1), y1(y1) {}
+
+	bool IsEmpty() const { return x0 >= x1 || y0 >= y1; }
+	int GetWidth() const { return IsEmpty() ? 0 : x1 - x0; }
+	int GetHeight() const { return IsEmpty() ? 0 : y1 - y0; }
+	unsigned int GetArea() const { return (unsigned int)GetWidth() * (unsigned int)GetHeight(); }
+
+	bool Intersects(const PixelRect& r) const { return !IsEmpty() && !r.IsEmpty() && x0 < r.x1 && r.x0 < x1 && y0 < r.y1 && r.y0 < y1; }
+
+	// Grows to contain r
+	void Add(const PixelRect& r);
+
+	// The part inside a width x height image
+	PixelRect Clip(int width, int height) const;
+};
+
+class DirtyRegion
+{
+public:
+	// Past this many rectangles, the bookkeeping costs more than copying their bounds
+	static const int MAX_RECTS = 8;
+
+	std::vector<PixelRect> rects;
+
+	void Add(const PixelRect& rect);
+	void Add(const DirtyRegion& region);
+	void Clear() { rects.clear(); }
+
+	bool IsEmpty() const { return rects.empty(); }
+	unsigned int GetArea() const;
+};
@@ -2,6 +2,62 @@
 #include "mesh.h"
 #include "camera.h"
 #include "image.h"
+#include "rasterizer.h"
+#include "vertexstage.h"
+#include <algorithm>
+
+// Edges of a WIREFRAME render, drawn in one batch (kept between renders so they are not allocated every frame)
+static std::vector<LineSegment> wireframe_lines;
+
+// Triangle fan over a clipped polygon, the colors and texture coordinates are rebuilt from the weights of each vertex
+static void DrawPolygon(const Vector3* screen, const float* inv_w, const Vector3* weights, int count,
+    bool use_interpolation, const Vector2* corner_uvs, FloatImage* zBuffer, Image* texture,
+    Image* framebuffer, Rasterizer* rasterizer)
+{
+    // Setup Colors for interpolation (Task C)
+    Color c0, c1, c2;
+    if (use_interpolation) {
+        c0 = Color::RED; c1 = Color::GREEN; c2 = Color::BLUE;
+    }
+    else {
+        c0 = Color::WHITE; c1 = Color::WHITE; c2 = Color::WHITE;
+    }
+
+    Color colors[Clipper::MAX_VERTICES];
+    Vector2 texcoords[Clipper::MAX_VERTICES];
+    for (int j = 0; j < count; ++j)
+    {
+        colors[j] = Clipper::Interpolate(weights[j], c0, c1, c2);
+        texcoords[j] = Clipper::Interpolate(weights[j], corner_uvs[0], corner_uvs[1], corner_uvs[2]);
+    }
+
+    for (int j = 1; j + 1 < count; ++j)
+    {
+        // 1/w of the corners, for perspective-correct texture coordinates
+        float fan_inv_w[3] = { inv_w[0], inv_w[j], inv_w[j + 1] };
+
+        if (rasterizer)
+        {
+            rasterizer->AddTriangle(
+                screen[0], screen[j], screen[j + 1],
+                colors[0], colors[j], colors[j + 1],
+                zBuffer, texture,
+                texcoords[0], texcoords[j], texcoords[j + 1],
+                fan_inv_w
+            );
+            continue;
+        }
+
+        framebuffer->DrawTriangleInterpolated(
+            screen[0], screen[j], screen[j + 1],
+            colors[0], colors[j], colors[j + 1], // Pass configured colors
+            zBuffer,  // 'Z' key toggles this
+            texture, // 'T' key toggles this
+            texcoords[0], texcoords[j], texcoords[j + 1],
+            fan_inv_w
+        );
+    }
+}
 
 Entity::Entity()
     : mesh(nullptr), model(), base_position(0, 0, 0),
@@ -13,10 +69,14 @@ Entity::~Entity()
 {
 }
 
-void Entity::Render(Image* framebuffer, Camera* camera, FloatImage* zBuffer)
+void Entity::Render(Image* framebuffer, Camera* camera, FloatImage* zBuffer, Rasterizer* rasterizer)
 {
     if (!framebuffer || !camera || !mesh) return;
 
+    // Lines and points are drawn immediately, so the queued triangles have to land first
+    if (rasterizer && (mode == eRenderMode::WIREFRAME || mode == eRenderMode::POINTCLOUD))
+        rasterizer->Flush();
+
     const std::vector<Vector3>& vertices = mesh->GetVertices();
     const std::vector<Vector2>& uvs = mesh->GetUVs();
 
@@ -25,64 +85,135 @@ void Entity::Render(Image* framebuffer, Camera* camera, FloatImage* zBuffer)
     float width = (float)framebuffer->width;
     float height = (float)framebuffer->height;
 
-    for (size_t i = 0; i + 2 < vertices.size(); i += 3)
-    {
-        Vector3 v0 = model * vertices[i];
-        Vector3 v1 = model * vertices[i + 1];
-        Vector3 v2 = model * vertices[i + 2];
+    clipper.stats = ClipStats();
 
-        Vector3 p0 = camera->ProjectVector(v0);
-        Vector3 p1 = camera->ProjectVector(v1);
-        Vector3 p2 = camera->ProjectVector(v2);
+    // All the vertices to clip space at once, with model and view-projection folded into one matrix
+    VertexStage* stage = VertexStage::Get();
+    stage->Transform(camera->viewprojection_matrix * model, vertices);
 
-        if (p0.x < -1.0f || p0.x > 1.0f || p0.y < -1.0f || p0.y > 1.0f || p0.z < 0.0f || p0.z > 1.0f ||
-            p1.x < -1.0f || p1.x > 1.0f || p1.y < -1.0f || p1.y > 1.0f || p1.z < 0.0f || p1.z > 1.0f ||
-            p2.x < -1.0f || p2.x > 1.0f || p2.y < -1.0f || p2.y > 1.0f || p2.z < 0.0f || p2.z > 1.0f)
-            continue;
+    Vector3 screen[Clipper::MAX_VERTICES];
+    float inv_w[Clipper::MAX_VERTICES];
+    Vector3 weights[Clipper::MAX_VERTICES];
+
+    wireframe_lines.clear();
 
-        Vector2 s0((p0.x + 1.0f) * 0.5f * width, (p0.y + 1.0f) * 0.5f * height);
-        Vector2 s1((p1.x + 1.0f) * 0.5f * width, (p1.y + 1.0f) * 0.5f * height);
-        Vector2 s2((p2.x + 1.0f) * 0.5f * width, (p2.y + 1.0f) * 0.5f * height);
+    for (size_t i = 0; i + 2 < vertices.size(); i += 3)
+    {
+        // Clip space, the perspective divide is done by the clipper
+        Vector4 c0 = stage->GetClipPosition(i);
+        Vector4 c1 = stage->GetClipPosition(i + 1);
+        Vector4 c2 = stage->GetClipPosition(i + 2);
+
+        // Culled, or the visible part as a convex polygon in screen space
+        int count = clipper.ClipTriangle(c0, c1, c2, width, height, screen, inv_w, weights);
+        if (count == 0)
+            continue;
 
         // --- RENDER MODES ---
 
         if (mode == eRenderMode::WIREFRAME)
         {
-            // Draw lines for wireframe
-            framebuffer->DrawLineDDA((int)s0.x, (int)s0.y, (int)s1.x, (int)s1.y, Color::WHITE);
-            framebuffer->DrawLineDDA((int)s1.x, (int)s1.y, (int)s2.x, (int)s2.y, Color::WHITE);
-            framebuffer->DrawLineDDA((int)s2.x, (int)s2.y, (int)s0.x, (int)s0.y, Color::WHITE);
+            // Edges of the clipped polygon, drawn after the loop
+            for (int j = 0; j < count; ++j)
+            {
+                const Vector3& a = screen[j];
+                const Vector3& b = screen[(j + 1) % count];
+                wireframe_lines.push_back(LineSegment(a.x, a.y, b.x, b.y));
+            }
         }
         else if (mode == eRenderMode::POINTCLOUD)
         {
-            framebuffer->SetPixel((int)s0.x, (int)s0.y, Color::WHITE);
-            framebuffer->SetPixel((int)s1.x, (int)s1.y, Color::WHITE);
-            framebuffer->SetPixel((int)s2.x, (int)s2.y, Color::WHITE);
+            for (int j = 0; j < count; ++j)
+                framebuffer->SetPixel((int)screen[j].x, (int)screen[j].y, Color::WHITE);
         }
         else // TRIANGLES_INTERPOLATED
         {
-            Vector2 uv0 = uvs[i];
-            Vector2 uv1 = uvs[i + 1];
-            Vector2 uv2 = uvs[i + 2];
-
-            // Setup Colors for interpolation (Task C)
-            Color c0, c1, c2;
-            if (use_interpolation) {
-                c0 = Color::RED; c1 = Color::GREEN; c2 = Color::BLUE;
-            }
-            else {
-                c0 = Color::WHITE; c1 = Color::WHITE; c2 = Color::WHITE;
+            Vector2 corner_uvs[3] = { uvs[i], uvs[i + 1], uvs[i + 2] };
+            DrawPolygon(screen, inv_w, weights, count, use_interpolation, corner_uvs,
+                use_zbuffer ? zBuffer : nullptr, use_texture ? this->texture : nullptr, framebuffer, rasterizer);
+        }
+    }
+
+    if (!wireframe_lines.empty())
+        framebuffer->DrawLines(wireframe_lines.data(), (int)wireframe_lines.size(), Color::WHITE, antialias_lines);
+}
+
+MeshInstance Entity::GetInstance()
+{
+    clipper.stats = ClipStats();
+
+    MeshInstance instance;
+    instance.model = model;
+    instance.texture = texture;
+    instance.use_texture = use_texture;
+    instance.use_zbuffer = use_zbuffer;
+    instance.use_interpolation = use_interpolation;
+    instance.cull_backfaces = clipper.cull_backfaces;
+    instance.stats = &clipper.stats;
+    return instance;
+}
+
+// Instances transformed together, at most BATCH_VERTICES clip positions at a time so a batch of a large mesh stays a few MB
+static const int INSTANCE_BATCH = 16;
+static const int BATCH_VERTICES = 1 << 18;
+
+void Entity::RenderInstances(Mesh* mesh, const MeshInstance* instances, int count,
+    Image* framebuffer, Camera* camera, FloatImage* zBuffer, Rasterizer* rasterizer)
+{
+    if (!framebuffer || !camera || !mesh || !instances || count <= 0) return;
+
+    const std::vector<Vector3>& vertices = mesh->GetVertices();
+    const std::vector<Vector2>& uvs = mesh->GetUVs();
+
+    int num_vertices = (int)vertices.size() / 3 * 3;
+    if (num_vertices < 3) return;
+
+    float width = (float)framebuffer->width;
+    float height = (float)framebuffer->height;
+
+    VertexStage* stage = VertexStage::Get();
+    int max_batch = std::max(1, std::min(INSTANCE_BATCH, BATCH_VERTICES / num_vertices));
+
+    Matrix44 mvps[INSTANCE_BATCH];
+    Clipper clipper;
+
+    Vector3 screen[Clipper::MAX_VERTICES];
+    float inv_w[Clipper::MAX_VERTICES];
+    Vector3 weights[Clipper::MAX_VERTICES];
+
+    for (int first = 0; first < count; first += max_batch)
+    {
+        int batch = std::min(max_batch, count - first);
+        for (int k = 0; k < batch; ++k)
+            mvps[k] = camera->viewprojection_matrix * instances[first + k].model;
+
+        stage->TransformInstances(mvps, batch, &vertices[0], num_vertices);
+
+        // Each instance is drawn whole, in the order given, so the triangles reach the z buffer as with one Render per copy
+        for (int k = 0; k < batch; ++k)
+        {
+            const MeshInstance& instance = instances[first + k];
+            clipper.stats = ClipStats();
+            clipper.cull_backfaces = instance.cull_backfaces;
+
+            for (int i = 0; i < num_vertices; i += 3)
+            {
+                Vector4 c0 = stage->GetClipPosition(k, i);
+                Vector4 c1 = stage->GetClipPosition(k, i + 1);
+                Vector4 c2 = stage->GetClipPosition(k, i + 2);
+
+                int n = clipper.ClipTriangle(c0, c1, c2, width, height, screen, inv_w, weights);
+                if (n == 0)
+                    continue;
+
+                Vector2 corner_uvs[3] = { uvs[i], uvs[i + 1], uvs[i + 2] };
+                DrawPolygon(screen, inv_w, weights, n, instance.use_interpolation, corner_uvs,
+                    instance.use_zbuffer ? zBuffer : nullptr, instance.use_texture ? instance.texture : nullptr,
+                    framebuffer, rasterizer);
             }
 
-            framebuffer->DrawTriangleInterpolated(
-                Vector3(s0.x, s0.y, p0.z),
-                Vector3(s1.x, s1.y, p1.z),
-                Vector3(s2.x, s2.y, p2.z),
-                c0, c1, c2, // Pass configured colors
-                use_zbuffer ? zBuffer : nullptr,  // 'Z' key toggles this
-                use_texture ? this->texture : nullptr, // 'T' key toggles this
-                uv0, uv1, uv2
-            );
+            if (instance.stats)
+                instance.stats->Add(clipper.stats);
         }
     }
 }
@@ -1,11 +1,25 @@
 #pragma once
 
 #include "framework.h"
+#include "clipper.h"
+#include "pixelimage.h"
 
 class Mesh;
 class Image;
 class Camera;
-class FloatImage;
+class Rasterizer;
+
+// One copy of a shared mesh in an instanced draw, with its own transform, texture and toggles
+struct MeshInstance
+{
+	Matrix44 model;
+	Image* texture = nullptr;
+	bool use_texture = true;
+	bool use_zbuffer = true;
+	bool use_interpolation = true;
+	bool cull_backfaces = true;
+	ClipStats* stats = nullptr;	// Optional, the clipper counters of the instance are added here
+};
 
 enum class eRenderMode {
 	POINTCLOUD,
@@ -31,10 +45,24 @@ public:
 	bool use_texture = true;       // 'T' key
 	bool use_zbuffer = true;       // 'Z' key
 	bool use_interpolation = true; // 'C' key
+	bool antialias_lines = false;  // 'A' key, for WIREFRAME
+
+	// Frustum clipping and back-face culling ('X' key), its stats are the ones of the last Render
+	Clipper clipper;
 
 	Entity();
 	~Entity();
 
-	void Render(Image* framebuffer, Camera* camera, FloatImage* zBuffer);
+	// When a rasterizer is given the triangles are queued in it instead of drawn right away
+	void Render(Image* framebuffer, Camera* camera, FloatImage* zBuffer, Rasterizer* rasterizer = nullptr);
 	void Update(float seconds_elapsed);
+
+	// The entity as an instance of its mesh (its clipper stats are reset and collect the counters of the draw)
+	MeshInstance GetInstance();
+
+	// Draws many copies of one mesh as filled triangles, the same as one Render per copy in the order given. The instances go
+	// in batches: the mesh is transformed for the whole batch in one pass, so its positions are read once per batch, not
+	// once per copy
+	static void RenderInstances(Mesh* mesh, const MeshInstance* instances, int count,
+		Image* framebuffer, Camera* camera, FloatImage* zBuffer, Rasterizer* rasterizer = nullptr);
 };
\ No newline at end of file
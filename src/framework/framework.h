@@ -7,6 +7,7 @@
 #include <vector>
 #include <cmath>
 #include <random>
+#include <climits>
 
 #ifndef PI
 	#define PI 3.14159265359
@@ -14,11 +15,6 @@
 #define DEG2RAD 0.0174532925f
 
 
-struct Cell {
-	int minx = INT_MAX;
-	int maxx = INT_MIN;
-};
-
 // Clamp a value 'x' between 'a' and 'b'
 inline float clamp(float x, float a, float b) { return x < a ? a : (x > b ? b : x); }
 inline unsigned int clamp(unsigned int x, unsigned int a, unsigned int b) { return x < a ? a : (x > b ? b : x); }
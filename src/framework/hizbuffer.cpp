@@ -0,0 +1,87 @@
+#include "hizbuffer.h"
+#include "image.h"
+#include "simd.h"
+
+#include <algorithm>
+
+HiZBuffer::HiZBuffer()
+{
+	zbuffer = nullptr;
+	blocks_x = blocks_y = 0;
+	tiles_x = tiles_y = 0;
+}
+
+void HiZBuffer::Reset(FloatImage* zbuffer, float value)
+{
+	this->zbuffer = zbuffer;
+
+	blocks_x = ((int)zbuffer->width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	blocks_y = ((int)zbuffer->height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	tiles_x = ((int)zbuffer->width + TILE_SIZE - 1) / TILE_SIZE;
+	tiles_y = ((int)zbuffer->height + TILE_SIZE - 1) / TILE_SIZE;
+
+	block_max.assign(blocks_x * blocks_y, value);
+	block_dirty.assign(blocks_x * blocks_y, 0);
+	tile_max.assign(tiles_x * tiles_y, value);
+	tile_dirty.assign(tiles_x * tiles_y, 0);
+}
+
+float HiZBuffer::GetBlockMax(int bx, int by)
+{
+	int index = by * blocks_x + bx;
+	if (!block_dirty[index])
+		return block_max[index];
+
+	int x0 = bx * BLOCK_SIZE;
+	int y0 = by * BLOCK_SIZE;
+	int x1 = std::min(x0 + BLOCK_SIZE, (int)zbuffer->width);
+	int y1 = std::min(y0 + BLOCK_SIZE, (int)zbuffer->height);
+
+	float result = zbuffer->GetPixel(x0, y0);
+	for (int y = y0; y < y1; ++y)
+	{
+		const float* row = zbuffer->GetRow(y);
+		int x = x0;
+#ifdef CG_SIMD
+		if (x1 - x0 == BLOCK_SIZE)
+		{
+			vfloat m = simdLoad(row + x);
+			for (x += CG_SIMD_WIDTH; x < x1; x += CG_SIMD_WIDTH)
+				m = simdMax(m, simdLoad(row + x));
+			float lanes[CG_SIMD_WIDTH];
+			simdStore(lanes, m);
+			for (int l = 0; l < CG_SIMD_WIDTH; ++l)
+				result = std::max(result, lanes[l]);
+		}
+#endif
+		for (; x < x1; ++x)
+			result = std::max(result, row[x]);
+	}
+
+	block_max[index] = result;
+	block_dirty[index] = 0;
+	return result;
+}
+
+float HiZBuffer::GetTileMax(int tx, int ty)
+{
+	int index = ty * tiles_x + tx;
+	if (!tile_dirty[index])
+		return tile_max[index];
+
+	int bx0 = tx * BLOCKS_PER_TILE;
+	int by0 = ty * BLOCKS_PER_TILE;
+	int bx1 = std::min(bx0 + BLOCKS_PER_TILE, blocks_x);
+	int by1 = std::min(by0 + BLOCKS_PER_TILE, blocks_y);
+
+	// Built from the stored block values even if some are stale: they can only be farther, and refreshing
+	// every dirty block of the tile here would cost more than the rejection saves
+	float result = block_max[by0 * blocks_x + bx0];
+	for (int by = by0; by < by1; ++by)
+		for (int bx = bx0; bx < bx1; ++bx)
+			result = std::max(result, block_max[by * blocks_x + bx]);
+
+	tile_max[index] = result;
+	tile_dirty[index] = 0;
+	return result;
+}
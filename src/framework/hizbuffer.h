@@ -0,0 +1,47 @@
+/*
+	+ This class keeps a hierarchical version of a depth buffer: the farthest depth of every 8x8 block and of every 64x64 tile.
+	+ The rasterizer compares the nearest depth of a triangle with them to skip whole tiles and blocks before any per-pixel work.
+	+ Depths only get closer while a frame is drawn, so a stale (farther) value is still safe; written blocks are marked dirty
+	  and recomputed when they are queried.
+*/
+
+#pragma once
+
+#include <vector>
+#include "pixelimage.h"
+
+class HiZBuffer
+{
+public:
+	static const int BLOCK_SIZE = 8;	// Level 0
+	static const int TILE_SIZE = 64;	// Level 1, same as the rasterizer tiles
+
+	FloatImage* zbuffer;
+
+	HiZBuffer();
+
+	// Matches the size of the depth buffer and sets all the levels to the value it was filled with
+	void Reset(FloatImage* zbuffer, float value);
+
+	// Farthest depth stored in a block / tile (in block and tile coordinates)
+	float GetBlockMax(int bx, int by);
+	float GetTileMax(int tx, int ty);
+
+	// Called after writing depths inside a block
+	void MarkWritten(int bx, int by)
+	{
+		block_dirty[by * blocks_x + bx] = 1;
+		tile_dirty[(by / BLOCKS_PER_TILE) * tiles_x + bx / BLOCKS_PER_TILE] = 1;
+	}
+
+private:
+	static const int BLOCKS_PER_TILE = TILE_SIZE / BLOCK_SIZE;
+
+	int blocks_x, blocks_y;
+	int tiles_x, tiles_y;
+
+	std::vector<float> block_max;
+	std::vector<unsigned char> block_dirty;
+	std::vector<float> tile_max;
+	std::vector<unsigned char> tile_dirty;
+};
@@ -4,432 +4,495 @@
 #include <algorithm>
 #include <vector>
 #include "GL/glew.h"
-#include "../extra/picopng.h"
 #include "image.h"
 #include "utils.h"
 #include "camera.h"
 #include "mesh.h"
+#include "rasterizer.h"
+#include "resampler.h"
+#include "blitter.h"
+#include "polygonfill.h"
+#include "pngcodec.h"
+#include "tgacodec.h"
+#include "mappedfile.h"
 #include <cmath>
 #include <algorithm>	
 
-Image::Image() {
-	width = 0; height = 0;
-	pixels = NULL;
+Image::Image()
+{
 }
 
-Image::Image(unsigned int width, unsigned int height)
+Image::Image(unsigned int width, unsigned int height) : PixelImage<FormatRGB8>(width, height)
 {
-	this->width = width;
-	this->height = height;
-	pixels = new Color[width*height];
-	memset(pixels, 0, width * height * sizeof(Color));
 }
 
-// Copy constructor
-Image::Image(const Image& c)
+// Copy constructor (the mip pyramid is not copied, it is built again when needed)
+Image::Image(const Image& c) : PixelImage<FormatRGB8>(c)
 {
-	pixels = NULL;
-	width = c.width;
-	height = c.height;
-	bytes_per_pixel = c.bytes_per_pixel;
-	if(c.pixels)
-	{
-		pixels = new Color[width*height];
-		memcpy(pixels, c.pixels, width*height*bytes_per_pixel);
-	}
+}
+
+// The mip pyramid belongs to the pixels, so it moves with them
+Image::Image(Image&& c) noexcept : PixelImage<FormatRGB8>(std::move(c))
+{
+	std::swap(mipmaps, c.mipmaps);
 }
 
 // Assign operator
 Image& Image::operator = (const Image& c)
 {
-	if(pixels) delete[] pixels;
-	pixels = NULL;
-
-	width = c.width;
-	height = c.height;
-	bytes_per_pixel = c.bytes_per_pixel;
+	if (this == &c)
+		return *this;
+	InvalidateMipmaps();
+	PixelImage<FormatRGB8>::operator = (c);
+	return *this;
+}
 
-	if(c.pixels)
-	{
-		pixels = new Color[width*height*bytes_per_pixel];
-		memcpy(pixels, c.pixels, width*height*bytes_per_pixel);
-	}
+Image& Image::operator = (Image&& c) noexcept
+{
+	if (this == &c)
+		return *this;
+	InvalidateMipmaps();
+	PixelImage<FormatRGB8>::operator = (std::move(c));
+	std::swap(mipmaps, c.mipmaps);
 	return *this;
 }
 
 Image::~Image()
 {
-	if(pixels) 
-		delete[] pixels;
+	delete mipmaps;
 }
 
 void Image::Render()
 {
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glDrawPixels(width, height, bytes_per_pixel == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch);
+	glDrawPixels(width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+void Image::CopyArea(const Image& source, int x, int y, int w, int h)
+{
+	int x0 = std::max(x, 0), y0 = std::max(y, 0);
+	int x1 = std::min(x + w, (int)std::min(width, source.width));
+	int y1 = std::min(y + h, (int)std::min(height, source.height));
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	for (int row = y0; row < y1; ++row)
+		memcpy(GetRow(row) + x0, source.GetRow(row) + x0, (x1 - x0) * sizeof(Color));
 }
 
 // Change image size (the old one will remain in the top-left corner)
 void Image::Resize(unsigned int width, unsigned int height)
 {
-	Color* new_pixels = new Color[width*height];
-	unsigned int min_width = this->width > width ? width : this->width;
-	unsigned int min_height = this->height > height ? height : this->height;
+	InvalidateMipmaps();
+	PixelImage<FormatRGB8>::Resize(width, height);
+}
+// Cohen-Sutherland region codes: which sides of [0, max_x] x [0, max_y] a point is past
+enum {
+	CLIP_LEFT = 1,
+	CLIP_RIGHT = 2,
+	CLIP_TOP = 4,
+	CLIP_BOTTOM = 8
+};
+
+static int GetOutCode(double x, double y, double max_x, double max_y)
+{
+	int code = 0;
+	if (x < 0.0) code |= CLIP_LEFT;
+	else if (x > max_x) code |= CLIP_RIGHT;
+	if (y < 0.0) code |= CLIP_TOP;
+	else if (y > max_y) code |= CLIP_BOTTOM;
+	return code;
+}
 
-	for(unsigned int x = 0; x < min_width; ++x)
-		for(unsigned int y = 0; y < min_height; ++y)
-			new_pixels[ y * width + x ] = GetPixel(x,y);
+// Moves the ends of the segment to the borders of [0, max_x] x [0, max_y] until both are inside. False when the segment
+// misses the rectangle
+static bool ClipSegment(double& x0, double& y0, double& x1, double& y1, double max_x, double max_y)
+{
+	int code0 = GetOutCode(x0, y0, max_x, max_y);
+	int code1 = GetOutCode(x1, y1, max_x, max_y);
+	while (code0 | code1)
+	{
+		if (code0 & code1)
+			return false;
+
+		int code = code0 ? code0 : code1;
+		double x, y;
+		if (code & CLIP_TOP) { x = x0 + (x1 - x0) * (0.0 - y0) / (y1 - y0); y = 0.0; }
+		else if (code & CLIP_BOTTOM) { x = x0 + (x1 - x0) * (max_y - y0) / (y1 - y0); y = max_y; }
+		else if (code & CLIP_LEFT) { y = y0 + (y1 - y0) * (0.0 - x0) / (x1 - x0); x = 0.0; }
+		else { y = y0 + (y1 - y0) * (max_x - x0) / (x1 - x0); x = max_x; }
+
+		if (code == code0) { x0 = x; y0 = y; code0 = GetOutCode(x0, y0, max_x, max_y); }
+		else { x1 = x; y1 = y; code1 = GetOutCode(x1, y1, max_x, max_y); }
+	}
+	return true;
+}
 
-	delete[] pixels;
-	this->width = width;
-	this->height = height;
-	pixels = new_pixels;
+// Bresenham steps along the major axis: after i steps the minor coordinate has moved floor((2 i minor + major - 1) / (2 major)).
+// First step that has moved at least m, and last one that has moved at most m (-1 if none)
+static long long FirstStepReaching(long long m, long long major, long long minor)
+{
+	if (m <= 0)
+		return 0;
+	long long n = 2 * major * m - major + 1;
+	return (n + 2 * minor - 1) / (2 * minor);
 }
-void Image::DrawLineDDA(int x0, int y0, int x1, int y1, const Color&c){
-	int dx= x1-x0;
-	int dy= y1-y0;
-	int d=std::max(std::abs(dx), std::abs(dy));
 
-	float vx=dx/(float)d;
-	float vy=dy/(float)d;
+static long long LastStepWithin(long long m, long long major, long long minor)
+{
+	if (m < 0)
+		return -1;
+	long long n = 2 * major * (m + 1) - major + 1;
+	return (n + 2 * minor - 1) / (2 * minor) - 1;
+}
 
-	float x= (float)x0;
-	float y=(float)y0;
-	for (int i = 0; i <= d; i++) {
-		int xi=(int)std::floor(x);
-		int yi=(int)std::floor(y);
-		SetPixel(xi,yi,c);
-		x=x+vx;
-		y=y+vy;
+// count pixels of a Bresenham line from p, with the error of the first one
+static inline void StepLine(Color* p, int count, ptrdiff_t major_step, ptrdiff_t minor_step, long long error, long long major,
+	long long minor, const Color& c)
+{
+	for (int i = 0; i < count; ++i, p += major_step)
+	{
+		*p = c;
+		if (error > 0)
+		{
+			p += minor_step;
+			error -= 2 * major;
+		}
+		error += 2 * minor;
+	}
+}
 
+void Image::DrawLine(int x0, int y0, int x1, int y1, const Color& c)
+{
+	if (!pixels)
+		return;
 
+	int max_x = (int)width - 1, max_y = (int)height - 1;
+	int code0 = GetOutCode(x0, y0, max_x, max_y);
+	int code1 = GetOutCode(x1, y1, max_x, max_y);
+	if (code0 & code1)
+		return;	// Both ends past the same side
 
+	// Whole line inside, the usual case
+	if (!(code0 | code1))
+	{
+		int dx = std::abs(x1 - x0), dy = std::abs(y1 - y0);
+		ptrdiff_t step_x = x0 < x1 ? 1 : -1;
+		ptrdiff_t step_y = y0 < y1 ? (ptrdiff_t)pitch : -(ptrdiff_t)pitch;
+		Color* p = GetRow(y0) + x0;
+		if (dx >= dy)
+			StepLine(p, dx + 1, step_x, step_y, 2 * dy - dx, dx, dy, c);
+		else
+			StepLine(p, dy + 1, step_y, step_x, 2 * dx - dy, dy, dx, c);
+		return;
 	}
 
+	// Stepped along the major axis (a), the minor one (b) moves when the error crosses zero
+	bool x_major = std::abs((long long)x1 - x0) >= std::abs((long long)y1 - y0);
+	long long a0 = x_major ? x0 : y0, a1 = x_major ? x1 : y1;
+	long long b0 = x_major ? y0 : x0, b1 = x_major ? y1 : x1;
+	long long a_max = x_major ? max_x : max_y, b_max = x_major ? max_y : max_x;
+	long long major = std::abs(a1 - a0), minor = std::abs(b1 - b0);
+	int step_a = a0 < a1 ? 1 : -1, step_b = b0 < b1 ? 1 : -1;
+
+	// Steps that land inside the image: the same pixels the whole line would have there, not a new line between the
+	// clipped ends
+	long long first = std::max(0LL, step_a > 0 ? -a0 : a0 - a_max);
+	long long last = std::min(major, step_a > 0 ? a_max - a0 : a0);
+	long long low = step_b > 0 ? -b0 : b0 - b_max;	// Minor moves that keep b inside
+	long long high = step_b > 0 ? b_max - b0 : b0;
+	if (minor > 0)
+	{
+		first = std::max(first, FirstStepReaching(low, major, minor));
+		last = std::min(last, LastStepWithin(high, major, minor));
+	}
+	else if (low > 0 || high < 0)
+		return;
+	if (first > last)
+		return;
+
+	long long moved = (2 * first * minor + major - 1) / (2 * major);
+	long long error = 2 * minor - major + 2 * first * minor - 2 * major * moved;
+	int a = (int)(a0 + step_a * first), b = (int)(b0 + step_b * moved);
+	Color* p = x_major ? GetRow(b) + a : GetRow(a) + b;
+
+	ptrdiff_t row = (ptrdiff_t)pitch;
+	if (x_major)
+		StepLine(p, (int)(last - first + 1), step_a, step_b * row, error, major, minor, c);
+	else
+		StepLine(p, (int)(last - first + 1), step_a * row, step_b, error, major, minor, c);
+}
 
+// c over the pixel at x,y with coverage (0 to 1), when it is inside the image
+static inline void BlendCoverage(Image& image, int x, int y, const Color& c, float coverage)
+{
+	if ((unsigned int)x >= image.width || (unsigned int)y >= image.height)
+		return;
+
+	// Rounded (c * a + d * (255 - a)) / 255
+	int a = (int)(coverage * 255.0f + 0.5f), inverse = 255 - a;
+	Color& d = image.GetPixelRef(x, y);
+	int r = c.r * a + d.r * inverse + 128, g = c.g * a + d.g * inverse + 128, b = c.b * a + d.b * inverse + 128;
+	d.r = (unsigned char)((r + (r >> 8)) >> 8);
+	d.g = (unsigned char)((g + (g >> 8)) >> 8);
+	d.b = (unsigned char)((b + (b >> 8)) >> 8);
 }
-void Image::ScanLineDDA(int x0, int y0, int x1, int y1,std::vector<Cell> &edgeTable) {
-	int dx = x1 - x0;
-	int dy = y1 - y0;
-	int d = std::max(std::abs(dx), std::abs(dy));
 
-	float vx = dx / (float)d;
-	float vy = dy / (float)d;
+void Image::DrawLineAA(float x0, float y0, float x1, float y1, const Color& c)
+{
+	double cx0 = x0, cy0 = y0, cx1 = x1, cy1 = y1;
+	if (!pixels || !ClipSegment(cx0, cy0, cx1, cy1, (double)width - 1.0, (double)height - 1.0))
+		return;
+	x0 = (float)cx0; y0 = (float)cy0; x1 = (float)cx1; y1 = (float)cy1;
+
+	// Stepped along x: a steep line is drawn with the axes swapped
+	bool steep = std::abs(y1 - y0) > std::abs(x1 - x0);
+	if (steep)
+	{
+		std::swap(x0, y0);
+		std::swap(x1, y1);
+	}
+	if (x0 > x1)
+	{
+		std::swap(x0, x1);
+		std::swap(y0, y1);
+	}
 
-	float x = (float)x0;
-	float y = (float)y0;
-	for (int i = 0; i <= d; i++) {
-		int xi = (int)std::floor(x);
-		int yi = (int)std::floor(y);
-		if (edgeTable[yi].minx > xi)
-			edgeTable[yi].minx=xi;
-		if (edgeTable[yi].maxx < xi)
-			edgeTable[yi].maxx=xi;
-		x = x + vx;
-		y = y + vy;
-		
+	float dx = x1 - x0;
+	float gradient = dx == 0.0f ? 1.0f : (y1 - y0) / dx;
 
+	// Pixels across the line at column x, for the line at height y, with coverage scaled by the part of the column covered
+	auto plot = [&](int x, float y, float covered) {
+		int iy = (int)std::floor(y);
+		float f = y - iy;
+		if (steep)
+		{
+			BlendCoverage(*this, iy, x, c, (1.0f - f) * covered);
+			BlendCoverage(*this, iy + 1, x, c, f * covered);
+		}
+		else
+		{
+			BlendCoverage(*this, x, iy, c, (1.0f - f) * covered);
+			BlendCoverage(*this, x, iy + 1, c, f * covered);
+		}
+	};
 
-	}
+	// The ends cover only part of their column
+	int start = (int)std::floor(x0 + 0.5f);
+	float y_start = y0 + gradient * (start - x0);
+	plot(start, y_start, 1.0f - (x0 + 0.5f - std::floor(x0 + 0.5f)));
+
+	int end = (int)std::floor(x1 + 0.5f);
+	float y_end = y1 + gradient * (end - x1);
+	if (end != start)
+		plot(end, y_end, x1 + 0.5f - std::floor(x1 + 0.5f));
 
+	float y = y_start + gradient;
+	for (int x = start + 1; x < end; ++x, y += gradient)
+		plot(x, y, 1.0f);
+}
 
+void Image::DrawLines(const LineSegment* segments, int count, const Color& c, bool antialiased)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		const LineSegment& s = segments[i];
+		if (antialiased)
+			DrawLineAA(s.x0, s.y0, s.x1, s.y1, c);
+		else
+			DrawLine((int)s.x0, (int)s.y0, (int)s.x1, (int)s.y1, c);
+	}
 }
+
 void Image::DrawRect(int x, int y, int w, int h, const Color& borderColor,
 	int borderWidth, bool isFilled, const Color& fillColor)
 {
 	if (w <= 0 || h <= 0) return;
 
-	for (int j = 0; j < h; ++j)
+	// Four strips of border around the inside, every one filled a row at a time
+	int b = std::max(borderWidth, 0);
+	if (2 * b >= w || 2 * b >= h)
 	{
-		for (int i = 0; i < w; ++i)
-		{
-			bool inBorder =
-				(i < borderWidth) || (j < borderWidth) ||
-				(i >= w - borderWidth) || (j >= h - borderWidth);
-
-			if (inBorder)
-				SetPixel(x + i, y + j, borderColor);
-			else if (isFilled)
-				SetPixel(x + i, y + j, fillColor);
-		}
+		FillArea(borderColor, x, y, w, h);
+		return;
 	}
+	FillArea(borderColor, x, y, w, b);
+	FillArea(borderColor, x, y + h - b, w, b);
+	FillArea(borderColor, x, y + b, b, h - 2 * b);
+	FillArea(borderColor, x + w - b, y + b, b, h - 2 * b);
+	if (isFilled)
+		FillArea(fillColor, x + b, y + b, w - 2 * b, h - 2 * b);
 }
-void Image::DrawTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& borderColor, bool isFilled, const Color& fillColor) {
-	if(isFilled){
-		std::vector<Cell> edgeTable;
-		edgeTable.resize(height);
-		ScanLineDDA(p0.x,p0.y,p1.x,p1.y, edgeTable );
-		ScanLineDDA(p1.x, p1.y, p2.x, p2.y, edgeTable);
-		ScanLineDDA(p2.x, p2.y, p0.x, p0.y, edgeTable);
-		for (int y = 0; y < height; y++) {
-			for(int x= edgeTable[y].minx; x<= edgeTable[y].maxx; x++){
-				SetPixel(x,y,fillColor);
-			
-			}
-		}
+
+void Image::DrawTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& borderColor, bool isFilled, const Color& fillColor)
+{
+	if (isFilled)
+	{
+		Vector2 corners[3] = { p0, p1, p2 };
+		FillPolygon(corners, 3, fillColor);
 	}
-	DrawLineDDA(p0.x, p0.y, p1.x, p1.y,borderColor);
-	DrawLineDDA(p1.x, p1.y, p2.x, p2.y, borderColor);
-	DrawLineDDA(p2.x, p2.y, p0.x, p0.y, borderColor);
+	DrawLine(p0.x, p0.y, p1.x, p1.y, borderColor);
+	DrawLine(p1.x, p1.y, p2.x, p2.y, borderColor);
+	DrawLine(p2.x, p2.y, p0.x, p0.y, borderColor);
 }
-void Image::DrawImage(const Image& image, int x, int y)
+
+void Image::FillPolygon(const Vector2* vertices, int count, const Color& c, eFillRule rule)
 {
-	for (int iy = 0; iy < (int)image.height; ++iy)
-	{
-		int dstY = y + iy;
-		if (dstY < 0 || dstY >= (int)this->height) continue;
+	PolygonFiller::Get()->Fill(*this, vertices, count, c, rule);
+}
 
-		for (int ix = 0; ix < (int)image.width; ++ix)
-		{
-			int dstX = x + ix;
-			if (dstX < 0 || dstX >= (int)this->width) continue;
+void Image::DrawImage(const Image& image, int x, int y)
+{
+	Blitter::Get()->Copy(image, *this, x, y);
+}
 
-			Color c = image.GetPixel((unsigned)ix, (unsigned)iy);
-			this->SetPixel(dstX, dstY, c);
-		}
-	}
+// The colours of image must be premultiplied by its alpha
+void Image::DrawImage(const RGBAImage& image, int x, int y)
+{
+	Blitter::Get()->Blend(image, *this, x, y);
 }
 
 // Change image size and scale the content
-void Image::Scale(unsigned int width, unsigned int height)
+void Image::Scale(unsigned int width, unsigned int height, eScaleFilter filter)
 {
-	Color* new_pixels = new Color[width*height];
+	InvalidateMipmaps();
 
-	for(unsigned int x = 0; x < width; ++x)
-		for(unsigned int y = 0; y < height; ++y)
-			new_pixels[ y * width + x ] = GetPixel((unsigned int)(this->width * (x / (float)width)), (unsigned int)(this->height * (y / (float)height)) );
+	Image result(width, height);
+	ScaleTo(result, filter);
+	Swap(result);
+}
 
-	delete[] pixels;
-	this->width = width;
-	this->height = height;
-	pixels = new_pixels;
+void Image::ScaleTo(Image& destination, eScaleFilter filter) const
+{
+	Resampler::Get()->Scale(*this, destination, filter);
 }
 
 Image Image::GetArea(unsigned int start_x, unsigned int start_y, unsigned int width, unsigned int height)
 {
 	Image result(width, height);
-	for(unsigned int x = 0; x < width; ++x)
-		for(unsigned int y = 0; y < height; ++y)
-		{
-			if( (x + start_x) < this->width && (y + start_y) < this->height) 
-				result.SetPixelUnsafe( x, y, GetPixel(x + start_x,y + start_y) );
-		}
+	if (start_x >= this->width || start_y >= this->height)
+		return result;
+
+	// The part outside this image stays black
+	unsigned int copy_width = std::min(width, this->width - start_x);
+	unsigned int copy_height = std::min(height, this->height - start_y);
+	for (unsigned int y = 0; y < copy_height; ++y)
+		memcpy(result.GetRow(y), GetRow(y + start_y) + start_x, copy_width * sizeof(Color));
 	return result;
 }
 
 void Image::FlipY()
 {
-	int row_size = bytes_per_pixel * width;
+	InvalidateMipmaps();
+
+	int row_size = sizeof(Color) * width;
 	Uint8* temp_row = new Uint8[row_size];
 #pragma omp simd
 	for (int y = 0; y < height * 0.5; y += 1)
 	{
-		Uint8* pos = (Uint8*)pixels + y * row_size;
+		Uint8* pos = (Uint8*)GetRow(y);
 		memcpy(temp_row, pos, row_size);
-		Uint8* pos2 = (Uint8*)pixels + (height - y - 1) * row_size;
+		Uint8* pos2 = (Uint8*)GetRow(height - y - 1);
 		memcpy(pos, pos2, row_size);
 		memcpy(pos2, temp_row, row_size);
 	}
 	delete[] temp_row;
 }
 
-bool Image::LoadPNG(const char* filename, bool flip_y)
+// Maps the file and decodes it straight into image, the alpha is dropped for an Image
+template <typename T>
+static bool LoadPNGFile(const char* filename, T& image, bool flip_y)
 {
 	std::string sfullPath = absResPath(filename);
-	std::ifstream file(sfullPath, std::ios::in | std::ios::binary | std::ios::ate);
-
-	// Get filesize
-	std::streamsize size = 0;
-	if (file.seekg(0, std::ios::end).good()) size = file.tellg();
-	if (file.seekg(0, std::ios::beg).good()) size -= file.tellg();
-
-	if (!size){
-		std::cerr << "--- Failed to load file: " << sfullPath.c_str() << std::endl;
+	MappedFile file;
+	if (!file.Open(sfullPath))
+	{
+		std::cerr << "--- File not found: " << sfullPath.c_str() << std::endl;
 		return false;
 	}
 
-	std::vector<unsigned char> buffer;
-
-	// Read contents of the file into the vector
-	if (size > 0)
+	PNGDecoder decoder;
+	if (!decoder.Decode(file.GetData(), file.GetSize(), image, flip_y))
 	{
-		buffer.resize((size_t)size);
-		file.read((char*)(&buffer[0]), size);
-	}
-	else
-		buffer.clear();
-
-	std::vector<unsigned char> out_image;
-
-	if (decodePNG(out_image, width, height, buffer.empty() ? 0 : &buffer[0], (unsigned long)buffer.size(), true) != 0){
 		std::cerr << "--- Failed to load file: " << sfullPath.c_str() << std::endl;
 		return false;
 	}
 
-	size_t bufferSize = out_image.size();
-	unsigned int originalBytesPerPixel = (unsigned int)bufferSize / (width * height);
-	
-	// Force 3 channels
-	bytes_per_pixel = 3;
-
-	if (originalBytesPerPixel == 3) {
-		if (pixels) delete[] pixels;
-		pixels = new Color[bufferSize];
-		memcpy(pixels, &out_image[0], bufferSize);
-	}
-	else if (originalBytesPerPixel == 4) {
-		if (pixels) delete[] pixels;
-
-		unsigned int newBufferSize = width * height * bytes_per_pixel;
-		pixels = new Color[newBufferSize];
-
-		unsigned int k = 0;
-		for (unsigned int i = 0; i < bufferSize; i += originalBytesPerPixel) {
-			pixels[k] = Color(out_image[i], out_image[i + 1], out_image[i + 2]);
-			k++;
-		}
-	}
-
-	// Flip pixels in Y
-	if (flip_y)
-		FlipY();
-
 	std::cout << "+++ File loaded: " << sfullPath.c_str() << std::endl;
 
 	return true;
 }
 
+bool Image::LoadPNG(const char* filename, bool flip_y)
+{
+	InvalidateMipmaps();
+	return LoadPNGFile(filename, *this, flip_y);
+}
+
+bool LoadPNG(const char* filename, RGBAImage& image, bool flip_y)
+{
+	return LoadPNGFile(filename, image, flip_y);
+}
+
 // Loads an image from a TGA file
 bool Image::LoadTGA(const char* filename, bool flip_y)
 {
-	unsigned char TGAheader[12] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-	unsigned char TGAcompare[12];
-	unsigned char header[6];
-	unsigned int imageSize;
-	unsigned int bytesPerPixel;
-
-    std::string sfullPath = absResPath( filename );
+	InvalidateMipmaps();
 
-	FILE * file = fopen( sfullPath.c_str(), "rb");
-   	if ( file == NULL || fread(TGAcompare, 1, sizeof(TGAcompare), file) != sizeof(TGAcompare) ||
-		memcmp(TGAheader, TGAcompare, sizeof(TGAheader)) != 0 ||
-		fread(header, 1, sizeof(header), file) != sizeof(header))
+	std::string sfullPath = absResPath(filename);
+	MappedFile file;
+	if (!file.Open(sfullPath))
 	{
 		std::cerr << "--- File not found: " << sfullPath.c_str() << std::endl;
-		if (file == NULL)
-			return NULL;
-		else
-		{
-			fclose(file);
-			return NULL;
-		}
+		return false;
 	}
 
-	TGAInfo* tgainfo = new TGAInfo;
-    
-	tgainfo->width = header[1] * 256 + header[0];
-	tgainfo->height = header[3] * 256 + header[2];
-    
-	if (tgainfo->width <= 0 || tgainfo->height <= 0 || (header[4] != 24 && header[4] != 32))
+	TGADecoder decoder;
+	if (!decoder.Decode(file.GetData(), file.GetSize(), *this, flip_y))
 	{
 		std::cerr << "--- Failed to load file: " << sfullPath.c_str() << std::endl;
-		fclose(file);
-		delete tgainfo;
-		return NULL;
-	}
-    
-	tgainfo->bpp = header[4];
-	bytesPerPixel = tgainfo->bpp / 8;
-	imageSize = tgainfo->width * tgainfo->height * bytesPerPixel;
-    
-	tgainfo->data = new unsigned char[imageSize];
-    
-	if (tgainfo->data == NULL || fread(tgainfo->data, 1, imageSize, file) != imageSize)
-	{
-		std::cerr << "--- Failed to load file: " << sfullPath.c_str() << std::endl;
-
-		if (tgainfo->data != NULL)
-			delete[] tgainfo->data;
-            
-		fclose(file);
-		delete tgainfo;
 		return false;
 	}
 
-	fclose(file);
-
-	// Save info in image
-	if(pixels)
-		delete[] pixels;
-
-	width = tgainfo->width;
-	height = tgainfo->height;
-	pixels = new Color[width*height];
-
-	// Convert to float all pixels
-	for (unsigned int y = 0; y < height; ++y) {
-		for (unsigned int x = 0; x < width; ++x) {
-			unsigned int pos = y * width * bytesPerPixel + x * bytesPerPixel;
-			// Make sure we don't access out of memory
-			if( (pos < imageSize) && (pos + 1 < imageSize) && (pos + 2 < imageSize))
-				SetPixelUnsafe(x, height - y - 1, Color(tgainfo->data[pos + 2], tgainfo->data[pos + 1], tgainfo->data[pos]));
-		}
-	}
-
-	// Flip pixels in Y
-	if (flip_y)
-		FlipY();
-
-	delete[] tgainfo->data;
-	delete tgainfo;
-
 	std::cout << "+++ File loaded: " << sfullPath.c_str() << std::endl;
 
 	return true;
 }
 
-// Saves the image to a TGA file
-bool Image::SaveTGA(const char* filename)
+bool Image::SaveTGA(const char* filename, bool rle)
 {
-	unsigned char TGAheader[12] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-
 	std::string fullPath = absResPath(filename);
-	FILE *file = fopen(fullPath.c_str(), "wb");
-	if ( file == NULL )
+	std::ofstream file(fullPath, std::ios::out | std::ios::binary);
+
+	TGAEncoder encoder;
+	encoder.rle = rle;
+	if (!file.is_open() || !encoder.Encode(*this, file))
 	{
 		std::cerr << "--- Failed to save file: " << fullPath.c_str() << std::endl;
 		return false;
 	}
 
-	unsigned short header_short[3];
-	header_short[0] = width;
-	header_short[1] = height;
-	unsigned char* header = (unsigned char*)header_short;
-	header[4] = 24;
-	header[5] = 0;
-
-	fwrite(TGAheader, 1, sizeof(TGAheader), file);
-	fwrite(header, 1, 6, file);
-
-	// Convert pixels to unsigned char
-	unsigned char* bytes = new unsigned char[width*height*3];
-	for(unsigned int y = 0; y < height; ++y)
-		for(unsigned int x = 0; x < width; ++x)
-		{
-			Color c = pixels[y*width+x];
-			unsigned int pos = (y*width+x)*3;
-			bytes[pos+2] = c.r;
-			bytes[pos+1] = c.g;
-			bytes[pos] = c.b;
-		}
+	std::cout << "+++ File saved: " << fullPath.c_str() << std::endl;
+	return true;
+}
 
-	fwrite(bytes, 1, width*height*3, file);
-	fclose(file);
+bool Image::SavePNG(const char* filename, int level, bool parallel)
+{
+	std::string fullPath = absResPath(filename);
+	std::ofstream file(fullPath, std::ios::out | std::ios::binary);
 
-	delete[] bytes;
+	PNGEncoder encoder;
+	encoder.level = level;
+	encoder.parallel = parallel;
+	if (!file.is_open() || !encoder.Encode(*this, file))
+	{
+		std::cerr << "--- Failed to save file: " << fullPath.c_str() << std::endl;
+		return false;
+	}
 
 	std::cout << "+++ File saved: " << fullPath.c_str() << std::endl;
-
 	return true;
 }
 
@@ -439,70 +502,59 @@ bool Image::SaveTGA(const char* filename)
 // ForEachPixel( img, img2, [](Color a, Color b) { return a + b; } );
 template <typename F>
 void ForEachPixel(Image& img, const Image& img2, F f) {
-	for(unsigned int pos = 0; pos < img.width * img.height; ++pos)
-		img.pixels[pos] = f( img.pixels[pos], img2.pixels[pos] );
+	for(unsigned int y = 0; y < img.height; ++y)
+		for(unsigned int x = 0; x < img.width; ++x)
+			img.GetPixelRef(x, y) = f( img.GetPixel(x, y), img2.GetPixel(x, y) );
 }
 
 #endif
 
-FloatImage::FloatImage(unsigned int width, unsigned int height)
+// Each texel is the average of the 2x2 texels below it, the last row / column is repeated on odd sizes
+const std::vector<Image>& Image::GetMipmaps()
 {
-	this->width = width;
-	this->height = height;
-	pixels = new float[width * height];
-	memset(pixels, 0, width * height * sizeof(float));
-}
+	if (mipmaps)
+		return *mipmaps;
 
-// Copy constructor
-FloatImage::FloatImage(const FloatImage& c) {
-	pixels = NULL;
+	mipmaps = new std::vector<Image>();
+	if (!pixels)
+		return *mipmaps;
 
-	width = c.width;
-	height = c.height;
-	if (c.pixels)
+	const Image* src = this;
+	while (src->width > 1 || src->height > 1)
 	{
-		pixels = new float[width * height];
-		memcpy(pixels, c.pixels, width * height * sizeof(float));
-	}
-}
+		unsigned int w = std::max(src->width / 2, 1u);
+		unsigned int h = std::max(src->height / 2, 1u);
+		Image level(w, h);
 
-// Assign operator
-FloatImage& FloatImage::operator = (const FloatImage& c)
-{
-	if (pixels) delete[] pixels;
-	pixels = NULL;
+		for (unsigned int y = 0; y < h; ++y)
+		{
+			unsigned int y0 = std::min(y * 2, src->height - 1);
+			unsigned int y1 = std::min(y * 2 + 1, src->height - 1);
+			for (unsigned int x = 0; x < w; ++x)
+			{
+				unsigned int x0 = std::min(x * 2, src->width - 1);
+				unsigned int x1 = std::min(x * 2 + 1, src->width - 1);
+				const Color& a = src->GetRow(y0)[x0];
+				const Color& b = src->GetRow(y0)[x1];
+				const Color& c = src->GetRow(y1)[x0];
+				const Color& d = src->GetRow(y1)[x1];
+				Color& out = level.GetPixelRef(x, y);
+				out.r = (unsigned char)((a.r + b.r + c.r + d.r + 2) >> 2);
+				out.g = (unsigned char)((a.g + b.g + c.g + d.g + 2) >> 2);
+				out.b = (unsigned char)((a.b + b.b + c.b + d.b + 2) >> 2);
+			}
+		}
 
-	width = c.width;
-	height = c.height;
-	if (c.pixels)
-	{
-		pixels = new float[width * height * sizeof(float)];
-		memcpy(pixels, c.pixels, width * height * sizeof(float));
+		mipmaps->push_back(level);
+		src = &mipmaps->back();
 	}
-	return *this;
+	return *mipmaps;
 }
 
-FloatImage::~FloatImage()
+void Image::InvalidateMipmaps()
 {
-	if (pixels)
-		delete[] pixels;
-}
-
-// Change image size (the old one will remain in the top-left corner)
-void FloatImage::Resize(unsigned int width, unsigned int height)
-{
-	float* new_pixels = new float[width * height];
-	unsigned int min_width = this->width > width ? width : this->width;
-	unsigned int min_height = this->height > height ? height : this->height;
-
-	for (unsigned int x = 0; x < min_width; ++x)
-		for (unsigned int y = 0; y < min_height; ++y)
-			new_pixels[y * width + x] = GetPixel(x, y);
-
-	delete[] pixels;
-	this->width = width;
-	this->height = height;
-	pixels = new_pixels;
+	delete mipmaps;
+	mipmaps = nullptr;
 }
 
  //Helper
@@ -516,52 +568,13 @@ void Image::DrawTriangleInterpolated(
 	const Color& c0, const Color& c1, const Color& c2,
 	FloatImage* zbuffer,
 	Image* texture,
-	const Vector2& uv0, const Vector2& uv1, const Vector2& uv2)
+	const Vector2& uv0, const Vector2& uv1, const Vector2& uv2, const float* inv_w)
 {
-	int min_x = std::max(0, (int)std::floor(std::min({ p0.x, p1.x, p2.x })));
-	int max_x = std::min((int)width - 1, (int)std::ceil(std::max({ p0.x, p1.x, p2.x })));
-	int min_y = std::max(0, (int)std::floor(std::min({ p0.y, p1.y, p2.y })));
-	int max_y = std::min((int)height - 1, (int)std::ceil(std::max({ p0.y, p1.y, p2.y })));
-
-	float area012 = getArea(Vector2(p0.x, p0.y), Vector2(p1.x, p1.y), Vector2(p2.x, p2.y));
-	if (std::abs(area012) < 1e-6) return;
-
-	for (int y = min_y; y <= max_y; ++y) {
-		for (int x = min_x; x <= max_x; ++x) {
-			Vector2 P((float)x, (float)y);
-
-			float w0 = getArea(Vector2(p1.x, p1.y), Vector2(p2.x, p2.y), P) / area012;
-			float w1 = getArea(Vector2(p2.x, p2.y), Vector2(p0.x, p0.y), P) / area012;
-			float w2 = 1.0f - w0 - w1;
-
-			if (w0 >= -0.001f && w1 >= -0.001f && w2 >= -0.001f) {
-
-				float z = p0.z * w0 + p1.z * w1 + p2.z * w2;
-
-				if (zbuffer == nullptr || z < zbuffer->GetPixel(x, y)) {
+	// Edge equations and attribute planes are computed once, then stepped per pixel
+	TriangleSetup t;
+	if (!t.Setup(p0, p1, p2, c0, c1, c2, zbuffer, texture, uv0, uv1, uv2,
+		0, 0, (int)width - 1, (int)height - 1, inv_w))
+		return;
 
-					if (zbuffer) zbuffer->SetPixel(x, y, z);
-
-					Color finalColor;
-
-					if (texture) {
-						Vector2 uv = uv0 * w0 + uv1 * w1 + uv2 * w2;
-
-						int tx = (int)(uv.x * (texture->width - 1));
-						if (tx < 0) tx = 0; else if (tx >= (int)texture->width) tx = (int)texture->width - 1;
-
-						int ty = (int)(uv.y * (texture->height - 1));
-						if (ty < 0) ty = 0; else if (ty >= (int)texture->height) ty = (int)texture->height - 1;
-
-						finalColor = texture->GetPixel(tx, ty);
-					}
-					else {
-						finalColor = c0 * w0 + c1 * w1 + c2 * w2;
-					}
-
-					SetPixelUnsafe(x, y, finalColor);
-				}
-			}
-		}
-	}
-}
\ No newline at end of file
+	Rasterizer::DrawTriangle(this, t, 0, 0, (int)width - 1, (int)height - 1);
+}
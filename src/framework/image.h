@@ -1,6 +1,7 @@
 /*
 	+ This file defines the class Image that allows to manipulate images.
 	+ It defines all the need operators for Color and Image
+	+ The pixels are kept by PixelImage (pixelimage.h), Image adds the drawing and file functions for RGB8 images.
 */
 
 #pragma once
@@ -8,7 +9,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <iostream>
+#include <vector>
 #include "framework.h"
+#include "pixelimage.h"
 
 //remove unsafe warnings
 #ifndef _CRT_SECURE_NO_WARNINGS
@@ -16,75 +19,107 @@
 #pragma warning(disable:4996)
 #endif
 
-class FloatImage;
 class Entity;
 class Camera;
 
-// A matrix of pixels
-class Image
-{
-	// A general struct to store all the information about a TGA file
-	typedef struct sTGAInfo {
-		unsigned int width;
-		unsigned int height;
-		unsigned int bpp; // Bits per pixel
-		unsigned char* data; // Bytes with the pixel information
-	} TGAInfo;
-	
-		
+// Filters of Image::Scale: box averages the covered pixels (sharp when enlarging), bilinear is smooth and Lanczos-3
+// keeps the most detail but can ring around hard edges
+enum class eScaleFilter {
+	BOX,
+	BILINEAR,
+	LANCZOS3
+};
 
-public:
-	unsigned int width;
-	unsigned int height;
-	unsigned int bytes_per_pixel = 3; // Bits per pixel
+// Which points are inside a polygon whose edges cross: the ones with an odd number of edges on one side, or the ones
+// the outline winds around (a different number of edges going up and down)
+enum class eFillRule {
+	EVEN_ODD,
+	NON_ZERO
+};
+
+// Segment from x0,y0 to x1,y1 (both ends are drawn)
+struct LineSegment
+{
+	float x0, y0, x1, y1;
 
-	Color* pixels;
+	LineSegment() : x0(0), y0(0), x1(0), y1(0) {}
+	LineSegment(float x0, float y0, float x1, float y1) : x0(x0), y0(y0), x1(x1), y1(y1) {}
+};
 
+// A matrix of pixels
+class Image : public PixelImage<FormatRGB8>
+{
+public:
 	// Constructors
 	Image();
 	Image(unsigned int width, unsigned int height);
 	Image(const Image& c);
+	Image(Image&& c) noexcept;
 	Image& operator = (const Image& c); // Assign operator
+	Image& operator = (Image&& c) noexcept; // Takes the pixels (and mip pyramid) of c, which is left empty
 
 	// Destructor
 	~Image();
 
 	void Render();
 
-	// Get the pixel at position x,y
-	Color GetPixel(unsigned int x, unsigned int y) const { return pixels[ y * width + x ]; }
-	Color& GetPixelRef(unsigned int x, unsigned int y)	{ return pixels[ y * width + x ]; }
+	// Get the pixel at position x,y (GetPixel, GetPixelRef and SetPixel come from PixelImage)
 	Color GetPixelSafe(unsigned int x, unsigned int y) const {	
 		x = clamp((unsigned int)x, 0, width-1); 
 		y = clamp((unsigned int)y, 0, height-1); 
-		return pixels[ y * width + x ]; 
+		return GetPixel(x, y); 
 	}
+	// Draws image with its top-left corner at x,y (clipped). The RGBAImage one blends it and expects its colours premultiplied
+	// by their alpha (see PremultiplyAlpha), see Blitter for more ways to draw
 	void DrawImage(const Image& image, int x, int y);
-
-	// Set the pixel at position x,y with value C
-	void SetPixel(unsigned int x, unsigned int y, const Color& c) { if(x < 0 || x > width-1) return; if(y < 0 || y > height-1) return; pixels[ y * width + x ] = c; }
-	inline void SetPixelUnsafe(unsigned int x, unsigned int y, const Color& c) { pixels[ y * width + x ] = c; }
+	void DrawImage(const RGBAImage& image, int x, int y);
 
 	void Resize(unsigned int width, unsigned int height);
-	void Scale(unsigned int width, unsigned int height);
-	void DrawLineDDA(int x0, int y0, int x1, int y1, const Color& c);
-	void ScanLineDDA(int x0, int y0, int x1, int y1, std::vector<Cell>& edgeTable);
+	void Scale(unsigned int width, unsigned int height, eScaleFilter filter = eScaleFilter::BILINEAR);
+
+	// Writes this image scaled to the size of destination, reusing its pixels (nothing is allocated once the
+	// weights for these sizes exist)
+	void ScaleTo(Image& destination, eScaleFilter filter = eScaleFilter::BILINEAR) const;
+	// Integer Bresenham line. The part outside the image is clipped away (Cohen-Sutherland) before stepping, and the
+	// pixels are written straight into the rows. DrawLineDDA is the same line, kept for the older callers
+	void DrawLine(int x0, int y0, int x1, int y1, const Color& c);
+	void DrawLineDDA(int x0, int y0, int x1, int y1, const Color& c) { DrawLine(x0, y0, x1, y1, c); }
+
+	// Xiaolin Wu's anti-aliased line: the two pixels across the line at every step are blended with c by their coverage
+	void DrawLineAA(float x0, float y0, float x1, float y1, const Color& c);
+
+	// Many segments of one colour: anti-aliased, or with the ends truncated to integers for DrawLine
+	void DrawLines(const LineSegment* segments, int count, const Color& c, bool antialiased = false);
+
 	void DrawRect(int x, int y, int w, int h, const Color& borderColor,
 		int borderWidth, bool isFilled, const Color& fillColor);
 	void DrawTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& borderColor, bool isFilled, const Color& fillColor);
+
+	// Fills the polygon with count vertices (convex or not), the pixels whose centre is inside (see PolygonFiller)
+	void FillPolygon(const Vector2* vertices, int count, const Color& c, eFillRule rule = eFillRule::NON_ZERO);
 	
 	void FlipY(); // Flip the image top-down
 
-	// Fill the image with the color C
-	void Fill(const Color& c) { for(unsigned int pos = 0; pos < width*height; ++pos) pixels[pos] = c; }
+	// Copies the w x h area at x,y of an image of the same size into the same place of this one (clipped to both images)
+	void CopyArea(const Image& source, int x, int y, int w, int h);
 
 	// Returns a new image with the area from (startx,starty) of size width,height
 	Image GetArea(unsigned int start_x, unsigned int start_y, unsigned int width, unsigned int height);
 
-	// Save or load images from the hard drive
+	// Mip pyramid used when the image is a texture of the rasterizer: level i (from 1) is half the size of level i-1,
+	// down to 1x1. It is built on the first call and kept until the size or the file changes; call InvalidateMipmaps
+	// after drawing into an image that is already used as a texture
+	const std::vector<Image>& GetMipmaps();
+	void InvalidateMipmaps();
+
+	// Save or load images from the hard drive (the alpha of PNG files is dropped, see the RGBAImage version)
 	bool LoadPNG(const char* filename, bool flip_y = true);
 	bool LoadTGA(const char* filename, bool flip_y = false);
-	bool SaveTGA(const char* filename);
+	// Row 0 is the bottom of the picture, as in SavePNG (LoadTGA with flip_y gives the same image back). The rows are
+	// run-length encoded when rle (LoadTGA reads both kinds, see tgacodec.h)
+	bool SaveTGA(const char* filename, bool rle = true);
+	// level goes from 0 (stored) to 9 (smallest), the pieces of the file are compressed on the thread pool when parallel
+	bool SavePNG(const char* filename, int level = 6, bool parallel = true);
 
 	// Used to easy code
 	#ifndef IGNORE_LAMBDAS
@@ -95,50 +130,25 @@ public:
 	template <typename F>
 	Image& ForEachPixel( F callback )
 	{
-		for(unsigned int pos = 0; pos < width*height; ++pos)
-			pixels[pos] = callback(pixels[pos]);
+		for(unsigned int y = 0; y < height; ++y)
+			for(unsigned int x = 0; x < width; ++x)
+				GetPixelRef(x, y) = callback(GetPixel(x, y));
 		return *this;
 	}
 
 	
 	float getArea(Vector2 a, Vector2 b, Vector2 c); //helper
 
+	// inv_w are the 1/w of the three vertices, when given the texture coordinates are interpolated with perspective
 	void DrawTriangleInterpolated(const Vector3& p0, const Vector3& p1, const Vector3& p2,
 		const Color& c0, const Color& c1, const Color& c2, FloatImage* zbuffer,
-		Image* texture, const Vector2& uv0, const Vector2& uv1, const Vector2& uv2);
+		Image* texture, const Vector2& uv0, const Vector2& uv1, const Vector2& uv2, const float* inv_w = nullptr);
 
 	#endif
-};
-
-// Image storing one float per pixel instead of a 3 or 4 component Color
-
-class FloatImage
-{
-public:
-	unsigned int width;
-	unsigned int height;
-	float* pixels;
-
-	// CONSTRUCTORS 
-	FloatImage() { width = height = 0; pixels = NULL; }
-	FloatImage(unsigned int width, unsigned int height);
-	FloatImage(const FloatImage& c);
-	FloatImage& operator = (const FloatImage& c); //assign operator
-
-	//destructor
-	~FloatImage();
-
-	void Fill(const float& v) { for (unsigned int pos = 0; pos < width * height; ++pos) pixels[pos] = v; }
-
-	//get the pixel at position x,y
-	float GetPixel(unsigned int x, unsigned int y) const { return pixels[y * width + x]; }
-	float& GetPixelRef(unsigned int x, unsigned int y) { return pixels[y * width + x]; }
-
-	//set the pixel at position x,y with value C
-	void SetPixel(unsigned int x, unsigned int y, const float& v) { if (x < 0 || x > width - 1) return; if (y < 0 || y > height - 1) return; pixels[y * width + x] = v; }
-	inline void SetPixelUnsafe(unsigned int x, unsigned int y, const float& v) { pixels[y * width + x] = v; }
-
-	void Resize(unsigned int width, unsigned int height);
-
 
+private:
+	std::vector<Image>* mipmaps = nullptr;
 };
+
+// Loads a PNG keeping its alpha channel (opaque when the file has none)
+bool LoadPNG(const char* filename, RGBAImage& image, bool flip_y = true);
@@ -0,0 +1,511 @@
+#include "imagefilter.h"
+#include "threadpool.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef CG_SIMD
+bool ImageFilter::use_simd = true;
+#else
+bool ImageFilter::use_simd = false;
+#endif
+
+// Jobs per thread, each one takes a run of tiles and reuses its buffers for all of them
+static const int JOBS_PER_THREAD = 4;
+
+// Source index read for index i of an axis of n samples, -1 for a zero
+static int BorderIndex(int i, int n, eBorderMode border)
+{
+	if (i >= 0 && i < n)
+		return i;
+
+	switch (border)
+	{
+	case eBorderMode::CLAMP:
+		return i < 0 ? 0 : n - 1;
+	case eBorderMode::MIRROR:
+	{
+		if (n == 1)
+			return 0;
+		int period = 2 * n - 2;
+		i = std::abs(i) % period;
+		return i < n ? i : period - i;
+	}
+	case eBorderMode::WRAP:
+		return ((i % n) + n) % n;
+	case eBorderMode::ZERO:
+		return -1;
+	}
+	return -1;
+}
+
+// out[i] = sum of weights[k] * in[offsets[k] + i], for i in [0, count)
+static void WeightedSum(const float* in, const int* offsets, const float* weights, int taps, float* out, int count)
+{
+	int i = 0;
+#ifdef CG_SIMD
+	if (ImageFilter::use_simd)
+	{
+		// Four independent sums at once, so the additions of one do not wait for the previous one
+		for (; i + 4 * CG_SIMD_WIDTH <= count; i += 4 * CG_SIMD_WIDTH)
+		{
+			vfloat sum0 = simdSplat(0.0f), sum1 = sum0, sum2 = sum0, sum3 = sum0;
+			for (int k = 0; k < taps; ++k)
+			{
+				vfloat w = simdSplat(weights[k]);
+				const float* p = in + offsets[k] + i;
+				sum0 = simdAdd(sum0, simdMul(w, simdLoad(p)));
+				sum1 = simdAdd(sum1, simdMul(w, simdLoad(p + CG_SIMD_WIDTH)));
+				sum2 = simdAdd(sum2, simdMul(w, simdLoad(p + 2 * CG_SIMD_WIDTH)));
+				sum3 = simdAdd(sum3, simdMul(w, simdLoad(p + 3 * CG_SIMD_WIDTH)));
+			}
+			simdStore(out + i, sum0);
+			simdStore(out + i + CG_SIMD_WIDTH, sum1);
+			simdStore(out + i + 2 * CG_SIMD_WIDTH, sum2);
+			simdStore(out + i + 3 * CG_SIMD_WIDTH, sum3);
+		}
+		for (; i + CG_SIMD_WIDTH <= count; i += CG_SIMD_WIDTH)
+		{
+			vfloat sum = simdSplat(0.0f);
+			for (int k = 0; k < taps; ++k)
+				sum = simdAdd(sum, simdMul(simdSplat(weights[k]), simdLoad(in + offsets[k] + i)));
+			simdStore(out + i, sum);
+		}
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		float sum = 0.0f;
+		for (int k = 0; k < taps; ++k)
+			sum = sum + weights[k] * in[offsets[k] + i];
+		out[i] = sum;
+	}
+}
+
+// Pixels [begin, end) of row y of the plane as floats
+static void LoadRun(const ImageFilter::Plane& plane, int y, int begin, int end, float* out)
+{
+	size_t first = ((size_t)y * plane.pitch + begin) * plane.channels;
+	int count = (end - begin) * plane.channels;
+	if (plane.floats)
+	{
+		memcpy(out, plane.floats + first, count * sizeof(float));
+		return;
+	}
+
+	const unsigned char* in = plane.bytes + first;
+	int i = 0;
+#ifdef CG_SIMD
+	if (ImageFilter::use_simd)
+		for (; i + CG_SIMD_WIDTH <= count; i += CG_SIMD_WIDTH)
+			simdStore(out + i, simdLoadBytes(in + i));
+#endif
+	for (; i < count; ++i)
+		out[i] = (float)in[i];
+}
+
+// Pixels [x0, x0 + count) of row y of the plane from floats, rounded and clamped to bytes for an Image
+static void StoreRun(ImageFilter::Plane& plane, int y, int x0, int count, const float* in)
+{
+	size_t first = ((size_t)y * plane.pitch + x0) * plane.channels;
+	count *= plane.channels;
+	if (plane.floats)
+	{
+		memcpy(plane.floats + first, in, count * sizeof(float));
+		return;
+	}
+
+	unsigned char* out = plane.bytes + first;
+	int i = 0;
+#ifdef CG_SIMD
+	if (ImageFilter::use_simd)
+	{
+		vfloat zero = simdSplat(0.0f), max = simdSplat(255.0f), half = simdSplat(0.5f);
+		for (; i + CG_SIMD_WIDTH <= count; i += CG_SIMD_WIDTH)
+			simdStoreBytes(out + i, simdTruncate(simdAdd(simdMin(simdMax(simdLoad(in + i), zero), max), half)));
+	}
+#endif
+	for (; i < count; ++i)
+		out[i] = (unsigned char)(int)(std::min(std::max(in[i], 0.0f), 255.0f) + 0.5f);
+}
+
+static ImageFilter::Plane GetPlane(const Image& image)
+{
+	ImageFilter::Plane plane;
+	plane.width = (int)image.width;
+	plane.height = (int)image.height;
+	plane.channels = 3;
+	plane.pitch = (int)image.pitch;
+	plane.bytes = (unsigned char*)image.pixels;
+	return plane;
+}
+
+static ImageFilter::Plane GetPlane(const FloatImage& image)
+{
+	ImageFilter::Plane plane;
+	plane.width = (int)image.width;
+	plane.height = (int)image.height;
+	plane.channels = 1;
+	plane.pitch = (int)image.pitch;
+	plane.floats = image.pixels;
+	return plane;
+}
+
+// Gives destination the size of source, false when there is nothing to filter
+static bool PrepareDestination(const Image& source, Image& destination)
+{
+	if (&source == &destination)
+	{
+		std::cerr << "ImageFilter: the destination cannot be the source" << std::endl;
+		return false;
+	}
+	if (!source.pixels || !source.width || !source.height)
+		return false;
+	if (destination.width != source.width || destination.height != source.height || !destination.pixels)
+		destination.Resize(source.width, source.height);
+	destination.InvalidateMipmaps();
+	return true;
+}
+
+static bool PrepareDestination(const FloatImage& source, FloatImage& destination)
+{
+	if (&source == &destination)
+	{
+		std::cerr << "ImageFilter: the destination cannot be the source" << std::endl;
+		return false;
+	}
+	if (!source.pixels || !source.width || !source.height)
+		return false;
+	if (destination.width != source.width || destination.height != source.height || !destination.pixels)
+		destination.Resize(source.width, source.height);
+	return true;
+}
+
+static void GaussianWeights(float sigma, std::vector<float>& weights)
+{
+	int radius = sigma > 0.0f ? (int)ceil(3.0f * sigma) : 0;
+	weights.resize(2 * radius + 1);
+
+	double total = 0.0;
+	std::vector<double> values(weights.size());
+	for (int k = -radius; k <= radius; ++k)
+	{
+		values[k + radius] = radius ? exp(-(double)(k * k) / (2.0 * sigma * sigma)) : 1.0;
+		total += values[k + radius];
+	}
+	for (size_t k = 0; k < weights.size(); ++k)
+		weights[k] = (float)(values[k] / total);
+}
+
+static void SharpenWeights(float amount, std::vector<float>& weights)
+{
+	float a = -amount;
+	float c = 1.0f + 4.0f * amount;
+	const float kernel[9] = { 0.0f, a, 0.0f, a, c, a, 0.0f, a, 0.0f };
+	weights.assign(kernel, kernel + 9);
+}
+
+void ImageFilter::FilterTile(const Kernel& kernel, const Plane& source, Plane& destination, Plane* gradient_x, Plane* gradient_y,
+	eBorderMode border, int x0, int y0, int x1, int y1, Scratch& buffers)
+{
+	const int r = kernel.radius;
+	const int channels = source.channels;
+	const int tile_width = x1 - x0;
+	const int tile_height = y1 - y0;
+	const int row_floats = (tile_width + 2 * r) * channels;	// One row of the input, with the border around the tile
+	const int out_floats = tile_width * channels;
+	const int input_rows = tile_height + 2 * r;
+
+	// Source pixels read by the tile, the ones outside the image already replaced by the border values
+	std::vector<float>& input = buffers.input;
+	if (input.size() < (size_t)row_floats * input_rows)
+		input.resize((size_t)row_floats * input_rows);
+
+	int inside_begin = std::max(x0 - r, 0);
+	int inside_end = std::min(x1 + r, source.width);
+	for (int j = 0; j < input_rows; ++j)
+	{
+		float* row = input.data() + (size_t)j * row_floats;
+		int sy = BorderIndex(y0 - r + j, source.height, border);
+		if (sy < 0)
+		{
+			std::fill(row, row + row_floats, 0.0f);
+			continue;
+		}
+
+		LoadRun(source, sy, inside_begin, inside_end, row + (inside_begin - (x0 - r)) * channels);
+		for (int x = x0 - r; x < x1 + r; ++x)
+		{
+			if (x >= inside_begin && x < inside_end)
+			{
+				x = inside_end - 1;
+				continue;
+			}
+			int sx = BorderIndex(x, source.width, border);
+			float* pixel = row + (x - (x0 - r)) * channels;
+			if (sx < 0)
+				std::fill(pixel, pixel + channels, 0.0f);
+			else
+				LoadRun(source, sy, sx, sx + 1, pixel);
+		}
+	}
+
+	std::vector<int>& offsets = buffers.offsets;
+	std::vector<float>& taps = buffers.taps;
+	if (buffers.output.size() < (size_t)out_floats)
+	{
+		buffers.output.resize(out_floats);
+		buffers.output_y.resize(out_floats);
+	}
+	float* output = buffers.output.data();
+	float* output_y = buffers.output_y.data();
+	const int size = 2 * r + 1;
+
+	if (kernel.separable)
+	{
+		// Along x for every input row, then along y for every output row
+		std::vector<float>& pass = buffers.pass;
+		if (pass.size() < (size_t)out_floats * input_rows)
+			pass.resize((size_t)out_floats * input_rows);
+
+		offsets.resize(size);
+		for (int k = 0; k < size; ++k)
+			offsets[k] = k * channels;
+		for (int j = 0; j < input_rows; ++j)
+			WeightedSum(input.data() + (size_t)j * row_floats, offsets.data(), kernel.weights.data(), size, pass.data() + (size_t)j * out_floats, out_floats);
+
+		for (int k = 0; k < size; ++k)
+			offsets[k] = k * out_floats;
+		for (int j = 0; j < tile_height; ++j)
+		{
+			WeightedSum(pass.data() + (size_t)j * out_floats, offsets.data(), kernel.weights.data(), size, output, out_floats);
+			StoreRun(destination, y0 + j, x0, tile_width, output);
+		}
+		return;
+	}
+
+	// Only the weights that are not zero are applied
+	int count_x = 0;
+	offsets.clear();
+	taps.clear();
+	for (int ky = 0; ky < size; ++ky)
+		for (int kx = 0; kx < size; ++kx)
+			if (kernel.weights[ky * size + kx] != 0.0f)
+			{
+				offsets.push_back(ky * row_floats + kx * channels);
+				taps.push_back(kernel.weights[ky * size + kx]);
+				count_x++;
+			}
+	if (kernel.sobel)
+		for (int ky = 0; ky < size; ++ky)
+			for (int kx = 0; kx < size; ++kx)
+				if (kernel.weights_y[ky * size + kx] != 0.0f)
+				{
+					offsets.push_back(ky * row_floats + kx * channels);
+					taps.push_back(kernel.weights_y[ky * size + kx]);
+				}
+	int count_y = (int)taps.size() - count_x;
+
+	for (int j = 0; j < tile_height; ++j)
+	{
+		const float* row = input.data() + (size_t)j * row_floats;
+		WeightedSum(row, offsets.data(), taps.data(), count_x, output, out_floats);
+		if (!kernel.sobel)
+		{
+			StoreRun(destination, y0 + j, x0, tile_width, output);
+			continue;
+		}
+
+		WeightedSum(row, offsets.data() + count_x, taps.data() + count_x, count_y, output_y, out_floats);
+		if (gradient_x)
+			StoreRun(*gradient_x, y0 + j, x0, tile_width, output);
+		if (gradient_y)
+			StoreRun(*gradient_y, y0 + j, x0, tile_width, output_y);
+
+		// Length of the gradient, written over the x gradient
+		int i = 0;
+#ifdef CG_SIMD
+		if (use_simd)
+			for (; i + CG_SIMD_WIDTH <= out_floats; i += CG_SIMD_WIDTH)
+			{
+				vfloat gx = simdLoad(output + i);
+				vfloat gy = simdLoad(output_y + i);
+				simdStore(output + i, simdSqrt(simdAdd(simdMul(gx, gx), simdMul(gy, gy))));
+			}
+#endif
+		for (; i < out_floats; ++i)
+			output[i] = sqrtf(output[i] * output[i] + output_y[i] * output_y[i]);
+		StoreRun(destination, y0 + j, x0, tile_width, output);
+	}
+}
+
+void ImageFilter::Run(const Kernel& kernel, const Plane& source, Plane& destination, Plane* gradient_x, Plane* gradient_y, eBorderMode border)
+{
+	int tiles_x = (source.width + TILE_WIDTH - 1) / TILE_WIDTH;
+	int tiles_y = (source.height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+	int tiles = tiles_x * tiles_y;
+	int jobs = std::min(tiles, (int)ThreadPool::Get()->GetNumThreads() * JOBS_PER_THREAD);
+	if ((int)scratch.size() < jobs)
+		scratch.resize(jobs);
+
+	// Every job takes a run of tiles in row order, so the tiles of a job share the rows they read
+	ThreadPool::Get()->ParallelFor(jobs, [&](int job) {
+		int begin = (int)((long long)tiles * job / jobs);
+		int end = (int)((long long)tiles * (job + 1) / jobs);
+		for (int tile = begin; tile < end; ++tile)
+		{
+			int x0 = (tile % tiles_x) * TILE_WIDTH;
+			int y0 = (tile / tiles_x) * TILE_HEIGHT;
+			int x1 = std::min(x0 + TILE_WIDTH, source.width);
+			int y1 = std::min(y0 + TILE_HEIGHT, source.height);
+			FilterTile(kernel, source, destination, gradient_x, gradient_y, border, x0, y0, x1, y1, scratch[job]);
+		}
+	});
+}
+
+void ImageFilter::GaussianBlur(const Image& source, Image& destination, float sigma, eBorderMode border)
+{
+	if (!PrepareDestination(source, destination))
+		return;
+	Kernel kernel;
+	kernel.separable = true;
+	GaussianWeights(sigma, kernel.weights);
+	kernel.radius = (int)kernel.weights.size() / 2;
+	Plane out = GetPlane(destination);
+	Run(kernel, GetPlane(source), out, nullptr, nullptr, border);
+}
+
+void ImageFilter::GaussianBlur(const FloatImage& source, FloatImage& destination, float sigma, eBorderMode border)
+{
+	if (!PrepareDestination(source, destination))
+		return;
+	Kernel kernel;
+	kernel.separable = true;
+	GaussianWeights(sigma, kernel.weights);
+	kernel.radius = (int)kernel.weights.size() / 2;
+	Plane out = GetPlane(destination);
+	Run(kernel, GetPlane(source), out, nullptr, nullptr, border);
+}
+
+void ImageFilter::BoxBlur(const Image& source, Image& destination, int radius, eBorderMode border)
+{
+	if (!PrepareDestination(source, destination))
+		return;
+	Kernel kernel;
+	kernel.separable = true;
+	kernel.radius = std::max(radius, 0);
+	kernel.weights.assign(2 * kernel.radius + 1, 1.0f / (2 * kernel.radius + 1));
+	Plane out = GetPlane(destination);
+	Run(kernel, GetPlane(source), out, nullptr, nullptr, border);
+}
+
+void ImageFilter::BoxBlur(const FloatImage& source, FloatImage& destination, int radius, eBorderMode border)
+{
+	if (!PrepareDestination(source, destination))
+		return;
+	Kernel kernel;
+	kernel.separable = true;
+	kernel.radius = std::max(radius, 0);
+	kernel.weights.assign(2 * kernel.radius + 1, 1.0f / (2 * kernel.radius + 1));
+	Plane out = GetPlane(destination);
+	Run(kernel, GetPlane(source), out, nullptr, nullptr, border);
+}
+
+void ImageFilter::Sharpen(const Image& source, Image& destination, float amount, eBorderMode border)
+{
+	if (!PrepareDestination(source, destination))
+		return;
+	Kernel kernel;
+	kernel.radius = 1;
+	SharpenWeights(amount, kernel.weights);
+	Plane out = GetPlane(destination);
+	Run(kernel, GetPlane(source), out, nullptr, nullptr, border);
+}
+
+void ImageFilter::Sharpen(const FloatImage& source, FloatImage& destination, float amount, eBorderMode border)
+{
+	if (!PrepareDestination(source, destination))
+		return;
+	Kernel kernel;
+	kernel.radius = 1;
+	SharpenWeights(amount, kernel.weights);
+	Plane out = GetPlane(destination);
+	Run(kernel, GetPlane(source), out, nullptr, nullptr, border);
+}
+
+void ImageFilter::Convolve(const Image& source, Image& destination, const float* weights, int size, eBorderMode border)
+{
+	if (size != 3 && size != 5)
+	{
+		std::cerr << "ImageFilter: only 3x3 and 5x5 kernels are supported" << std::endl;
+		return;
+	}
+	if (!PrepareDestination(source, destination))
+		return;
+	Kernel kernel;
+	kernel.radius = size / 2;
+	kernel.weights.assign(weights, weights + size * size);
+	Plane out = GetPlane(destination);
+	Run(kernel, GetPlane(source), out, nullptr, nullptr, border);
+}
+
+void ImageFilter::Convolve(const FloatImage& source, FloatImage& destination, const float* weights, int size, eBorderMode border)
+{
+	if (size != 3 && size != 5)
+	{
+		std::cerr << "ImageFilter: only 3x3 and 5x5 kernels are supported" << std::endl;
+		return;
+	}
+	if (!PrepareDestination(source, destination))
+		return;
+	Kernel kernel;
+	kernel.radius = size / 2;
+	kernel.weights.assign(weights, weights + size * size);
+	Plane out = GetPlane(destination);
+	Run(kernel, GetPlane(source), out, nullptr, nullptr, border);
+}
+
+static const float SOBEL_X[9] = { -1.0f, 0.0f, 1.0f, -2.0f, 0.0f, 2.0f, -1.0f, 0.0f, 1.0f };
+static const float SOBEL_Y[9] = { -1.0f, -2.0f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 2.0f, 1.0f };
+
+void ImageFilter::Sobel(const Image& source, Image& destination, eBorderMode border)
+{
+	if (!PrepareDestination(source, destination))
+		return;
+	Kernel kernel;
+	kernel.radius = 1;
+	kernel.sobel = true;
+	kernel.weights.assign(SOBEL_X, SOBEL_X + 9);
+	kernel.weights_y.assign(SOBEL_Y, SOBEL_Y + 9);
+	Plane out = GetPlane(destination);
+	Run(kernel, GetPlane(source), out, nullptr, nullptr, border);
+}
+
+void ImageFilter::Sobel(const FloatImage& source, FloatImage& magnitude, FloatImage* gradient_x, FloatImage* gradient_y, eBorderMode border)
+{
+	if (!PrepareDestination(source, magnitude))
+		return;
+	if (gradient_x && !PrepareDestination(source, *gradient_x))
+		return;
+	if (gradient_y && !PrepareDestination(source, *gradient_y))
+		return;
+	Kernel kernel;
+	kernel.radius = 1;
+	kernel.sobel = true;
+	kernel.weights.assign(SOBEL_X, SOBEL_X + 9);
+	kernel.weights_y.assign(SOBEL_Y, SOBEL_Y + 9);
+	Plane out = GetPlane(magnitude);
+	Plane out_x, out_y;
+	if (gradient_x)
+		out_x = GetPlane(*gradient_x);
+	if (gradient_y)
+		out_y = GetPlane(*gradient_y);
+	Run(kernel, GetPlane(source), out, gradient_x ? &out_x : nullptr, gradient_y ? &out_y : nullptr, border);
+}
+
+ImageFilter* ImageFilter::Get()
+{
+	static ImageFilter filter;
+	return &filter;
+}
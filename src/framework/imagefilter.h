@@ -0,0 +1,100 @@
+/*
+	+ This class applies neighbourhood filters (Gaussian and box blur, sharpen, Sobel gradients and any 3x3 or 5x5 kernel) to an
+	  Image, each of r, g and b on its own, or to a FloatImage.
+	+ The destination is split in tiles. Every tile copies the source pixels it reads, borders included, to a float buffer,
+	  so the kernels never test for the edge of the image and the data they touch stays in cache. Tiles run on the thread pool.
+	+ Every output value is a sum of weighted inputs, computed CG_SIMD_WIDTH values at a time; the scalar path does the same
+	  operations in the same order, so both give the same bits.
+	+ The scratch buffers are shared, so the filters must not be called from several threads at once.
+*/
+
+#pragma once
+
+#include <vector>
+#include "image.h"
+
+// Value of the pixels outside the image: the closest edge pixel, the image mirrored at the edge (without repeating
+// the edge pixel), the image repeated, or zero
+enum class eBorderMode {
+	CLAMP,
+	MIRROR,
+	WRAP,
+	ZERO
+};
+
+class ImageFilter
+{
+public:
+	static const int TILE_WIDTH = 128;
+	static const int TILE_HEIGHT = 64;
+
+	// Use the vectorized loops
+	static bool use_simd;
+
+	// Pixels of an Image (3 bytes per pixel) or a FloatImage (1 float per pixel)
+	struct Plane
+	{
+		int width = 0;
+		int height = 0;
+		int channels = 1;
+		int pitch = 0;	// Pixels per row
+		unsigned char* bytes = nullptr;
+		float* floats = nullptr;
+	};
+
+	// The destination is resized to the size of the source when needed and must not be the source
+
+	// Separable blur with a kernel of radius ceil(3 * sigma)
+	void GaussianBlur(const Image& source, Image& destination, float sigma, eBorderMode border = eBorderMode::CLAMP);
+	void GaussianBlur(const FloatImage& source, FloatImage& destination, float sigma, eBorderMode border = eBorderMode::CLAMP);
+
+	// Mean of the (2 * radius + 1)^2 pixels around every pixel
+	void BoxBlur(const Image& source, Image& destination, int radius, eBorderMode border = eBorderMode::CLAMP);
+	void BoxBlur(const FloatImage& source, FloatImage& destination, int radius, eBorderMode border = eBorderMode::CLAMP);
+
+	// Adds amount times the difference between every pixel and its four neighbours
+	void Sharpen(const Image& source, Image& destination, float amount = 1.0f, eBorderMode border = eBorderMode::CLAMP);
+	void Sharpen(const FloatImage& source, FloatImage& destination, float amount = 1.0f, eBorderMode border = eBorderMode::CLAMP);
+
+	// size x size kernel (3 or 5): kernel[ky * size + kx] weights the pixel at (x + kx - size / 2, y + ky - size / 2)
+	void Convolve(const Image& source, Image& destination, const float* kernel, int size, eBorderMode border = eBorderMode::CLAMP);
+	void Convolve(const FloatImage& source, FloatImage& destination, const float* kernel, int size, eBorderMode border = eBorderMode::CLAMP);
+
+	// Gradient magnitude of the Sobel operator (per channel for an Image, clamped to 255). For a FloatImage the
+	// gradients along x and y can also be kept
+	void Sobel(const Image& source, Image& destination, eBorderMode border = eBorderMode::CLAMP);
+	void Sobel(const FloatImage& source, FloatImage& magnitude, FloatImage* gradient_x = nullptr, FloatImage* gradient_y = nullptr,
+		eBorderMode border = eBorderMode::CLAMP);
+
+	// Filter library shared by the application and the tools
+	static ImageFilter* Get();
+
+private:
+	// Weights of the filter: separable ones have 2 * radius + 1 weights applied along x and then y, the rest
+	// (2 * radius + 1)^2 weights. Sobel applies weights and weights_y, and keeps the length of the two results
+	struct Kernel
+	{
+		int radius = 0;
+		bool separable = false;
+		bool sobel = false;
+		std::vector<float> weights;
+		std::vector<float> weights_y;
+	};
+
+	// Buffers of one job, reused by all its tiles
+	struct Scratch
+	{
+		std::vector<float> input;
+		std::vector<float> pass;
+		std::vector<float> output;
+		std::vector<float> output_y;
+		std::vector<int> offsets;
+		std::vector<float> taps;
+	};
+
+	std::vector<Scratch> scratch;
+
+	void Run(const Kernel& kernel, const Plane& source, Plane& destination, Plane* gradient_x, Plane* gradient_y, eBorderMode border);
+	void FilterTile(const Kernel& kernel, const Plane& source, Plane& destination, Plane* gradient_x, Plane* gradient_y,
+		eBorderMode border, int x0, int y0, int x1, int y1, Scratch& buffers);
+};
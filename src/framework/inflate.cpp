@@ -0,0 +1,459 @@
+#include "inflate.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+
+static const size_t WINDOW_SIZE = 32768;	// Farthest distance of a match
+static const size_t CHUNK_SIZE = 262144;	// Output decoded at least on every refill of the buffer
+static const size_t MAX_MATCH = 258;
+static const size_t SLACK = MAX_MATCH + 16;	// Room past the limit for the last match and the 8-byte copies
+
+// Base and extra bits of the length symbols 257 to 285 and of the distance symbols 0 to 29
+static const uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// Order in which the lengths of the code length code are stored
+static const uint8_t CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static bool Fail(const char* reason)
+{
+	std::cerr << "--- Inflate: " << reason << std::endl;
+	return false;
+}
+
+bool Inflater::HuffmanTable::Build(const unsigned char* lengths, int count)
+{
+	memset(counts, 0, sizeof(counts));
+	for (int i = 0; i < count; ++i)
+		counts[lengths[i]]++;
+	counts[0] = 0;
+
+	// Over-subscribed codes are invalid, incomplete ones are allowed (a distance code may have a single symbol)
+	int left = 1;
+	for (int length = 1; length < 16; ++length)
+	{
+		left = (left << 1) - counts[length];
+		if (left < 0)
+			return false;
+	}
+
+	uint16_t offsets[16];
+	offsets[1] = 0;
+	for (int length = 1; length < 15; ++length)
+		offsets[length + 1] = offsets[length] + counts[length];
+	for (int i = 0; i < count; ++i)
+		if (lengths[i])
+			symbols[offsets[lengths[i]]++] = (uint16_t)i;
+
+	// Codes are read from the lowest bit, so every short code fills the entries that start with its reversed bits
+	memset(fast, 0, sizeof(fast));
+	int code = 0, index = 0;
+	for (int length = 1; length <= FAST_BITS; ++length)
+	{
+		for (int i = 0; i < counts[length]; ++i, ++code)
+		{
+			int reversed = 0;
+			for (int b = 0; b < length; ++b)
+				reversed |= ((code >> b) & 1) << (length - 1 - b);
+			uint16_t entry = (uint16_t)(symbols[index++] | length << 9);
+			for (int j = reversed; j < (1 << FAST_BITS); j += 1 << length)
+				fast[j] = entry;
+		}
+		code <<= 1;
+	}
+	return true;
+}
+
+void Inflater::Begin(size_t max_read)
+{
+	pieces.clear();
+	next_piece = 0;
+	next = end = nullptr;
+	bits = 0;
+	count = 0;
+	padding = 0;
+	state = eBlockState::HEADER;
+	last_block = false;
+	header_read = false;
+	stored_left = 0;
+
+	// After a refill the buffer keeps the window or the unread bytes (less than max_read), and has room for a chunk more
+	buffer.resize(WINDOW_SIZE + 2 * max_read + CHUNK_SIZE + SLACK);
+	out_pos = read_pos = limit = 0;
+}
+
+void Inflater::AddInput(const unsigned char* data, size_t size)
+{
+	Piece piece = { data, size };
+	pieces.push_back(piece);
+}
+
+bool Inflater::Read(const unsigned char*& bytes, size_t count)
+{
+	if (out_pos - read_pos < count)
+	{
+		// Drop what is behind both the window and the read position, then decode until the buffer is full
+		size_t keep = out_pos > WINDOW_SIZE ? std::min(read_pos, out_pos - WINDOW_SIZE) : 0;
+		if (keep)
+		{
+			memmove(&buffer[0], &buffer[keep], out_pos - keep);
+			out_pos -= keep;
+			read_pos -= keep;
+		}
+		limit = buffer.size() - SLACK;
+		if (!Decode())
+			return false;
+		if (out_pos - read_pos < count)
+			return Fail("stream ends too early");
+	}
+
+	bytes = &buffer[read_pos];
+	read_pos += count;
+	return true;
+}
+
+inline void Inflater::Refill()
+{
+	// 8 bytes at once: the bits past the new count are loaded again, with the same values, on the next refill
+	if (end - next >= 8)
+	{
+		uint64_t word;
+		memcpy(&word, next, 8);	// Little-endian
+		bits |= word << count;
+		next += (63 - count) >> 3;
+		count |= 56;
+		return;
+	}
+
+	// Near the end of a piece, byte by byte, then zeros past the end of the last one
+	while (count <= 56)
+	{
+		if (next == end && next_piece < pieces.size())
+		{
+			next = pieces[next_piece].data;
+			end = next + pieces[next_piece].size;
+			next_piece++;
+			continue;
+		}
+		if (next < end)
+			bits |= (uint64_t)*next++ << count;
+		else
+			padding += 8;
+		count += 8;
+	}
+}
+
+inline uint32_t Inflater::GetBits(int n)
+{
+	uint32_t value = (uint32_t)(bits & (((uint64_t)1 << n) - 1));
+	bits >>= n;
+	count -= n;
+	return value;
+}
+
+inline int Inflater::DecodeSymbol(const HuffmanTable& table)
+{
+	int entry = table.fast[bits & ((1 << FAST_BITS) - 1)];
+	if (!entry)
+		return DecodeSlow(table);
+	int length = entry >> 9;
+	bits >>= length;
+	count -= length;
+	return entry & 511;
+}
+
+int Inflater::DecodeSlow(const HuffmanTable& table)
+{
+	// Canonical walk: the codes of each length are consecutive, starting where the ones of the previous length end
+	int code = 0, first = 0, index = 0;
+	for (int length = 1; length < 16; ++length)
+	{
+		code |= (int)((bits >> (length - 1)) & 1);
+		int n = table.counts[length];
+		if (code - first < n)
+		{
+			bits >>= length;
+			count -= length;
+			return table.symbols[index + code - first];
+		}
+		index += n;
+		first = (first + n) << 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+bool Inflater::ReadZlibHeader()
+{
+	Refill();
+	uint32_t method = GetBits(8), flags = GetBits(8);
+	if (padding > count)
+		return Fail("no zlib header");
+	if ((method * 256 + flags) % 31 != 0 || (method & 15) != 8 || (method >> 4) > 7)
+		return Fail("not a deflate stream");
+	if (flags & 32)
+		return Fail("preset dictionaries are not supported");
+	return true;
+}
+
+bool Inflater::ReadBlockHeader()
+{
+	Refill();
+	last_block = GetBits(1) != 0;
+	uint32_t type = GetBits(2);
+	if (padding > count)
+		return Fail("stream ends too early");
+
+	if (type == 0)
+	{
+		// Stored: aligned to a byte, then the length and its complement
+		GetBits(count & 7);
+		uint32_t length = GetBits(16), complement = GetBits(16);
+		if (padding > count)
+			return Fail("stream ends too early");
+		if ((length ^ 0xffff) != complement)
+			return Fail("corrupt stored block");
+		stored_left = length;
+		state = eBlockState::STORED;
+		return true;
+	}
+	if (type == 1)
+	{
+		// Built once, C++11 makes the initialization thread-safe
+		struct FixedTables
+		{
+			HuffmanTable literals, distances;
+			FixedTables()
+			{
+				unsigned char lengths[288];
+				memset(lengths, 8, 144);
+				memset(lengths + 144, 9, 112);
+				memset(lengths + 256, 7, 24);
+				memset(lengths + 280, 8, 8);
+				literals.Build(lengths, 288);
+				memset(lengths, 5, 30);
+				distances.Build(lengths, 30);
+			}
+		};
+		static const FixedTables fixed;
+		literals = fixed.literals;
+		distances = fixed.distances;
+		state = eBlockState::HUFFMAN;
+		return true;
+	}
+	if (type == 2)
+	{
+		if (!ReadDynamicTables())
+			return false;
+		state = eBlockState::HUFFMAN;
+		return true;
+	}
+	return Fail("invalid block type");
+}
+
+bool Inflater::ReadDynamicTables()
+{
+	Refill();
+	int num_literals = (int)GetBits(5) + 257;
+	int num_distances = (int)GetBits(5) + 1;
+	int num_code_lengths = (int)GetBits(4) + 4;
+	if (num_literals > 286 || num_distances > 30)
+		return Fail("too many symbols");
+
+	unsigned char lengths[288 + 32];
+	memset(lengths, 0, 19);
+	for (int i = 0; i < num_code_lengths; ++i)
+	{
+		if (i % 16 == 0)
+			Refill();	// 19 lengths of 3 bits are more than a refill guarantees
+		lengths[CODE_LENGTH_ORDER[i]] = (unsigned char)GetBits(3);
+	}
+
+	HuffmanTable code_lengths;
+	if (!code_lengths.Build(lengths, 19))
+		return Fail("corrupt code length code");
+
+	// Lengths of both codes in one run, the repeats may cross from one to the other
+	int total = num_literals + num_distances;
+	for (int i = 0; i < total;)
+	{
+		Refill();
+		int symbol = DecodeSymbol(code_lengths);
+		if (symbol < 0)
+			return Fail("corrupt code lengths");
+		if (symbol < 16)
+		{
+			lengths[i++] = (unsigned char)symbol;
+			continue;
+		}
+
+		int repeat = 0;
+		unsigned char value = 0;
+		if (symbol == 16)
+		{
+			if (i == 0)
+				return Fail("corrupt code lengths");
+			value = lengths[i - 1];
+			repeat = 3 + (int)GetBits(2);
+		}
+		else if (symbol == 17)
+			repeat = 3 + (int)GetBits(3);
+		else
+			repeat = 11 + (int)GetBits(7);
+		if (i + repeat > total)
+			return Fail("corrupt code lengths");
+		memset(lengths + i, value, repeat);
+		i += repeat;
+	}
+	if (padding > count)
+		return Fail("stream ends too early");
+
+	if (!lengths[256])
+		return Fail("no end of block code");
+	if (!literals.Build(lengths, num_literals) || !distances.Build(lengths + num_literals, num_distances))
+		return Fail("corrupt Huffman code");
+	return true;
+}
+
+bool Inflater::Decode()
+{
+	if (!header_read)
+	{
+		if (!ReadZlibHeader())
+			return false;
+		header_read = true;
+	}
+
+	while (out_pos < limit)
+	{
+		switch (state)
+		{
+		case eBlockState::HEADER:
+			if (!ReadBlockHeader())
+				return false;
+			break;
+		case eBlockState::STORED:
+			if (!CopyStored())
+				return false;
+			break;
+		case eBlockState::HUFFMAN:
+			if (!DecodeHuffman())
+				return false;
+			break;
+		case eBlockState::END:
+			return true;
+		}
+	}
+	return true;
+}
+
+bool Inflater::CopyStored()
+{
+	// First the whole bytes left in the bit buffer
+	while (stored_left && count >= 8 && out_pos < limit)
+	{
+		buffer[out_pos++] = (unsigned char)GetBits(8);
+		stored_left--;
+	}
+	if (padding > count)
+		return Fail("stream ends too early");
+
+	// Then straight from the input: the bit buffer is empty, but may hold bits of the next byte from the last refill
+	if (stored_left && count == 0)
+	{
+		bits = 0;
+		while (stored_left && out_pos < limit)
+		{
+			if (next == end)
+			{
+				if (next_piece == pieces.size())
+					return Fail("stream ends too early");
+				next = pieces[next_piece].data;
+				end = next + pieces[next_piece].size;
+				next_piece++;
+				continue;
+			}
+			size_t n = std::min(std::min(stored_left, (size_t)(end - next)), limit - out_pos);
+			memcpy(&buffer[out_pos], next, n);
+			next += n;
+			out_pos += n;
+			stored_left -= n;
+		}
+	}
+
+	if (!stored_left)
+		state = last_block ? eBlockState::END : eBlockState::HEADER;
+	return true;
+}
+
+bool Inflater::DecodeHuffman()
+{
+	unsigned char* start = &buffer[0];
+	unsigned char* out = start + out_pos;
+	unsigned char* out_limit = start + limit;
+
+	// One refill per symbol is enough: a length with its distance takes at most 15 + 5 + 15 + 13 = 48 bits
+	while (out < out_limit)
+	{
+		Refill();
+		int symbol = DecodeSymbol(literals);
+		if (symbol < 256)
+		{
+			if (symbol < 0)
+				break;
+			*out++ = (unsigned char)symbol;
+			continue;
+		}
+		if (symbol == 256)
+		{
+			state = last_block ? eBlockState::END : eBlockState::HEADER;
+			break;
+		}
+
+		symbol -= 257;
+		if (symbol >= 29)
+			break;
+		size_t length = LENGTH_BASE[symbol] + GetBits(LENGTH_EXTRA[symbol]);
+		int code = DecodeSymbol(distances);
+		if (code < 0 || code >= 30)
+			break;
+		size_t distance = DISTANCE_BASE[code] + GetBits(DISTANCE_EXTRA[code]);
+		if (distance > (size_t)(out - start))
+		{
+			out_pos = out - start;
+			return Fail("distance too far back");
+		}
+
+		// 8 bytes at a time when the copy does not overlap within them, the overshoot lands in the slack
+		const unsigned char* from = out - distance;
+		unsigned char* copy_end = out + length;
+		if (distance >= 8)
+		{
+			do
+			{
+				memcpy(out, from, 8);
+				out += 8;
+				from += 8;
+			} while (out < copy_end);
+		}
+		else if (distance == 1)
+			memset(out, *from, length);
+		else
+		{
+			do
+				*out++ = *from++;
+			while (out < copy_end);
+		}
+		out = copy_end;
+	}
+
+	out_pos = out - start;
+	if (padding > count)
+		return Fail("stream ends too early");
+	if (out < out_limit && state == eBlockState::HUFFMAN)
+		return Fail("corrupt Huffman data");
+	return true;
+}
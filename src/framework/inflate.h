@@ -0,0 +1,89 @@
+/*
+	+ This class decompresses a zlib stream (deflate, RFC 1950/1951) a piece at a time, as the PNG decoder reads its rows.
+	+ The compressed bits go through a 64-bit buffer refilled 8 bytes at a time, and every Huffman code is decoded with one
+	  lookup in a 1024-entry table (only the codes longer than 10 bits take a slower canonical walk).
+	+ The output goes to a buffer that keeps the last 32 KB (the farthest a match can reach back) plus the bytes that were not
+	  read yet, so memory does not grow with the size of the stream.
+	+ The stream can be split in several pieces (the IDAT chunks of a PNG) that are read in place. The Adler-32 checksum at
+	  the end is not checked.
+*/
+
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+class Inflater
+{
+public:
+	// Starts a new stream: the pieces are added with AddInput and must stay valid until the last Read.
+	// max_read is the largest count Read will be asked for
+	void Begin(size_t max_read);
+	void AddInput(const unsigned char* data, size_t size);
+
+	// Points bytes to the next count bytes of the output, valid until the next call. False when the stream is corrupt or
+	// ends before them
+	bool Read(const unsigned char*& bytes, size_t count);
+
+private:
+	static const int FAST_BITS = 10;
+
+	// Canonical Huffman code of an alphabet of up to 288 symbols
+	struct HuffmanTable
+	{
+		uint16_t fast[1 << FAST_BITS];	// By the next FAST_BITS bits (in stream order): symbol | length << 9, 0 if longer
+		uint16_t counts[16];			// Codes of each length
+		uint16_t symbols[288];			// Symbols sorted by code
+
+		bool Build(const unsigned char* lengths, int count);
+	};
+
+	enum class eBlockState {
+		HEADER,		// Next bits are the header of a block
+		STORED,		// Inside an uncompressed block
+		HUFFMAN,	// Inside a compressed block
+		END			// The last block has ended
+	};
+
+	// Input pieces and the one being read
+	struct Piece
+	{
+		const unsigned char* data;
+		size_t size;
+	};
+	std::vector<Piece> pieces;
+	size_t next_piece = 0;
+	const unsigned char* next = nullptr;
+	const unsigned char* end = nullptr;
+
+	// Bit buffer, the next bit to read is the lowest one. padding counts the zero bits fed after the end of the input
+	uint64_t bits = 0;
+	int count = 0;
+	int padding = 0;
+
+	eBlockState state = eBlockState::HEADER;
+	bool last_block = false;
+	bool header_read = false;
+	size_t stored_left = 0;
+	HuffmanTable literals;
+	HuffmanTable distances;
+
+	// Output: written at out_pos, read at read_pos, everything before read_pos is only kept as the 32 KB window
+	std::vector<unsigned char> buffer;
+	size_t out_pos = 0;
+	size_t read_pos = 0;
+	size_t limit = 0;	// Decoding stops past this, matches may overshoot it by MAX_MATCH + 8 bytes
+
+	inline void Refill();
+	inline uint32_t GetBits(int n);
+	inline int DecodeSymbol(const HuffmanTable& table);
+	int DecodeSlow(const HuffmanTable& table);
+
+	bool ReadZlibHeader();
+	bool ReadBlockHeader();
+	bool ReadDynamicTables();
+	bool Decode();
+	bool CopyStored();
+	bool DecodeHuffman();
+};
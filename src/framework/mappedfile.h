@@ -0,0 +1,37 @@
+/*
+	+ This class maps a whole file into memory, read only (mmap, or a file mapping on Windows), so the loaders parse it in
+	  place instead of reading it into a buffer first. The pages are read by the OS the first time they are touched.
+	+ The mapping stays valid until Close or the destructor; the file must not be truncated meanwhile.
+*/
+
+#pragma once
+
+#include <string>
+#include <stddef.h>
+
+class MappedFile
+{
+public:
+	MappedFile() {}
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator = (const MappedFile&) = delete;
+
+	// Maps the file at the full path, false if it can not be opened. An empty file is opened with no data
+	bool Open(const std::string& path);
+	void Close();
+
+	bool IsOpen() const { return is_open; }
+	const unsigned char* GetData() const { return data; }
+	size_t GetSize() const { return size; }
+
+private:
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+	bool is_open = false;
+#ifdef WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+};
@@ -1,10 +1,12 @@
 #include "mesh.h"
 #include "utils.h"
 #include "camera.h"
+#include "mappedfile.h"
+#include "objparser.h"
+#include "meshcache.h"
+#include "deflate.h"
 
 #include <string>
-#include <sys/stat.h>
-#include <cstring>
 
 Mesh::Mesh()
 {
@@ -238,111 +240,36 @@ void Mesh::CreateCube(float size)
 	uvs.push_back(Vector2(0, 0));
 }
 
-bool Mesh::LoadOBJ(const char* filename)
+bool Mesh::LoadOBJ(const char* filename, bool use_cache)
 {
-	struct stat stbuffer;
 	std::cout << "Loading mesh: " << filename << std::endl;
 
-	std::string relPath = absResPath(filename);
-
-	FILE* f = fopen(relPath.c_str(), "rb");
-	if (f == NULL)
+	std::string path = absResPath(filename);
+	MeshCache cache;
+	MeshCache::sSourceKey key;
+	MappedFile file;
+	if (!MeshCache::GetSourceKey(path, key) || !file.Open(path))
 	{
 		std::cerr << "File not found: " << filename << std::endl;
 		return false;
 	}
 
-	stat(relPath.c_str(), &stbuffer);
-
-	unsigned int size = stbuffer.st_size;
-	char* data = new char[size + 1];
-	fread(data, size, 1, f);
-	fclose(f);
-	data[size] = 0;
-
-	char* pos = data;
-	char line[255];
-	int i = 0;
-
-	std::vector<Vector3> indexed_positions;
-	std::vector<Vector3> indexed_normals;
-	std::vector<Vector2> indexed_uvs;
-
-	const float max_float = 10000000;
-	const float min_float = -10000000;
-
-	unsigned int vertex_i = 0;
-
-	//parse file
-	while (*pos != 0)
+	// The source is mapped but not read unless the cache is stale
+	if (use_cache && cache.Load(path, key, vertices, normals, uvs))
 	{
-		if (*pos == '\n') pos++;
-		if (*pos == '\r') pos++;
-
-		//read one line
-		i = 0;
-		while (i < 255 && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
-		std::memcpy(line, pos, i);
-		line[i] = 0;
-		pos = pos + i;
-
-		//std::cout << "Line: \"" << line << "\"" << std::endl;
-		if (*line == '#' || *line == 0) continue; //comment
-
-		//tokenize line
-		std::vector<std::string> tokens = tokenize(line, " ");
-
-		if (tokens.empty()) continue;
-
-		if (tokens[0] == "v" && tokens.size() == 4)
-		{
-			Vector3 v(std::stof(tokens[1].c_str()), std::stof(tokens[2].c_str()), std::stof(tokens[3].c_str()));
-			indexed_positions.push_back(v);
-		}
-		else if (tokens[0] == "vt" && (tokens.size() == 4 || tokens.size() == 3))
-		{
-			Vector2 v(std::stof(tokens[1].c_str()), std::stof(tokens[2].c_str()));
-			indexed_uvs.push_back(v);
-		}
-		else if (tokens[0] == "vn" && tokens.size() == 4)
-		{
-			Vector3 v(std::stof(tokens[1].c_str()), std::stof(tokens[2].c_str()), std::stof(tokens[3].c_str()));
-			indexed_normals.push_back(v);
-		}
-		else if (tokens[0] == "f" && tokens.size() >= 4)
-		{
-			Vector3 v1, v2, v3;
-			v1 = parseVector3(tokens[1].c_str(), '/');
-
-			for (size_t iPoly = 2; iPoly < tokens.size() - 1; iPoly++)
-			{
-				v2 = parseVector3(tokens[iPoly].c_str(), '/');
-				v3 = parseVector3(tokens[iPoly + 1].c_str(), '/');
-
-				vertices.push_back(indexed_positions[(unsigned int)(v1.x) - 1]);
-				vertices.push_back(indexed_positions[(unsigned int)(v2.x) - 1]);
-				vertices.push_back(indexed_positions[(unsigned int)(v3.x) - 1]);
-				//triangles.push_back( VECTOR_INDICES_TYPE(vertex_i, vertex_i+1, vertex_i+2) ); //not needed
-				vertex_i += 3;
-
-				if (indexed_uvs.size() > 0)
-				{
-					uvs.push_back(indexed_uvs[(unsigned int)(v1.y) - 1]);
-					uvs.push_back(indexed_uvs[(unsigned int)(v2.y) - 1]);
-					uvs.push_back(indexed_uvs[(unsigned int)(v3.y) - 1]);
-				}
-
-				if (indexed_normals.size() > 0)
-				{
-					normals.push_back(indexed_normals[(unsigned int)(v1.z) - 1]);
-					normals.push_back(indexed_normals[(unsigned int)(v2.z) - 1]);
-					normals.push_back(indexed_normals[(unsigned int)(v3.z) - 1]);
-				}
-			}
-		}
+		std::cout << "+++ File loaded: " << MeshCache::GetPath(path) << std::endl;
+		return true;
 	}
 
-	delete[] data;
+	OBJParser parser;
+	if (!parser.Parse((const char*)file.GetData(), file.GetSize(), vertices, normals, uvs))
+		return false;
 
+	if (use_cache)
+	{
+		key.size = file.GetSize();
+		key.crc = Crc32(0, file.GetData(), file.GetSize());
+		cache.Save(path, key, vertices, normals, uvs);
+	}
 	return true;
 }
@@ -25,7 +25,8 @@ public:
 	void CreateCube(float size);
 	void CreateQuad();
 
-	bool LoadOBJ(const char* filename);
+	// Parses the file, or reads its binary cache when it is up to date (see MeshCache); the cache is written after parsing
+	bool LoadOBJ(const char* filename, bool use_cache = true);
 
 	const std::vector<Vector3>& GetVertices() { return vertices; }
 	const std::vector<Vector3>& GetNormals() { return normals; }
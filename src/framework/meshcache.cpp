@@ -0,0 +1,316 @@
+#include "meshcache.h"
+#include "mappedfile.h"
+#include "deflate.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <sys/stat.h>
+
+#ifdef WIN32
+	#include <windows.h>
+#endif
+
+std::string MeshCache::directory;
+
+static const char MAGIC[4] = { 'C', 'G', 'M', 'C' };
+static const uint32_t VERSION = 2;
+static const uint32_t HAS_NORMALS = 1;
+static const uint32_t HAS_UVS = 2;
+static const uint64_t ALIGNMENT = 16;
+static const char* EXTENSION = ".meshcache";
+// A source modified this close before its cache was written may have changed again within the same tick of the file
+// system clock (2 seconds on FAT, the coarsest one)
+static const int64_t RACY_NANOSECONDS = 2000000000;
+
+struct sMeshCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint32_t source_crc;
+	uint32_t flags;
+	uint32_t num_vertices;	// In the streams
+	uint32_t num_indices;	// One per corner, 0 without index buffer (the vertices are the corners)
+	float bounds_min[3];
+	float bounds_max[3];
+	uint64_t positions_offset;	// From the start of the file, 0 for the streams that are not there
+	uint64_t normals_offset;
+	uint64_t uvs_offset;
+	uint64_t indices_offset;
+};
+static_assert(sizeof(sMeshCacheHeader) == 96, "the header is written as it is");
+
+// Everything a corner has, compared bit by bit to find the ones that share their vertex
+struct sVertexKey
+{
+	float values[8];
+	bool operator == (const sVertexKey& other) const { return memcmp(values, other.values, sizeof(values)) == 0; }
+};
+
+struct sVertexKeyHash
+{
+	size_t operator () (const sVertexKey& key) const
+	{
+		uint32_t words[8];
+		memcpy(words, key.values, sizeof(words));
+		uint64_t hash = 14695981039346656037ull;
+		for (int i = 0; i < 8; ++i)
+			hash = (hash ^ words[i]) * 1099511628211ull;
+		return (size_t)(hash ^ (hash >> 32));
+	}
+};
+
+static inline uint64_t Align(uint64_t offset)
+{
+	return (offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+bool MeshCache::GetSourceKey(const std::string& source_path, sSourceKey& key)
+{
+#ifdef WIN32
+	// In 100 ns ticks
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if (!GetFileAttributesExA(source_path.c_str(), GetFileExInfoStandard, &info))
+		return false;
+	key.size = (uint64_t)info.nFileSizeHigh << 32 | info.nFileSizeLow;
+	key.mtime = (int64_t)((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32 | info.ftLastWriteTime.dwLowDateTime) * 100;
+#else
+	struct stat info;
+	if (stat(source_path.c_str(), &info) != 0)
+		return false;
+	key.size = (uint64_t)info.st_size;
+#ifdef __APPLE__
+	key.mtime = (int64_t)info.st_mtimespec.tv_sec * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+	key.mtime = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+#endif
+	key.crc = 0;
+	return true;
+}
+
+std::string MeshCache::GetPath(const std::string& source_path)
+{
+	if (directory.empty())
+		return source_path + EXTENSION;
+
+	// The CRC of the whole path tells apart the files with the same name in different folders
+	size_t slash = source_path.find_last_of("/\\");
+	std::string name = slash == std::string::npos ? source_path : source_path.substr(slash + 1);
+	char hash[16];
+	snprintf(hash, sizeof(hash), "-%08x", Crc32(0, (const unsigned char*)source_path.data(), source_path.size()));
+	return directory + "/" + name + hash + EXTENSION;
+}
+
+bool MeshCache::Load(const std::string& source_path, const sSourceKey& key, std::vector<Vector3>& vertices, std::vector<Vector3>& normals,
+	std::vector<Vector2>& uvs)
+{
+	std::string path = GetPath(source_path);
+	MappedFile file;
+	if (!file.Open(path) || file.GetSize() < sizeof(sMeshCacheHeader))
+		return false;
+
+	sMeshCacheHeader header;
+	memcpy(&header, file.GetData(), sizeof(header));
+	if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION || header.source_size != key.size)
+		return false;
+
+	// Every stream aligned and inside the file
+	const uint64_t size = file.GetSize();
+	const uint64_t count = header.num_vertices;
+	const bool has_normals = (header.flags & HAS_NORMALS) != 0;
+	const bool has_uvs = (header.flags & HAS_UVS) != 0;
+	auto inside = [size](uint64_t offset, uint64_t bytes) { return offset % ALIGNMENT == 0 && offset <= size && bytes <= size - offset; };
+	if (!inside(header.positions_offset, count * sizeof(Vector3)) ||
+		(has_normals && !inside(header.normals_offset, count * sizeof(Vector3))) ||
+		(has_uvs && !inside(header.uvs_offset, count * sizeof(Vector2))) ||
+		(header.num_indices && !inside(header.indices_offset, (uint64_t)header.num_indices * sizeof(uint32_t))))
+		return false;
+
+	// Touched but maybe not changed, or maybe changed without a new time: only the contents can tell
+	sSourceKey cache_key;
+	bool touched = header.source_mtime != key.mtime;
+	bool racy = !GetSourceKey(path, cache_key) || cache_key.mtime - header.source_mtime < RACY_NANOSECONDS;
+	if (touched || racy)
+	{
+		MappedFile source;
+		if (!source.Open(source_path) || source.GetSize() != key.size || Crc32(0, source.GetData(), source.GetSize()) != header.source_crc)
+			return false;
+	}
+
+	const unsigned char* data = file.GetData();
+	const Vector3* positions = (const Vector3*)(data + header.positions_offset);
+	const Vector3* vertex_normals = has_normals ? (const Vector3*)(data + header.normals_offset) : nullptr;
+	const Vector2* vertex_uvs = has_uvs ? (const Vector2*)(data + header.uvs_offset) : nullptr;
+	if (!header.num_indices)
+	{
+		vertices.assign(positions, positions + count);
+		normals.assign(vertex_normals, vertex_normals + (has_normals ? count : 0));
+		uvs.assign(vertex_uvs, vertex_uvs + (has_uvs ? count : 0));
+	}
+	else
+	{
+		const uint32_t* indices = (const uint32_t*)(data + header.indices_offset);
+		const size_t corners = header.num_indices;
+		for (size_t i = 0; i < corners; ++i)
+			if (indices[i] >= count)
+				return false;
+
+		vertices.resize(corners);
+		normals.resize(has_normals ? corners : 0);
+		uvs.resize(has_uvs ? corners : 0);
+		for (size_t i = 0; i < corners; ++i)
+			vertices[i] = positions[indices[i]];
+		for (size_t i = 0; has_normals && i < corners; ++i)
+			normals[i] = vertex_normals[indices[i]];
+		for (size_t i = 0; has_uvs && i < corners; ++i)
+			uvs[i] = vertex_uvs[indices[i]];
+	}
+
+	bounds_min = Vector3(header.bounds_min[0], header.bounds_min[1], header.bounds_min[2]);
+	bounds_max = Vector3(header.bounds_max[0], header.bounds_max[1], header.bounds_max[2]);
+	indexed = header.num_indices != 0;
+	file.Close();
+
+	// So the next load does not read the source again: the write also gives the cache a new time, which stops it being racy
+	// once the source is old enough
+	if (touched || racy)
+	{
+		std::fstream stream(path, std::ios::in | std::ios::out | std::ios::binary);
+		stream.seekp(offsetof(sMeshCacheHeader, source_mtime));
+		stream.write((const char*)&key.mtime, sizeof(key.mtime));
+	}
+	return true;
+}
+
+bool MeshCache::Save(const std::string& source_path, const sSourceKey& key, const std::vector<Vector3>& vertices, const std::vector<Vector3>& normals,
+	const std::vector<Vector2>& uvs)
+{
+	const size_t corners = vertices.size();
+	const bool has_normals = !normals.empty();
+	const bool has_uvs = !uvs.empty();
+	if (corners > UINT32_MAX || (has_normals && normals.size() != corners) || (has_uvs && uvs.size() != corners))
+		return false;
+
+	// Corner of every distinct vertex, in the order they first appear, and the vertex of every corner
+	std::vector<uint32_t> distinct;
+	std::vector<uint32_t> indices(corners);
+	{
+		std::unordered_map<sVertexKey, uint32_t, sVertexKeyHash> found;
+		found.reserve(corners);
+		for (size_t i = 0; i < corners; ++i)
+		{
+			sVertexKey vertex;
+			memset(&vertex, 0, sizeof(vertex));
+			memcpy(vertex.values, &vertices[i], sizeof(Vector3));
+			if (has_normals)
+				memcpy(vertex.values + 3, &normals[i], sizeof(Vector3));
+			if (has_uvs)
+				memcpy(vertex.values + 6, &uvs[i], sizeof(Vector2));
+			auto inserted = found.insert(std::make_pair(vertex, (uint32_t)distinct.size()));
+			if (inserted.second)
+				distinct.push_back((uint32_t)i);
+			indices[i] = inserted.first->second;
+		}
+	}
+
+	// The index buffer only when it makes the file smaller
+	const uint64_t stride = sizeof(Vector3) + (has_normals ? sizeof(Vector3) : 0) + (has_uvs ? sizeof(Vector2) : 0);
+	indexed = distinct.size() * stride + corners * sizeof(uint32_t) < corners * stride;
+	const size_t count = indexed ? distinct.size() : corners;
+
+	sMeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.source_size = key.size;
+	header.source_mtime = key.mtime;
+	header.source_crc = key.crc;
+	header.flags = (has_normals ? HAS_NORMALS : 0) | (has_uvs ? HAS_UVS : 0);
+	header.num_vertices = (uint32_t)count;
+	header.num_indices = indexed ? (uint32_t)corners : 0;
+
+	bounds_min = bounds_max = corners ? vertices[0] : Vector3();
+	for (size_t i = 0; i < corners; ++i)
+		for (int k = 0; k < 3; ++k)
+		{
+			bounds_min.v[k] = std::min(bounds_min.v[k], vertices[i].v[k]);
+			bounds_max.v[k] = std::max(bounds_max.v[k], vertices[i].v[k]);
+		}
+	memcpy(header.bounds_min, bounds_min.v, sizeof(header.bounds_min));
+	memcpy(header.bounds_max, bounds_max.v, sizeof(header.bounds_max));
+
+	uint64_t offset = Align(sizeof(header));
+	header.positions_offset = offset;
+	offset = Align(offset + count * sizeof(Vector3));
+	if (has_normals)
+	{
+		header.normals_offset = offset;
+		offset = Align(offset + count * sizeof(Vector3));
+	}
+	if (has_uvs)
+	{
+		header.uvs_offset = offset;
+		offset = Align(offset + count * sizeof(Vector2));
+	}
+	if (indexed)
+		header.indices_offset = offset;
+
+	// Streams go one after the other, padded up to where the header says they start. With the index buffer only the
+	// corner of every distinct vertex is written
+	std::vector<unsigned char> bytes(sizeof(header));
+	memcpy(&bytes[0], &header, sizeof(header));
+	auto append = [&bytes](uint64_t start, const void* data, size_t size) {
+		bytes.resize((size_t)start);
+		bytes.insert(bytes.end(), (const unsigned char*)data, (const unsigned char*)data + size);
+	};
+	auto append_stream = [&](uint64_t start, const void* data, size_t element_size) {
+		if (!indexed)
+		{
+			append(start, data, count * element_size);
+			return;
+		}
+		bytes.resize((size_t)start);
+		for (size_t i = 0; i < count; ++i)
+			bytes.insert(bytes.end(), (const unsigned char*)data + distinct[i] * element_size, (const unsigned char*)data + (distinct[i] + 1) * element_size);
+	};
+	append_stream(header.positions_offset, vertices.data(), sizeof(Vector3));
+	if (has_normals)
+		append_stream(header.normals_offset, normals.data(), sizeof(Vector3));
+	if (has_uvs)
+		append_stream(header.uvs_offset, uvs.data(), sizeof(Vector2));
+	if (indexed)
+		append(header.indices_offset, indices.data(), corners * sizeof(uint32_t));
+
+	// Written aside and renamed, so a cache is never seen half written
+	std::string path = GetPath(source_path);
+	std::string temporary = path + ".tmp";
+	{
+		std::ofstream stream(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (stream)
+			stream.write((const char*)bytes.data(), bytes.size());
+		if (!stream)
+		{
+			std::cerr << "--- Failed to save file: " << path << std::endl;
+			stream.close();
+			std::remove(temporary.c_str());
+			return false;
+		}
+	}
+	std::remove(path.c_str());
+	if (std::rename(temporary.c_str(), path.c_str()) != 0)
+	{
+		std::cerr << "--- Failed to save file: " << path << std::endl;
+		std::remove(temporary.c_str());
+		return false;
+	}
+
+	std::cout << "+++ File saved: " << path << std::endl;
+	return true;
+}
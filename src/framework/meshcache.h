@@ -0,0 +1,56 @@
+/*
+	+ MeshCache keeps the parsed triangles of a mesh file in a binary file, so later loads map it (see MappedFile) and copy
+	  the streams out instead of parsing the text again.
+	+ The file is a header followed by the position, normal and uv streams, each 16-byte aligned, and an optional index
+	  buffer: when many corners share their vertex, the streams hold the distinct vertices and the indices give the vertex of
+	  every corner. The header also keeps the bounds of the positions.
+	+ A cache belongs to the size, modification time (in nanoseconds) and CRC-32 of its source file. A different size makes
+	  it stale; a different time only when the CRC differs too (then the time in the header is updated), so the source is
+	  only read back when it was touched. The CRC is also checked when the source was modified shortly before the cache
+	  was written, as a rewrite within the resolution of the file system clock leaves the time as it was. Stale caches are
+	  rebuilt by whoever loads the source.
+	+ The values are stored in the byte order of the machine, and a cache from a different one is just rebuilt.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "framework.h"
+
+class MeshCache
+{
+public:
+	// Where the cache files go, next to their source when empty
+	static std::string directory;
+
+	// Identifies the contents of a source file
+	struct sSourceKey
+	{
+		uint64_t size = 0;
+		int64_t mtime = 0;	// Nanoseconds
+		uint32_t crc = 0;
+	};
+
+	// Size and modification time of the file, as precise as the platform gives it, false if it does not exist
+	static bool GetSourceKey(const std::string& source_path, sSourceKey& key);
+
+	// Path of the cache of a source file
+	static std::string GetPath(const std::string& source_path);
+
+	// Fills the streams from the cache of the source if it is up to date with key (size and time). Returns false, without
+	// printing anything, when there is no valid cache
+	bool Load(const std::string& source_path, const sSourceKey& key, std::vector<Vector3>& vertices, std::vector<Vector3>& normals,
+		std::vector<Vector2>& uvs);
+
+	// Writes the cache of the source, whose key must have the CRC of the contents. normals and uvs are empty or have one
+	// element per vertex
+	bool Save(const std::string& source_path, const sSourceKey& key, const std::vector<Vector3>& vertices, const std::vector<Vector3>& normals,
+		const std::vector<Vector2>& uvs);
+
+	// Of the last mesh loaded or saved
+	Vector3 bounds_min;
+	Vector3 bounds_max;
+	bool indexed = false;
+};
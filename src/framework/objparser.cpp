@@ -0,0 +1,383 @@
+#include "objparser.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <iostream>
+
+static const size_t MIN_CHUNK_SIZE = 64 * 1024;
+static const size_t CHUNKS_PER_THREAD = 4;		// Lines vary in length, smaller chunks keep the threads busy to the end
+static const size_t CORNERS_PER_JOB = 3 * 8192;	// Of the last pass
+static const int INVALID = INT_MAX;				// Index that is never in range
+
+static const double POWERS_OF_10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16,
+	1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+static const int MAX_EXACT_POWER = 22;
+
+enum eLine { LINE_OTHER, LINE_POSITION, LINE_UV, LINE_NORMAL, LINE_FACE };
+
+static bool Fail(const char* reason)
+{
+	std::cerr << "--- OBJ: " << reason << std::endl;
+	return false;
+}
+
+static inline bool IsBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+static inline bool IsDigit(char c) { return (unsigned char)(c - '0') < 10; }
+static inline bool IsEndOfToken(const char* p, const char* end) { return p == end || IsBlank(*p); }
+
+static inline const char* SkipBlanks(const char* p, const char* end)
+{
+	while (p < end && IsBlank(*p))
+		p++;
+	return p;
+}
+
+// Decimal integer with an optional sign, clamped to INT_MAX. Returns the end of it, nullptr if there are no digits
+static const char* ScanInt(const char* p, const char* end, int& value)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	if (p == end || !IsDigit(*p))
+		return nullptr;
+
+	long long result = 0;
+	for (; p < end && IsDigit(*p); ++p)
+		result = std::min(result * 10 + (*p - '0'), (long long)INT_MAX);
+	value = negative ? -(int)result : (int)result;
+	return p;
+}
+
+// Decimal number with an optional sign, fraction and exponent. The first 19 significant digits go into an integer that is
+// scaled by an exact power of 10 in double precision, and then rounded to float; with up to 15 digits that is the float
+// strtof gives in all but the rarest cases. Returns the end of it, nullptr if it is not a number
+static const char* ScanFloat(const char* p, const char* end, float& value)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	unsigned long long mantissa = 0;
+	int digits = 0;		// Significant ones in mantissa
+	int exponent = 0;
+	bool any = false;
+	for (; p < end && IsDigit(*p); ++p, any = true)
+	{
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += mantissa != 0;
+		}
+		else
+			exponent++;
+	}
+	if (p < end && *p == '.')
+	{
+		for (++p; p < end && IsDigit(*p); ++p, any = true)
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+		}
+	}
+	if (!any)
+		return nullptr;
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		int power;
+		if (!(p = ScanInt(p + 1, end, power)))
+			return nullptr;
+		exponent = std::max(std::min(exponent + std::max(std::min(power, 1000), -1000), 1000), -1000);
+	}
+
+	double result = (double)mantissa;
+	if (mantissa)
+	{
+		for (; exponent > MAX_EXACT_POWER; exponent -= MAX_EXACT_POWER)
+			result *= POWERS_OF_10[MAX_EXACT_POWER];
+		for (; exponent < -MAX_EXACT_POWER; exponent += MAX_EXACT_POWER)
+			result /= POWERS_OF_10[MAX_EXACT_POWER];
+		result = exponent < 0 ? result / POWERS_OF_10[-exponent] : result * POWERS_OF_10[exponent];
+	}
+	value = (float)(negative ? -result : result);
+	return p;
+}
+
+// Index of the file (from 1, or negative to count back from the last of the defined ones) into the arrays
+static inline int ResolveIndex(int index, size_t defined)
+{
+	if (index > 0)
+		return index - 1;
+	if (index < 0 && (long long)defined + index >= 0)
+		return (int)((long long)defined + index);
+	return INVALID;
+}
+
+// Kind of the line that starts at p, after its blanks, and p past the keyword
+static eLine ReadKeyword(const char*& p, const char* end)
+{
+	if (p == end)
+		return LINE_OTHER;
+	if (*p == 'f' && IsEndOfToken(p + 1, end))
+	{
+		p += 1;
+		return LINE_FACE;
+	}
+	if (*p != 'v' || p + 1 == end)
+		return LINE_OTHER;
+	if (IsBlank(p[1]))
+	{
+		p += 1;
+		return LINE_POSITION;
+	}
+	if ((p[1] == 't' || p[1] == 'n') && IsEndOfToken(p + 2, end))
+	{
+		p += 2;
+		return p[-1] == 't' ? LINE_UV : LINE_NORMAL;
+	}
+	return LINE_OTHER;
+}
+
+// Calls line(kind, p, end) with the text after the keyword of every line of [begin, end) the parser reads, up to the
+// comment if there is one, until it returns false. Anything else (comments, groups, materials...) is skipped
+template <typename Function>
+static void ForEachLine(const char* begin, const char* end, Function line)
+{
+	const char* p = begin;
+	while (p < end)
+	{
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		const char* text = SkipBlanks(p, eol);
+		const char* comment = (const char*)memchr(text, '#', eol - text);
+		const char* text_end = comment ? comment : eol;
+		eLine kind = ReadKeyword(text, text_end);
+		if (kind != LINE_OTHER && !line(kind, text, text_end))
+			return;
+		p = eol < end ? eol + 1 : end;
+	}
+}
+
+static size_t CountTokens(const char* p, const char* end)
+{
+	size_t count = 0;
+	while ((p = SkipBlanks(p, end)) < end)
+	{
+		count++;
+		while (p < end && !IsBlank(*p))
+			p++;
+	}
+	return count;
+}
+
+void OBJParser::SplitChunks(const char* data, size_t size)
+{
+	size_t count = 1;
+	if (parallel)
+		count = std::max(std::min((size_t)ThreadPool::Get()->GetNumThreads() * CHUNKS_PER_THREAD, size / MIN_CHUNK_SIZE), (size_t)1);
+
+	chunks.clear();
+	const char* end = data + size;
+	const char* p = data;
+	for (size_t i = 0; i < count && p < end; ++i)
+	{
+		// Up to the end of the line the even split falls in
+		const char* chunk_end = std::max(data + size * (i + 1) / count, p);
+		const char* newline = chunk_end < end ? (const char*)memchr(chunk_end, '\n', end - chunk_end) : nullptr;
+		chunk_end = newline ? newline + 1 : end;
+
+		sChunk chunk;
+		chunk.begin = p;
+		chunk.end = chunk_end;
+		chunks.push_back(chunk);
+		p = chunk_end;
+	}
+}
+
+void OBJParser::CountChunk(sChunk& chunk)
+{
+	chunk.positions = chunk.uvs = chunk.normals = chunk.triangles = 0;
+	chunk.error = nullptr;
+	ForEachLine(chunk.begin, chunk.end, [&chunk](eLine kind, const char* p, const char* end) {
+		if (kind == LINE_POSITION)
+			chunk.positions++;
+		else if (kind == LINE_UV)
+			chunk.uvs++;
+		else if (kind == LINE_NORMAL)
+			chunk.normals++;
+		else
+		{
+			size_t count = CountTokens(p, end);
+			if (count >= 3)
+				chunk.triangles += count - 2;
+		}
+		return true;
+	});
+}
+
+void OBJParser::ParseChunk(sChunk& chunk)
+{
+	// Where the elements of the chunk go, which is also how many of each kind are defined before the current line
+	size_t defined[3] = { chunk.positions, chunk.uvs, chunk.normals };
+	sCorner* corner = corners.data() + chunk.triangles * 3;
+
+	ForEachLine(chunk.begin, chunk.end, [&](eLine kind, const char* p, const char* end) {
+		if (kind != LINE_FACE)
+		{
+			// The coordinates that follow the ones used (w, colours) are ignored
+			float values[3] = { 0.0f, 0.0f, 0.0f };
+			int needed = kind == LINE_UV ? 2 : 3;
+			int count = 0;
+			for (; count < 3 && (p = SkipBlanks(p, end)) < end; ++count)
+			{
+				if (!(p = ScanFloat(p, end, values[count])) || !IsEndOfToken(p, end))
+				{
+					chunk.error = "invalid number";
+					return false;
+				}
+			}
+			if (count < needed)
+			{
+				chunk.error = "missing coordinates";
+				return false;
+			}
+
+			if (kind == LINE_POSITION)
+				positions[defined[0]++] = Vector3(values[0], values[1], values[2]);
+			else if (kind == LINE_UV)
+				indexed_uvs[defined[1]++] = Vector2(values[0], values[1]);
+			else
+				indexed_normals[defined[2]++] = Vector3(values[0], values[1], values[2]);
+			return true;
+		}
+
+		// Faces are fans around their first vertex, each vertex is v, v/vt, v//vn or v/vt/vn
+		sCorner first = sCorner(), previous = sCorner();
+		int count = 0;
+		while ((p = SkipBlanks(p, end)) < end)
+		{
+			sCorner current;
+			int* indices[3] = { &current.position, &current.uv, &current.normal };
+			current.uv = current.normal = NONE;
+			for (int k = 0; k < 3; ++k)
+			{
+				if (k > 0)
+				{
+					if (p == end || *p != '/')
+						break;
+					if (++p < end && *p == '/' && k == 1)
+						continue;
+				}
+				int index;
+				if (!(p = ScanInt(p, end, index)))
+				{
+					chunk.error = "invalid face";
+					return false;
+				}
+				*indices[k] = ResolveIndex(index, defined[k]);
+			}
+			if (!IsEndOfToken(p, end))
+			{
+				chunk.error = "invalid face";
+				return false;
+			}
+
+			if (count == 0)
+				first = current;
+			else if (count >= 2)
+			{
+				corner[0] = first;
+				corner[1] = previous;
+				corner[2] = current;
+				corner += 3;
+			}
+			previous = current;
+			count++;
+		}
+		return true;
+	});
+}
+
+bool OBJParser::Parse(const char* data, size_t size, std::vector<Vector3>& vertices, std::vector<Vector3>& normals, std::vector<Vector2>& uvs)
+{
+	ThreadPool* pool = ThreadPool::Get();
+	auto run = [this, pool](int count, const std::function<void(int)>& job) {
+		if (parallel)
+			pool->ParallelFor(count, job);
+		else
+			for (int i = 0; i < count; ++i)
+				job(i);
+	};
+
+	SplitChunks(data, size);
+	run((int)chunks.size(), [this](int i) { CountChunk(chunks[i]); });
+
+	// The counts become where every chunk starts
+	size_t totals[4] = { 0, 0, 0, 0 };
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		size_t* counts[4] = { &chunks[i].positions, &chunks[i].uvs, &chunks[i].normals, &chunks[i].triangles };
+		for (int k = 0; k < 4; ++k)
+		{
+			size_t count = *counts[k];
+			*counts[k] = totals[k];
+			totals[k] += count;
+		}
+	}
+	if (totals[0] > (size_t)INT_MAX || totals[3] > (size_t)INT_MAX / 3)
+		return Fail("too many elements");
+
+	positions.resize(totals[0]);
+	indexed_uvs.resize(totals[1]);
+	indexed_normals.resize(totals[2]);
+	corners.resize(totals[3] * 3);
+	run((int)chunks.size(), [this](int i) { ParseChunk(chunks[i]); });
+	for (size_t i = 0; i < chunks.size(); ++i)
+		if (chunks[i].error)
+			return Fail(chunks[i].error);
+
+	// One vertex per corner. A face without uvs or normals in a file that has them gets zeros
+	vertices.resize(corners.size());
+	uvs.resize(indexed_uvs.empty() ? 0 : corners.size());
+	normals.resize(indexed_normals.empty() ? 0 : corners.size());
+	std::atomic<bool> out_of_range(false);
+	run((int)((corners.size() + CORNERS_PER_JOB - 1) / CORNERS_PER_JOB), [&](int job) {
+		size_t last = std::min((job + 1) * CORNERS_PER_JOB, corners.size());
+		bool valid = true;
+		for (size_t i = job * CORNERS_PER_JOB; i < last; ++i)
+		{
+			const sCorner& c = corners[i];
+			valid &= (size_t)c.position < positions.size();
+			vertices[i] = valid ? positions[c.position] : Vector3();
+			if (!uvs.empty())
+			{
+				valid &= c.uv == NONE || (size_t)c.uv < indexed_uvs.size();
+				uvs[i] = valid && c.uv != NONE ? indexed_uvs[c.uv] : Vector2();
+			}
+			if (!normals.empty())
+			{
+				valid &= c.normal == NONE || (size_t)c.normal < indexed_normals.size();
+				normals[i] = valid && c.normal != NONE ? indexed_normals[c.normal] : Vector3();
+			}
+		}
+		if (!valid)
+			out_of_range = true;
+	});
+
+	if (out_of_range)
+	{
+		vertices.clear();
+		uvs.clear();
+		normals.clear();
+		return Fail("index out of range");
+	}
+	return true;
+}
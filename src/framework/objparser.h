@@ -0,0 +1,56 @@
+/*
+	+ OBJParser parses a Wavefront OBJ file held in memory (see MappedFile) into one vertex per triangle corner, with the uvs
+	  and normals when the file has them. Faces of more than 3 vertices are split as fans, and negative indices count back
+	  from the last element defined before the face.
+	+ The file is split at line boundaries into chunks that are parsed on the thread pool in three passes: every chunk counts
+	  its elements, then parses them straight into their place in the arrays (the counts of the chunks before it give where
+	  its elements start and what its negative indices refer to), and last the triangles are expanded. Numbers are scanned in
+	  place, so no memory is allocated per line or per token.
+	+ A line ends at a '#', so elements and faces can be followed by a comment.
+*/
+
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+#include "framework.h"
+
+class OBJParser
+{
+public:
+	// Split the file across the threads of the pool
+	bool parallel = true;
+
+	// Parses a whole file. Prints the reason and returns false when it is not valid
+	bool Parse(const char* data, size_t size, std::vector<Vector3>& vertices, std::vector<Vector3>& normals, std::vector<Vector2>& uvs);
+
+	// Of the last file parsed
+	size_t GetNumPositions() const { return positions.size(); }
+	size_t GetNumTriangles() const { return corners.size() / 3; }
+
+private:
+	struct sChunk
+	{
+		const char* begin;
+		const char* end;
+		size_t positions, uvs, normals, triangles;	// Counted in the first pass, where they start in the second one
+		const char* error;
+	};
+
+	// Indices into the arrays below, NONE when the face does not give one
+	struct sCorner
+	{
+		int position, uv, normal;
+	};
+	static const int NONE = -1;
+
+	std::vector<sChunk> chunks;
+	std::vector<Vector3> positions;
+	std::vector<Vector2> indexed_uvs;
+	std::vector<Vector3> indexed_normals;
+	std::vector<sCorner> corners;
+
+	void SplitChunks(const char* data, size_t size);
+	void CountChunk(sChunk& chunk);
+	void ParseChunk(sChunk& chunk);
+};
@@ -0,0 +1,187 @@
+/*
+	+ Pixel formats of PixelImage. A format is a type with the pixel type, the number of channels and the conversion of a pixel
+	  to and from a Vector4 of normalized values (0..1 for 8-bit channels, as they are for floats). Missing channels read as
+	  0, and alpha as 1, like GL does.
+	+ PixelConverter<To, From> converts single pixels. The pairs used the most are specialized so they copy or widen the
+	  channels directly instead of going through floats; the rest go through Vector4.
+*/
+
+#pragma once
+
+#include <string.h>
+#include "framework.h"
+
+// 8-bit color with alpha
+struct ColorRGBA
+{
+	unsigned char r, g, b, a;
+
+	ColorRGBA() { r = g = b = 0; a = 255; }
+	ColorRGBA(unsigned char r, unsigned char g, unsigned char b, unsigned char a = 255) : r(r), g(g), b(b), a(a) {}
+};
+
+// Two 16-bit floats, stored as their bits
+struct Half2
+{
+	unsigned short r, g;
+
+	Half2() { r = g = 0; }
+	Half2(unsigned short r, unsigned short g) : r(r), g(g) {}
+};
+
+// IEEE 754 binary16, rounded to the nearest (even) value. Values too large become infinity, too small zero or denormals
+inline unsigned short FloatToHalf(float value)
+{
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	unsigned int sign = (bits >> 16) & 0x8000u;
+	unsigned int exponent = (bits >> 23) & 0xffu;
+	unsigned int mantissa = bits & 0x7fffffu;
+
+	if (exponent == 0xffu)	// Infinity and NaN (which keeps a mantissa bit)
+		return (unsigned short)(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+
+	int half_exponent = (int)exponent - 127 + 15;
+	if (half_exponent >= 31)
+		return (unsigned short)(sign | 0x7c00u);
+
+	if (half_exponent <= 0)
+	{
+		if (half_exponent < -10)
+			return (unsigned short)sign;
+		// Denormal: the implicit bit becomes explicit and the mantissa is shifted into place
+		mantissa |= 0x800000u;
+		int shift = 14 - half_exponent;
+		unsigned int half_mantissa = mantissa >> shift;
+		unsigned int rest = mantissa & ((1u << shift) - 1u);
+		unsigned int halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half_mantissa & 1u)))
+			half_mantissa++;
+		return (unsigned short)(sign | half_mantissa);
+	}
+
+	unsigned int half = sign | ((unsigned int)half_exponent << 10) | (mantissa >> 13);
+	unsigned int rest = mantissa & 0x1fffu;
+	if (rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+		half++;	// A carry into the exponent is still the right value (and gives infinity past the largest one)
+	return (unsigned short)half;
+}
+
+inline float HalfToFloat(unsigned short half)
+{
+	unsigned int sign = (unsigned int)(half & 0x8000u) << 16;
+	unsigned int exponent = (half >> 10) & 0x1fu;
+	unsigned int mantissa = half & 0x3ffu;
+	unsigned int bits;
+
+	if (exponent == 0x1fu)
+		bits = sign | 0x7f800000u | (mantissa << 13);
+	else if (exponent != 0)
+		bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	else if (mantissa == 0)
+		bits = sign;
+	else
+	{
+		// Denormal: normalized for the float exponent
+		exponent = 127 - 15 + 1;
+		while (!(mantissa & 0x400u))
+		{
+			mantissa <<= 1;
+			exponent--;
+		}
+		bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+	}
+
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+inline unsigned char FloatToByte(float v)
+{
+	v = v * 255.0f + 0.5f;
+	return (unsigned char)(v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v));
+}
+
+struct FormatRGB8
+{
+	typedef Color Pixel;
+	static const int CHANNELS = 3;
+
+	static Vector4 ToVector(const Pixel& p) { return Vector4(p.r / 255.0f, p.g / 255.0f, p.b / 255.0f, 1.0f); }
+	static Pixel FromVector(const Vector4& v) { Pixel p; p.r = FloatToByte(v.x); p.g = FloatToByte(v.y); p.b = FloatToByte(v.z); return p; }
+};
+
+struct FormatRGBA8
+{
+	typedef ColorRGBA Pixel;
+	static const int CHANNELS = 4;
+
+	static Vector4 ToVector(const Pixel& p) { return Vector4(p.r / 255.0f, p.g / 255.0f, p.b / 255.0f, p.a / 255.0f); }
+	static Pixel FromVector(const Vector4& v) { return Pixel(FloatToByte(v.x), FloatToByte(v.y), FloatToByte(v.z), FloatToByte(v.w)); }
+};
+
+struct FormatR32F
+{
+	typedef float Pixel;
+	static const int CHANNELS = 1;
+
+	static Vector4 ToVector(const Pixel& p) { return Vector4(p, 0.0f, 0.0f, 1.0f); }
+	static Pixel FromVector(const Vector4& v) { return v.x; }
+};
+
+struct FormatRG16F
+{
+	typedef Half2 Pixel;
+	static const int CHANNELS = 2;
+
+	static Vector4 ToVector(const Pixel& p) { return Vector4(HalfToFloat(p.r), HalfToFloat(p.g), 0.0f, 1.0f); }
+	static Pixel FromVector(const Vector4& v) { return Pixel(FloatToHalf(v.x), FloatToHalf(v.y)); }
+};
+
+struct FormatRGBA32F
+{
+	typedef Vector4 Pixel;
+	static const int CHANNELS = 4;
+
+	static Vector4 ToVector(const Pixel& p) { return p; }
+	static Pixel FromVector(const Vector4& v) { return v; }
+};
+
+// Any pair of formats, through normalized floats
+template <typename To, typename From>
+struct PixelConverter
+{
+	static typename To::Pixel Convert(const typename From::Pixel& p) { return To::FromVector(From::ToVector(p)); }
+};
+
+template <typename Format>
+struct PixelConverter<Format, Format>
+{
+	static typename Format::Pixel Convert(const typename Format::Pixel& p) { return p; }
+};
+
+template <>
+struct PixelConverter<FormatRGBA8, FormatRGB8>
+{
+	static ColorRGBA Convert(const Color& p) { return ColorRGBA(p.r, p.g, p.b); }
+};
+
+template <>
+struct PixelConverter<FormatRGB8, FormatRGBA8>
+{
+	static Color Convert(const ColorRGBA& p) { Color c; c.r = p.r; c.g = p.g; c.b = p.b; return c; }
+};
+
+template <>
+struct PixelConverter<FormatR32F, FormatRG16F>
+{
+	static float Convert(const Half2& p) { return HalfToFloat(p.r); }
+};
+
+template <>
+struct PixelConverter<FormatRG16F, FormatR32F>
+{
+	static Half2 Convert(const float& p) { return Half2(FloatToHalf(p), 0); }
+};
@@ -0,0 +1,143 @@
+#include "pixelimage.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+
+bool PixelPool::enabled = true;
+
+// Kept right before the aligned pixels: the block returned by malloc and the size class of the buffer
+struct PixelHeader
+{
+	void* block;
+	int size_class;
+};
+
+static const int MIN_CLASS_BITS = 8;
+
+// Class i holds the buffers of up to (4 + i % 4 + 1) * 2^(MIN_CLASS_BITS - 2 + i / 4) bytes: four classes per power of two,
+// so a buffer is at most 25% larger than the request it serves
+static size_t GetClassBytes(int size_class)
+{
+	int bits = MIN_CLASS_BITS + size_class / 4;
+	return ((size_t)1 << bits) + (size_t)(size_class % 4 + 1) * ((size_t)1 << (bits - 2));
+}
+
+static int GetSizeClass(size_t bytes)
+{
+	if (bytes <= GetClassBytes(0))
+		return 0;
+
+	int bits = 0;
+	while (((size_t)1 << (bits + 1)) < bytes)
+		bits++;
+	size_t quarter = (size_t)1 << (bits - 2);
+	int step = (int)((bytes - ((size_t)1 << bits) + quarter - 1) / quarter);	// 1 to 4
+	return (bits - MIN_CLASS_BITS) * 4 + step - 1;
+}
+
+void* PixelPool::Allocate(size_t bytes, bool clear)
+{
+	int size_class = GetSizeClass(bytes);
+	if (size_class >= NUM_CLASSES)
+		return nullptr;
+	size_t class_bytes = GetClassBytes(size_class);
+
+	void* pixels = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.allocations++;
+		if (!free_lists[size_class].empty())
+		{
+			pixels = free_lists[size_class].back();
+			free_lists[size_class].pop_back();
+			stats.bytes_cached -= class_bytes;
+			stats.hits++;
+		}
+		stats.bytes_in_use += class_bytes;
+		stats.peak_bytes = std::max(stats.peak_bytes, stats.bytes_in_use + stats.bytes_cached);
+	}
+
+	if (!pixels)
+	{
+		// Over-allocated by the alignment, the header goes in the gap before the aligned pointer
+		void* block = malloc(class_bytes + PIXEL_ALIGNMENT + sizeof(PixelHeader));
+		if (!block)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stats.bytes_in_use -= class_bytes;
+			return nullptr;
+		}
+		uintptr_t aligned = ((uintptr_t)block + sizeof(PixelHeader) + PIXEL_ALIGNMENT - 1) & ~(uintptr_t)(PIXEL_ALIGNMENT - 1);
+		PixelHeader* header = (PixelHeader*)aligned - 1;
+		header->block = block;
+		header->size_class = size_class;
+		pixels = (void*)aligned;
+	}
+
+	if (clear)
+		memset(pixels, 0, bytes);
+	return pixels;
+}
+
+void PixelPool::Free(void* pixels)
+{
+	if (!pixels)
+		return;
+
+	PixelHeader* header = (PixelHeader*)pixels - 1;
+	size_t class_bytes = GetClassBytes(header->size_class);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.bytes_in_use -= class_bytes;
+		if (enabled && stats.bytes_cached + class_bytes <= MAX_CACHED_BYTES)
+		{
+			free_lists[header->size_class].push_back(pixels);
+			stats.bytes_cached += class_bytes;
+			return;
+		}
+	}
+	free(header->block);
+}
+
+void PixelPool::Trim()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (int i = 0; i < NUM_CLASSES; ++i)
+	{
+		for (size_t j = 0; j < free_lists[i].size(); ++j)
+			free(((PixelHeader*)free_lists[i][j] - 1)->block);
+		free_lists[i].clear();
+	}
+	stats.bytes_cached = 0;
+}
+
+PixelPoolStats PixelPool::GetStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+void PixelPool::ResetStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	stats.allocations = 0;
+	stats.hits = 0;
+	stats.peak_bytes = stats.bytes_in_use + stats.bytes_cached;
+}
+
+PixelPool* PixelPool::Get()
+{
+	// Never destroyed: images in static storage may free their pixels after it would be
+	static PixelPool* pool = new PixelPool();
+	return pool;
+}
+
+void* AllocatePixels(size_t bytes, bool clear)
+{
+	return PixelPool::Get()->Allocate(bytes, clear);
+}
+
+void FreePixels(void* pixels)
+{
+	PixelPool::Get()->Free(pixels);
+}
@@ -0,0 +1,265 @@
+/*
+	+ PixelImage is a matrix of pixels of a compile-time format (see pixelformat.h). Image (RGB8, with the drawing and file
+	  functions) derives from it and FloatImage (R32F) is an alias of it.
+	+ The first pixel is aligned to ALIGNMENT bytes. Rows are packed (pitch == width) unless the image is created with
+	  aligned rows, then every row starts on an ALIGNMENT boundary too so whole rows can be read with aligned vector loads.
+	  Rows are reached with GetRow(y), pixels[y * width + x] is only right for packed images.
+	+ The pixels come from PixelPool, which keeps freed buffers by size class and gives them to the next image of about the
+	  same size, so resizing the window or making the same temporary image every frame does not go back to the heap.
+	  Images can be moved, which hands over the pixels without copying them.
+*/
+
+#pragma once
+
+#include <string.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include "pixelformat.h"
+
+static const unsigned int PIXEL_ALIGNMENT = 64;
+
+// Memory for pixels, aligned to PIXEL_ALIGNMENT bytes and zeroed unless clear is false (from PixelPool)
+void* AllocatePixels(size_t bytes, bool clear = true);
+void FreePixels(void* pixels);
+
+// Counters of PixelPool. The bytes are those of the size classes, not the ones requested
+struct PixelPoolStats
+{
+	size_t allocations = 0;		// Buffers requested
+	size_t hits = 0;			// Of them, served with a freed buffer instead of one from the heap
+	size_t bytes_in_use = 0;	// Held by images
+	size_t bytes_cached = 0;	// Freed and kept for reuse
+	size_t peak_bytes = 0;		// Largest bytes_in_use + bytes_cached
+
+	double GetHitRate() const { return allocations ? (double)hits / allocations : 0.0; }
+};
+
+// Recycles pixel buffers: a freed buffer goes to the free list of its size class (four per power of two) and the next
+// request of that class takes it back. At most MAX_CACHED_BYTES are kept, the rest go back to the heap
+class PixelPool
+{
+public:
+	static const int NUM_CLASSES = 128;
+	static const size_t MAX_CACHED_BYTES = (size_t)256 << 20;
+
+	// When false freed buffers go straight back to the heap (the cached ones are still used)
+	static bool enabled;
+
+	void* Allocate(size_t bytes, bool clear);
+	void Free(void* pixels);
+
+	// Returns the cached buffers to the heap
+	void Trim();
+
+	PixelPoolStats GetStats();
+	void ResetStats();	// Restarts the counters and the peak (from the bytes held now)
+
+	static PixelPool* Get();
+
+private:
+	std::mutex mutex;
+	std::vector<void*> free_lists[NUM_CLASSES];
+	PixelPoolStats stats;
+};
+
+template <typename Format>
+class PixelImage
+{
+public:
+	typedef Format PixelFormat;
+	typedef typename Format::Pixel Pixel;
+
+	// Of the first pixel, and of every row with aligned rows (so also of 16 and 32 bytes for SSE and AVX)
+	static const unsigned int ALIGNMENT = PIXEL_ALIGNMENT;
+
+	unsigned int width = 0;
+	unsigned int height = 0;
+	unsigned int pitch = 0;	// Pixels from the start of a row to the start of the next one
+	Pixel* pixels = nullptr;
+
+	PixelImage() {}
+	PixelImage(unsigned int width, unsigned int height, bool align_rows = false) { Allocate(width, height, align_rows); }
+	PixelImage(const PixelImage& c) { *this = c; }
+	PixelImage(PixelImage&& c) noexcept { Swap(c); }
+	PixelImage& operator = (const PixelImage& c);
+	PixelImage& operator = (PixelImage&& c) noexcept;	// c is left empty
+	~PixelImage() { FreePixels(pixels); }
+
+	// Frees the pixels and allocates new ones, all zero
+	void Allocate(unsigned int width, unsigned int height, bool align_rows = false);
+
+	// Exchanges the pixels (and sizes) of two images without copying them
+	void Swap(PixelImage& other) noexcept;
+
+	// Frees the pixels, the image becomes 0 x 0
+	void Release();
+
+	bool IsPacked() const { return pitch == width; }
+	bool HasAlignedRows() const { return aligned_rows; }
+	size_t GetRowBytes() const { return (size_t)pitch * sizeof(Pixel); }
+
+	Pixel* GetRow(unsigned int y) { return pixels + (size_t)y * pitch; }
+	const Pixel* GetRow(unsigned int y) const { return pixels + (size_t)y * pitch; }
+
+	// Get the pixel at position x,y
+	Pixel GetPixel(unsigned int x, unsigned int y) const { return pixels[(size_t)y * pitch + x]; }
+	Pixel& GetPixelRef(unsigned int x, unsigned int y) { return pixels[(size_t)y * pitch + x]; }
+
+	// Set the pixel at position x,y with value v
+	void SetPixel(unsigned int x, unsigned int y, const Pixel& v) { if (x >= width || y >= height) return; pixels[(size_t)y * pitch + x] = v; }
+	inline void SetPixelUnsafe(unsigned int x, unsigned int y, const Pixel& v) { pixels[(size_t)y * pitch + x] = v; }
+
+	// Fill the image (or the w x h area at x,y, clipped to the image) with the value v
+	void Fill(const Pixel& v) { FillArea(v, 0, 0, (int)width, (int)height); }
+	void FillArea(const Pixel& v, int x, int y, int w, int h);
+
+	// Change image size (the old one will remain in the top-left corner, the rest is zero)
+	void Resize(unsigned int width, unsigned int height);
+
+	// Becomes a copy of source converted to this format
+	template <typename SourceFormat>
+	void ConvertFrom(const PixelImage<SourceFormat>& source);
+
+private:
+	bool aligned_rows = false;
+
+	// Allocate, leaving the pixels as they come from the pool when they are all going to be written
+	void Reallocate(unsigned int width, unsigned int height, bool align_rows, bool clear);
+};
+
+template <typename Format>
+void PixelImage<Format>::Allocate(unsigned int width, unsigned int height, bool align_rows)
+{
+	Reallocate(width, height, align_rows, true);
+}
+
+template <typename Format>
+void PixelImage<Format>::Reallocate(unsigned int width, unsigned int height, bool align_rows, bool clear)
+{
+	FreePixels(pixels);
+	pixels = nullptr;
+	this->width = width;
+	this->height = height;
+	aligned_rows = align_rows;
+
+	// A whole number of pixels that is also a whole number of ALIGNMENT blocks
+	unsigned int step = 1;
+	if (align_rows)
+	{
+		unsigned int a = ALIGNMENT, b = (unsigned int)sizeof(Pixel);
+		while (b)
+		{
+			unsigned int t = a % b;
+			a = b;
+			b = t;
+		}
+		step = ALIGNMENT / a;
+	}
+	pitch = (width + step - 1) / step * step;
+	pixels = (width && height) ? (Pixel*)AllocatePixels((size_t)pitch * height * sizeof(Pixel), clear) : nullptr;
+}
+
+template <typename Format>
+PixelImage<Format>& PixelImage<Format>::operator = (const PixelImage& c)
+{
+	if (this == &c)
+		return *this;
+
+	// Same size and layout: the pixel array is reused
+	if (!pixels || !c.pixels || width != c.width || height != c.height || aligned_rows != c.aligned_rows)
+	{
+		if (c.pixels)
+			Reallocate(c.width, c.height, c.aligned_rows, false);
+		else
+		{
+			Release();
+			width = c.width;
+			height = c.height;
+			pitch = c.pitch;
+			aligned_rows = c.aligned_rows;
+		}
+	}
+
+	if (c.pixels)
+		memcpy(pixels, c.pixels, (size_t)pitch * height * sizeof(Pixel));
+	return *this;
+}
+
+template <typename Format>
+PixelImage<Format>& PixelImage<Format>::operator = (PixelImage&& c) noexcept
+{
+	if (this != &c)
+	{
+		Release();
+		Swap(c);
+	}
+	return *this;
+}
+
+template <typename Format>
+void PixelImage<Format>::Release()
+{
+	FreePixels(pixels);
+	pixels = nullptr;
+	width = height = pitch = 0;
+	aligned_rows = false;
+}
+
+template <typename Format>
+void PixelImage<Format>::Swap(PixelImage& other) noexcept
+{
+	std::swap(width, other.width);
+	std::swap(height, other.height);
+	std::swap(pitch, other.pitch);
+	std::swap(pixels, other.pixels);
+	std::swap(aligned_rows, other.aligned_rows);
+}
+
+template <typename Format>
+void PixelImage<Format>::FillArea(const Pixel& v, int x, int y, int w, int h)
+{
+	int x0 = std::max(x, 0), y0 = std::max(y, 0);
+	int x1 = std::min(x + w, (int)width), y1 = std::min(y + h, (int)height);
+	if (x0 >= x1)
+		return;
+	for (int row = y0; row < y1; ++row)
+		std::fill(GetRow(row) + x0, GetRow(row) + x1, v);
+}
+
+template <typename Format>
+void PixelImage<Format>::Resize(unsigned int width, unsigned int height)
+{
+	if (pixels && width == this->width && height == this->height)
+		return;
+
+	PixelImage resized(width, height, aligned_rows);
+	unsigned int min_width = std::min(this->width, width);
+	unsigned int min_height = std::min(this->height, height);
+	if (pixels && min_width)
+		for (unsigned int y = 0; y < min_height; ++y)
+			memcpy(resized.GetRow(y), GetRow(y), min_width * sizeof(Pixel));
+	Swap(resized);
+}
+
+template <typename Format>
+template <typename SourceFormat>
+void PixelImage<Format>::ConvertFrom(const PixelImage<SourceFormat>& source)
+{
+	if (!pixels || width != source.width || height != source.height)
+		Reallocate(source.width, source.height, aligned_rows, false);
+
+	for (unsigned int y = 0; y < height; ++y)
+	{
+		const typename SourceFormat::Pixel* in = source.GetRow(y);
+		Pixel* out = GetRow(y);
+		for (unsigned int x = 0; x < width; ++x)
+			out[x] = PixelConverter<Format, SourceFormat>::Convert(in[x]);
+	}
+}
+
+// Image storing one float per pixel instead of a 3 or 4 component Color
+typedef PixelImage<FormatR32F> FloatImage;
+
+// 8-bit color with alpha (Image has no alpha)
+typedef PixelImage<FormatRGBA8> RGBAImage;
@@ -0,0 +1,781 @@
+#include "pngcodec.h"
+#include "deflate.h"
+#include "image.h"
+#include "threadpool.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+#ifdef CG_SIMD
+bool PNGDecoder::use_simd = true;
+bool PNGEncoder::use_simd = true;
+#else
+bool PNGDecoder::use_simd = false;
+bool PNGEncoder::use_simd = false;
+#endif
+
+static const unsigned char PNG_SIGNATURE[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+static const uint64_t MAX_PIXELS = (uint64_t)1 << 28;
+static const size_t ROW_PADDING = 16;	// Past the end of the scratch rows, for the 4-byte stores of 3-byte pixels
+
+static bool Fail(const char* reason)
+{
+	std::cerr << "--- PNG: " << reason << std::endl;
+	return false;
+}
+
+static uint32_t ReadUint32(const unsigned char* p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static bool IsChunk(const unsigned char* type, const char* name)
+{
+	return memcmp(type, name, 4) == 0;
+}
+
+static inline unsigned char PaethPredictor(int a, int b, int c)
+{
+	int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+	return (unsigned char)((pa <= pb && pa <= pc) ? a : pb <= pc ? b : c);
+}
+
+// Reverses the filter of a row of length bytes with pixels of bpp bytes, previous is the unfiltered row above (zeros for
+// the first row of a pass)
+static void UnfilterScalar(int filter, unsigned char* row, const unsigned char* filtered, const unsigned char* previous,
+	size_t length, int bpp)
+{
+	size_t first = std::min((size_t)bpp, length);
+	switch (filter)
+	{
+	case 0:
+		memcpy(row, filtered, length);
+		break;
+	case 1:
+		memcpy(row, filtered, first);
+		for (size_t i = first; i < length; ++i)
+			row[i] = filtered[i] + row[i - bpp];
+		break;
+	case 2:
+		for (size_t i = 0; i < length; ++i)
+			row[i] = filtered[i] + previous[i];
+		break;
+	case 3:
+		for (size_t i = 0; i < first; ++i)
+			row[i] = filtered[i] + (previous[i] >> 1);
+		for (size_t i = first; i < length; ++i)
+			row[i] = filtered[i] + ((row[i - bpp] + previous[i]) >> 1);
+		break;
+	case 4:
+		for (size_t i = 0; i < first; ++i)
+			row[i] = filtered[i] + previous[i];
+		for (size_t i = first; i < length; ++i)
+			row[i] = filtered[i] + PaethPredictor(row[i - bpp], previous[i], previous[i - bpp]);
+		break;
+	}
+}
+
+// Reverses the filter of the last pixel of a row of length bytes, the bytes before it already unfiltered
+static void UnfilterLastPixel(int filter, unsigned char* row, const unsigned char* filtered, const unsigned char* previous,
+	size_t length, int bpp)
+{
+	for (size_t i = length - bpp; i < length; ++i)
+	{
+		int a = i >= (size_t)bpp ? row[i - bpp] : 0;
+		int b = previous[i];
+		int c = i >= (size_t)bpp ? previous[i - bpp] : 0;
+		switch (filter)
+		{
+		case 0: row[i] = filtered[i]; break;
+		case 1: row[i] = (unsigned char)(filtered[i] + a); break;
+		case 2: row[i] = (unsigned char)(filtered[i] + b); break;
+		case 3: row[i] = (unsigned char)(filtered[i] + ((a + b) >> 1)); break;
+		case 4: row[i] = (unsigned char)(filtered[i] + PaethPredictor(a, b, c)); break;
+		}
+	}
+}
+
+#ifdef CG_SIMD
+
+// Pixels of 3 or 4 bytes in the low lanes. The 3-byte ones are loaded and stored as 4 bytes: the extra byte read is in the
+// same buffer, and the one written is rewritten by the next pixel or lands in the padding of the row
+static inline __m128i LoadPixel(const unsigned char* p)
+{
+	int v;
+	memcpy(&v, p, 4);
+	return _mm_cvtsi32_si128(v);
+}
+
+static inline void StorePixel(unsigned char* p, __m128i v)
+{
+	int value = _mm_cvtsi128_si32(v);
+	memcpy(p, &value, 4);
+}
+
+static inline __m128i Abs16(__m128i v)
+{
+	return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+static inline __m128i Select(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// The filters that only depend on the row above are 16 bytes at a time; Sub, Average and Paeth depend on the pixel to the
+// left, so they go a pixel at a time with every channel in a lane (Sub of 4-byte pixels adds 4 at a time with a prefix sum)
+static void UnfilterSimd(int filter, unsigned char* row, const unsigned char* filtered, const unsigned char* previous,
+	size_t length, int bpp)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+
+	if (filter == 2)
+	{
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i*)(filtered + i));
+			__m128i b = _mm_loadu_si128((const __m128i*)(previous + i));
+			_mm_storeu_si128((__m128i*)(row + i), _mm_add_epi8(x, b));
+		}
+		for (; i < length; ++i)
+			row[i] = filtered[i] + previous[i];
+		return;
+	}
+
+	if (filter == 1 && bpp == 4)
+	{
+		__m128i left = zero;
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i*)(filtered + i));
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+			x = _mm_add_epi8(x, left);
+			_mm_storeu_si128((__m128i*)(row + i), x);
+			left = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+		}
+		for (; i < length; i += 4)
+		{
+			left = _mm_add_epi8(LoadPixel(filtered + i), left);
+			StorePixel(row + i, left);
+		}
+		return;
+	}
+
+	if (filter == 1)
+	{
+		__m128i left = zero;
+		for (; i < length; i += bpp)
+		{
+			left = _mm_add_epi8(LoadPixel(filtered + i), left);
+			StorePixel(row + i, left);
+		}
+		return;
+	}
+
+	if (filter == 3)
+	{
+		// Rounded down average: the rounded up one minus the carry of the odd sums
+		const __m128i one = _mm_set1_epi8(1);
+		__m128i left = zero;
+		for (; i < length; i += bpp)
+		{
+			__m128i up = LoadPixel(previous + i);
+			__m128i average = _mm_sub_epi8(_mm_avg_epu8(left, up), _mm_and_si128(_mm_xor_si128(left, up), one));
+			left = _mm_add_epi8(LoadPixel(filtered + i), average);
+			StorePixel(row + i, left);
+		}
+		return;
+	}
+
+	if (filter == 4)
+	{
+		// a, b and c (left, up and up-left) widened to 16 bits. Ties prefer a, then b, as in the scalar predictor
+		__m128i a = zero, c = zero;
+		for (; i < length; i += bpp)
+		{
+			__m128i b = _mm_unpacklo_epi8(LoadPixel(previous + i), zero);
+			__m128i pa = _mm_sub_epi16(b, c);
+			__m128i pb = _mm_sub_epi16(a, c);
+			__m128i pc = Abs16(_mm_add_epi16(pa, pb));
+			pa = Abs16(pa);
+			pb = Abs16(pb);
+			__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+			__m128i nearest = Select(_mm_cmpeq_epi16(smallest, pb), b, c);
+			nearest = Select(_mm_cmpeq_epi16(smallest, pa), a, nearest);
+
+			__m128i x = _mm_add_epi8(LoadPixel(filtered + i), _mm_packus_epi16(nearest, zero));
+			StorePixel(row + i, x);
+			a = _mm_unpacklo_epi8(x, zero);
+			c = b;
+		}
+		return;
+	}
+
+	UnfilterScalar(filter, row, filtered, previous, length, bpp);
+}
+
+#endif
+
+static void Unfilter(int filter, unsigned char* row, const unsigned char* filtered, const unsigned char* previous,
+	size_t length, int bpp)
+{
+#ifdef CG_SIMD
+	if (PNGDecoder::use_simd && (filter == 2 || bpp == 3 || bpp == 4))
+	{
+		UnfilterSimd(filter, row, filtered, previous, length, bpp);
+		return;
+	}
+#endif
+	UnfilterScalar(filter, row, filtered, previous, length, bpp);
+}
+
+bool PNGDecoder::ReadHeader(const unsigned char* chunk, size_t length)
+{
+	if (length != 13)
+		return Fail("corrupt header");
+
+	width = ReadUint32(chunk);
+	height = ReadUint32(chunk + 4);
+	bit_depth = chunk[8];
+	color_type = chunk[9];
+	if (chunk[10] != 0 || chunk[11] != 0)
+		return Fail("unknown compression or filter method");
+	if (chunk[12] > 1)
+		return Fail("unknown interlace method");
+	interlaced = chunk[12] == 1;
+	if (!width || !height || (uint64_t)width * height > MAX_PIXELS)
+		return Fail("invalid image size");
+
+	// Samples per pixel, and the bit depths each colour type allows
+	int samples = 0;
+	bool valid_depth = false;
+	switch (color_type)
+	{
+	case 0: samples = 1; valid_depth = bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8 || bit_depth == 16; break;
+	case 2: samples = 3; valid_depth = bit_depth == 8 || bit_depth == 16; break;
+	case 3: samples = 1; valid_depth = bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8; break;
+	case 4: samples = 2; valid_depth = bit_depth == 8 || bit_depth == 16; break;
+	case 6: samples = 4; valid_depth = bit_depth == 8 || bit_depth == 16; break;
+	default: return Fail("unknown colour type");
+	}
+	if (!valid_depth)
+		return Fail("invalid bit depth");
+	bits_per_pixel = samples * bit_depth;
+	return true;
+}
+
+bool PNGDecoder::ReadTransparency(const unsigned char* chunk, size_t length)
+{
+	if (color_type == 3)
+	{
+		if ((int)length > palette_size)
+			return Fail("more transparency entries than colours");
+		for (size_t i = 0; i < length; ++i)
+			palette[i].a = chunk[i];
+		return true;
+	}
+
+	int samples = color_type == 0 ? 1 : color_type == 2 ? 3 : 0;
+	if (!samples)
+		return Fail("transparency key on a colour type with alpha");
+	if ((int)length != 2 * samples)
+		return Fail("corrupt transparency key");
+	for (int i = 0; i < samples; ++i)
+		key[i] = (uint16_t)(chunk[2 * i] << 8 | chunk[2 * i + 1]);
+	has_key = true;
+	return true;
+}
+
+bool PNGDecoder::Decode(const unsigned char* data, size_t size, Image& image, bool flip_y)
+{
+	return ReadChunks(data, size) && DecodePixels(image, flip_y);
+}
+
+bool PNGDecoder::Decode(const unsigned char* data, size_t size, RGBAImage& image, bool flip_y)
+{
+	return ReadChunks(data, size) && DecodePixels(image, flip_y);
+}
+
+bool PNGDecoder::ReadChunks(const unsigned char* data, size_t size)
+{
+	if (!data || size < 8 || memcmp(data, PNG_SIGNATURE, 8) != 0)
+		return Fail("not a PNG file");
+
+	palette_size = 0;
+	has_key = false;
+	bool header_read = false, has_data = false;
+
+	// Chunks: length, type, data and CRC. The IDAT ones are inflated where they are, as pieces of a single stream
+	size_t pos = 8;
+	while (pos + 12 <= size)
+	{
+		size_t length = ReadUint32(data + pos);
+		const unsigned char* type = data + pos + 4;
+		const unsigned char* chunk = data + pos + 8;
+		if (length > size - pos - 12)
+			return Fail("truncated chunk");
+		pos += 12 + length;
+
+		if (!header_read)
+		{
+			if (!IsChunk(type, "IHDR"))
+				return Fail("no header");
+			if (!ReadHeader(chunk, length))
+				return false;
+			header_read = true;
+
+			// The widest row (the whole image, with its filter byte) is the largest read of the inflater
+			inflater.Begin(((size_t)width * bits_per_pixel + 7) / 8 + 1);
+		}
+		else if (IsChunk(type, "IDAT"))
+		{
+			inflater.AddInput(chunk, length);
+			has_data = true;
+		}
+		else if (IsChunk(type, "PLTE"))
+		{
+			if (length % 3 || length > 3 * 256)
+				return Fail("corrupt palette");
+			palette_size = (int)length / 3;
+			for (int i = 0; i < palette_size; ++i)
+				palette[i] = ColorRGBA(chunk[3 * i], chunk[3 * i + 1], chunk[3 * i + 2]);
+		}
+		else if (IsChunk(type, "tRNS"))
+		{
+			if (!ReadTransparency(chunk, length))
+				return false;
+		}
+		else if (IsChunk(type, "IEND"))
+			break;
+		else if (!(type[0] & 32))
+			return Fail("unknown critical chunk");
+	}
+
+	if (!header_read || !has_data)
+		return Fail("no image data");
+	if (color_type == 3 && !palette_size)
+		return Fail("no palette");
+	return true;
+}
+
+template <typename Format>
+bool PNGDecoder::DecodePixels(PixelImage<Format>& image, bool flip_y)
+{
+	image.Allocate(width, height);
+	if (!interlaced)
+		return DecodePass(image, flip_y, 0, 0, 1, 1);
+
+	// Adam7: seven reduced images, each one with its own filtered rows
+	static const int START_X[7] = { 0, 4, 0, 2, 0, 1, 0 };
+	static const int START_Y[7] = { 0, 0, 4, 0, 2, 0, 1 };
+	static const int STEP_X[7] = { 8, 8, 4, 4, 2, 2, 1 };
+	static const int STEP_Y[7] = { 8, 8, 8, 4, 4, 2, 2 };
+	for (int pass = 0; pass < 7; ++pass)
+		if (!DecodePass(image, flip_y, START_X[pass], START_Y[pass], STEP_X[pass], STEP_Y[pass]))
+			return false;
+	return true;
+}
+
+template <typename Format>
+bool PNGDecoder::DecodePass(PixelImage<Format>& image, bool flip_y, int start_x, int start_y, int step_x, int step_y)
+{
+	if ((unsigned int)start_x >= width || (unsigned int)start_y >= height)
+		return true;	// Empty pass, it has no rows in the stream
+
+	unsigned int pass_width = (width - start_x + step_x - 1) / step_x;
+	unsigned int pass_height = (height - start_y + step_y - 1) / step_y;
+	size_t row_bytes = ((size_t)pass_width * bits_per_pixel + 7) / 8;
+	int bpp = std::max(bits_per_pixel / 8, 1);
+
+	// 8-bit RGB into an Image and 8-bit RGBA into an RGBAImage need no conversion: every row is unfiltered into the image,
+	// against the row above in the image. The last pixel is unfiltered on its own, as the vectorized unfilters of 3-byte
+	// pixels read and write a byte past it, which is the next row of the image or past its end
+	bool direct = !interlaced && bit_depth == 8 && color_type == (Format::CHANNELS == 4 ? 6 : 2);
+	size_t direct_bytes = row_bytes - bpp;
+
+	size_t stride = row_bytes + ROW_PADDING;
+	rows.assign(2 * stride, 0);
+	unsigned char* current = &rows[0];
+	unsigned char* previous = &rows[stride];
+
+	for (unsigned int y = 0; y < pass_height; ++y)
+	{
+		const unsigned char* filtered;
+		if (!inflater.Read(filtered, row_bytes + 1))
+			return false;
+		int filter = filtered[0];
+		if (filter > 4)
+			return Fail("unknown filter type");
+
+		unsigned int image_y = start_y + y * step_y;
+		typename Format::Pixel* out = image.GetRow(flip_y ? height - 1 - image_y : image_y);
+		if (direct)
+		{
+			unsigned char* row = (unsigned char*)out;
+			const unsigned char* above = y ? previous : &rows[stride];
+			Unfilter(filter, row, filtered + 1, above, direct_bytes, bpp);
+			UnfilterLastPixel(filter, row, filtered + 1, above, row_bytes, bpp);
+			previous = row;
+			continue;
+		}
+
+		Unfilter(filter, current, filtered + 1, previous, row_bytes, bpp);
+		if (!ConvertRow(current, pass_width, out + start_x, step_x))
+			return false;
+		std::swap(current, previous);
+	}
+	return true;
+}
+
+static inline void SetPixel(ColorRGBA* out, const ColorRGBA& c)
+{
+	*out = c;
+}
+
+static inline void SetPixel(Color* out, const ColorRGBA& c)
+{
+	*out = Color(c.r, c.g, c.b);
+}
+
+template <typename Pixel>
+bool PNGDecoder::ConvertRow(const unsigned char* row, unsigned int count, Pixel* out, int step)
+{
+	// Samples of less than 8 bits are packed from the highest bit of each byte
+	int mask = (1 << bit_depth) - 1;
+	#define PACKED_SAMPLE(i) ((row[((i) * bit_depth) >> 3] >> (8 - bit_depth - (((i) * bit_depth) & 7))) & mask)
+
+	switch (color_type * 32 + bit_depth)
+	{
+	case 0 * 32 + 1:
+	case 0 * 32 + 2:
+	case 0 * 32 + 4:
+		for (unsigned int i = 0; i < count; ++i, out += step)
+		{
+			int sample = PACKED_SAMPLE(i);
+			unsigned char v = (unsigned char)(sample * 255 / mask);
+			SetPixel(out, ColorRGBA(v, v, v, has_key && sample == key[0] ? 0 : 255));
+		}
+		break;
+	case 0 * 32 + 8:
+		for (unsigned int i = 0; i < count; ++i, out += step)
+			SetPixel(out, ColorRGBA(row[i], row[i], row[i], has_key && row[i] == key[0] ? 0 : 255));
+		break;
+	case 0 * 32 + 16:
+		for (unsigned int i = 0; i < count; ++i, out += step, row += 2)
+			SetPixel(out, ColorRGBA(row[0], row[0], row[0], has_key && (row[0] << 8 | row[1]) == key[0] ? 0 : 255));
+		break;
+	case 2 * 32 + 8:
+		for (unsigned int i = 0; i < count; ++i, out += step, row += 3)
+			SetPixel(out, ColorRGBA(row[0], row[1], row[2], has_key && row[0] == key[0] && row[1] == key[1] && row[2] == key[2] ? 0 : 255));
+		break;
+	case 2 * 32 + 16:
+		for (unsigned int i = 0; i < count; ++i, out += step, row += 6)
+		{
+			bool transparent = has_key && (row[0] << 8 | row[1]) == key[0] && (row[2] << 8 | row[3]) == key[1] && (row[4] << 8 | row[5]) == key[2];
+			SetPixel(out, ColorRGBA(row[0], row[2], row[4], transparent ? 0 : 255));
+		}
+		break;
+	case 3 * 32 + 1:
+	case 3 * 32 + 2:
+	case 3 * 32 + 4:
+	case 3 * 32 + 8:
+		for (unsigned int i = 0; i < count; ++i, out += step)
+		{
+			int index = bit_depth == 8 ? row[i] : PACKED_SAMPLE(i);
+			if (index >= palette_size)
+				return Fail("colour index out of the palette");
+			SetPixel(out, palette[index]);
+		}
+		break;
+	case 4 * 32 + 8:
+		for (unsigned int i = 0; i < count; ++i, out += step, row += 2)
+			SetPixel(out, ColorRGBA(row[0], row[0], row[0], row[1]));
+		break;
+	case 4 * 32 + 16:
+		for (unsigned int i = 0; i < count; ++i, out += step, row += 4)
+			SetPixel(out, ColorRGBA(row[0], row[0], row[0], row[2]));
+		break;
+	case 6 * 32 + 8:
+		for (unsigned int i = 0; i < count; ++i, out += step, row += 4)
+			SetPixel(out, ColorRGBA(row[0], row[1], row[2], row[3]));
+		break;
+	case 6 * 32 + 16:
+		for (unsigned int i = 0; i < count; ++i, out += step, row += 8)
+			SetPixel(out, ColorRGBA(row[0], row[2], row[4], row[6]));
+		break;
+	}
+
+	#undef PACKED_SAMPLE
+	return true;
+}
+
+static const size_t PIECE_SIZE = 256 * 1024;	// Filtered bytes compressed by each task
+static const int NUM_FILTERS = 5;
+
+static void WriteUint32(unsigned char* p, uint32_t v)
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+// Writes length, type, data and the CRC of type and data. Returns the bytes written
+static size_t WriteChunk(std::ostream& stream, const char* type, const unsigned char* data, size_t size)
+{
+	unsigned char header[8];
+	WriteUint32(header, (uint32_t)size);
+	memcpy(header + 4, type, 4);
+	unsigned char crc[4];
+	WriteUint32(crc, Crc32(Crc32(0, header + 4, 4), data, size));
+
+	stream.write((const char*)header, 8);
+	stream.write((const char*)data, size);
+	stream.write((const char*)crc, 4);
+	return size + 12;
+}
+
+// Filters bytes [start, end) of a row with pixels of bpp bytes with Sub, Up, Average and Paeth into candidates[1..4],
+// previous is the row above (zeros for the first one). scores[f] adds the absolute values of the output of filter f as
+// signed bytes, the none filter (0) is the row itself
+static void FilterScalar(const unsigned char* row, const unsigned char* previous, size_t start, size_t end, int bpp,
+	unsigned char* const* candidates, uint64_t* scores)
+{
+	for (size_t i = start; i < end; ++i)
+	{
+		int a = i >= (size_t)bpp ? row[i - bpp] : 0;
+		int b = previous[i];
+		int c = i >= (size_t)bpp ? previous[i - bpp] : 0;
+		unsigned char out[NUM_FILTERS] = {
+			row[i],
+			(unsigned char)(row[i] - a),
+			(unsigned char)(row[i] - b),
+			(unsigned char)(row[i] - ((a + b) >> 1)),
+			(unsigned char)(row[i] - PaethPredictor(a, b, c))
+		};
+		for (int f = 1; f < NUM_FILTERS; ++f)
+			candidates[f][i] = out[f];
+		for (int f = 0; f < NUM_FILTERS; ++f)
+			scores[f] += (unsigned int)abs((signed char)out[f]);
+	}
+}
+
+#ifdef CG_SIMD
+
+// Sum of the absolute values of the 16 signed bytes of v, in the two 64-bit lanes
+static inline __m128i AbsSum(__m128i v)
+{
+	__m128i zero = _mm_setzero_si128();
+	return _mm_sad_epu8(_mm_min_epu8(v, _mm_sub_epi8(zero, v)), zero);
+}
+
+// Paeth predictor of 8 pixels bytes widened to 16 bits
+static inline __m128i Paeth16(__m128i a, __m128i b, __m128i c)
+{
+	__m128i pa = _mm_sub_epi16(b, c);
+	__m128i pb = _mm_sub_epi16(a, c);
+	__m128i pc = Abs16(_mm_add_epi16(pa, pb));
+	pa = Abs16(pa);
+	pb = Abs16(pb);
+	__m128i not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+	__m128i use_c = _mm_cmpgt_epi16(pb, pc);
+	return Select(not_a, Select(use_c, c, b), a);
+}
+
+// Unlike unfiltering, every output byte only depends on the input rows, so all the filters go 16 bytes at a time. The
+// first pixel (no left neighbour) and the tail are scalar
+static void FilterSimd(const unsigned char* row, const unsigned char* previous, size_t length, int bpp,
+	unsigned char* const* candidates, uint64_t* scores)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi8(1);
+	size_t start = std::min(length, (size_t)bpp);
+	FilterScalar(row, previous, 0, start, bpp, candidates, scores);
+
+	__m128i sums[NUM_FILTERS];
+	for (int f = 0; f < NUM_FILTERS; ++f)
+		sums[f] = zero;
+
+	size_t i = start;
+	for (; i + 16 <= length; i += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+		__m128i a = _mm_loadu_si128((const __m128i*)(row + i - bpp));
+		__m128i b = _mm_loadu_si128((const __m128i*)(previous + i));
+		__m128i c = _mm_loadu_si128((const __m128i*)(previous + i - bpp));
+
+		// Rounded down average: the rounded up one minus the odd bit of the sum
+		__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+		__m128i paeth = _mm_packus_epi16(
+			Paeth16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero)),
+			Paeth16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero)));
+
+		__m128i out[NUM_FILTERS] = { x, _mm_sub_epi8(x, a), _mm_sub_epi8(x, b), _mm_sub_epi8(x, average),
+			_mm_sub_epi8(x, paeth) };
+		for (int f = 1; f < NUM_FILTERS; ++f)
+			_mm_storeu_si128((__m128i*)(candidates[f] + i), out[f]);
+		for (int f = 0; f < NUM_FILTERS; ++f)
+			sums[f] = _mm_add_epi64(sums[f], AbsSum(out[f]));
+	}
+
+	for (int f = 0; f < NUM_FILTERS; ++f)
+	{
+		uint64_t lanes[2];
+		_mm_storeu_si128((__m128i*)lanes, sums[f]);
+		scores[f] += lanes[0] + lanes[1];
+	}
+	FilterScalar(row, previous, i, length, bpp, candidates, scores);
+}
+
+#endif
+
+// Writes the filter byte and the filtered row to out, with the filter that gives the smallest sum. scratch holds the
+// candidates, 4 rows of length bytes
+static void FilterRow(const unsigned char* row, const unsigned char* previous, size_t length, int bpp, bool adaptive,
+	unsigned char* scratch, unsigned char* out)
+{
+	if (!adaptive)
+	{
+		out[0] = 0;
+		memcpy(out + 1, row, length);
+		return;
+	}
+
+	unsigned char* candidates[NUM_FILTERS] = { nullptr, scratch, scratch + length, scratch + 2 * length, scratch + 3 * length };
+	uint64_t scores[NUM_FILTERS] = { 0, 0, 0, 0, 0 };
+#ifdef CG_SIMD
+	if (PNGEncoder::use_simd)
+		FilterSimd(row, previous, length, bpp, candidates, scores);
+	else
+#endif
+		FilterScalar(row, previous, 0, length, bpp, candidates, scores);
+
+	int best = 0;
+	for (int f = 1; f < NUM_FILTERS; ++f)
+		if (scores[f] < scores[best])
+			best = f;
+	out[0] = (unsigned char)best;
+	memcpy(out + 1, best ? candidates[best] : row, length);
+}
+
+size_t PNGEncoder::Encode(const Image& image, std::ostream& stream, bool flip_y)
+{
+	static_assert(sizeof(Color) == 3, "Image rows are written as packed RGB bytes");
+
+	if (!image.width || !image.height)
+	{
+		Fail("the image is empty");
+		return 0;
+	}
+
+	const int bpp = 3;
+	const unsigned int height = image.height;
+	const size_t row_bytes = (size_t)image.width * bpp;
+	const size_t filtered_bytes = row_bytes + 1;
+	const int compression = std::max(0, std::min(level, (int)Deflater::MAX_LEVEL));
+
+	// Each piece is a run of rows; the rows covering the 32 KB before it are filtered again as its dictionary (a stored
+	// stream needs none). Every row is filtered from the image rows alone, so the pieces do not depend on each other
+	const unsigned int piece_rows = (unsigned int)std::max((size_t)1, PIECE_SIZE / filtered_bytes);
+	const unsigned int dictionary_rows = compression ? (unsigned int)((Deflater::WINDOW_SIZE + filtered_bytes - 1) / filtered_bytes) : 0;
+	const int num_pieces = (int)((height + piece_rows - 1) / piece_rows);
+
+	// Row y of the file, the row above the first one is all zeros
+	std::vector<unsigned char> zeros(row_bytes, 0);
+	auto file_row = [&](unsigned int y) -> const unsigned char* {
+		return (const unsigned char*)image.GetRow(flip_y ? height - 1 - y : y);
+	};
+
+	struct Slot
+	{
+		Deflater deflater;
+		std::vector<unsigned char> input, output, scratch;
+		uint32_t adler;
+		Slot(int level) : deflater(level) {}
+	};
+	ThreadPool* pool = ThreadPool::Get();
+	const int batch = parallel ? (int)pool->GetNumThreads() * 2 : 1;
+	std::vector<Slot> slots;
+	slots.reserve(std::min(batch, num_pieces));
+	for (int i = 0; i < std::min(batch, num_pieces); ++i)
+		slots.emplace_back(compression);
+
+	auto compress_piece = [&](int piece, Slot& slot) {
+		unsigned int first = piece * piece_rows;
+		unsigned int last = std::min(height, first + piece_rows);
+		unsigned int dictionary_first = first > dictionary_rows ? first - dictionary_rows : 0;
+
+		slot.input.resize((last - dictionary_first) * filtered_bytes);
+		slot.scratch.resize(4 * row_bytes);
+		for (unsigned int y = dictionary_first; y < last; ++y)
+			FilterRow(file_row(y), y ? file_row(y - 1) : zeros.data(), row_bytes, bpp, compression > 0,
+				slot.scratch.data(), slot.input.data() + (y - dictionary_first) * filtered_bytes);
+
+		size_t dictionary_size = (first - dictionary_first) * filtered_bytes;
+		size_t size = slot.input.size() - dictionary_size;
+		const unsigned char* data = slot.input.data() + dictionary_size;
+		slot.adler = Adler32(1, data, size);
+
+		slot.output.clear();
+		if (piece == 0)
+		{
+			// zlib header: deflate with a 32 KB window, the level hint and the check bits
+			unsigned char cmf = 0x78;
+			unsigned char flg = (unsigned char)((compression < 2 ? 0 : compression < 6 ? 1 : compression == 6 ? 2 : 3) << 6);
+			flg |= 31 - (cmf * 256 + flg) % 31;
+			slot.output.push_back(cmf);
+			slot.output.push_back(flg);
+		}
+		slot.deflater.Compress(data, size, dictionary_size, piece == num_pieces - 1, slot.output);
+	};
+
+	size_t written = 0;
+	stream.write((const char*)PNG_SIGNATURE, 8);
+	written += 8;
+
+	unsigned char header[13];
+	WriteUint32(header, image.width);
+	WriteUint32(header + 4, height);
+	header[8] = 8;		// Bit depth
+	header[9] = 2;		// RGB
+	header[10] = 0;		// Deflate
+	header[11] = 0;		// Adaptive filtering
+	header[12] = 0;		// Not interlaced
+	written += WriteChunk(stream, "IHDR", header, sizeof(header));
+
+	// Every batch is written as soon as it is compressed, in order
+	uint32_t adler = 1;
+	for (int start = 0; start < num_pieces && stream; start += batch)
+	{
+		int count = std::min(batch, num_pieces - start);
+		if (parallel && count > 1)
+			pool->ParallelFor(count, [&](int i) { compress_piece(start + i, slots[i]); });
+		else
+			for (int i = 0; i < count; ++i)
+				compress_piece(start + i, slots[i]);
+
+		for (int i = 0; i < count; ++i)
+		{
+			const Slot& slot = slots[i];
+			written += WriteChunk(stream, "IDAT", slot.output.data(), slot.output.size());
+			size_t size = std::min(height, (start + i + 1) * piece_rows) - (start + i) * piece_rows;
+			adler = Adler32Combine(adler, slot.adler, size * filtered_bytes);
+		}
+	}
+
+	unsigned char trailer[4];
+	WriteUint32(trailer, adler);
+	written += WriteChunk(stream, "IDAT", trailer, 4);
+	written += WriteChunk(stream, "IEND", nullptr, 0);
+
+	if (!stream)
+	{
+		Fail("could not write the file");
+		return 0;
+	}
+	return written;
+}
@@ -0,0 +1,84 @@
+/*
+	+ PNGDecoder decodes PNG files held in memory (see MappedFile) into an Image (the alpha is dropped) or an RGBAImage:
+	  every colour type and bit depth, transparency keys and palettes, and Adam7 interlacing.
+	+ The rows are inflated a few at a time (see Inflater) and unfiltered straight into the rows of the image when the file
+	  is not interlaced and has the 8-bit layout of the image (RGB for Image, RGBA for RGBAImage); other layouts go through
+	  a scratch row that is converted into the image, so nothing the size of the image is allocated besides the image itself.
+	+ The Sub, Average and Paeth filters of 3 and 4-byte pixels and the Up filter of any pixel are vectorized; the scalar
+	  path gives the same bytes.
+	+ The chunk CRCs are not checked. A decoder works from one thread at a time, but several decoders can work at once.
+	+ PNGEncoder writes an Image as an 8-bit RGB PNG. Every row gets the filter whose output has the smallest sum of absolute
+	  values, and the filtered rows are compressed in pieces of about 256 KB (see Deflater), on the thread pool when parallel.
+	  Each batch of pieces is written as soon as it is compressed, so the file is never held whole in memory.
+*/
+
+#pragma once
+
+#include <vector>
+#include <ostream>
+#include "pixelimage.h"
+#include "inflate.h"
+
+class Image;
+
+class PNGDecoder
+{
+public:
+	// Use the vectorized unfilters
+	static bool use_simd;
+
+	// Decodes a whole PNG file held in memory, flipped in Y if requested. Prints the reason and returns false when the
+	// file is not valid
+	bool Decode(const unsigned char* data, size_t size, Image& image, bool flip_y = true);
+	bool Decode(const unsigned char* data, size_t size, RGBAImage& image, bool flip_y = true);
+
+private:
+	// From the IHDR chunk
+	unsigned int width = 0;
+	unsigned int height = 0;
+	int bit_depth = 0;
+	int color_type = 0;
+	bool interlaced = false;
+	int bits_per_pixel = 0;
+
+	// From the PLTE and tRNS chunks
+	ColorRGBA palette[256];
+	int palette_size = 0;
+	bool has_key = false;
+	uint16_t key[3];	// Transparent grey or RGB sample, in the bit depth of the file
+
+	Inflater inflater;
+	std::vector<unsigned char> rows;	// Current and previous scratch rows
+
+	bool ReadHeader(const unsigned char* chunk, size_t length);
+	bool ReadTransparency(const unsigned char* chunk, size_t length);
+
+	// Reads every chunk up to IEND, leaving the image data in the inflater
+	bool ReadChunks(const unsigned char* data, size_t size);
+
+	template <typename Format>
+	bool DecodePixels(PixelImage<Format>& image, bool flip_y);
+	template <typename Format>
+	bool DecodePass(PixelImage<Format>& image, bool flip_y, int start_x, int start_y, int step_x, int step_y);
+
+	// Converts count unfiltered pixels of the file into the image, one every step
+	template <typename Pixel>
+	bool ConvertRow(const unsigned char* row, unsigned int count, Pixel* out, int step);
+};
+
+class PNGEncoder
+{
+public:
+	// Use the vectorized filters
+	static bool use_simd;
+
+	// 0 stores the pixels, 1 is the fastest compression and 9 the smallest (see Deflater)
+	int level = 6;
+
+	// Compresses the pieces of the image on the thread pool
+	bool parallel = true;
+
+	// Writes image to stream, the last row first when flip_y (LoadPNG flips it back). Returns the bytes written, 0 when the
+	// stream fails
+	size_t Encode(const Image& image, std::ostream& stream, bool flip_y = true);
+};
@@ -0,0 +1,115 @@
+#include "polygonfill.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+// First of size pixels whose centre is at or after v, or size if none. The float is clamped before it is converted, so any
+// value is safe (NaN gives 0)
+static inline int FirstCentreFrom(float v, int size)
+{
+	float i = std::ceil(v - 0.5f);
+	if (!(i > 0.0f))
+		return 0;
+	return i < (float)size ? (int)i : size;
+}
+
+void PolygonFiller::Fill(Image& image, const Vector2* vertices, int count, const Color& c, eFillRule rule)
+{
+	if (!image.pixels || count < 3)
+		return;
+	for (int i = 0; i < count; ++i)
+		if (!std::isfinite(vertices[i].x) || !std::isfinite(vertices[i].y))
+			return;
+
+	// Rows whose centre is crossed by an edge, clipped to the image
+	edges.clear();
+	int top = INT_MAX, bottom = INT_MIN;
+	for (int i = 0; i < count; ++i)
+	{
+		Vector2 a = vertices[i];
+		Vector2 b = vertices[(i + 1) % count];
+		if (a.y == b.y)
+			continue;	// Horizontal edges cross no row centre
+
+		Edge edge;
+		edge.winding = a.y < b.y ? 1 : -1;
+		if (a.y > b.y)
+			std::swap(a, b);
+		edge.x_top = a.x;
+		edge.y_top = a.y;
+		edge.slope = (b.x - a.x) / (b.y - a.y);
+		edge.first_row = FirstCentreFrom(a.y, (int)image.height);
+		edge.last_row = FirstCentreFrom(b.y, (int)image.height) - 1;
+		if (edge.first_row > edge.last_row)
+			continue;
+
+		edges.push_back(edge);
+		top = std::min(top, edge.first_row);
+		bottom = std::max(bottom, edge.last_row);
+	}
+	if (edges.empty())
+		return;
+
+	// Edge table over the rows of the polygon
+	first_edge.assign(bottom - top + 1, -1);
+	for (int i = 0; i < (int)edges.size(); ++i)
+	{
+		int& head = first_edge[edges[i].first_row - top];
+		edges[i].next = head;
+		head = i;
+	}
+
+	active.clear();
+	int width = (int)image.width;
+	for (int row = top; row <= bottom; ++row)
+	{
+		// Drop the edges that ended above and add the ones that start here
+		size_t kept = 0;
+		for (size_t i = 0; i < active.size(); ++i)
+			if (edges[active[i]].last_row >= row)
+				active[kept++] = active[i];
+		active.resize(kept);
+		for (int e = first_edge[row - top]; e >= 0; e = edges[e].next)
+			active.push_back(e);
+
+		// Crossings sorted by x: insertion sort, since they barely change order from one row to the next
+		float y = row + 0.5f;
+		crossings.resize(active.size());
+		for (size_t i = 0; i < active.size(); ++i)
+		{
+			const Edge& edge = edges[active[i]];
+			Crossing crossing = { edge.x_top + (y - edge.y_top) * edge.slope, edge.winding };
+			size_t j = i;
+			for (; j > 0 && crossings[j - 1].x > crossing.x; --j)
+			{
+				crossings[j] = crossings[j - 1];
+				active[j] = active[j - 1];
+			}
+			crossings[j] = crossing;
+			active[j] = (int)(&edge - edges.data());
+		}
+
+		// Spans between the crossings where the point is inside, pixels with their centre in [start, end)
+		Color* pixels = image.GetRow(row);
+		int winding = 0;
+		for (size_t i = 0; i + 1 < crossings.size(); ++i)
+		{
+			winding += rule == eFillRule::EVEN_ODD ? 1 : crossings[i].winding;
+			bool inside = rule == eFillRule::EVEN_ODD ? (winding & 1) != 0 : winding != 0;
+			if (!inside)
+				continue;
+
+			int x0 = FirstCentreFrom(crossings[i].x, width);
+			int x1 = FirstCentreFrom(crossings[i + 1].x, width);
+			if (x0 < x1)
+				std::fill(pixels + x0, pixels + x1, c);
+		}
+	}
+}
+
+PolygonFiller* PolygonFiller::Get()
+{
+	static PolygonFiller filler;
+	return &filler;
+}
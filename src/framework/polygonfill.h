@@ -0,0 +1,48 @@
+/*
+	+ This class fills polygons (convex or not, self-intersecting too) in an Image with a scanline active-edge table.
+	+ The edges are bucketed by the row where they start, over the rows of the polygon only. Every row adds the edges that
+	  start there, drops the ones that ended, keeps the active ones sorted by x and fills the spans between them with whole
+	  row writes. A pixel is filled when its centre is inside, so polygons that share an edge do not overlap.
+	+ The edge tables are shared, so Fill must not be called from several threads at once.
+*/
+
+#pragma once
+
+#include <vector>
+#include "image.h"
+
+class PolygonFiller
+{
+public:
+	// Fills the polygon with count vertices (the last one is joined to the first) with c, clipped to the image. Nothing is
+	// drawn when a vertex is not finite
+	void Fill(Image& image, const Vector2* vertices, int count, const Color& c, eFillRule rule = eFillRule::NON_ZERO);
+
+	// Filler used by Image::FillPolygon and DrawTriangle
+	static PolygonFiller* Get();
+
+private:
+	// Crosses the centres of the rows first_row to last_row: x at the centre of a row is x_top + (row + 0.5 - y_top) * slope
+	struct Edge
+	{
+		float x_top;
+		float y_top;
+		float slope;
+		int first_row;
+		int last_row;
+		int winding;	// +1 going down, -1 going up
+		int next;		// Next edge starting on the same row, -1 for none
+	};
+
+	// Where an active edge crosses the current row
+	struct Crossing
+	{
+		float x;
+		int winding;
+	};
+
+	std::vector<Edge> edges;
+	std::vector<int> first_edge;	// Per row of the polygon, first edge that starts there
+	std::vector<int> active;
+	std::vector<Crossing> crossings;
+};
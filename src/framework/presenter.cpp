@@ -0,0 +1,165 @@
+#include "presenter.h"
+#include "image.h"
+#include "shader.h"
+#include "utils.h"
+
+Presenter::Presenter()
+{
+	for (int i = 0; i < RING_SIZE; ++i)
+	{
+		pbos[i] = 0;
+		fences[i] = 0;
+	}
+}
+
+Presenter::~Presenter()
+{
+	// The context may already be gone here, so the GL objects are left to it unless Release was called before
+}
+
+bool Presenter::Init()
+{
+	initialized = true;
+
+	if (!GLEW_VERSION_2_1 && !GLEW_ARB_pixel_buffer_object)
+	{
+		std::cerr << "Presenter: no pixel buffer objects, using glDrawPixels" << std::endl;
+		return false;
+	}
+
+	shader = Shader::Get("shaders/quad.vs", "shaders/quad.fs");
+	if (!shader)
+	{
+		std::cerr << "Presenter: quad shader not available, using glDrawPixels" << std::endl;
+		return false;
+	}
+
+	// With fences a slot is only waited for when the ring comes back to it, and its buffer is mapped without the driver
+	// synchronizing or reallocating it. Without them the buffer is orphaned every frame
+	use_fences = (GLEW_VERSION_3_2 || GLEW_ARB_sync) && (GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range);
+
+	quad.CreateQuad();
+	glGenBuffers(RING_SIZE, pbos);
+	return checkGLErrors();
+}
+
+void Presenter::Resize(unsigned int width, unsigned int height)
+{
+	this->width = width;
+	this->height = height;
+
+	for (int i = 0; i < RING_SIZE; ++i)
+	{
+		// Storage only, the pixels come from the buffers
+		textures[i].Create(width, height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, false);
+		textures[i].Upload(GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, false, NULL, GL_RGBA8);
+
+		// One texel per pixel: no filtering at all (anisotropic filtering would still blend neighbours)
+		glBindTexture(GL_TEXTURE_2D, textures[i].texture_id);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 1.0f);
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)width * height * 4, NULL, GL_STREAM_DRAW);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void Presenter::Present(Image& framebuffer)
+{
+	if (!initialized)
+		supported = Init();
+
+	if (!use_streaming || !supported || !framebuffer.pixels)
+	{
+		framebuffer.Render();
+		return;
+	}
+
+	if (framebuffer.width != width || framebuffer.height != height)
+		Resize(framebuffer.width, framebuffer.height);
+
+	GLsizeiptr size = (GLsizeiptr)width * height * 4;
+	int slot = next_slot;
+	next_slot = (next_slot + 1) % RING_SIZE;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[slot]);
+	unsigned int* dst = NULL;
+	if (use_fences)
+	{
+		// The frame that used this slot RING_SIZE frames ago is almost always done by now
+		if (fences[slot])
+		{
+			glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			glDeleteSync(fences[slot]);
+			fences[slot] = 0;
+		}
+		dst = (unsigned int*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	}
+	else
+	{
+		// Orphan the buffer first: if the driver is still reading the previous contents it hands out new memory instead of waiting
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		dst = (unsigned int*)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	}
+
+	if (!dst)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		framebuffer.Render();
+		return;
+	}
+
+	// RGB to 0xAARRGGBB, the layout GL_BGRA / GL_UNSIGNED_INT_8_8_8_8_REV copies without conversion
+	for (unsigned int y = 0; y < height; ++y, dst += width)
+	{
+		const Color* src = framebuffer.GetRow(y);
+		for (unsigned int x = 0; x < width; ++x)
+			dst[x] = 0xff000000u | ((unsigned int)src[x].r << 16) | ((unsigned int)src[x].g << 8) | src[x].b;
+	}
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	// With a buffer bound the pointer is an offset in it, and the call returns before the copy is done. The texture is not
+	// the one the last frames were drawn with, so the copy does not wait for those draws either
+	glBindTexture(GL_TEXTURE_2D, textures[slot].texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	glDisable(GL_DITHER);
+	shader->Enable();
+	shader->SetTexture("u_texture", &textures[slot]);
+	quad.Render(GL_TRIANGLES);
+	shader->Disable();
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// Covers the copy and the draw that read this slot
+	if (use_fences)
+		fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void Presenter::Release()
+{
+	if (supported)
+	{
+		for (int i = 0; i < RING_SIZE; ++i)
+		{
+			if (fences[i])
+				glDeleteSync(fences[i]);
+			textures[i].Clear();
+		}
+		glDeleteBuffers(RING_SIZE, pbos);
+	}
+	for (int i = 0; i < RING_SIZE; ++i)
+	{
+		pbos[i] = 0;
+		fences[i] = 0;
+	}
+	initialized = supported = false;
+	width = height = 0;
+	next_slot = 0;
+}
@@ -0,0 +1,51 @@
+/*
+	+ This class puts the CPU framebuffer on the screen. Instead of glDrawPixels, every frame is written into one of a ring of
+	  pixel-buffer objects as 4-byte BGRA rows, copied from it to a texture and drawn with a full-screen quad (shaders/quad.vs/.fs).
+	+ The copy from the buffer to the texture is done by the driver after the call returns, so it overlaps the rendering of the
+	  next frame. Each slot of the ring has its own buffer and texture, so the next frame never waits for a copy or a draw still
+	  in flight; a fence per slot tells when it can be written again.
+	+ When the GL context has no pixel-buffer objects or the shader does not compile, it falls back to Image::Render.
+*/
+
+#pragma once
+
+#include "texture.h"
+#include "mesh.h"
+
+class Image;
+class Shader;
+
+class Presenter
+{
+public:
+	static const int RING_SIZE = 3;
+
+	// Use the pixel-buffer ring, otherwise glDrawPixels ('P' key)
+	bool use_streaming = true;
+
+	Presenter();
+	~Presenter();
+
+	void Present(Image& framebuffer);
+
+	// Frees the GL objects (they are created again on the next Present)
+	void Release();
+
+private:
+	bool initialized = false;
+	bool supported = false;
+	bool use_fences = false;
+
+	GLuint pbos[RING_SIZE];
+	GLsync fences[RING_SIZE];
+	Texture textures[RING_SIZE];
+	int next_slot = 0;
+	unsigned int width = 0;
+	unsigned int height = 0;
+
+	Shader* shader = nullptr;
+	Mesh quad;
+
+	bool Init();
+	void Resize(unsigned int width, unsigned int height);
+};
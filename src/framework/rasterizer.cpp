@@ -0,0 +1,713 @@
+#include "rasterizer.h"
+#include "image.h"
+#include "threadpool.h"
+#include "simd.h"
+#include "hizbuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <mutex>
+#include <atomic>
+
+// Floor and ceil of a / SUBPIXEL_ONE for signed sub-pixel values
+static inline long long SubpixelFloor(long long a) { return a >> TriangleSetup::SUBPIXEL_BITS; }
+static inline long long SubpixelCeil(long long a) { return (a + TriangleSetup::SUBPIXEL_ONE - 1) >> TriangleSetup::SUBPIXEL_BITS; }
+
+// Plane of an attribute in terms of the edge values E1 and E2
+static inline void SetPlane(float* plane, float a0, float a1, float a2, float inv_area)
+{
+	plane[0] = a0;
+	plane[1] = (a1 - a0) * inv_area;
+	plane[2] = (a2 - a0) * inv_area;
+}
+
+bool TriangleSetup::Setup(const Vector3& p0, const Vector3& p1, const Vector3& p2,
+	const Color& c0, const Color& c1, const Color& c2, FloatImage* zbuffer,
+	Image* texture, const Vector2& uv0, const Vector2& uv1, const Vector2& uv2,
+	int clip_min_x, int clip_min_y, int clip_max_x, int clip_max_y, const float* inv_w)
+{
+	const Vector3* p[3] = { &p0, &p1, &p2 };
+	const Color* c[3] = { &c0, &c1, &c2 };
+	const Vector2* uv[3] = { &uv0, &uv1, &uv2 };
+
+	// Snap the vertices to the sub-pixel grid
+	long long x[3], y[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		x[i] = (long long)std::floor(p[i]->x * SUBPIXEL_ONE + 0.5f);
+		y[i] = (long long)std::floor(p[i]->y * SUBPIXEL_ONE + 0.5f);
+	}
+
+	long long area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+	if (area == 0)
+		return false;
+
+	// Both windings are drawn: make it counter-clockwise so inside means positive edges
+	bool swapped = area < 0;
+	if (swapped)
+	{
+		std::swap(x[1], x[2]); std::swap(y[1], y[2]);
+		std::swap(p[1], p[2]); std::swap(c[1], c[2]); std::swap(uv[1], uv[2]);
+		area = -area;
+	}
+
+	// Sample at pixel centers
+	long long bx0 = SubpixelCeil(std::min({ x[0], x[1], x[2] }) - SUBPIXEL_ONE / 2);
+	long long bx1 = SubpixelFloor(std::max({ x[0], x[1], x[2] }) - SUBPIXEL_ONE / 2);
+	long long by0 = SubpixelCeil(std::min({ y[0], y[1], y[2] }) - SUBPIXEL_ONE / 2);
+	long long by1 = SubpixelFloor(std::max({ y[0], y[1], y[2] }) - SUBPIXEL_ONE / 2);
+	min_x = (int)std::max(bx0, (long long)clip_min_x);
+	max_x = (int)std::min(bx1, (long long)clip_max_x);
+	min_y = (int)std::max(by0, (long long)clip_min_y);
+	max_y = (int)std::min(by1, (long long)clip_max_y);
+	if (min_x > max_x || min_y > max_y)
+		return false;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		// Edge from vertex a to vertex b, opposite to vertex i
+		int a = (i + 1) % 3;
+		int b = (i + 2) % 3;
+		long long dx = x[b] - x[a];
+		long long dy = y[b] - y[a];
+
+		edge_a[i] = -dy * SUBPIXEL_ONE;
+		edge_b[i] = dx * SUBPIXEL_ONE;
+		edge_c[i] = dx * (SUBPIXEL_ONE / 2 - y[a]) - dy * (SUBPIXEL_ONE / 2 - x[a]);
+
+		// Top-left rule (y grows upwards): left edges go down, top edges go left
+		bool top_left = dy < 0 || (dy == 0 && dx < 0);
+		edge_min[i] = top_left ? 0 : 1;
+	}
+
+	float inv_area = 1.0f / (float)area;
+
+	SetPlane(this->z, p[0]->z, p[1]->z, p[2]->z, inv_area);
+	SetPlane(this->r, c[0]->r, c[1]->r, c[2]->r, inv_area);
+	SetPlane(this->g, c[0]->g, c[1]->g, c[2]->g, inv_area);
+	SetPlane(this->b, c[0]->b, c[1]->b, c[2]->b, inv_area);
+
+	// Interpolated depths can round a little below the closest vertex, keep a margin so the hierarchy never rejects a visible pixel
+	float z_range = std::max({ std::abs(p[0]->z), std::abs(p[1]->z), std::abs(p[2]->z) });
+	z_nearest = std::min({ p[0]->z, p[1]->z, p[2]->z }) - (z_range * 1e-5f + 1e-6f);
+
+	this->zbuffer = zbuffer;
+	this->texture = (texture && texture->pixels) ? texture : nullptr;
+	this->mipmaps = nullptr;
+	this->filter = Rasterizer::texture_filter;
+	this->max_level = 0;
+	if (this->texture)
+	{
+		// Without 1/w every q is 1 and this is plain screen-space interpolation
+		float q[3] = { 1.0f, 1.0f, 1.0f };
+		if (inv_w)
+		{
+			q[0] = inv_w[0]; q[1] = inv_w[1]; q[2] = inv_w[2];
+			if (swapped)
+				std::swap(q[1], q[2]);
+		}
+		SetPlane(this->q, q[0], q[1], q[2], inv_area);
+		SetPlane(this->u, uv[0]->x * q[0], uv[1]->x * q[1], uv[2]->x * q[2], inv_area);
+		SetPlane(this->v, uv[0]->y * q[0], uv[1]->y * q[1], uv[2]->y * q[2], inv_area);
+
+		if (filter != eTextureFilter::NEAREST)
+		{
+			mipmaps = &this->texture->GetMipmaps();
+			max_level = (int)mipmaps->size();
+		}
+	}
+
+	return true;
+}
+
+eTextureFilter Rasterizer::texture_filter = eTextureFilter::TRILINEAR;
+const unsigned int Rasterizer::NO_TRIANGLE;
+
+#ifdef CG_SIMD
+bool Rasterizer::use_simd = true;
+#else
+bool Rasterizer::use_simd = false;
+#endif
+
+bool Rasterizer::HasSimd()
+{
+#ifdef CG_SIMD
+	return true;
+#else
+	return false;
+#endif
+}
+
+Rasterizer::Rasterizer()
+{
+	framebuffer = nullptr;
+	hiz = nullptr;
+	tiles_x = tiles_y = 0;
+}
+
+// Texture coordinates of the pixel with edge values f1 and f2: u/w and v/w are interpolated and divided by the interpolated 1/w
+static inline void GetTexCoord(const TriangleSetup& t, float f1, float f2, float& u, float& v)
+{
+	float inv_q = 1.0f / (t.q[0] + f1 * t.q[1] + f2 * t.q[2]);
+	u = (t.u[0] + f1 * t.u[1] + f2 * t.u[2]) * inv_q;
+	v = (t.v[0] + f1 * t.v[1] + f2 * t.v[2]) * inv_q;
+}
+
+static inline const Image& GetMipLevel(const TriangleSetup& t, int level)
+{
+	return level == 0 ? *t.texture : (*t.mipmaps)[level - 1];
+}
+
+// Level of detail of the 2x2 quad at (qx,qy), the same for its four pixels: log2 of the largest texel step
+// between neighbouring pixels, measured in texels of level 0
+static float GetQuadLod(const TriangleSetup& t, int qx, int qy)
+{
+	float u[3], v[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		int x = qx + (i == 1);
+		int y = qy + (i == 2);
+		float f1 = (float)(t.edge_a[1] * x + t.edge_b[1] * y + t.edge_c[1]);
+		float f2 = (float)(t.edge_a[2] * x + t.edge_b[2] * y + t.edge_c[2]);
+		GetTexCoord(t, f1, f2, u[i], v[i]);
+	}
+
+	float tw = (float)t.texture->width;
+	float th = (float)t.texture->height;
+	float dudx = (u[1] - u[0]) * tw, dvdx = (v[1] - v[0]) * th;
+	float dudy = (u[2] - u[0]) * tw, dvdy = (v[2] - v[0]) * th;
+	float rho2 = std::max(dudx * dudx + dvdx * dvdx, dudy * dudy + dvdy * dvdy);
+
+	// Magnification, or NaN when the quad reaches past the horizon of the triangle plane
+	if (!(rho2 > 1.0f))
+		return 0.0f;
+	return std::min(0.5f * std::log2(rho2), (float)t.max_level);
+}
+
+// Remembers the level of detail of the last quad of a row, so it is computed once per 2x2 quad and not per pixel
+struct QuadLodCache
+{
+	const TriangleSetup* triangle = nullptr;
+	int quad_x = INT_MIN;
+	float lod = 0.0f;
+
+	float Get(const TriangleSetup& t, int x, int y)
+	{
+		if ((x >> 1) != quad_x || &t != triangle)
+		{
+			triangle = &t;
+			quad_x = x >> 1;
+			lod = GetQuadLod(t, x & ~1, y & ~1);
+		}
+		return lod;
+	}
+};
+
+// Bilinear filter of one level, texel centers at half integers and clamped at the borders
+static inline void SampleBilinear(const Image& level, float u, float v, float* rgb)
+{
+	int w = (int)level.width;
+	int h = (int)level.height;
+	float s = u * w - 0.5f;
+	float r = v * h - 0.5f;
+	float fs = std::floor(s);
+	float fr = std::floor(r);
+	float ax = s - fs;
+	float ay = r - fr;
+
+	int x0 = (int)fs, y0 = (int)fr;
+	int x1 = x0 + 1, y1 = y0 + 1;
+	x0 = std::min(std::max(x0, 0), w - 1); x1 = std::min(std::max(x1, 0), w - 1);
+	y0 = std::min(std::max(y0, 0), h - 1); y1 = std::min(std::max(y1, 0), h - 1);
+
+	const Color& c00 = level.GetRow(y0)[x0];
+	const Color& c10 = level.GetRow(y0)[x1];
+	const Color& c01 = level.GetRow(y1)[x0];
+	const Color& c11 = level.GetRow(y1)[x1];
+	for (int k = 0; k < 3; ++k)
+	{
+		float bottom = c00.v[k] + (c10.v[k] - c00.v[k]) * ax;
+		float top = c01.v[k] + (c11.v[k] - c01.v[k]) * ax;
+		rgb[k] = bottom + (top - bottom) * ay;
+	}
+}
+
+// Texture color of pixel (x,y) of a textured triangle
+static inline Color SampleTexture(const TriangleSetup& t, int x, int y, float f1, float f2, QuadLodCache& lods)
+{
+	float u, v;
+	GetTexCoord(t, f1, f2, u, v);
+
+	// Point sampling of level 0
+	if (t.filter == eTextureFilter::NEAREST)
+	{
+		int tex_w = (int)t.texture->width;
+		int tex_h = (int)t.texture->height;
+
+		int tx = (int)(u * (tex_w - 1));
+		if (tx < 0) tx = 0; else if (tx >= tex_w) tx = tex_w - 1;
+
+		int ty = (int)(v * (tex_h - 1));
+		if (ty < 0) ty = 0; else if (ty >= tex_h) ty = tex_h - 1;
+
+		return t.texture->GetRow(ty)[tx];
+	}
+
+	float lod = lods.Get(t, x, y);
+	float rgb[3];
+
+	if (t.filter == eTextureFilter::BILINEAR)
+	{
+		SampleBilinear(GetMipLevel(t, std::min((int)(lod + 0.5f), t.max_level)), u, v, rgb);
+	}
+	else
+	{
+		// Trilinear: blend the two closest levels
+		int level = (int)lod;
+		float blend = lod - (float)level;
+		SampleBilinear(GetMipLevel(t, level), u, v, rgb);
+		if (blend > 0.0f && level < t.max_level)
+		{
+			float next[3];
+			SampleBilinear(GetMipLevel(t, level + 1), u, v, next);
+			for (int k = 0; k < 3; ++k)
+				rgb[k] += (next[k] - rgb[k]) * blend;
+		}
+	}
+
+	return Color(rgb[0] + 0.5f, rgb[1] + 0.5f, rgb[2] + 0.5f);
+}
+
+// Color of pixel (x,y) of the triangle, f1 and f2 are its E1 and E2 edge values
+static inline Color ShadeColor(const TriangleSetup& t, int x, int y, float f1, float f2, QuadLodCache& lods)
+{
+	if (t.texture)
+		return SampleTexture(t, x, y, f1, f2, lods);
+
+	return Color(t.r[0] + f1 * t.r[1] + f2 * t.r[2],
+		t.g[0] + f1 * t.g[1] + f2 * t.g[2],
+		t.b[0] + f1 * t.b[1] + f2 * t.b[2]);
+}
+
+// Row of the targets a span writes to. With ids the color is not computed, the triangle id is stored instead
+struct SpanTarget
+{
+	Color* pixel;
+	float* depth;
+	unsigned int* ids;
+	unsigned int id;
+	int y;
+};
+
+// Depth test, depth write and shading (or id write) of pixel x of the row.
+// Returns true when the pixel was drawn
+static inline bool ShadePixel(const TriangleSetup& t, const SpanTarget& row, int x, float f1, float f2, QuadLodCache& lods)
+{
+	if (row.depth)
+	{
+		float z = t.z[0] + f1 * t.z[1] + f2 * t.z[2];
+		if (!(z < row.depth[x])) return false;
+		row.depth[x] = z;
+	}
+
+	if (row.ids)
+		row.ids[x] = row.id;
+	else
+		row.pixel[x] = ShadeColor(t, x, row.y, f1, f2, lods);
+	return true;
+}
+
+// Reference kernel: pixels [x0,x1] of the row one at a time, e0..e2 are the edge values at x0.
+// Returns the number of pixels drawn
+static int DrawSpanScalar(const TriangleSetup& t, const SpanTarget& row, int x0, int x1,
+	long long e0, long long e1, long long e2, QuadLodCache& lods)
+{
+	int drawn = 0;
+	for (int x = x0; x <= x1; ++x)
+	{
+		if (e0 >= t.edge_min[0] && e1 >= t.edge_min[1] && e2 >= t.edge_min[2])
+			drawn += ShadePixel(t, row, x, (float)e1, (float)e2, lods);
+
+		e0 += t.edge_a[0];
+		e1 += t.edge_a[1];
+		e2 += t.edge_a[2];
+	}
+	return drawn;
+}
+
+#ifdef CG_SIMD
+
+static const int SIMD_W = CG_SIMD_WIDTH;
+
+// The vector kernel keeps the edge values in 32-bit lanes. They are linear, so checking the corners of the
+// rectangle is enough; only huge triangles (in sub-pixel units) fail and go through the scalar kernel
+static bool FitsInLanes(const TriangleSetup& t, int min_x, int min_y, int max_x, int max_y)
+{
+	const long long limit = 0x7fffffffLL;
+	for (int i = 0; i < 3; ++i)
+	{
+		if (std::abs(t.edge_a[i]) * SIMD_W > limit)
+			return false;
+		for (int corner = 0; corner < 4; ++corner)
+		{
+			long long e = t.edge_a[i] * ((corner & 1) ? max_x : min_x) + t.edge_b[i] * ((corner & 2) ? max_y : min_y) + t.edge_c[i];
+			if (e > limit || e < -limit)
+				return false;
+		}
+	}
+	return true;
+}
+
+// Triangle constants broadcast to all the lanes, built once per DrawTriangle
+struct SimdTriangle
+{
+	vint lane_e[3];		// a * lane, added to the edge value of the first lane
+	vint min_e[3];		// edge_min - 1, inside means greater than this
+	vfloat z[3], r[3], g[3], b[3];
+
+	SimdTriangle(const TriangleSetup& t)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			int offsets[SIMD_W];
+			for (int l = 0; l < SIMD_W; ++l)
+				offsets[l] = (int)(t.edge_a[i] * l);
+			lane_e[i] = simdLoad(offsets);
+			min_e[i] = simdSplat((int)t.edge_min[i] - 1);
+
+			z[i] = simdSplat(t.z[i]);
+			r[i] = simdSplat(t.r[i]);
+			g[i] = simdSplat(t.g[i]);
+			b[i] = simdSplat(t.b[i]);
+		}
+	}
+};
+
+// Plane evaluation in the same order as the scalar kernel: p0 + f1 * p1 + f2 * p2
+static inline vfloat EvalPlane(const vfloat* p, vfloat f1, vfloat f2)
+{
+	return simdAdd(simdAdd(p[0], simdMul(f1, p[1])), simdMul(f2, p[2]));
+}
+
+// Vector kernel: SIMD_W pixels of the span per step. Edge tests, depth interpolation, z-compare and the depth
+// store are done for all the lanes at once; colors are computed in lanes and stored only where the mask is set,
+// texture sampling is done per visible lane. The operations are the same as in ShadePixel and in the same order,
+// so both kernels give the same bits
+static int DrawSpanSimd(const TriangleSetup& t, const SimdTriangle& s, const SpanTarget& row, int x0, int x1,
+	long long e0, long long e1, long long e2, QuadLodCache& lods)
+{
+	Color* pixel = row.pixel;
+	float* depth = row.depth;
+	int ia[SIMD_W], ib[SIMD_W], ic[SIMD_W];
+	float fa[SIMD_W], fb[SIMD_W];
+	int drawn = 0;
+
+	int x = x0;
+	for (; x + SIMD_W - 1 <= x1; x += SIMD_W)
+	{
+		vint le0 = simdAdd(simdSplat((int)e0), s.lane_e[0]);
+		vint le1 = simdAdd(simdSplat((int)e1), s.lane_e[1]);
+		vint le2 = simdAdd(simdSplat((int)e2), s.lane_e[2]);
+
+		e0 += t.edge_a[0] * SIMD_W;
+		e1 += t.edge_a[1] * SIMD_W;
+		e2 += t.edge_a[2] * SIMD_W;
+
+		vint inside = simdAnd(simdAnd(simdGreater(le0, s.min_e[0]), simdGreater(le1, s.min_e[1])), simdGreater(le2, s.min_e[2]));
+		if (simdMoveMask(inside) == 0)
+			continue;
+
+		vfloat f1 = simdToFloat(le1);
+		vfloat f2 = simdToFloat(le2);
+		vfloat mask = simdAsFloat(inside);
+
+		if (depth)
+		{
+			vfloat z = EvalPlane(s.z, f1, f2);
+			vfloat stored = simdLoad(depth + x);
+			mask = simdAnd(mask, simdLess(z, stored));
+			simdStore(depth + x, simdSelect(mask, z, stored));
+		}
+
+		int bits = simdMoveMask(mask);
+		if (bits == 0)
+			continue;
+
+		if (row.ids)
+		{
+			for (int l = 0; l < SIMD_W; ++l)
+				if (bits & (1 << l))
+				{
+					row.ids[x + l] = row.id;
+					drawn++;
+				}
+		}
+		else if (t.texture)
+		{
+			simdStore(fa, f1);
+			simdStore(fb, f2);
+			for (int l = 0; l < SIMD_W; ++l)
+			{
+				if (!(bits & (1 << l))) continue;
+				pixel[x + l] = SampleTexture(t, x + l, row.y, fa[l], fb[l], lods);
+				drawn++;
+			}
+		}
+		else
+		{
+			simdStore(ia, simdTruncate(EvalPlane(s.r, f1, f2)));
+			simdStore(ib, simdTruncate(EvalPlane(s.g, f1, f2)));
+			simdStore(ic, simdTruncate(EvalPlane(s.b, f1, f2)));
+			for (int l = 0; l < SIMD_W; ++l)
+			{
+				if (!(bits & (1 << l))) continue;
+				Color& c = pixel[x + l];
+				c.r = (unsigned char)ia[l];
+				c.g = (unsigned char)ib[l];
+				c.b = (unsigned char)ic[l];
+				drawn++;
+			}
+		}
+	}
+
+	// Leftover pixels at the end of the span
+	if (x <= x1)
+		drawn += DrawSpanScalar(t, row, x, x1, e0, e1, e2, lods);
+
+	return drawn;
+}
+
+#endif
+
+void Rasterizer::DrawTriangle(Image* framebuffer, const TriangleSetup& t, int min_x, int min_y, int max_x, int max_y,
+	HiZBuffer* hiz, RasterStats* stats, unsigned int* ids, unsigned int id)
+{
+	min_x = std::max(min_x, t.min_x);
+	max_x = std::min(max_x, t.max_x);
+	min_y = std::max(min_y, t.min_y);
+	max_y = std::min(max_y, t.max_y);
+	if (min_x > max_x || min_y > max_y)
+		return;
+
+	// The hierarchy only knows about its own depth buffer
+	if (hiz && hiz->zbuffer != t.zbuffer)
+		hiz = nullptr;
+
+	// Coarse level: nothing to do if the triangle is behind everything stored in the tiles it touches
+	if (hiz)
+	{
+		bool visible = false;
+		for (int ty = min_y / HiZBuffer::TILE_SIZE; ty <= max_y / HiZBuffer::TILE_SIZE && !visible; ++ty)
+			for (int tx = min_x / HiZBuffer::TILE_SIZE; tx <= max_x / HiZBuffer::TILE_SIZE && !visible; ++tx)
+				visible = t.z_nearest < hiz->GetTileMax(tx, ty);
+		if (!visible)
+		{
+			if (stats) stats->hiz_rejected_triangles++;
+			return;
+		}
+	}
+
+#ifdef CG_SIMD
+	bool simd = use_simd && FitsInLanes(t, min_x, min_y, max_x, max_y);
+	SimdTriangle s(t);
+#endif
+
+	FloatImage* zbuffer = t.zbuffer;
+	const int B = HiZBuffer::BLOCK_SIZE;
+
+	// Walk the bounding box in 8x8 blocks, rows of pixels are only visited in blocks that can have something to draw
+	for (int by = min_y / B; by <= max_y / B; ++by)
+	{
+		int y0 = std::max(min_y, by * B);
+		int y1 = std::min(max_y, by * B + B - 1);
+
+		for (int bx = min_x / B; bx <= max_x / B; ++bx)
+		{
+			int x0 = std::max(min_x, bx * B);
+			int x1 = std::min(max_x, bx * B + B - 1);
+
+			// Edge values at the block corner, and skip the block if one edge is negative in all of it
+			long long e[3];
+			bool touches = true;
+			for (int i = 0; i < 3 && touches; ++i)
+			{
+				e[i] = t.edge_a[i] * x0 + t.edge_b[i] * y0 + t.edge_c[i];
+				long long best = e[i] + (t.edge_a[i] > 0 ? t.edge_a[i] * (x1 - x0) : 0) + (t.edge_b[i] > 0 ? t.edge_b[i] * (y1 - y0) : 0);
+				touches = best >= t.edge_min[i];
+			}
+			if (!touches)
+				continue;
+
+			if (hiz && !(t.z_nearest < hiz->GetBlockMax(bx, by)))
+			{
+				if (stats) stats->hiz_rejected_blocks++;
+				continue;
+			}
+			if (stats) stats->blocks_drawn++;
+
+			int drawn = 0;
+			for (int y = y0; y <= y1; ++y)
+			{
+				SpanTarget row;
+				row.pixel = framebuffer->GetRow(y);
+				row.depth = zbuffer ? zbuffer->GetRow(y) : nullptr;
+				row.ids = ids ? ids + y * framebuffer->width : nullptr;
+				row.id = id;
+				row.y = y;
+
+				QuadLodCache lods;
+#ifdef CG_SIMD
+				if (simd)
+					drawn += DrawSpanSimd(t, s, row, x0, x1, e[0], e[1], e[2], lods);
+				else
+#endif
+					drawn += DrawSpanScalar(t, row, x0, x1, e[0], e[1], e[2], lods);
+
+				e[0] += t.edge_b[0];
+				e[1] += t.edge_b[1];
+				e[2] += t.edge_b[2];
+			}
+
+			if (stats)
+			{
+				stats->fragments += drawn;
+				if (!ids)
+					stats->pixels_shaded += drawn;
+			}
+			if (drawn && hiz)
+				hiz->MarkWritten(bx, by);
+		}
+	}
+}
+
+void Rasterizer::Begin(Image* framebuffer, HiZBuffer* hiz)
+{
+	this->framebuffer = framebuffer;
+	this->hiz = hiz;
+	triangles.clear();
+	used_tiles.clear();
+	stats = RasterStats();
+
+	// The shading pass leaves the ids empty again, so they only have to be cleared when the size changes
+	if (visibility_buffer && visibility.size() != (size_t)framebuffer->width * framebuffer->height)
+		visibility.assign((size_t)framebuffer->width * framebuffer->height, NO_TRIANGLE);
+
+	tiles_x = ((int)framebuffer->width + TILE_SIZE - 1) / TILE_SIZE;
+	tiles_y = ((int)framebuffer->height + TILE_SIZE - 1) / TILE_SIZE;
+
+	// Keep the bins between frames so their memory is reused
+	bins.resize(tiles_x * tiles_y);
+	for (size_t i = 0; i < bins.size(); ++i)
+		bins[i].clear();
+}
+
+void Rasterizer::AddTriangle(const Vector3& p0, const Vector3& p1, const Vector3& p2,
+	const Color& c0, const Color& c1, const Color& c2, FloatImage* zbuffer,
+	Image* texture, const Vector2& uv0, const Vector2& uv1, const Vector2& uv2, const float* inv_w)
+{
+	if (!framebuffer) return;
+
+	TriangleSetup t;
+	if (!t.Setup(p0, p1, p2, c0, c1, c2, zbuffer, texture, uv0, uv1, uv2,
+		0, 0, (int)framebuffer->width - 1, (int)framebuffer->height - 1, inv_w))
+		return;
+
+	stats.triangles++;
+
+	if (!tiled && !visibility_buffer)
+	{
+		DrawTriangle(framebuffer, t, 0, 0, (int)framebuffer->width - 1, (int)framebuffer->height - 1, hiz, &stats);
+		return;
+	}
+
+	// The visibility buffer keeps every triangle until the shading pass, the id is its index
+	unsigned int index = (unsigned int)triangles.size();
+	triangles.push_back(t);
+
+	if (!tiled)
+	{
+		DrawTriangle(framebuffer, t, 0, 0, (int)framebuffer->width - 1, (int)framebuffer->height - 1, hiz, &stats,
+			visibility.data(), index);
+		return;
+	}
+
+	for (int ty = t.min_y / TILE_SIZE; ty <= t.max_y / TILE_SIZE; ++ty)
+		for (int tx = t.min_x / TILE_SIZE; tx <= t.max_x / TILE_SIZE; ++tx)
+		{
+			std::vector<unsigned int>& bin = bins[ty * tiles_x + tx];
+			if (bin.empty())
+				used_tiles.push_back(ty * tiles_x + tx);
+			bin.push_back(index);
+		}
+}
+
+void Rasterizer::Flush()
+{
+	if (!framebuffer || triangles.empty()) return;
+
+	std::mutex stats_mutex;
+	unsigned int* ids = visibility_buffer ? visibility.data() : nullptr;
+
+	// Each tile owns a disjoint block of framebuffer, zbuffer and hierarchy entries, so tiles need no locking
+	ThreadPool::Get()->ParallelFor((int)used_tiles.size(), [this, ids, &stats_mutex](int i) {
+		int tile = used_tiles[i];
+		int x0 = (tile % tiles_x) * TILE_SIZE;
+		int y0 = (tile / tiles_x) * TILE_SIZE;
+		int x1 = std::min(x0 + TILE_SIZE, (int)framebuffer->width) - 1;
+		int y1 = std::min(y0 + TILE_SIZE, (int)framebuffer->height) - 1;
+
+		RasterStats tile_stats;
+		const std::vector<unsigned int>& bin = bins[tile];
+		for (size_t j = 0; j < bin.size(); ++j)
+			DrawTriangle(framebuffer, triangles[bin[j]], x0, y0, x1, y1, hiz, &tile_stats, ids, bin[j]);
+
+		std::lock_guard<std::mutex> lock(stats_mutex);
+		stats.Add(tile_stats);
+	});
+
+	if (visibility_buffer)
+		ShadeVisible();
+
+	triangles.clear();
+	for (size_t i = 0; i < used_tiles.size(); ++i)
+		bins[used_tiles[i]].clear();
+	used_tiles.clear();
+}
+
+// Second pass of the visibility buffer: every pixel with an id is shaded once from the edge values of its triangle
+// at the pixel center, which are the same the first pass tested, so the image is the same as drawing directly
+void Rasterizer::ShadeVisible()
+{
+	const int ROWS_PER_JOB = 8;
+	int width = (int)framebuffer->width;
+	int height = (int)framebuffer->height;
+	std::atomic<unsigned int> shaded(0);
+
+	ThreadPool::Get()->ParallelFor((height + ROWS_PER_JOB - 1) / ROWS_PER_JOB, [this, width, height, &shaded](int job) {
+		unsigned int count = 0;
+		int y1 = std::min((job + 1) * ROWS_PER_JOB, height);
+		for (int y = job * ROWS_PER_JOB; y < y1; ++y)
+		{
+			unsigned int* ids = visibility.data() + y * width;
+			Color* pixel = framebuffer->GetRow(y);
+			QuadLodCache lods;
+
+			for (int x = 0; x < width; ++x)
+			{
+				if (ids[x] == NO_TRIANGLE)
+					continue;
+
+				const TriangleSetup& t = triangles[ids[x]];
+				float f1 = (float)(t.edge_a[1] * x + t.edge_b[1] * y + t.edge_c[1]);
+				float f2 = (float)(t.edge_a[2] * x + t.edge_b[2] * y + t.edge_c[2]);
+				pixel[x] = ShadeColor(t, x, y, f1, f2, lods);
+				ids[x] = NO_TRIANGLE;
+				count++;
+			}
+		}
+		shaded += count;
+	});
+
+	stats.pixels_shaded += shaded;
+}
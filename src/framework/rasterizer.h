@@ -0,0 +1,148 @@
+/*
+	+ This class collects the triangles of a frame, bins them into screen tiles and rasterizes the tiles in parallel.
+	+ Every tile draws its triangles in submission order, so the result is the same as calling DrawTriangleInterpolated directly.
+	+ TriangleSetup holds the per triangle work (fixed-point edges and attribute planes) so it is done once and not per pixel or per tile.
+	+ Pixels are visited in 8x8 blocks; with a HiZBuffer, tiles and blocks behind what is already drawn are skipped.
+*/
+
+#pragma once
+
+#include <vector>
+#include "framework.h"
+#include "pixelimage.h"
+
+class Image;
+class HiZBuffer;
+
+// How textures are sampled: level 0 point sampling, bilinear on the closest mip level or trilinear between two levels.
+// The mip level is chosen per 2x2 pixel quad
+enum class eTextureFilter {
+	NEAREST,
+	BILINEAR,
+	TRILINEAR
+};
+
+// Screen-space triangle ready to be rasterized
+struct TriangleSetup
+{
+	static const int SUBPIXEL_BITS = 4;
+	static const int SUBPIXEL_ONE = 1 << SUBPIXEL_BITS;
+
+	// Pixels that can be covered (inclusive), already clamped to the target
+	int min_x, min_y, max_x, max_y;
+
+	// Edge i (the one opposite to vertex i) at the center of pixel (x,y) is E = a*x + b*y + c, in sub-pixel units.
+	// The pixel is inside when E >= edge_min for all three edges: 0 on top and left edges, 1 on the rest,
+	// so pixels on an edge shared by two triangles are drawn exactly once
+	long long edge_a[3];
+	long long edge_b[3];
+	long long edge_c[3];
+	long long edge_min[3];
+
+	// Attribute planes in terms of the edge values: value = plane[0] + E1 * plane[1] + E2 * plane[2]
+	float z[3];
+	float r[3], g[3], b[3];
+	float z_nearest;  // Lower bound of the depth of any pixel of the triangle
+
+	// Texture coordinates divided by w and 1/w (q), divided again per pixel for perspective-correct texturing
+	float u[3], v[3], q[3];
+
+	FloatImage* zbuffer;
+	Image* texture;
+	const std::vector<Image>* mipmaps; // Levels from 1 of the texture (not used by NEAREST)
+	int max_level;
+	eTextureFilter filter;
+
+	// Returns false when the triangle is degenerate or falls outside [clip_min, clip_max].
+	// inv_w (optional) are the 1/w of the vertices, without them texture coordinates are interpolated linearly on screen
+	bool Setup(const Vector3& p0, const Vector3& p1, const Vector3& p2,
+		const Color& c0, const Color& c1, const Color& c2, FloatImage* zbuffer,
+		Image* texture, const Vector2& uv0, const Vector2& uv1, const Vector2& uv2,
+		int clip_min_x, int clip_min_y, int clip_max_x, int clip_max_y, const float* inv_w = nullptr);
+};
+
+// Counters of the triangles drawn since the last Begin
+struct RasterStats
+{
+	unsigned int triangles = 0;				// Triangles that passed the setup
+	unsigned int blocks_drawn = 0;			// 8x8 blocks where pixels were visited
+	unsigned int hiz_rejected_triangles = 0;	// Triangle / tile pairs rejected by the tile level of the hierarchy
+	unsigned int hiz_rejected_blocks = 0;		// 8x8 blocks rejected by the block level
+	unsigned int fragments = 0;				// Pixels that passed the depth test
+	unsigned int pixels_shaded = 0;			// Pixels whose color was computed
+
+	void Add(const RasterStats& s)
+	{
+		triangles += s.triangles;
+		blocks_drawn += s.blocks_drawn;
+		hiz_rejected_triangles += s.hiz_rejected_triangles;
+		hiz_rejected_blocks += s.hiz_rejected_blocks;
+		fragments += s.fragments;
+		pixels_shaded += s.pixels_shaded;
+	}
+
+	// Fragments per shaded pixel: the shading work the visibility buffer saves, 1 when drawing directly
+	float GetOverdraw() const { return pixels_shaded ? (float)fragments / (float)pixels_shaded : 1.0f; }
+};
+
+class Rasterizer
+{
+public:
+	static const int TILE_SIZE = 64;
+
+	// Use the vectorized pixel kernel (SSE2, or AVX2 if compiled for it). The scalar kernel is the reference
+	// and both produce the same pixels. Ignored when the target has no vector instructions
+	static bool use_simd;
+	static bool HasSimd();
+
+	// Filter of the triangles set up from now on ('L' key)
+	static eTextureFilter texture_filter;
+
+	// Bin the triangles and draw them on the thread pool ('M' key), otherwise they are drawn as they arrive
+	bool tiled = true;
+
+	// Two passes ('I' key): triangles only write depth and their id, then Flush shades every visible pixel once.
+	// Change it only between frames
+	bool visibility_buffer = false;
+
+	RasterStats stats;
+
+	Rasterizer();
+
+	// Starts collecting triangles that will be drawn into framebuffer. When a hierarchical z-buffer is given,
+	// triangles that use its depth buffer are tested against it before rasterization
+	void Begin(Image* framebuffer, HiZBuffer* hiz = nullptr);
+
+	// Same parameters as Image::DrawTriangleInterpolated, in tiled mode the triangle is drawn on the next Flush
+	void AddTriangle(const Vector3& p0, const Vector3& p1, const Vector3& p2,
+		const Color& c0, const Color& c1, const Color& c2, FloatImage* zbuffer,
+		Image* texture, const Vector2& uv0, const Vector2& uv1, const Vector2& uv2, const float* inv_w = nullptr);
+
+	// Rasterizes all the queued triangles using the thread pool and empties the queue,
+	// with the visibility buffer it also runs the shading pass
+	void Flush();
+
+	bool HasPending() const { return !triangles.empty(); }
+
+	// Draws the pixels of a set up triangle that fall inside [min_x,max_x] x [min_y,max_y].
+	// With ids (one per framebuffer pixel) the color is left alone and id is written instead
+	static void DrawTriangle(Image* framebuffer, const TriangleSetup& t, int min_x, int min_y, int max_x, int max_y,
+		HiZBuffer* hiz = nullptr, RasterStats* stats = nullptr, unsigned int* ids = nullptr, unsigned int id = 0);
+
+private:
+	static const unsigned int NO_TRIANGLE = 0xffffffff;
+
+	// Index in triangles of the closest triangle of every pixel since the last Flush
+	std::vector<unsigned int> visibility;
+
+	void ShadeVisible();
+
+	Image* framebuffer;
+	HiZBuffer* hiz;
+	int tiles_x;
+	int tiles_y;
+
+	std::vector<TriangleSetup> triangles;
+	std::vector<std::vector<unsigned int>> bins; // Triangle indices per tile, in submission order
+	std::vector<int> used_tiles;				  // Tiles with at least one triangle
+};
@@ -0,0 +1,211 @@
+#include "resampler.h"
+#include "threadpool.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef CG_SIMD
+bool Resampler::use_simd = true;
+#else
+bool Resampler::use_simd = false;
+#endif
+
+// Jobs per thread, so bands of rows that cost more (more taps near the edges, cache misses) are balanced
+static const int JOBS_PER_THREAD = 4;
+
+// Half width of the filter in source pixels when the image is not reduced
+static double FilterSupport(eScaleFilter filter)
+{
+	switch (filter)
+	{
+	case eScaleFilter::BOX: return 0.5;
+	case eScaleFilter::BILINEAR: return 1.0;
+	case eScaleFilter::LANCZOS3: return 3.0;
+	}
+	return 1.0;
+}
+
+static double Sinc(double x)
+{
+	if (x == 0.0)
+		return 1.0;
+	x *= PI;
+	return sin(x) / x;
+}
+
+static double FilterWeight(eScaleFilter filter, double x)
+{
+	switch (filter)
+	{
+	case eScaleFilter::BOX:
+		return (x > -0.5 && x <= 0.5) ? 1.0 : 0.0;
+	case eScaleFilter::BILINEAR:
+		x = fabs(x);
+		return x < 1.0 ? 1.0 - x : 0.0;
+	case eScaleFilter::LANCZOS3:
+		return (x > -3.0 && x < 3.0) ? Sinc(x) * Sinc(x / 3.0) : 0.0;
+	}
+	return 0.0;
+}
+
+void Resampler::ComputeWeights(Axis& axis, unsigned int source_size, unsigned int destination_size, eScaleFilter filter)
+{
+	if (axis.source_size == source_size && axis.destination_size == destination_size && axis.filter == filter)
+		return;
+
+	axis.source_size = source_size;
+	axis.destination_size = destination_size;
+	axis.filter = filter;
+
+	// When reducing, the filter is stretched to cover all the source pixels that fall in a destination pixel
+	double scale = (double)source_size / destination_size;
+	double filter_scale = std::max(scale, 1.0);
+	double support = FilterSupport(filter) * filter_scale;
+
+	// Window of source samples around the center of every destination sample, cut at the borders. All the samples read
+	// as many source samples as the widest window
+	std::vector<int>& begins = axis.first;
+	begins.resize(destination_size);
+	int taps = 1;
+	for (unsigned int i = 0; i < destination_size; ++i)
+	{
+		double center = (i + 0.5) * scale;
+		int begin = std::max((int)(center - support + 0.5), 0);
+		int end = std::min((int)(center + support + 0.5), (int)source_size);
+		begins[i] = std::min(begin, (int)source_size - 1);
+		taps = std::max(taps, end - begins[i]);
+	}
+	axis.taps = taps;
+	axis.weights.assign((size_t)destination_size * taps, 0.0f);
+
+	std::vector<double> window(taps);
+	for (unsigned int i = 0; i < destination_size; ++i)
+	{
+		double center = (i + 0.5) * scale;
+		int begin = begins[i];
+		int end = std::min((int)(center + support + 0.5), (int)source_size);
+		int count = std::max(end - begin, 1);
+
+		double total = 0.0;
+		for (int k = 0; k < count; ++k)
+		{
+			window[k] = FilterWeight(filter, (begin + k - center + 0.5) / filter_scale);
+			total += window[k];
+		}
+
+		// The window fits in the taps once moved back from the end of the axis, the rest of the weights stay at zero
+		int first = std::min(begin, (int)source_size - taps);
+		float* weights = &axis.weights[(size_t)i * taps + (begin - first)];
+		for (int k = 0; k < count; ++k)
+			weights[k] = total != 0.0 ? (float)(window[k] / total) : (k == 0 ? 1.0f : 0.0f);
+		begins[i] = first;
+	}
+}
+
+void Resampler::ScaleRow(const Image& source, Image& destination, unsigned int y, float* row)
+{
+	// Vertical pass: the source rows of the window summed into row, one float per channel
+	const int v_taps = vertical.taps;
+	const float* v_weights = &vertical.weights[(size_t)y * v_taps];
+	size_t channels = (size_t)source.width * 3;
+	size_t stride = source.GetRowBytes();
+	const unsigned char* base = (const unsigned char*)source.GetRow(vertical.first[y]);
+
+	size_t i = 0;
+#ifdef CG_SIMD
+	if (use_simd)
+	{
+		for (; i + CG_SIMD_WIDTH <= channels; i += CG_SIMD_WIDTH)
+		{
+			vfloat sum = simdSplat(0.0f);
+			for (int k = 0; k < v_taps; ++k)
+				sum = simdAdd(sum, simdMul(simdSplat(v_weights[k]), simdLoadBytes(base + k * stride + i)));
+			simdStore(row + i, sum);
+		}
+	}
+#endif
+	for (; i < channels; ++i)
+	{
+		float sum = 0.0f;
+		for (int k = 0; k < v_taps; ++k)
+			sum = sum + v_weights[k] * (float)base[k * stride + i];
+		row[i] = sum;
+	}
+
+	// Horizontal pass: every destination pixel from the pixels of row in its window, rounded and clamped to bytes
+	const int h_taps = horizontal.taps;
+	Color* out = destination.GetRow(y);
+	for (unsigned int x = 0; x < destination.width; ++x)
+	{
+		const float* h_weights = &horizontal.weights[(size_t)x * h_taps];
+		const float* pixel = row + (size_t)horizontal.first[x] * 3;
+
+#ifdef CG_SIMD
+		if (use_simd)
+		{
+			// r, g, b and the red of the next pixel (or the padding after the row), which is dropped
+			__m128 sum = _mm_setzero_ps();
+			for (int k = 0; k < h_taps; ++k)
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(h_weights[k]), _mm_loadu_ps(pixel + k * 3)));
+			sum = _mm_add_ps(_mm_min_ps(_mm_max_ps(sum, _mm_setzero_ps()), _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f));
+
+			int values[4];
+			_mm_storeu_si128((__m128i*)values, _mm_cvttps_epi32(sum));
+			out[x].r = (unsigned char)values[0];
+			out[x].g = (unsigned char)values[1];
+			out[x].b = (unsigned char)values[2];
+			continue;
+		}
+#endif
+		float r = 0.0f, g = 0.0f, b = 0.0f;
+		for (int k = 0; k < h_taps; ++k)
+		{
+			r = r + h_weights[k] * pixel[k * 3];
+			g = g + h_weights[k] * pixel[k * 3 + 1];
+			b = b + h_weights[k] * pixel[k * 3 + 2];
+		}
+		out[x].r = (unsigned char)(int)(std::min(std::max(r, 0.0f), 255.0f) + 0.5f);
+		out[x].g = (unsigned char)(int)(std::min(std::max(g, 0.0f), 255.0f) + 0.5f);
+		out[x].b = (unsigned char)(int)(std::min(std::max(b, 0.0f), 255.0f) + 0.5f);
+	}
+}
+
+void Resampler::Scale(const Image& source, Image& destination, eScaleFilter filter)
+{
+	if (&source == &destination || !source.pixels || !destination.pixels)
+		return;
+	if (!source.width || !source.height || !destination.width || !destination.height)
+		return;
+
+	destination.InvalidateMipmaps();
+	ComputeWeights(horizontal, source.width, destination.width, filter);
+	ComputeWeights(vertical, source.height, destination.height, filter);
+
+	int jobs = std::min((int)destination.height, (int)ThreadPool::Get()->GetNumThreads() * JOBS_PER_THREAD);
+	if ((int)rows.size() < jobs)
+		rows.resize(jobs);
+
+	// One float of padding after the row for the vector that loads the last pixel
+	size_t row_size = (size_t)source.width * 3 + 1;
+	for (int j = 0; j < jobs; ++j)
+	{
+		if (rows[j].size() < row_size)
+			rows[j].resize(row_size);
+		rows[j][row_size - 1] = 0.0f;
+	}
+
+	ThreadPool::Get()->ParallelFor(jobs, [&](int job) {
+		unsigned int y0 = (unsigned int)((size_t)destination.height * job / jobs);
+		unsigned int y1 = (unsigned int)((size_t)destination.height * (job + 1) / jobs);
+		float* row = rows[job].data();
+		for (unsigned int y = y0; y < y1; ++y)
+			ScaleRow(source, destination, y, row);
+	});
+}
+
+Resampler* Resampler::Get()
+{
+	static Resampler resampler;
+	return &resampler;
+}
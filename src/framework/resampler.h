@@ -0,0 +1,49 @@
+/*
+	+ This class scales images with a reconstruction filter. The scale is separable: every destination row is first a weighted
+	  sum of source rows (vertical pass) and then every destination pixel a weighted sum of pixels of that row (horizontal pass).
+	+ The weights of each destination row and column are computed once per source size, destination size and filter and kept,
+	  as are the scratch rows, so scaling many images of the same size allocates nothing.
+	+ Bands of destination rows are split over the thread pool. The vertical pass runs CG_SIMD_WIDTH channels at a time and the
+	  horizontal one a whole pixel per vector; the scalar path does the same operations in the same order, so both give the same bits.
+	+ The tables are shared, so Scale must not be called from several threads at once.
+*/
+
+#pragma once
+
+#include <vector>
+#include "image.h"
+
+class Resampler
+{
+public:
+	// Use the vectorized passes
+	static bool use_simd;
+
+	// Writes source scaled to the size of destination (which must not be the same image)
+	void Scale(const Image& source, Image& destination, eScaleFilter filter);
+
+	// Resampler used by Image::Scale
+	static Resampler* Get();
+
+private:
+	// Contributions to every destination sample along one axis: taps source samples from first[i], with
+	// weights[i * taps ...] (padded with zeros, so every sample reads the same number of them)
+	struct Axis
+	{
+		unsigned int source_size = 0;
+		unsigned int destination_size = 0;
+		eScaleFilter filter = eScaleFilter::BILINEAR;
+		int taps = 0;
+		std::vector<int> first;
+		std::vector<float> weights;
+	};
+
+	Axis horizontal;
+	Axis vertical;
+
+	// One row of the vertical pass per job, as floats
+	std::vector<std::vector<float>> rows;
+
+	void ComputeWeights(Axis& axis, unsigned int source_size, unsigned int destination_size, eScaleFilter filter);
+	void ScaleRow(const Image& source, Image& destination, unsigned int y, float* row);
+};
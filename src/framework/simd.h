@@ -0,0 +1,159 @@
+/*
+	+ Thin wrappers over the SSE2 / AVX2 intrinsics so the vectorized kernels are written once for any lane count.
+	+ CG_SIMD is only defined when the target has vector instructions, code using it must keep a scalar path.
+*/
+
+#pragma once
+
+#if defined(__AVX2__)
+	#define CG_SIMD 1
+	#define CG_SIMD_WIDTH 8
+	#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define CG_SIMD 1
+	#define CG_SIMD_WIDTH 4
+	#include <emmintrin.h>
+#endif
+
+#ifdef CG_SIMD
+
+#include <string.h>
+
+#if CG_SIMD_WIDTH == 8
+
+typedef __m256 vfloat;	// 8 floats
+typedef __m256i vint;	// 8 ints
+
+inline vfloat simdSplat(float v) { return _mm256_set1_ps(v); }
+inline vint simdSplat(int v) { return _mm256_set1_epi32(v); }
+
+inline vfloat simdLoad(const float* p) { return _mm256_loadu_ps(p); }
+inline vint simdLoad(const int* p) { return _mm256_loadu_si256((const __m256i*)p); }
+inline void simdStore(float* p, vfloat v) { _mm256_storeu_ps(p, v); }
+inline void simdStore(int* p, vint v) { _mm256_storeu_si256((__m256i*)p, v); }
+
+inline vfloat simdAdd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+inline vfloat simdSub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+inline vfloat simdMul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+inline vfloat simdMin(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+inline vfloat simdMax(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+inline vfloat simdSqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+inline vint simdAdd(vint a, vint b) { return _mm256_add_epi32(a, b); }
+inline vint simdSub(vint a, vint b) { return _mm256_sub_epi32(a, b); }
+
+// Masks have all bits set in the lanes where the comparison is true
+inline vfloat simdLess(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline vint simdGreater(vint a, vint b) { return _mm256_cmpgt_epi32(a, b); }
+inline vfloat simdAnd(vfloat a, vfloat b) { return _mm256_and_ps(a, b); }
+inline vint simdAnd(vint a, vint b) { return _mm256_and_si256(a, b); }
+inline vfloat simdSelect(vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, mask); }
+inline int simdMoveMask(vfloat mask) { return _mm256_movemask_ps(mask); }
+inline int simdMoveMask(vint mask) { return _mm256_movemask_ps(_mm256_castsi256_ps(mask)); }
+inline vfloat simdAsFloat(vint v) { return _mm256_castsi256_ps(v); }
+
+inline vfloat simdToFloat(vint v) { return _mm256_cvtepi32_ps(v); }
+inline vint simdTruncate(vfloat v) { return _mm256_cvttps_epi32(v); }
+
+// CG_SIMD_WIDTH consecutive bytes, each one converted to a float
+inline vfloat simdLoadBytes(const unsigned char* p) { return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p))); }
+
+// Stores the lanes, which must be in [0, 255], as CG_SIMD_WIDTH consecutive bytes
+inline void simdStoreBytes(unsigned char* p, vint v)
+{
+	__m128i words = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	_mm_storel_epi64((__m128i*)p, _mm_packus_epi16(words, words));
+}
+
+#else
+
+typedef __m128 vfloat;	// 4 floats
+typedef __m128i vint;	// 4 ints
+
+inline vfloat simdSplat(float v) { return _mm_set1_ps(v); }
+inline vint simdSplat(int v) { return _mm_set1_epi32(v); }
+
+inline vfloat simdLoad(const float* p) { return _mm_loadu_ps(p); }
+inline vint simdLoad(const int* p) { return _mm_loadu_si128((const __m128i*)p); }
+inline void simdStore(float* p, vfloat v) { _mm_storeu_ps(p, v); }
+inline void simdStore(int* p, vint v) { _mm_storeu_si128((__m128i*)p, v); }
+
+inline vfloat simdAdd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+inline vfloat simdSub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+inline vfloat simdMul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+inline vfloat simdMin(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+inline vfloat simdMax(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+inline vfloat simdSqrt(vfloat a) { return _mm_sqrt_ps(a); }
+inline vint simdAdd(vint a, vint b) { return _mm_add_epi32(a, b); }
+inline vint simdSub(vint a, vint b) { return _mm_sub_epi32(a, b); }
+
+// Masks have all bits set in the lanes where the comparison is true
+inline vfloat simdLess(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+inline vint simdGreater(vint a, vint b) { return _mm_cmpgt_epi32(a, b); }
+inline vfloat simdAnd(vfloat a, vfloat b) { return _mm_and_ps(a, b); }
+inline vint simdAnd(vint a, vint b) { return _mm_and_si128(a, b); }
+inline vfloat simdSelect(vfloat mask, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+inline int simdMoveMask(vfloat mask) { return _mm_movemask_ps(mask); }
+inline int simdMoveMask(vint mask) { return _mm_movemask_ps(_mm_castsi128_ps(mask)); }
+inline vfloat simdAsFloat(vint v) { return _mm_castsi128_ps(v); }
+
+inline vfloat simdToFloat(vint v) { return _mm_cvtepi32_ps(v); }
+inline vint simdTruncate(vfloat v) { return _mm_cvttps_epi32(v); }
+
+// CG_SIMD_WIDTH consecutive bytes, each one converted to a float
+inline vfloat simdLoadBytes(const unsigned char* p)
+{
+	int bytes;
+	memcpy(&bytes, p, sizeof(bytes));
+	__m128i zero = _mm_setzero_si128();
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero));
+}
+
+// Stores the lanes, which must be in [0, 255], as CG_SIMD_WIDTH consecutive bytes
+inline void simdStoreBytes(unsigned char* p, vint v)
+{
+	__m128i words = _mm_packs_epi32(v, v);
+	int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+	memcpy(p, &bytes, sizeof(bytes));
+}
+
+#endif
+
+// 4 packed 3-byte pixels (RGB or BGR), one per 32-bit lane. The fourth byte of every lane is zero with AVX2 and the first
+// byte of the next pixel without it. Reads 16 bytes, 4 past the pixels
+inline __m128i simdLoadRGB4(const void* p)
+{
+#ifdef __AVX2__
+	const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p), spread);
+#else
+	// Lane i is the 32 bits at byte 3 * i
+	__m128i v = _mm_loadu_si128((const __m128i*)p);
+	__m128i first = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+	__m128i second = _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9));
+	return _mm_unpacklo_epi64(first, second);
+#endif
+}
+
+// Stores the first three bytes of every lane as 4 packed pixels (exactly 12 bytes)
+inline void simdStoreRGB4(void* p, __m128i v)
+{
+	unsigned char* bytes = (unsigned char*)p;
+#ifdef __AVX2__
+	const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	__m128i packed = _mm_shuffle_epi8(v, pack);
+	_mm_storel_epi64((__m128i*)bytes, packed);
+	int last = _mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+	memcpy(bytes + 8, &last, 4);
+#else
+	// Closes the gap between the two pixels of every 64 bits and then the one between both halves
+	v = _mm_and_si128(v, _mm_set1_epi32(0x00ffffff));
+	__m128i pairs = _mm_or_si128(_mm_and_si128(v, _mm_set_epi32(0, -1, 0, -1)),
+		_mm_and_si128(_mm_srli_epi64(v, 8), _mm_set_epi32(0x0000ffff, (int)0xff000000, 0x0000ffff, (int)0xff000000)));
+	pairs = _mm_or_si128(_mm_and_si128(pairs, _mm_set_epi32(0, 0, 0x0000ffff, -1)), _mm_and_si128(_mm_srli_si128(pairs, 2), _mm_set_epi32(0, -1, (int)0xffff0000, 0)));
+	_mm_storel_epi64((__m128i*)bytes, pairs);
+	int last = _mm_cvtsi128_si32(_mm_srli_si128(pairs, 8));
+	memcpy(bytes + 8, &last, 4);
+#endif
+}
+
+#endif
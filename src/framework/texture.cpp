@@ -1,6 +1,8 @@
 #include "texture.h"
 #include "utils.h"
 #include "image.h"
+#include "tgacodec.h"
+#include "mappedfile.h"
 
 #include <iostream> //to output
 #include <cmath>
@@ -9,6 +11,7 @@ std::map<std::string, Texture*> Texture::s_Textures;
 
 Texture::Texture()
 {
+	texture_id = 0;
 	width = 0;
 	height = 0;
 	format = GL_RGB;
@@ -80,25 +83,23 @@ bool Texture::Load(const char* filename, bool mipmaps)
 	std::string ext = sfullPath.substr(sfullPath.size() - 4,4 );
 
 	if (ext == ".tga" || ext == ".TGA") {
-		TGAInfo* tgainfo = LoadTGA(sfullPath.c_str());
-		if (tgainfo == NULL)
+		// The bottom row first, as OpenGL expects
+		MappedFile file;
+		RGBAImage image;
+		TGADecoder decoder;
+		if (!file.Open(sfullPath) || !decoder.Decode(file.GetData(), file.GetSize(), image, true))
 			return false;
 
 		this->filename = sfullPath;
-		Create(tgainfo->width, tgainfo->height, tgainfo->bpp == 24 ? GL_BGR : GL_BGRA, GL_UNSIGNED_BYTE, mipmaps, tgainfo->data, (tgainfo->bpp == 24 ? 3 : 4));
-
-		delete tgainfo->data;
-		delete tgainfo;
+		Create(image.width, image.height, GL_RGBA, GL_UNSIGNED_BYTE, mipmaps, (Uint8*)image.pixels, (decoder.GetBitsPerPixel() == 24 ? 3 : 4));
 		return true;
 	}
 	else if (ext == ".png" || ext == ".PNG") {
-		Image* image = new Image();
-		if (!image->LoadPNG(filename)) {
-			delete image;
+		RGBAImage image;
+		if (!LoadPNG(filename, image))
 			return false;
-		}
 		this->filename = sfullPath;
-		Create(image->width, image->height, image->bytes_per_pixel == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, mipmaps, (Uint8*)image->pixels);
+		Create(image.width, image.height, GL_RGBA, GL_UNSIGNED_BYTE, mipmaps, (Uint8*)image.pixels);
 		return true;
 	}
 	else {
@@ -147,60 +148,3 @@ void Texture::GenerateMipmaps()
 		// Not using any older method
 	}
 }
-
-Texture::TGAInfo* Texture::LoadTGA(const char* filename)
-{
-    GLubyte TGAheader[12] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    GLubyte TGAcompare[12];
-    GLubyte header[6];
-    GLuint bytesPerPixel;
-    GLuint imageSize;
-    GLuint type = GL_RGBA;
-
-    FILE * file = fopen(filename, "rb");
-    
-    if ( file == NULL || fread(TGAcompare, 1, sizeof(TGAcompare), file) != sizeof(TGAcompare) ||
-        memcmp(TGAheader, TGAcompare, sizeof(TGAheader)) != 0 ||
-        fread(header, 1, sizeof(header), file) != sizeof(header))
-    {
-        if (file == NULL)
-            return NULL;
-        else
-        {
-            fclose(file);
-            return NULL;
-        }
-    }
-
-	TGAInfo* tgainfo = new TGAInfo;
-    
-    tgainfo->width = header[1] * 256 + header[0];
-    tgainfo->height = header[3] * 256 + header[2];
-    
-    if (tgainfo->width <= 0 || tgainfo->height <= 0 || (header[4] != 24 && header[4] != 32))
-    {
-        fclose(file);
-		delete tgainfo;
-        return NULL;
-    }
-    
-    tgainfo->bpp = header[4];
-    bytesPerPixel = tgainfo->bpp / 8;
-    imageSize = tgainfo->width * tgainfo->height * bytesPerPixel;
-    
-    tgainfo->data = (GLubyte*)malloc(imageSize);
-    
-    if (tgainfo->data == NULL || fread(tgainfo->data, 1, imageSize, file) != imageSize)
-    {
-        if (tgainfo->data != NULL)
-            free(tgainfo->data);
-            
-        fclose(file);
-		delete tgainfo;
-        return NULL;
-    }
-    
-    fclose(file);
-
-	return tgainfo;
-}
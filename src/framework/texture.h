@@ -10,14 +10,6 @@
 
 class Texture
 {
-	typedef struct sTGAInfo //a general struct to store all the information about a TGA file
-	{
-		GLuint width;
-		GLuint height;
-		GLuint bpp; //bits per pixel
-		GLubyte* data; //bytes with the pixel information
-	} TGAInfo;
-
 public:
 
 	GLuint texture_id; // GL id to identify the texture in opengl, every texture must have its own id
@@ -46,7 +38,4 @@ public:
 
 	static Texture* Get(const char* filename);
 	static std::map<std::string, Texture*> s_Textures;
-
-protected:
-	TGAInfo* LoadTGA(const char* filename);
 };
\ No newline at end of file
@@ -0,0 +1,329 @@
+#include "tgacodec.h"
+#include "image.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#ifdef CG_SIMD
+bool TGADecoder::use_simd = true;
+bool TGAEncoder::use_simd = true;
+#else
+bool TGADecoder::use_simd = false;
+bool TGAEncoder::use_simd = false;
+#endif
+
+static const size_t HEADER_SIZE = 18;
+static const unsigned char TYPE_RAW = 2;
+static const unsigned char TYPE_RLE = 10;
+static const unsigned char ORIGIN_TOP = 0x20;	// Bit of the descriptor, the first row of the file is the top one
+static const unsigned char ORIGIN_RIGHT = 0x10;
+static const unsigned int MAX_PACKET = 128;
+
+static bool Fail(const char* reason)
+{
+	std::cerr << "--- TGA: " << reason << std::endl;
+	return false;
+}
+
+static inline Color ConvertPixel(const unsigned char* p, int, Color*)
+{
+	return Color(p[2], p[1], p[0]);
+}
+
+static inline ColorRGBA ConvertPixel(const unsigned char* p, int bytes, ColorRGBA*)
+{
+	return ColorRGBA(p[2], p[1], p[0], bytes == 4 ? p[3] : 255);
+}
+
+template <typename Pixel>
+static void ConvertScalar(const unsigned char* source, int bytes, Pixel* out, size_t count)
+{
+	for (size_t i = 0; i < count; ++i, source += bytes)
+		out[i] = ConvertPixel(source, bytes, out);
+}
+
+#ifdef CG_SIMD
+
+// Swaps the bytes 0 and 2 of every 32-bit lane
+static inline __m128i SwapRedBlue(__m128i v)
+{
+	return _mm_or_si128(_mm_and_si128(v, _mm_set1_epi32((int)0xff00ff00)),
+		_mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), _mm_set1_epi32(0xff)), _mm_and_si128(_mm_slli_epi32(v, 16), _mm_set1_epi32(0xff0000))));
+}
+
+// 3-byte pixels, 16 at a time: every output byte is the one two before, the same one or the one two after, depending on
+// its place in the pixel. 48 bytes are 3 vectors, each with its own masks; the loads two bytes before and after the vector
+// stay inside the pixels because the first pixel and the last one are scalar. 4-byte pixels are swapped in their lanes and
+// packed 4 at a time
+static size_t ConvertSimd(const unsigned char* source, int bytes, Color* out, size_t count)
+{
+	struct SwapMasks
+	{
+		__m128i from_next[3], same[3], from_previous[3];
+		SwapMasks()
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned char masks[3][16];
+				for (int j = 0; j < 16; ++j)
+					for (int m = 0; m < 3; ++m)
+						masks[m][j] = (16 * k + j) % 3 == m ? 0xff : 0;
+				from_next[k] = _mm_loadu_si128((const __m128i*)masks[0]);
+				same[k] = _mm_loadu_si128((const __m128i*)masks[1]);
+				from_previous[k] = _mm_loadu_si128((const __m128i*)masks[2]);
+			}
+		}
+	};
+	static const SwapMasks masks;
+
+	size_t i = 0;
+	if (bytes == 4)
+	{
+		for (; i + 4 <= count; i += 4)
+			simdStoreRGB4(out + i, SwapRedBlue(_mm_loadu_si128((const __m128i*)(source + 4 * i))));
+		return i;
+	}
+
+	if (count < 18)
+		return 0;
+	ConvertScalar(source, bytes, out, 1);
+	unsigned char* output = (unsigned char*)out;
+	for (i = 1; i + 17 <= count; i += 16)
+		for (int k = 0; k < 3; ++k)
+		{
+			const unsigned char* p = source + 3 * i + 16 * k;
+			__m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*)p), masks.same[k]);
+			v = _mm_or_si128(v, _mm_and_si128(_mm_loadu_si128((const __m128i*)(p + 2)), masks.from_next[k]));
+			v = _mm_or_si128(v, _mm_and_si128(_mm_loadu_si128((const __m128i*)(p - 2)), masks.from_previous[k]));
+			_mm_storeu_si128((__m128i*)(output + 3 * i + 16 * k), v);
+		}
+	return i;
+}
+
+static size_t ConvertSimd(const unsigned char* source, int bytes, ColorRGBA* out, size_t count)
+{
+	size_t i = 0;
+	if (bytes == 4)
+	{
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_si128((__m128i*)(out + i), SwapRedBlue(_mm_loadu_si128((const __m128i*)(source + 4 * i))));
+	}
+	else
+	{
+		// The load reads 4 bytes past the 4 pixels
+		const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+		for (; i + 6 <= count; i += 4)
+			_mm_storeu_si128((__m128i*)(out + i), _mm_or_si128(SwapRedBlue(simdLoadRGB4(source + 3 * i)), alpha));
+	}
+	return i;
+}
+
+#endif
+
+// Converts count pixels of bytes (3 or 4) in BGR(A) order to out: the vectorized kernels return how many they converted
+// and the rest go one at a time. Swapping red and blue works both ways, so it also turns RGB pixels into BGR ones
+template <typename Pixel>
+static void ConvertPixels(const unsigned char* source, int bytes, Pixel* out, size_t count, bool use_simd)
+{
+	size_t i = 0;
+#ifdef CG_SIMD
+	if (use_simd)
+		i = ConvertSimd(source, bytes, out, count);
+#endif
+	ConvertScalar(source + bytes * i, bytes, out + i, count - i);
+}
+
+bool TGADecoder::ReadHeader(const unsigned char* data, size_t size)
+{
+	if (!data || size < HEADER_SIZE)
+		return Fail("not a TGA file");
+
+	// Identification field and colour map, both skipped
+	size_t id_length = data[0];
+	int color_map_type = data[1];
+	int image_type = data[2];
+	size_t color_map_length = data[5] | data[6] << 8;
+	int color_map_bits = data[7];
+	if (color_map_type > 1)
+		return Fail("not a TGA file");
+	if (image_type != TYPE_RAW && image_type != TYPE_RLE)
+		return Fail("only true-colour images are supported, raw or RLE");
+
+	width = data[12] | data[13] << 8;
+	height = data[14] | data[15] << 8;
+	bits_per_pixel = data[16];
+	unsigned char descriptor = data[17];
+	if (!width || !height)
+		return Fail("empty image");
+	if (bits_per_pixel != 24 && bits_per_pixel != 32)
+		return Fail("only 24 and 32 bits per pixel are supported");
+	if (descriptor & ORIGIN_RIGHT)
+		return Fail("right-to-left images are not supported");
+
+	rle = image_type == TYPE_RLE;
+	top_down = (descriptor & ORIGIN_TOP) != 0;
+
+	size_t offset = HEADER_SIZE + id_length + (color_map_type ? color_map_length * ((color_map_bits + 7) / 8) : 0);
+	if (offset > size)
+		return Fail("truncated header");
+	pixels = data + offset;
+	end = data + size;
+	return true;
+}
+
+bool TGADecoder::Decode(const unsigned char* data, size_t size, Image& image, bool flip_y)
+{
+	return ReadHeader(data, size) && DecodePixels(image, flip_y);
+}
+
+bool TGADecoder::Decode(const unsigned char* data, size_t size, RGBAImage& image, bool flip_y)
+{
+	return ReadHeader(data, size) && DecodePixels(image, flip_y);
+}
+
+template <typename Format>
+bool TGADecoder::DecodePixels(PixelImage<Format>& image, bool flip_y)
+{
+	typedef typename Format::Pixel Pixel;
+	const int bytes = bits_per_pixel / 8;
+	const size_t row_bytes = (size_t)width * bytes;
+
+	// Row of the image of every row of the file
+	bool bottom_first = top_down == flip_y;
+	auto image_row = [&](unsigned int y) { return bottom_first ? height - 1 - y : y; };
+
+	if (!rle)
+	{
+		if ((size_t)(end - pixels) / row_bytes < height)
+			return Fail("truncated pixel data");
+		image.Allocate(width, height);
+		for (unsigned int y = 0; y < height; ++y)
+			ConvertPixels(pixels + y * row_bytes, bytes, image.GetRow(image_row(y)), width, use_simd);
+		return true;
+	}
+
+	// Packets: a header byte with the count (minus 1) in the low 7 bits, then one pixel repeated when the top bit is set,
+	// or count literal pixels
+	image.Allocate(width, height);
+	const unsigned char* p = pixels;
+	unsigned int left = 0;	// Pixels of the current packet not written yet
+	bool repeated = false;
+	Pixel value = Pixel();
+	for (unsigned int y = 0; y < height; ++y)
+	{
+		Pixel* out = image.GetRow(image_row(y));
+		unsigned int x = 0;
+		while (x < width)
+		{
+			if (!left)
+			{
+				if (p >= end)
+					return Fail("truncated pixel data");
+				unsigned char header = *p++;
+				left = (header & 0x7f) + 1;
+				repeated = (header & 0x80) != 0;
+				if (repeated)
+				{
+					if (end - p < bytes)
+						return Fail("truncated pixel data");
+					value = ConvertPixel(p, bytes, (Pixel*)nullptr);
+					p += bytes;
+				}
+			}
+
+			unsigned int count = std::min(left, width - x);
+			if (repeated)
+				std::fill(out + x, out + x + count, value);
+			else
+			{
+				if ((size_t)(end - p) < (size_t)count * bytes)
+					return Fail("truncated pixel data");
+				ConvertPixels(p, bytes, out + x, count, use_simd);
+				p += (size_t)count * bytes;
+			}
+			x += count;
+			left -= count;
+		}
+	}
+	return true;
+}
+
+// Appends a row of BGR pixels as RLE packets: runs of 2 or more equal pixels are repeated packets, the pixels between them
+// go in literal packets
+static void EncodeRow(const unsigned char* row, unsigned int width, std::vector<unsigned char>& out)
+{
+	auto same = [&](unsigned int a, unsigned int b) { return memcmp(row + 3 * a, row + 3 * b, 3) == 0; };
+
+	unsigned int x = 0;
+	while (x < width)
+	{
+		unsigned int run = 1;
+		while (x + run < width && run < MAX_PACKET && same(x, x + run))
+			run++;
+		if (run >= 2)
+		{
+			out.push_back((unsigned char)(0x80 | (run - 1)));
+			out.insert(out.end(), row + 3 * x, row + 3 * x + 3);
+			x += run;
+			continue;
+		}
+
+		unsigned int count = 1;
+		while (x + count < width && count < MAX_PACKET && !(x + count + 1 < width && same(x + count, x + count + 1)))
+			count++;
+		out.push_back((unsigned char)(count - 1));
+		out.insert(out.end(), row + 3 * x, row + 3 * (x + count));
+		x += count;
+	}
+}
+
+size_t TGAEncoder::Encode(const Image& image, std::ostream& stream, bool flip_y)
+{
+	if (!image.width || !image.height || image.width > 0xffff || image.height > 0xffff)
+	{
+		Fail("the image is empty or too large");
+		return 0;
+	}
+
+	unsigned char header[HEADER_SIZE] = { 0 };
+	header[2] = rle ? TYPE_RLE : TYPE_RAW;
+	header[12] = (unsigned char)image.width;
+	header[13] = (unsigned char)(image.width >> 8);
+	header[14] = (unsigned char)image.height;
+	header[15] = (unsigned char)(image.height >> 8);
+	header[16] = 24;
+	header[17] = 0;	// Origin at the bottom left, no alpha
+	stream.write((const char*)header, HEADER_SIZE);
+	size_t written = HEADER_SIZE;
+
+	// The bottom row of the picture first, as TGADecoder reads it back
+	std::vector<Color> bgr(image.width);
+	std::vector<unsigned char> packets;
+	for (unsigned int y = 0; y < image.height && stream; ++y)
+	{
+		const Color* row = image.GetRow(flip_y ? y : image.height - 1 - y);
+		ConvertPixels((const unsigned char*)row, 3, bgr.data(), image.width, use_simd);
+		const unsigned char* bytes = (const unsigned char*)bgr.data();
+		if (rle)
+		{
+			packets.clear();
+			EncodeRow(bytes, image.width, packets);
+			stream.write((const char*)packets.data(), packets.size());
+			written += packets.size();
+		}
+		else
+		{
+			stream.write((const char*)bytes, (size_t)image.width * 3);
+			written += (size_t)image.width * 3;
+		}
+	}
+
+	if (!stream)
+	{
+		Fail("could not write the file");
+		return 0;
+	}
+	return written;
+}
@@ -0,0 +1,63 @@
+/*
+	+ TGADecoder decodes true-colour TGA files of 24 and 32 bits, uncompressed (type 2) or run-length encoded (type 10),
+	  held in memory (see MappedFile), into an Image (the alpha is dropped) or an RGBAImage (24-bit files get alpha 255).
+	+ Every row is converted from BGR(A) straight into its row of the image, in the orientation asked for whatever the
+	  origin of the file is: the raw runs of pixels go through a vectorized swizzle, the repeated ones are converted once and
+	  filled. RLE packets may cross rows.
+	+ TGAEncoder writes an Image as a 24-bit TGA with its origin at the bottom left, uncompressed or with every row run-length
+	  encoded on its own.
+*/
+
+#pragma once
+
+#include <ostream>
+#include "pixelimage.h"
+
+class Image;
+
+class TGADecoder
+{
+public:
+	// Use the vectorized swizzle
+	static bool use_simd;
+
+	// Decodes a whole TGA file. Row 0 of the image is the top of the picture, or the bottom when flip_y. Prints the reason
+	// and returns false when the file is not valid
+	bool Decode(const unsigned char* data, size_t size, Image& image, bool flip_y = false);
+	bool Decode(const unsigned char* data, size_t size, RGBAImage& image, bool flip_y = false);
+
+	// Of the last file decoded, 24 or 32
+	int GetBitsPerPixel() const { return bits_per_pixel; }
+
+private:
+	// From the header
+	unsigned int width = 0;
+	unsigned int height = 0;
+	int bits_per_pixel = 0;
+	bool rle = false;
+	bool top_down = false;
+
+	// Pixel data, up to the end of the file
+	const unsigned char* pixels = nullptr;
+	const unsigned char* end = nullptr;
+
+	bool ReadHeader(const unsigned char* data, size_t size);
+
+	template <typename Format>
+	bool DecodePixels(PixelImage<Format>& image, bool flip_y);
+};
+
+class TGAEncoder
+{
+public:
+	// Use the vectorized swizzle
+	static bool use_simd;
+
+	// Run-length encode the rows
+	bool rle = true;
+
+	// Writes image to stream, so that TGADecoder gives the same image back with the same flip_y. Row 0 is the bottom of the
+	// picture when flip_y, as in PNGEncoder. Returns the bytes written, 0 when the image is too large for a TGA or the
+	// stream fails
+	size_t Encode(const Image& image, std::ostream& stream, bool flip_y = true);
+};
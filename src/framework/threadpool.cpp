@@ -0,0 +1,111 @@
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+// State shared by all the threads that take part in one ParallelFor
+struct sParallelJob
+{
+	std::function<void(int)> job;
+	int count;
+	std::atomic<int> next;
+	std::atomic<int> done;
+	std::mutex mutex;
+	std::condition_variable finished;
+
+	// Grabs indices until there are none left
+	void Run()
+	{
+		int i;
+		while ((i = next++) < count)
+		{
+			job(i);
+			if (++done == count)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				finished.notify_all();
+			}
+		}
+	}
+};
+
+ThreadPool::ThreadPool(unsigned int num_threads)
+{
+	if (num_threads == 0)
+		num_threads = std::thread::hardware_concurrency();
+	if (num_threads == 0)
+		num_threads = 1;
+
+	for (unsigned int i = 1; i < num_threads; ++i)
+		workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_all();
+
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+}
+
+void ThreadPool::WorkerLoop()
+{
+	while (1)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+			if (stopping && tasks.empty())
+				return;
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int)>& job)
+{
+	if (count <= 0)
+		return;
+
+	// Nothing to share: run it here and skip the synchronization
+	if (count == 1 || workers.empty())
+	{
+		for (int i = 0; i < count; ++i)
+			job(i);
+		return;
+	}
+
+	std::shared_ptr<sParallelJob> state = std::make_shared<sParallelJob>();
+	state->job = job;
+	state->count = count;
+	state->next = 0;
+	state->done = 0;
+
+	// Helpers that start late just find no indices left, so the caller never waits for them
+	size_t helpers = std::min(workers.size(), (size_t)count - 1);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < helpers; ++i)
+			tasks.push_back([state] { state->Run(); });
+	}
+	condition.notify_all();
+
+	state->Run();
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->finished.wait(lock, [&state] { return state->done == state->count; });
+}
+
+ThreadPool* ThreadPool::Get()
+{
+	static ThreadPool pool;
+	return &pool;
+}
@@ -0,0 +1,69 @@
+/*
+	+ This class keeps a set of worker threads alive to split work across all the cores.
+	+ ParallelFor runs a job for every index and returns when all of them are done; the calling thread also takes part.
+	+ Submit queues a single task and returns right away with a future of its result.
+*/
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+
+class ThreadPool
+{
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping = false;
+
+	void WorkerLoop();
+
+public:
+
+	// num_threads counts the calling thread too, 0 means one per hardware core
+	ThreadPool(unsigned int num_threads = 0);
+	~ThreadPool();
+
+	// Number of threads that execute a ParallelFor (workers + caller)
+	unsigned int GetNumThreads() const { return (unsigned int)workers.size() + 1; }
+
+	// Calls job(i) for every i in [0, count) and blocks until all of them are finished
+	void ParallelFor(int count, const std::function<void(int)>& job);
+
+	// Runs task on a worker, or right here when there are none, and returns the future of what it returns
+	template <typename Function>
+	std::future<typename std::result_of<Function()>::type> Submit(Function task);
+
+	// Shared pool used by the framework
+	static ThreadPool* Get();
+};
+
+template <typename Function>
+std::future<typename std::result_of<Function()>::type> ThreadPool::Submit(Function task)
+{
+	typedef typename std::result_of<Function()>::type Result;
+
+	// std::function needs a copyable target, the packaged task goes behind a shared pointer
+	std::shared_ptr<std::packaged_task<Result()>> job = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+	std::future<Result> result = job->get_future();
+	if (workers.empty())
+	{
+		(*job)();
+		return result;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back([job] { (*job)(); });
+	}
+	condition.notify_one();
+	return result;
+}
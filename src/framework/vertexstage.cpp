@@ -0,0 +1,145 @@
+#include "vertexstage.h"
+#include "threadpool.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef CG_SIMD
+bool VertexStage::use_simd = true;
+#else
+bool VertexStage::use_simd = false;
+#endif
+
+// Vertices per job when the stream is split over the thread pool
+static const int BATCH_SIZE = 4096;
+
+// Row r of the matrix applied to (x, y, z, 1), same order as operator * (Matrix44, Vector4)
+static inline float TransformRow(const Matrix44& m, int r, float x, float y, float z)
+{
+	return m.m[r] * x + m.m[4 + r] * y + m.m[8 + r] * z + m.m[12 + r];
+}
+
+// Output arrays of the stage, instance k of vertex i is at k * stride + i
+struct ClipArrays
+{
+	float* x;
+	float* y;
+	float* z;
+	float* w;
+	int stride;
+};
+
+// Each vertex is read once and transformed by all the matrices
+static void TransformScalar(const Matrix44* matrices, int instances, const Vector3* in, const ClipArrays& out, int begin, int end)
+{
+	for (int i = begin; i < end; ++i)
+	{
+		const Vector3& p = in[i];
+		for (int k = 0; k < instances; ++k)
+		{
+			const Matrix44& m = matrices[k];
+			int j = k * out.stride + i;
+			out.x[j] = TransformRow(m, 0, p.x, p.y, p.z);
+			out.y[j] = TransformRow(m, 1, p.x, p.y, p.z);
+			out.z[j] = TransformRow(m, 2, p.x, p.y, p.z);
+			out.w[j] = TransformRow(m, 3, p.x, p.y, p.z);
+		}
+	}
+}
+
+#ifdef CG_SIMD
+
+static inline vfloat TransformRow(const vfloat* m, int r, vfloat x, vfloat y, vfloat z)
+{
+	return simdAdd(simdAdd(simdAdd(simdMul(m[r], x), simdMul(m[4 + r], y)), simdMul(m[8 + r], z)), m[12 + r]);
+}
+
+static void TransformSimd(const Matrix44* matrices, int instances, const Vector3* in, const ClipArrays& out, int begin, int end)
+{
+	const int W = CG_SIMD_WIDTH;
+
+	int i = begin;
+	for (; i + W <= end; i += W)
+	{
+		// Transpose the batch from xyz triplets to one register per component
+		float px[W], py[W], pz[W];
+		for (int l = 0; l < W; ++l)
+		{
+			px[l] = in[i + l].x;
+			py[l] = in[i + l].y;
+			pz[l] = in[i + l].z;
+		}
+		vfloat vx = simdLoad(px);
+		vfloat vy = simdLoad(py);
+		vfloat vz = simdLoad(pz);
+
+		for (int k = 0; k < instances; ++k)
+		{
+			vfloat m[16];
+			for (int c = 0; c < 16; ++c)
+				m[c] = simdSplat(matrices[k].m[c]);
+
+			int j = k * out.stride + i;
+			simdStore(out.x + j, TransformRow(m, 0, vx, vy, vz));
+			simdStore(out.y + j, TransformRow(m, 1, vx, vy, vz));
+			simdStore(out.z + j, TransformRow(m, 2, vx, vy, vz));
+			simdStore(out.w + j, TransformRow(m, 3, vx, vy, vz));
+		}
+	}
+
+	TransformScalar(matrices, instances, in, out, i, end);
+}
+
+#endif
+
+void VertexStage::Transform(const Matrix44& mvp, const std::vector<Vector3>& positions)
+{
+	TransformInstances(&mvp, 1, positions.data(), (int)positions.size());
+}
+
+void VertexStage::TransformInstances(const Matrix44* mvps, int instances, const Vector3* positions, int count)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	size_t size = (size_t)count * instances;
+	if (x.size() < size)
+	{
+		x.resize(size);
+		y.resize(size);
+		z.resize(size);
+		w.resize(size);
+	}
+	stride = count;
+
+	ClipArrays out;
+	out.x = x.data();
+	out.y = y.data();
+	out.z = z.data();
+	out.w = w.data();
+	out.stride = count;
+
+	int batches = (count + BATCH_SIZE - 1) / BATCH_SIZE;
+	ThreadPool::Get()->ParallelFor(batches, [&](int batch) {
+		int begin = batch * BATCH_SIZE;
+		int end = std::min(begin + BATCH_SIZE, count);
+#ifdef CG_SIMD
+		if (use_simd)
+		{
+			TransformSimd(mvps, instances, positions, out, begin, end);
+			return;
+		}
+#endif
+		TransformScalar(mvps, instances, positions, out, begin, end);
+	});
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+	stats.vertices += (unsigned int)size;
+	stats.milliseconds += elapsed.count();
+}
+
+VertexStage* VertexStage::Get()
+{
+	static VertexStage stage;
+	return &stage;
+}
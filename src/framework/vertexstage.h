@@ -0,0 +1,48 @@
+/*
+	+ This class is the vertex processing stage: it transforms a whole vertex stream to clip space with a single model-view-projection
+	  matrix and leaves the result in a structure of arrays that primitive assembly reads by vertex index.
+	+ Instanced draws transform a run of vertices for several matrices at once: each position is loaded once per batch of
+	  instances and the results are laid out one run per instance.
+	+ The output buffers are kept between calls so, once they have grown to the largest mesh, no memory is allocated per frame.
+	+ Batches of vertices are transposed to lanes and transformed with SSE2 / AVX2 when available; large streams are also split over
+	  the thread pool. The scalar path does the same operations in the same order, so both give the same bits.
+*/
+
+#pragma once
+
+#include <vector>
+#include "framework.h"
+
+// Work done by the stage since the last ResetStats
+struct VertexStats
+{
+	unsigned int vertices = 0;
+	double milliseconds = 0.0;
+};
+
+class VertexStage
+{
+public:
+	// Clip-space position of every vertex of the last stream, one run of stride vertices per instance
+	std::vector<float> x, y, z, w;
+	int stride = 0;
+
+	// Use the vectorized transform (toggled with the pixel kernel, 'K' key)
+	static bool use_simd;
+
+	VertexStats stats;
+
+	// Transforms positions by mvp (with w = 1) into x, y, z, w
+	void Transform(const Matrix44& mvp, const std::vector<Vector3>& positions);
+
+	// Same for several instances of the same vertices: every position is loaded once and transformed by all the matrices
+	void TransformInstances(const Matrix44* mvps, int instances, const Vector3* positions, int count);
+
+	Vector4 GetClipPosition(size_t i) const { return Vector4(x[i], y[i], z[i], w[i]); }
+	Vector4 GetClipPosition(int instance, size_t i) const { return GetClipPosition((size_t)instance * stride + i); }
+
+	void ResetStats() { stats = VertexStats(); }
+
+	// Stage shared by the entities, so they all reuse the same buffers
+	static VertexStage* Get();
+};